@@ -57,6 +57,9 @@ impl<T> Hash for ArenaId<T> {
 pub struct Arena<T> {
     items: Vec<Option<T>>,
     free_slots: Vec<usize>,
+	/// Version of every slot, see `version`.
+	versions: Vec<u64>,
+	next_version: u64,
 }
 
 impl<T> Default for Arena<T> {
@@ -64,6 +67,8 @@ impl<T> Default for Arena<T> {
         Self {
             items: Vec::new(),
             free_slots: Vec::new(),
+			versions: Vec::new(),
+			next_version: 1,
         }
     }
 }
@@ -76,14 +81,35 @@ impl<T> Arena<T> {
     pub fn insert(&mut self, item: T) -> ArenaId<T> {
         if let Some(index) = self.free_slots.pop() {
             self.items[index] = Some(item);
+			self.touch(index);
             ArenaId::new(index)
         } else {
             let index = self.items.len();
             self.items.push(Some(item));
+			self.versions.push(0);
+			self.touch(index);
             ArenaId::new(index)
         }
     }
 
+	fn touch(&mut self, index: usize) {
+		self.versions[index] = self.next_version;
+		self.next_version += 1;
+	}
+
+	/// Changes whenever the item is inserted or borrowed mutably. Ids are
+	/// reused after removal, so caches keyed by id compare versions to tell
+	/// an edited or replaced item from the one they saw. A mutable borrow
+	/// counts as an edit even if nothing is written, so the engine uploads
+	/// a mesh again after `get_mut` or `iter_mut` on it; use `get` to read.
+	pub fn version(&self, id: &ArenaId<T>) -> Option<u64> {
+		if self.contains(id) {
+			Some(self.versions[id.index])
+		} else {
+			None
+		}
+	}
+
 	pub fn reserve(&mut self, size: usize) {
 		self.items.reserve(size);
 	}
@@ -97,6 +123,9 @@ impl<T> Arena<T> {
     }
 
     pub fn get_mut(&mut self, id: &ArenaId<T>) -> Option<&mut T> {
+		if self.contains(id) {
+			self.touch(id.index);
+		}
         self.items.get_mut(id.index).and_then(|opt| opt.as_mut())
     }
 
@@ -129,9 +158,9 @@ impl<T> Arena<T> {
 
     pub fn iter_mut(&mut self) -> ArenaIterMut<T> {
         ArenaIterMut {
-            arena: self as *mut _,
-            current: 0,
-			_marker: PhantomData,
+            items: self.items.iter_mut().enumerate(),
+            versions: &mut self.versions,
+            next_version: &mut self.next_version,
         }
     }
 }
@@ -156,29 +185,26 @@ impl<'a, T> Iterator for ArenaIterator<'a, T> {
     }
 }
 
+/// Borrows the items and the versions separately, so versions can be
+/// bumped while the items handed out are alive.
 pub struct ArenaIterMut<'a, T> {
-    arena: *mut Arena<T>,
-    current: usize,
-    _marker: PhantomData<&'a mut Arena<T>>,
+    items: std::iter::Enumerate<std::slice::IterMut<'a, Option<T>>>,
+    versions: &'a mut [u64],
+    next_version: &'a mut u64,
 }
 
 impl<'a, T> Iterator for ArenaIterMut<'a, T> {
     type Item = (ArenaId<T>, &'a mut T);
 
     fn next(&mut self) -> Option<Self::Item> {
-        unsafe {
-            let len = (*self.arena).items.len();
-            let items_ptr = (*self.arena).items.as_mut_ptr();
-            while self.current < len {
-                let index = self.current;
-                self.current += 1;
-                let slot_ptr = items_ptr.add(index);
-                if let Some(item) = (*slot_ptr).as_mut() {
-                    return Some((ArenaId::new(index), item));
-                }
+        for (index, slot) in &mut self.items {
+            if let Some(item) = slot.as_mut() {
+                self.versions[index] = *self.next_version;
+                *self.next_version += 1;
+                return Some((ArenaId::new(index), item));
             }
-            None
         }
+        None
     }
 }
 
@@ -219,11 +245,7 @@ impl<'a, T> IntoIterator for &'a mut Arena<T> {
     type IntoIter = ArenaIterMut<'a, T>;
 
     fn into_iter(self) -> Self::IntoIter {
-        ArenaIterMut {
-            arena: self as *mut _,
-            current: 0,
-            _marker: PhantomData,
-        }
+        self.iter_mut()
     }
 }
 
@@ -305,6 +327,26 @@ mod tests {
         assert_eq!(person_id1.index, person_id2.index); // Ensure the slot was reused
     }
 
+    #[test]
+    fn test_versions_change_on_edit_and_reuse() {
+        let mut arena = Arena::new();
+        let id = arena.insert(Car { model: "Tesla Model 3".to_string() });
+        let inserted = arena.version(&id).unwrap();
+        assert_eq!(arena.version(&id), Some(inserted));
+        arena.get_mut(&id).unwrap().model = "Tesla Model Y".to_string();
+        let edited = arena.version(&id).unwrap();
+        assert_ne!(edited, inserted);
+        for _ in arena.iter_mut() {}
+        assert_ne!(arena.version(&id), Some(edited));
+
+        let replaced = arena.version(&id).unwrap();
+        arena.remove(&id);
+        assert_eq!(arena.version(&id), None);
+        let reused = arena.insert(Car { model: "Ford Mustang".to_string() });
+        assert_eq!(reused.index, id.index);
+        assert_ne!(arena.version(&reused), Some(replaced));
+    }
+
     #[test]
     fn test_reuse_slots_car() {
         let mut arena = Arena::new();
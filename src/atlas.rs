@@ -0,0 +1,176 @@
+/// Side of an atlas page in pixels.
+pub const ATLAS_SIZE: u32 = 2048;
+/// Textures up to this size on both sides are packed into atlas pages,
+/// larger ones keep a texture of their own.
+pub const ATLAS_MAX_TILE: u32 = 256;
+/// Border of wrapped pixels around every tile so linear filtering at its
+/// edges doesn't pick up the neighbours.
+const GUTTER: u32 = 2;
+
+/// Where a texture was packed. `uv_rect` is the offset and scale mapping
+/// the texture's own uvs into the page.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct AtlasPlacement {
+	pub page: usize,
+	/// Top left corner of the padded tile in the page.
+	pub x: u32,
+	pub y: u32,
+	pub uv_rect: [f32; 4],
+}
+
+#[derive(Debug, Clone)]
+struct Shelf {
+	y: u32,
+	height: u32,
+	x: u32,
+}
+
+#[derive(Debug, Clone, Default)]
+struct Page {
+	shelves: Vec<Shelf>,
+	next_y: u32,
+}
+
+impl Page {
+	/// Shelf packing: the lowest shelf that is tall enough and has room,
+	/// or a new shelf below the last one.
+	fn insert(&mut self, width: u32, height: u32) -> Option<(u32, u32)> {
+		let best = self.shelves.iter_mut()
+			.filter(|shelf| shelf.height >= height && ATLAS_SIZE - shelf.x >= width)
+			.min_by_key(|shelf| shelf.height);
+		if let Some(shelf) = best {
+			let x = shelf.x;
+			shelf.x += width;
+			return Some((x, shelf.y));
+		}
+		if ATLAS_SIZE - self.next_y < height {
+			return None;
+		}
+		let y = self.next_y;
+		self.next_y += height;
+		self.shelves.push(Shelf { y, height, x: width });
+		Some((0, y))
+	}
+}
+
+/// Packs small textures of the same format into shared pages. Only the
+/// placement is tracked, the pixels are written to the page textures by
+/// the caller.
+#[derive(Debug, Clone, Default)]
+pub struct TextureAtlas {
+	pages: Vec<Page>,
+}
+
+impl TextureAtlas {
+	pub fn fits(width: u32, height: u32) -> bool {
+		width > 0 && height > 0 && width <= ATLAS_MAX_TILE && height <= ATLAS_MAX_TILE
+	}
+
+	/// Finds room for a texture, adding a page when none has any. None when
+	/// the texture is too large to be packed.
+	pub fn insert(&mut self, width: u32, height: u32) -> Option<AtlasPlacement> {
+		if !Self::fits(width, height) {
+			return None;
+		}
+		let padded = (width + GUTTER * 2, height + GUTTER * 2);
+		let found = self.pages.iter_mut()
+			.enumerate()
+			.find_map(|(i, page)| page.insert(padded.0, padded.1).map(|(x, y)| (i, x, y)));
+		let (page, x, y) = match found {
+			Some(found) => found,
+			None => {
+				let mut page = Page::default();
+				let (x, y) = page.insert(padded.0, padded.1)?;
+				self.pages.push(page);
+				(self.pages.len() - 1, x, y)
+			}
+		};
+		let size = ATLAS_SIZE as f32;
+		Some(AtlasPlacement {
+			page,
+			x,
+			y,
+			uv_rect: [
+				(x + GUTTER) as f32 / size,
+				(y + GUTTER) as f32 / size,
+				width as f32 / size,
+				height as f32 / size,
+			],
+		})
+	}
+
+	pub fn page_count(&self) -> usize {
+		self.pages.len()
+	}
+}
+
+/// Copies RGBA8 pixels into a tile surrounded by the gutter. Atlased
+/// textures repeat inside their rect, so the gutter wraps around to the
+/// opposite edge like a repeating sampler would. Returns the tile and its
+/// size.
+pub fn pad_tile(data: &[u8], width: u32, height: u32) -> (Vec<u8>, u32, u32) {
+	let padded_width = width + GUTTER * 2;
+	let padded_height = height + GUTTER * 2;
+	let mut tile = vec![0; (padded_width * padded_height * 4) as usize];
+	for y in 0..padded_height {
+		let src_y = (y + height * GUTTER - GUTTER) % height;
+		for x in 0..padded_width {
+			let src_x = (x + width * GUTTER - GUTTER) % width;
+			let src = ((src_y * width + src_x) * 4) as usize;
+			let dst = ((y * padded_width + x) * 4) as usize;
+			tile[dst..dst + 4].copy_from_slice(&data[src..src + 4]);
+		}
+	}
+	(tile, padded_width, padded_height)
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	fn overlaps(a: &AtlasPlacement, b: &AtlasPlacement, size: u32) -> bool {
+		let size = size + GUTTER * 2;
+		a.page == b.page && a.x < b.x + size && b.x < a.x + size && a.y < b.y + size && b.y < a.y + size
+	}
+
+	#[test]
+	fn test_tiles_are_disjoint_and_spill_into_new_pages() {
+		let mut atlas = TextureAtlas::default();
+		let per_page = (ATLAS_SIZE / (64 + GUTTER * 2)).pow(2) as usize;
+		let placements: Vec<_> = (0..per_page + 1).map(|_| atlas.insert(64, 64).unwrap()).collect();
+		assert_eq!(atlas.page_count(), 2);
+		assert_eq!(placements[per_page].page, 1);
+		for (i, a) in placements.iter().enumerate() {
+			assert!(a.x + 64 + GUTTER * 2 <= ATLAS_SIZE && a.y + 64 + GUTTER * 2 <= ATLAS_SIZE);
+			for b in &placements[i + 1..] {
+				assert!(!overlaps(a, b, 64));
+			}
+		}
+		assert!(atlas.insert(ATLAS_MAX_TILE + 1, 4).is_none());
+	}
+
+	#[test]
+	fn test_uv_rect_skips_the_gutter() {
+		let mut atlas = TextureAtlas::default();
+		let first = atlas.insert(16, 8).unwrap();
+		let second = atlas.insert(16, 8).unwrap();
+		let size = ATLAS_SIZE as f32;
+		assert_eq!(first.uv_rect, [GUTTER as f32 / size, GUTTER as f32 / size, 16.0 / size, 8.0 / size]);
+		assert_eq!((second.x, second.y), (16 + GUTTER * 2, 0));
+	}
+
+	#[test]
+	fn test_pad_tile_wraps_edges() {
+		// 3x1 texture: red, green, blue.
+		let data = [255, 0, 0, 255, 0, 255, 0, 255, 0, 0, 255, 255];
+		let (tile, width, height) = pad_tile(&data, 3, 1);
+		assert_eq!((width, height), (3 + GUTTER * 2, 1 + GUTTER * 2));
+		let pixel = |x: u32, y: u32| &tile[((y * width + x) * 4) as usize..((y * width + x) * 4 + 4) as usize];
+		assert_eq!(pixel(GUTTER, GUTTER), &[255, 0, 0, 255]);
+		assert_eq!(pixel(GUTTER + 2, GUTTER), &[0, 0, 255, 255]);
+		// Left of the first column is the last one and the other way around.
+		assert_eq!(pixel(GUTTER - 1, GUTTER), &[0, 0, 255, 255]);
+		assert_eq!(pixel(GUTTER + 3, GUTTER), &[255, 0, 0, 255]);
+		assert_eq!(pixel(GUTTER + 4, 0), &[0, 255, 0, 255]);
+	}
+}
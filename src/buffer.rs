@@ -3,7 +3,7 @@ use std::ops::Range;
 use crate::hardware::BufferHandle;
 use crate::hardware::Hardware;
 
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, PartialEq)]
 pub struct BufferSlice {
     pub handle: BufferHandle,
     pub range: Range<u64>,
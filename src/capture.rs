@@ -0,0 +1,334 @@
+use std::collections::BTreeMap;
+use std::collections::HashMap;
+use std::fs;
+use std::io;
+use std::io::Write;
+use std::path::Path;
+use std::path::PathBuf;
+
+use crate::hardware::CaptureTile;
+
+/// How captured frames are written. Png, Qoi and Raw write a file per
+/// frame, Y4m and RawVideo append every frame of a window to one stream
+/// that ffmpeg can read, also from a pipe.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum CaptureFormat {
+	Png,
+	Qoi,
+	/// Headerless RGBA8 rows.
+	Raw,
+	/// YUV 4:4:4 video.
+	Y4m,
+	/// Headerless RGBA8 frames, `ffmpeg -f rawvideo -pix_fmt rgba -s WxH`.
+	RawVideo,
+}
+
+impl CaptureFormat {
+	pub fn parse(value: &str) -> Option<Self> {
+		match value.to_ascii_lowercase().as_str() {
+			"png" => Some(Self::Png),
+			"qoi" => Some(Self::Qoi),
+			"raw" | "rgba" => Some(Self::Raw),
+			"y4m" => Some(Self::Y4m),
+			"rawvideo" => Some(Self::RawVideo),
+			_ => None,
+		}
+	}
+
+	pub fn extension(self) -> &'static str {
+		match self {
+			Self::Png => "png",
+			Self::Qoi => "qoi",
+			Self::Raw | Self::RawVideo => "rgba",
+			Self::Y4m => "y4m",
+		}
+	}
+
+	pub fn is_stream(self) -> bool {
+		matches!(self, Self::Y4m | Self::RawVideo)
+	}
+}
+
+#[derive(Debug, Clone)]
+pub struct CaptureSettings {
+	pub format: CaptureFormat,
+	/// Where streams go, `{window}` is replaced by the window id. "-" is
+	/// stdout, which is why logs go to stderr. By default a file per window
+	/// in the screenshot directory.
+	pub stream_path: Option<String>,
+	pub fps: u32,
+}
+
+impl Default for CaptureSettings {
+	fn default() -> Self {
+		Self {
+			format: CaptureFormat::Png,
+			stream_path: None,
+			fps: 60,
+		}
+	}
+}
+
+impl CaptureSettings {
+	pub fn stream_path(&self, dir: &Path, window_id: u32) -> String {
+		match &self.stream_path {
+			Some(path) => path.replace("{window}", &window_id.to_string()),
+			None => {
+				let filename = format!("capture_{}.{}", window_id, self.format.extension());
+				dir.join(filename).to_string_lossy().to_string()
+			}
+		}
+	}
+}
+
+/// Largest side of a target captures are packed into.
+pub const MAX_CAPTURE_TARGET: u32 = 4096;
+
+/// Columns and rows of a target holding up to `count` tiles of the given
+/// size. Tiles that don't fit go into further targets.
+pub fn capture_grid(count: usize, width: u32, height: u32) -> (u32, u32) {
+	let max_cols = (MAX_CAPTURE_TARGET / width.max(1)).max(1);
+	let max_rows = (MAX_CAPTURE_TARGET / height.max(1)).max(1);
+	let count = (count as u32).clamp(1, max_cols * max_rows);
+	let cols = count.min(max_cols).min((count as f32).sqrt().ceil() as u32);
+	(cols, (count + cols - 1) / cols)
+}
+
+/// Viewport of a tile in 0..1 with y going up, as `RenderPass::set_viewport`
+/// takes it.
+pub fn tile_viewport(col: u32, row: u32, cols: u32, rows: u32) -> [f32; 4] {
+	let w = 1.0 / cols as f32;
+	let h = 1.0 / rows as f32;
+	[col as f32 * w, 1.0 - (row + 1) as f32 * h, w, h]
+}
+
+/// Where a captured frame goes.
+#[derive(Debug, Clone, PartialEq)]
+pub enum Capture {
+	File(String),
+	/// The next frame of the stream at a path.
+	Stream(String),
+	/// Tiles cut from the frame and kept in memory.
+	Tiles(Vec<CaptureTile>),
+}
+
+/// The screenshot to take of a window this frame, a requested one or one
+/// every `SCREENSHOT_INTERVAL` frames, as a file or a frame of the
+/// window's stream.
+pub fn frame_screenshot_path(pending: &mut HashMap<u32, String>, dir: &Option<PathBuf>, settings: &CaptureSettings, interval: u64, frame_index: u64, window_id: u32) -> Option<Capture> {
+	if let Some(path) = pending.remove(&window_id) {
+		return Some(Capture::File(path));
+	}
+	let dir = dir.as_ref()?;
+	if interval == 0 || frame_index % interval != 0 {
+		return None;
+	}
+	if settings.format.is_stream() {
+		return Some(Capture::Stream(settings.stream_path(dir, window_id)));
+	}
+	let filename = format!("screenshot_{}_{}.{}", window_id, frame_index, settings.format.extension());
+	Some(Capture::File(dir.join(filename).to_string_lossy().to_string()))
+}
+
+/// Saves RGBA8 pixels to a file, the format picked by its extension.
+pub fn save_file(path: &str, pixels: &[u8], width: u32, height: u32) {
+	let extension = Path::new(path).extension().and_then(|e| e.to_str()).unwrap_or("");
+	let result = match extension {
+		"rgba" | "raw" => fs::write(path, pixels).map_err(|err| err.to_string()),
+		_ => image::save_buffer(path, pixels, width, height, image::ColorType::Rgba8).map_err(|err| err.to_string()),
+	};
+	match result {
+		Ok(_) => crate::log1!("Screenshot saved to {}", path),
+		Err(err) => log::error!("Failed to save screenshot {}: {}", path, err),
+	}
+}
+
+/// Copies a tile out of RGBA8 rows `width` pixels wide.
+pub fn cut_tile(pixels: &[u8], width: u32, tile: &CaptureTile) -> Vec<u8> {
+	let mut out = Vec::with_capacity((tile.width * tile.height * 4) as usize);
+	for y in tile.y..tile.y + tile.height {
+		let start = ((y * width + tile.x) * 4) as usize;
+		out.extend_from_slice(&pixels[start..start + (tile.width * 4) as usize]);
+	}
+	out
+}
+
+/// BT.601 limited range, what ffmpeg assumes for y4m input.
+fn rgb_to_yuv(r: i32, g: i32, b: i32) -> (u8, u8, u8) {
+	let y = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+	let u = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+	let v = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+	(y as u8, u as u8, v as u8)
+}
+
+/// The bytes of one frame in a stream, everything but the stream header.
+/// Runs on the encode workers, writing is left to `FrameStream`.
+pub fn encode_stream_frame(format: CaptureFormat, pixels: Vec<u8>) -> Vec<u8> {
+	match format {
+		CaptureFormat::Y4m => {
+			let count = pixels.len() / 4;
+			let mut frame = Vec::with_capacity(6 + count * 3);
+			frame.extend_from_slice(b"FRAME\n");
+			frame.resize(6 + count * 3, 0);
+			let (y_plane, uv) = frame[6..].split_at_mut(count);
+			let (u_plane, v_plane) = uv.split_at_mut(count);
+			for (i, pixel) in pixels.chunks_exact(4).enumerate() {
+				let (y, u, v) = rgb_to_yuv(pixel[0] as i32, pixel[1] as i32, pixel[2] as i32);
+				y_plane[i] = y;
+				u_plane[i] = u;
+				v_plane[i] = v;
+			}
+			frame
+		}
+		_ => pixels,
+	}
+}
+
+/// One stream of frames. Frames may be encoded out of order on several
+/// workers, they are written in the order they were captured.
+pub struct FrameStream {
+	path: String,
+	format: CaptureFormat,
+	fps: u32,
+	out: Box<dyn Write + Send>,
+	size: Option<(u32, u32)>,
+	next: u64,
+	pending: BTreeMap<u64, Option<(u32, u32, Vec<u8>)>>,
+}
+
+impl FrameStream {
+	/// Opening a named pipe blocks until a reader opens it too.
+	pub fn open(path: &str, format: CaptureFormat, fps: u32) -> io::Result<Self> {
+		let out: Box<dyn Write + Send> = if path == "-" {
+			Box::new(io::stdout())
+		} else {
+			Box::new(io::BufWriter::new(fs::File::create(path)?))
+		};
+		Ok(Self::new(path, format, fps, out))
+	}
+
+	fn new(path: &str, format: CaptureFormat, fps: u32, out: Box<dyn Write + Send>) -> Self {
+		Self {
+			path: path.to_string(),
+			format,
+			fps: fps.max(1),
+			out,
+			size: None,
+			next: 0,
+			pending: BTreeMap::new(),
+		}
+	}
+
+	/// Queues frame `index` and writes the frames that are next in line.
+	/// None marks a frame that failed, so the ones after it aren't held.
+	pub fn write(&mut self, index: u64, frame: Option<(u32, u32, Vec<u8>)>) {
+		self.pending.insert(index, frame);
+		while let Some(frame) = self.pending.remove(&self.next) {
+			self.next += 1;
+			let (width, height, bytes) = match frame {
+				Some(frame) => frame,
+				None => continue,
+			};
+			if let Err(err) = self.write_frame(width, height, &bytes) {
+				log::error!("Failed to write frame to {}: {:?}", self.path, err);
+			}
+		}
+		if let Err(err) = self.out.flush() {
+			log::error!("Failed to flush {}: {:?}", self.path, err);
+		}
+	}
+
+	fn write_frame(&mut self, width: u32, height: u32, bytes: &[u8]) -> io::Result<()> {
+		match self.size {
+			None => {
+				if self.format == CaptureFormat::Y4m {
+					write!(self.out, "YUV4MPEG2 W{} H{} F{}:1 Ip A1:1 C444\n", width, height, self.fps)?;
+				}
+				crate::log1!("Streaming {}x{} {:?} at {} fps to {}", width, height, self.format, self.fps, self.path);
+				self.size = Some((width, height));
+			}
+			Some(size) if size != (width, height) => {
+				log::warn!("Frame of {}x{} dropped from {}, the stream is {}x{}", width, height, self.path, size.0, size.1);
+				return Ok(());
+			}
+			Some(_) => {}
+		}
+		self.out.write_all(bytes)
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+	use std::sync::Arc;
+	use std::sync::Mutex;
+
+	#[derive(Clone, Default)]
+	struct Shared(Arc<Mutex<Vec<u8>>>);
+
+	impl Write for Shared {
+		fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+			self.0.lock().unwrap().extend_from_slice(buf);
+			Ok(buf.len())
+		}
+
+		fn flush(&mut self) -> io::Result<()> {
+			Ok(())
+		}
+	}
+
+	#[test]
+	fn test_y4m_frames_are_written_in_order() {
+		let out = Shared::default();
+		let mut stream = FrameStream::new("test", CaptureFormat::Y4m, 30, Box::new(out.clone()));
+		let frame = |gray: u8| Some((1, 1, encode_stream_frame(CaptureFormat::Y4m, vec![gray, gray, gray, 255])));
+		stream.write(1, frame(255));
+		assert!(out.0.lock().unwrap().is_empty());
+		stream.write(2, None);
+		stream.write(0, frame(0));
+		stream.write(3, Some((2, 1, vec![0; 8])));
+		let written = out.0.lock().unwrap().clone();
+		let mut expected = b"YUV4MPEG2 W1 H1 F30:1 Ip A1:1 C444\n".to_vec();
+		expected.extend_from_slice(b"FRAME\n\x10\x80\x80");
+		expected.extend_from_slice(b"FRAME\n\xeb\x80\x80");
+		assert_eq!(written, expected);
+	}
+
+	#[test]
+	fn test_cut_tile() {
+		// 3x2 image, pixel i has all channels set to i.
+		let pixels: Vec<u8> = (0..6u8).flat_map(|i| [i; 4]).collect();
+		let tile = CaptureTile {
+			id: 7,
+			x: 1,
+			y: 0,
+			width: 2,
+			height: 2,
+		};
+		let out = cut_tile(&pixels, 3, &tile);
+		let ids: Vec<u8> = out.chunks(4).map(|p| p[0]).collect();
+		assert_eq!(ids, vec![1, 2, 4, 5]);
+	}
+
+	#[test]
+	fn test_capture_grid() {
+		assert_eq!(capture_grid(1, 640, 480), (1, 1));
+		assert_eq!(capture_grid(5, 640, 480), (3, 2));
+		assert_eq!(capture_grid(1000, 1024, 1024), (4, 4));
+		assert_eq!(capture_grid(3, 8000, 100), (1, 3));
+		assert_eq!(tile_viewport(1, 0, 2, 2), [0.5, 0.5, 0.5, 0.5]);
+	}
+
+	#[test]
+	fn test_formats() {
+		assert_eq!(CaptureFormat::parse("QOI"), Some(CaptureFormat::Qoi));
+		assert_eq!(CaptureFormat::parse("jpeg"), None);
+		assert!(CaptureFormat::RawVideo.is_stream());
+		let settings = CaptureSettings {
+			format: CaptureFormat::Y4m,
+			stream_path: Some("/tmp/view_{window}.y4m".to_string()),
+			fps: 30,
+		};
+		assert_eq!(settings.stream_path(Path::new("dir"), 2), "/tmp/view_2.y4m");
+	}
+}
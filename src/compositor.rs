@@ -11,6 +11,8 @@ use ttf_parser::OutlineBuilder;
 
 pub use crate::gui::*;
 use crate::internal_types::*;
+use crate::hit_grid::HitGrid;
+use crate::hit_grid::HitRect;
 
 #[derive(Debug, Default, Clone, PartialEq)]
 pub struct DrawRect {
@@ -103,6 +105,8 @@ pub struct DrawText {
 	pub font_size: f32,
 	pub font_color: [f32; 4],
 	pub outline: Outline,
+	/// Glyphs are cut to this region, the clip of the containers around.
+	pub clip: Clip,
 }
 
 const DEFAULT_UI_HEIGHT: f32 = 600.0;
@@ -212,19 +216,114 @@ impl Outline {
 	}
 }
 
+/// Axis aligned region outside of which nothing is laid out.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct Clip {
+	left: f32,
+	right: f32,
+	top: f32,
+	bottom: f32,
+}
+
+impl Clip {
+	fn full() -> Self {
+		Self {
+			left: -1.0,
+			right: 1.0,
+			top: 1.0,
+			bottom: -1.0,
+		}
+	}
+
+	fn from_outline(outline: &Outline) -> Self {
+		Self {
+			left: outline.left_up[0].min(outline.left_down[0]),
+			right: outline.right_up[0].max(outline.right_down[0]),
+			top: outline.left_up[1].max(outline.right_up[1]),
+			bottom: outline.left_down[1].min(outline.right_down[1]),
+		}
+	}
+
+	fn intersect(&self, other: &Clip) -> Clip {
+		Clip {
+			left: self.left.max(other.left),
+			right: self.right.min(other.right),
+			top: self.top.min(other.top),
+			bottom: self.bottom.max(other.bottom),
+		}
+	}
+
+	fn is_empty(&self) -> bool {
+		self.left >= self.right || self.bottom >= self.top
+	}
+
+	fn intersects(&self, outline: &Outline) -> bool {
+		!self.intersect(&Clip::from_outline(outline)).is_empty()
+	}
+
+	fn clamp(&self, p: [f32; 2]) -> [f32; 2] {
+		[p[0].clamp(self.left, self.right), p[1].clamp(self.bottom, self.top)]
+	}
+
+	fn contains(&self, p: [f32; 2]) -> bool {
+		p[0] >= self.left && p[0] <= self.right && p[1] >= self.bottom && p[1] <= self.top
+	}
+
+	/// Part of a triangle inside the region as a convex polygon, cut by each
+	/// side in turn.
+	fn clip_triangle(&self, triangle: [[f32; 2]; 3]) -> Vec<[f32; 2]> {
+		// Signed distance of a point to each side, positive inside.
+		let sides: [&dyn Fn([f32; 2]) -> f32; 4] = [
+			&|p| p[0] - self.left,
+			&|p| self.right - p[0],
+			&|p| p[1] - self.bottom,
+			&|p| self.top - p[1],
+		];
+		let mut polygon = triangle.to_vec();
+		for side in sides {
+			let mut clipped = Vec::with_capacity(polygon.len() + 1);
+			for i in 0..polygon.len() {
+				let a = polygon[i];
+				let b = polygon[(i + 1) % polygon.len()];
+				let (da, db) = (side(a), side(b));
+				if da >= 0.0 {
+					clipped.push(a);
+				}
+				if (da >= 0.0) != (db >= 0.0) {
+					let t = da / (da - db);
+					clipped.push([a[0] + (b[0] - a[0]) * t, a[1] + (b[1] - a[1]) * t]);
+				}
+			}
+			polygon = clipped;
+			if polygon.len() < 3 {
+				return Vec::new();
+			}
+		}
+		polygon
+	}
+}
+
+impl Default for Clip {
+	fn default() -> Self {
+		Self::full()
+	}
+}
+
 #[derive(Debug, Clone, PartialEq)]
 pub struct Lineariser {
 	pub items: Vec<DrawItem>,
+	pub hits: Vec<HitRect>,
 }
 
 impl Lineariser {
 	pub fn new() -> Self {
 		Self {
-			items: Vec::new()
+			items: Vec::new(),
+			hits: Vec::new(),
 		}
 	}
 
-	fn inner_linearize(&mut self, item: &GUIElement, outline: Option<Outline>) {
+	fn inner_linearize(&mut self, item: &GUIElement, outline: Option<Outline>, clip: Clip) {
 		let mut outline = outline.unwrap_or(Outline {
 			left_up: [-1.0, 1.0],
 			right_up: [1.0, 1.0],
@@ -261,12 +360,25 @@ impl Lineariser {
 			}
 		}
 
+		if !clip.intersects(&outline) {
+			return;
+		}
+
+		if let Some(id) = item.mouse_area {
+			let bounds = clip.intersect(&Clip::from_outline(&outline));
+			self.hits.push(HitRect {
+				id,
+				min: [bounds.left, bounds.bottom],
+				max: [bounds.right, bounds.top],
+			});
+		}
+
 		if let Some(background_color) = item.background_color {
 			self.items.push(DrawItem::Rect(DrawRect {
-				top_left: outline.left_up,
-				top_right: outline.right_up,
-				bottom_left: outline.left_down,
-				bottom_right: outline.right_down,
+				top_left: clip.clamp(outline.left_up),
+				top_right: clip.clamp(outline.right_up),
+				bottom_left: clip.clamp(outline.left_down),
+				bottom_right: clip.clamp(outline.right_down),
 				background_color,
 				..Default::default()
 			}));
@@ -279,20 +391,41 @@ impl Lineariser {
 				font_size,
 				font_color: item.font_color,
 				outline: outline.clone(),
+				clip,
 			};
 			self.items.push(DrawItem::Text(text));
 		}
 
 		if let Some(camera_id) = item.camera_id {
+			// A view cut by its containers keeps its projection and is
+			// scissored to the part left visible.
+			let bounds = Clip::from_outline(&outline);
+			let visible = clip.intersect(&bounds);
 			self.items.push(DrawItem::CamView(CamView {
 				camera_id,
 				x: (outline.left_up[0] + 1.0) / 2.0,
 				y: (outline.left_down[1] + 1.0) / 2.0,
 				w: (outline.right_up[0] - outline.left_up[0]) / 2.0,
-				h: (outline.left_up[1] - outline.left_down[1]) / 2.0
+				h: (outline.left_up[1] - outline.left_down[1]) / 2.0,
+				clip: (visible != bounds).then(|| [
+					(visible.left + 1.0) / 2.0,
+					(visible.bottom + 1.0) / 2.0,
+					(visible.right - visible.left) / 2.0,
+					(visible.top - visible.bottom) / 2.0,
+				]),
 			}));
 		}
 
+		let clip = clip.intersect(&Clip::from_outline(&outline));
+		if clip.is_empty() {
+			return;
+		}
+
+		if let Some(extent) = item.item_extent {
+			self.linearize_virtual(item, &outline, clip, extent);
+			return;
+		}
+
 		if item.children.len() > 0 {	
 			match item.flex_dir {
 				Flex::Horizontal => {
@@ -316,7 +449,7 @@ impl Lineariser {
 							right_up,
 							left_down,
 							right_down
-						}));
+						}), clip);
 					}
 				},
 				Flex::Vertical => {
@@ -340,7 +473,7 @@ impl Lineariser {
 							right_up: top_right_up,
 							left_down: top_left_down,
 							right_down: top_right_down
-						}));
+						}), clip);
 					}
 				},
 				Flex::None => {
@@ -358,16 +491,67 @@ impl Lineariser {
 							right_up,
 							left_down,
 							right_down
-						}));
+						}), clip);
 					}
 				}
 			}
 		}
 	}
 
+	/// Lays out only the children of a virtualized container which fall inside
+	/// the visible region. Every child gets a slot of `extent`, so the first
+	/// visible one follows from the scroll offset and the cost depends on the
+	/// visible rows, not on the child count. A child's own width or height
+	/// only sizes it inside its slot.
+	fn linearize_virtual(&mut self, item: &GUIElement, outline: &Outline, clip: Clip, extent: f32) {
+		let extent = extent.max(f32::EPSILON);
+		let scroll = item.scroll_offset.max(0.0);
+		let first = ((scroll / extent).floor() as usize).min(item.children.len());
+		let mut offset = first as f32 * extent - scroll;
+
+		match item.flex_dir {
+			Flex::Vertical => {
+				let visible = outline.left_height().max(outline.right_height());
+				for child in &item.children[first..] {
+					if offset >= visible {
+						break;
+					}
+					let child_outline = Outline {
+						left_up: [outline.left_up[0], outline.left_up[1] - offset],
+						right_up: [outline.right_up[0], outline.right_up[1] - offset],
+						left_down: [outline.left_down[0], outline.left_up[1] - offset - extent],
+						right_down: [outline.right_down[0], outline.right_up[1] - offset - extent],
+					};
+					offset += extent;
+					self.inner_linearize(child, Some(child_outline), clip);
+				}
+			},
+			Flex::Horizontal => {
+				let visible = outline.top_width().max(outline.bottom_width());
+				for child in &item.children[first..] {
+					if offset >= visible {
+						break;
+					}
+					let child_outline = Outline {
+						left_up: [outline.left_up[0] + offset, outline.left_up[1]],
+						right_up: [outline.left_up[0] + offset + extent, outline.right_up[1]],
+						left_down: [outline.left_down[0] + offset, outline.left_down[1]],
+						right_down: [outline.left_down[0] + offset + extent, outline.right_down[1]],
+					};
+					offset += extent;
+					self.inner_linearize(child, Some(child_outline), clip);
+				}
+			},
+			Flex::None => {
+				log::warn!("item_extent has no effect on a container without flex direction");
+			}
+		}
+	}
+
 	pub fn linearize(&mut self, item: &GUIElement) {
 		self.items.clear();
-		self.inner_linearize(item, None);
+		self.hits.clear();
+		self.inner_linearize(item, None, Clip::full());
 	}
 }
 
@@ -378,7 +562,8 @@ pub struct Compositor {
 	pub positions: Vec<[f32; 3]>,
 	pub indices: Vec<u16>,
 	pub colors: Vec<[f32; 3]>,
-	pub views: Vec<CamView>
+	pub views: Vec<CamView>,
+	pub hit_grid: HitGrid,
 }
 
 impl Compositor {
@@ -390,7 +575,8 @@ impl Compositor {
 			positions: Vec::new(),
 			indices: Vec::new(),
 			colors: Vec::new(),
-			views: Vec::new()
+			views: Vec::new(),
+			hit_grid: HitGrid::new(32),
 		}
 	}
 
@@ -401,6 +587,7 @@ impl Compositor {
 		self.views.clear();
 
 		self.lineariser.linearize(item);
+		self.hit_grid.update(&self.lineariser.hits);
 
 		let items = self.lineariser.items.clone();
 		for draw in &items {
@@ -473,12 +660,16 @@ impl Compositor {
 					.is_ok()
 				{
 					let current_offset = self.positions.len() as u16;
-					self.positions
-						.extend(geometry.vertices.iter().map(|&p| [p.x, p.y, 0.0]));
-					self.indices
-						.extend(geometry.indices.iter().map(|&i| i + current_offset));
-					self.colors
-						.extend(std::iter::repeat(color).take(geometry.vertices.len()));
+					if geometry.vertices.iter().all(|p| text.clip.contains([p.x, p.y])) {
+						self.positions
+							.extend(geometry.vertices.iter().map(|&p| [p.x, p.y, 0.0]));
+						self.indices
+							.extend(geometry.indices.iter().map(|&i| i + current_offset));
+						self.colors
+							.extend(std::iter::repeat(color).take(geometry.vertices.len()));
+					} else {
+						self.push_clipped(&geometry, &text.clip, color);
+					}
 				}
 			}
 
@@ -490,6 +681,26 @@ impl Compositor {
 			pen_x += advance * scale;
 		}
 	}
+
+	/// Adds the triangles of a glyph cut by the clip of its text.
+	fn push_clipped(&mut self, geometry: &VertexBuffers<Point, u16>, clip: &Clip, color: [f32; 3]) {
+		for triangle in geometry.indices.chunks_exact(3) {
+			let [a, b, c] = [triangle[0], triangle[1], triangle[2]].map(|i| {
+				let p = geometry.vertices[i as usize];
+				[p.x, p.y]
+			});
+			let polygon = clip.clip_triangle([a, b, c]);
+			if polygon.is_empty() {
+				continue;
+			}
+			let first = self.positions.len() as u16;
+			self.positions.extend(polygon.iter().map(|p| [p[0], p[1], 0.0]));
+			self.colors.extend(std::iter::repeat(color).take(polygon.len()));
+			for i in 1..polygon.len() as u16 - 1 {
+				self.indices.extend([first, first + i, first + i + 1]);
+			}
+		}
+	}
 }
 
 #[cfg(test)]
@@ -648,4 +859,136 @@ mod tests {
 
 		println!("{:?}", linearizer.items);
 	}
+
+	#[test]
+	fn test_virtual_column_lays_out_visible_rows_only() {
+		let rows: Vec<GUIElement> = (0..100_000)
+			.map(|_| rect().background_color(Color::RED))
+			.collect();
+		let list = virtual_column(0.25, rows).scroll(1000.0);
+		let mut linearizer = Lineariser::new();
+		linearizer.linearize(&list);
+
+		assert_eq!(linearizer.items.len(), 8);
+		let r = DrawRect {
+			top_left: [-1.0, 1.0],
+			top_right: [1.0, 1.0],
+			bottom_left: [-1.0, 0.75],
+			bottom_right: [1.0, 0.75],
+			background_color: Color::RED,
+			..Default::default()
+		};
+		assert_eq!(linearizer.items[0], DrawItem::Rect(r));
+	}
+
+	#[test]
+	fn test_virtual_column_clips_partial_rows() {
+		let rows: Vec<GUIElement> = (0..100)
+			.map(|_| rect().background_color(Color::GREEN))
+			.collect();
+		let list = virtual_column(0.5, rows).scroll(0.25);
+		let mut linearizer = Lineariser::new();
+		linearizer.linearize(&list);
+
+		assert_eq!(linearizer.items.len(), 5);
+		match &linearizer.items[0] {
+			DrawItem::Rect(r) => {
+				assert_eq!(r.top_left, [-1.0, 1.0]);
+				assert_eq!(r.bottom_left, [-1.0, 0.75]);
+			}
+			item => panic!("unexpected item {:?}", item),
+		}
+		match &linearizer.items[4] {
+			DrawItem::Rect(r) => {
+				assert_eq!(r.top_left, [-1.0, -0.75]);
+				assert_eq!(r.bottom_left, [-1.0, -1.0]);
+			}
+			item => panic!("unexpected item {:?}", item),
+		}
+	}
+
+	#[test]
+	fn test_virtual_column_ignores_child_sizes() {
+		let rows: Vec<GUIElement> = (0..100)
+			.map(|i| rect().background_color(Color::GREEN).height(0.1 * (i % 3 + 1) as f32))
+			.collect();
+		let list = virtual_column(0.5, rows).scroll(10.0);
+		let mut linearizer = Lineariser::new();
+		linearizer.linearize(&list);
+
+		// Every row takes a slot of the extent whatever the rows asked for.
+		assert_eq!(linearizer.items.len(), 4);
+		match &linearizer.items[1] {
+			DrawItem::Rect(r) => assert_eq!(r.top_left, [-1.0, 0.5]),
+			item => panic!("unexpected item {:?}", item),
+		}
+	}
+
+	#[test]
+	fn test_virtual_column_clips_views_and_text() {
+		let mut cameras = crate::arena::Arena::new();
+		let camera_id = cameras.insert(crate::types::Camera::default());
+		let rows: Vec<GUIElement> = (0..10)
+			.map(|_| camera_view(camera_id).add(text("row")))
+			.collect();
+		let list = virtual_column(0.5, rows).scroll(0.25);
+		let mut linearizer = Lineariser::new();
+		linearizer.linearize(&list);
+
+		match &linearizer.items[0] {
+			DrawItem::CamView(view) => {
+				assert_eq!([view.y, view.h], [0.875, 0.25]);
+				assert_eq!(view.clip, Some([0.0, 0.875, 1.0, 0.125]));
+			}
+			item => panic!("unexpected item {:?}", item),
+		}
+		match &linearizer.items[1] {
+			DrawItem::Text(text) => assert_eq!([text.clip.bottom, text.clip.top], [0.75, 1.0]),
+			item => panic!("unexpected item {:?}", item),
+		}
+		match &linearizer.items[2] {
+			DrawItem::CamView(view) => assert_eq!(view.clip, None),
+			item => panic!("unexpected item {:?}", item),
+		}
+	}
+
+	#[test]
+	fn test_clip_triangle() {
+		let clip = Clip { left: 0.0, right: 1.0, top: 1.0, bottom: 0.0 };
+		let polygon = clip.clip_triangle([[-1.0, 0.5], [2.0, 0.5], [0.5, 2.0]]);
+		assert!(polygon.len() >= 3);
+		assert!(polygon.iter().all(|&p| clip.contains(p)));
+		assert!(clip.clip_triangle([[2.0, 2.0], [3.0, 2.0], [2.0, 3.0]]).is_empty());
+	}
+
+	#[test]
+	fn test_children_outside_parent_are_skipped() {
+		let outside = GUIElement {
+			top_margin: 1.0,
+			..rect().background_color(Color::GREEN).height(0.25).anchor_top()
+		};
+		let ui = rect()
+			.background_color(Color::RED)
+			.height(0.5)
+			.anchor_top()
+			.add(outside);
+		let mut linearizer = Lineariser::new();
+		linearizer.linearize(&ui);
+
+		assert_eq!(linearizer.items.len(), 1);
+	}
+
+	#[test]
+	fn test_mouse_area_hit() {
+		let ui = column(&[
+			rect().background_color(Color::RED).mouse_area(1),
+			rect().background_color(Color::GREEN).add(mouse_area(2).width(0.5).anchor_left()),
+		]);
+		let mut compositor = Compositor::new();
+		compositor.process(&ui);
+
+		assert_eq!(compositor.hit_grid.query(0.0, 0.5).map(|m| m.id), Some(1));
+		assert_eq!(compositor.hit_grid.query(-0.75, -0.5).map(|m| m.id), Some(2));
+		assert_eq!(compositor.hit_grid.query(0.75, -0.5), None);
+	}
 }
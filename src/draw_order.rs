@@ -0,0 +1,63 @@
+/// Depth buckets between a camera's near and far plane. They are spaced
+/// exponentially like the light cluster slices, so near draws, where
+/// overdraw costs the most, are told apart finely.
+pub const DEPTH_BUCKETS: u16 = 256;
+
+pub fn depth_bucket(depth: f32, near: f32, far: f32) -> u16 {
+	let near = near.max(1e-4);
+	let far = far.max(near * 1.01);
+	if depth <= near {
+		return 0;
+	}
+	let bucket = (depth / near).ln() / (far / near).ln() * DEPTH_BUCKETS as f32;
+	(bucket as u16).min(DEPTH_BUCKETS - 1)
+}
+
+/// Orders items front to back by their depth bucket. A counting sort, so
+/// linear in the number of items, and stable, so draws sharing a bucket
+/// keep their material order.
+pub fn sort_front_to_back<T>(items: &mut Vec<T>, bucket: impl Fn(&T) -> u16) {
+	if items.len() < 2 {
+		return;
+	}
+	let bucket = |item: &T| bucket(item).min(DEPTH_BUCKETS - 1) as usize;
+	let mut starts = [0usize; DEPTH_BUCKETS as usize + 1];
+	for item in items.iter() {
+		starts[bucket(item) + 1] += 1;
+	}
+	for i in 1..starts.len() {
+		starts[i] += starts[i - 1];
+	}
+	let mut sorted: Vec<Option<T>> = (0..items.len()).map(|_| None).collect();
+	for item in items.drain(..) {
+		let b = bucket(&item);
+		sorted[starts[b]] = Some(item);
+		starts[b] += 1;
+	}
+	items.extend(sorted.into_iter().flatten());
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn test_depth_buckets_grow_with_depth() {
+		assert_eq!(depth_bucket(0.05, 0.1, 100.0), 0);
+		assert_eq!(depth_bucket(1000.0, 0.1, 100.0), DEPTH_BUCKETS - 1);
+		let mut last = 0;
+		for i in 1..200 {
+			let bucket = depth_bucket(i as f32 * 0.5, 0.1, 100.0);
+			assert!(bucket >= last);
+			last = bucket;
+		}
+	}
+
+	#[test]
+	fn test_sort_is_stable_front_to_back() {
+		let mut items = vec![(3, 'a'), (1, 'b'), (3, 'c'), (0, 'd'), (1, 'e'), (DEPTH_BUCKETS + 5, 'f')];
+		sort_front_to_back(&mut items, |item| item.0);
+		let order: String = items.iter().map(|item| item.1).collect();
+		assert_eq!(order, "dbeacf");
+	}
+}
@@ -1,19 +1,54 @@
 use glam::Mat4;
 use ttf_parser::Transform;
 
+use crate::atlas::pad_tile;
+use crate::atlas::TextureAtlas;
+use crate::atlas::ATLAS_SIZE;
 use crate::buffer::Buffer;
+use crate::buffer::BufferSlice;
+use crate::capture::capture_grid;
+use crate::capture::tile_viewport;
 use crate::compositor::Compositor;
+use crate::geometry_pool::GeometryPool;
+use crate::gpu_cull::CullMesh;
+use crate::gpu_cull::GpuCull;
 use crate::hardware;
 use crate::hardware::BufferHandle;
+use crate::hardware::BundleHandle;
+use crate::hardware::CaptureTile;
 use crate::hardware::Hardware;
+use crate::hardware::MaterialHandle;
+use crate::hardware::MaterialFeatures;
 use crate::hardware::PipelineHandle;
 use crate::hardware::RenderEncoder;
+use crate::hardware::RenderPass;
 use crate::hardware::TextureHandle;
 use crate::hardware::WindowHandle;
+use crate::instance_buffer::slot_runs;
+use crate::instance_buffer::InstanceBuffer;
 use crate::internal_types::*;
+use crate::light_clusters::ClusterLight;
+use crate::light_clusters::LightClusters;
+use crate::draw_order::depth_bucket;
+use crate::draw_order::sort_front_to_back;
+use crate::lod::lod_distances;
+use crate::lod::select_lod;
+use crate::occlusion::transform_aabb;
+use crate::occlusion::Frustum;
+use crate::occlusion::OcclusionBuffer;
+use crate::occlusion::OCCLUSION_HEIGHT;
+use crate::occlusion::OCCLUSION_WIDTH;
 use crate::state::State;
+use crate::static_batch::BatchMember;
+use crate::static_batch::StaticBatches;
+use crate::static_batch::STATIC_BATCH_MAX_INSTANCES;
+use crate::text::FontMesh;
 use crate::types::*;
 use crate::utility::topo_sort_nodes;
+use crate::vertex_format::pack_vertices;
+use crate::vertex_format::RawQuantizedVertex;
+use crate::vertex_format::RawVertex;
+use crate::vertex_format::stored_bounds;
 use crate::ArenaId;
 use crate::GUIElement;
 use crate::Window;
@@ -22,15 +57,47 @@ use std::ops::Range;
 use std::time::Duration;
 use std::time::Instant;
 
+const LABEL_FONT_DATA: &[u8] = include_bytes!("../fonts/Roboto-Regular.ttf");
+/// Stride of the material array. Dynamic offsets into storage bindings have
+/// to be multiples of 256 bytes and every draw offsets to its own entry.
+const MATERIAL_STRIDE: u64 = 256;
+
+fn quantize_positions() -> bool {
+	matches!(std::env::var("QUANTIZE_POSITIONS").as_deref(), Ok("1"))
+}
+
+fn gpu_culling() -> bool {
+	matches!(std::env::var("GPU_CULLING").as_deref(), Ok("1"))
+}
+
+/// Lays down the depth of the opaque draws before shading them, for scenes
+/// where fill rate rather than vertex work is the bottleneck.
+fn depth_prepass() -> bool {
+	matches!(std::env::var("DEPTH_PREPASS").as_deref(), Ok("1"))
+}
+
+/// Indexed draw from a geometry page. `indices_range` is the first and
+/// end index inside the page's index buffer. Draws with `indirect` set take
+/// their instances from the camera's GPU cull output instead of `instances`.
 #[derive(Debug, Clone)]
 pub struct DrawCall {
 	pub material: Option<ArenaId<Material>>,
-	pub vertices: Range<u64>,
-	pub indices: Range<u64>,
-	pub normals: Range<u64>,
-	pub tex_coords: Range<u64>,
+	pub page: usize,
+	pub base_vertex: i32,
 	pub instances: Range<u32>,
 	pub indices_range: Range<u32>,
+	pub indirect: Option<u32>,
+	/// Depth bucket of the nearest instance, camera draws are ordered front
+	/// to back by it. 0 for draws that aren't sorted.
+	pub depth_bucket: u16,
+}
+
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
+enum GeometryKey {
+	/// Primitive of a mesh at a version of the mesh, see `Arena::version`.
+	Primitive(ArenaId<Mesh>, usize, u64),
+	Glyph(char),
+	StaticBatch(ArenaId<Scene>, u64, usize),
 }
 
 #[derive(Debug, Clone)]
@@ -72,11 +139,132 @@ impl GuiBuffers {
     }
 }
 
+/// 3D pipelines of a window or capture target.
+struct TargetPipelines {
+	pipeline: PipelineHandle,
+	/// Variants of `pipeline` per set of textures a material samples.
+	material_pipelines: HashMap<MaterialFeatures, PipelineHandle>,
+	depth_pipeline: Option<PipelineHandle>,
+}
+
 struct WindowContext {
 	window_id: ArenaId<Window>,
 	window: WindowHandle,
-	pipeline: PipelineHandle,
 	gui_pipeline: PipelineHandle,
+	pipelines: TargetPipelines,
+}
+
+/// Offscreen target capture requests of one size are packed into, a tile
+/// per request.
+struct CaptureTarget {
+	target: WindowHandle,
+	tile_width: u32,
+	tile_height: u32,
+	cols: u32,
+	rows: u32,
+	pipelines: TargetPipelines,
+}
+
+/// Bind group a material draws with and the textures it was built with,
+/// looked up again when one of them finishes loading.
+struct MaterialBinding {
+	textures: [TextureHandle; 5],
+	features: MaterialFeatures,
+	handle: MaterialHandle,
+}
+
+/// Bind group of one set of textures over the whole material array and the
+/// number of materials drawing with it. Materials whose textures went into
+/// the same atlas pages end up with the same set.
+struct TextureBinding {
+	handle: MaterialHandle,
+	users: usize,
+}
+
+/// First entry of the material array, the window a material bind group
+/// sees before the draw's offset moves it to the draw's slot.
+fn material_slice(buffer: BufferHandle) -> BufferSlice {
+	BufferSlice {
+		handle: buffer,
+		range: 0..std::mem::size_of::<RawMaterial>() as u64,
+	}
+}
+
+/// What the commands of a static bundle are recorded from. Compared every
+/// frame instead of recording the commands again, the bundle is only
+/// re-recorded when one of them changed.
+#[derive(Debug, Clone, Copy, PartialEq)]
+struct StaticBundleStamp {
+	/// `StaticBatches::generation` of the scene, the draw calls only change
+	/// with it.
+	batches: u64,
+	/// `Engine::material_generation`, bumped when bind groups change.
+	materials: u64,
+	/// `GeometryPool::buffer_generation`.
+	geometry: u64,
+	/// Instance buffer and the first transient instance the batches use.
+	instances: (BufferHandle, u32),
+	camera: BufferHandle,
+	lights: BufferHandle,
+	/// Pipeline of the target and its number of material variants, which
+	/// only grows.
+	pipelines: (PipelineHandle, usize),
+}
+
+/// Camera side of a view drawn into a pass shared by the views of a scene.
+#[derive(Debug, Clone, Copy)]
+struct ViewBinding {
+	camera_id: ArenaId<Camera>,
+	camera: BufferHandle,
+	lights: BufferHandle,
+	/// None inside bundles, which can't set one.
+	viewport: Option<[f32; 4]>,
+	/// Visible part of the viewport when the GUI cuts the view.
+	scissor: Option<[f32; 4]>,
+}
+
+impl ViewBinding {
+	/// Sets the view's rect on a pass, when it has one.
+	fn set_viewport(&self, pass: &mut RenderPass) {
+		if let Some(rect) = self.viewport {
+			pass.set_viewport(rect);
+		}
+		if let Some(rect) = self.scissor {
+			pass.set_scissor(rect);
+		}
+	}
+}
+
+/// Camera looking at a scene as seen by mesh culling and LOD selection.
+struct CullView {
+	camera_id: ArenaId<Camera>,
+	position: glam::Vec3,
+	projection: f32,
+	frustum: Frustum,
+	near: f32,
+	far: f32,
+}
+
+fn camera_view_projection(camera: &Camera, node: &Node) -> glam::Mat4 {
+	glam::Mat4::perspective_lh(camera.fovy, camera.aspect, camera.znear, camera.zfar)
+		* node.global_transform.inverse()
+}
+
+/// Depth bucket of the point of a box nearest to the camera.
+fn view_depth_bucket(view: &CullView, min: glam::Vec3, max: glam::Vec3) -> u16 {
+	let nearest = view.position.clamp(min, max);
+	depth_bucket(nearest.distance(view.position), view.near, view.far)
+}
+
+/// Frustum test followed by the occluder test when the scene has occluders.
+fn is_visible(view: &CullView, occlusion: Option<&OcclusionBuffer>, min: glam::Vec3, max: glam::Vec3) -> bool {
+	if !view.frustum.intersects_aabb(min, max) {
+		return false;
+	}
+	match occlusion {
+		Some(buffer) => buffer.is_visible(min, max),
+		None => true,
+	}
 }
 
 struct NodeComputedMetadata {
@@ -88,26 +276,53 @@ pub struct Engine<A, H> {
     pub app: A,
     pub state: State,
     hardware: H,
-    vertices_buffer: Buffer,
-    tex_coords_buffer: Buffer,
-    normal_buffer: Buffer,	
-    index_buffer: Buffer,
-    point_light_buffers: HashMap<ArenaId<Scene>, Buffer>,
+	geometry: GeometryPool<GeometryKey>,
+	vertex_scratch: Vec<u8>,
+	quantize_positions: bool,
+    light_clusters: HashMap<ArenaId<Camera>, (LightClusters, Buffer)>,
     gui_buffers: HashMap<ArenaId<GUIElement>, GuiBuffers>,
     camera_buffers: HashMap<ArenaId<Camera>, Buffer>,
     default_texture: TextureHandle,
 	default_point_lights: Buffer,
-	default_material: BufferHandle,
-    scene_instance_buffers: HashMap<ArenaId<Scene>, Buffer>,
+	default_material: MaterialHandle,
+    scene_instance_buffers: HashMap<ArenaId<Scene>, InstanceBuffer<(ArenaId<Node>, usize)>>,
     scene_draw_calls: HashMap<ArenaId<Scene>, Vec<DrawCall>>,
+	camera_draw_calls: HashMap<ArenaId<Camera>, Vec<DrawCall>>,
+	/// Static batch draws, replayed from a recorded bundle per window and
+	/// camera together with the commands they were recorded from.
+	static_draw_calls: HashMap<ArenaId<Scene>, Vec<DrawCall>>,
+	static_bundles: HashMap<(ArenaId<Window>, ArenaId<Camera>), (StaticBundleStamp, BundleHandle)>,
+	static_batches: HashMap<ArenaId<Scene>, StaticBatches>,
+	occlusion_buffers: HashMap<ArenaId<Camera>, OcclusionBuffer>,
+	gpu_culling: bool,
+	depth_prepass: bool,
+	gpu_culls: HashMap<ArenaId<Camera>, GpuCull>,
+	primitive_bounds: HashMap<(ArenaId<Mesh>, usize), (glam::Vec3, glam::Vec3)>,
 	textures: HashMap<ArenaId<Texture>, TextureHandle>,
-	materials: HashMap<ArenaId<Material>, BufferHandle>,
+	/// Small textures share pages of the atlas, `texture_rects` holds where
+	/// in its page each of them went.
+	atlas: TextureAtlas,
+	atlas_pages: Vec<TextureHandle>,
+	texture_rects: HashMap<ArenaId<Texture>, [f32; 4]>,
+	/// Every `RawMaterial` in one storage buffer, slot 0 is the default.
+	material_buffer: BufferHandle,
+	raw_materials: Vec<RawMaterial>,
+	/// Slot of each material and the version of the material it holds.
+	material_slots: HashMap<ArenaId<Material>, (u32, u64)>,
+	/// Slots of removed materials, reused before the array grows.
+	free_material_slots: Vec<u32>,
+	/// Bumped whenever a material gets or loses a bind group.
+	material_generation: u64,
+	material_bindings: HashMap<ArenaId<Material>, MaterialBinding>,
+	texture_bindings: HashMap<[TextureHandle; 5], TextureBinding>,
     ui_compositors: HashMap<ArenaId<GUIElement>, Compositor>,
     ui_render_args: HashMap<ArenaId<GUIElement>, UIRenderArgs>,
 	windows: Vec<WindowContext>,
+	capture_targets: Vec<CaptureTarget>,
 	//nodes: HashMap<ArenaId<Node>, NodeComputedMetadata>,
 	mesh_nodes: HashMap<ArenaId<Mesh>, Vec<ArenaId<Node>>>,
 	topo_sorted_nodes: Vec<ArenaId<Node>>,
+	label_font: Option<FontMesh>,
 	fps: u32
 }
 
@@ -121,16 +336,24 @@ where
 		//let data = [0, 0, 0, 0];
         let default_texture = hardware.create_texture("default_texture", &data, 1, 1);
 
-        let vertices_buffer = Buffer::new(hardware.create_buffer("vertices", 1000));
-        let tex_coords_buffer = Buffer::new(hardware.create_buffer("tex_coords", 1000));
-        let normal_buffer = Buffer::new(hardware.create_buffer("normals", 1000));
-        let index_buffer = Buffer::new(hardware.create_buffer("indices", 1000));
+		let quantize_positions = quantize_positions();
+		let vertex_stride = if quantize_positions {
+			std::mem::size_of::<RawQuantizedVertex>()
+		} else {
+			std::mem::size_of::<RawVertex>()
+		};
 
-		let default_point_lights = Buffer::new(hardware.create_buffer("default_point_lights", 1000));
+		// Clusters without any lights for views whose camera has none built.
+		let mut default_point_lights = Buffer::new(hardware.create_buffer("default_point_lights", 1000));
+		let mut no_lights = LightClusters::default();
+		no_lights.build(&Mat4::IDENTITY, 0.1, 1.0, &[]);
+		default_point_lights.write(bytemuck::cast_slice(&no_lights.words));
+		default_point_lights.flush(&mut hardware);
         
-        let default_material_data = RawMaterial::default();
-        let default_material = hardware.create_buffer("default_material", 1000);
-        hardware.write_buffer(default_material, bytemuck::cast_slice(&[default_material_data]));
+        let raw_materials = vec![RawMaterial::default()];
+        let material_buffer = hardware.create_buffer("materials", 64 * MATERIAL_STRIDE);
+        hardware.write_buffer(material_buffer, bytemuck::cast_slice(&raw_materials));
+        let default_material = hardware.create_material([default_texture; 5], material_slice(material_buffer));
 
         let mut state = State::default();
         app.on_create(&mut state);
@@ -141,11 +364,10 @@ where
             app,
             state,
             hardware,
-            vertices_buffer,
-            tex_coords_buffer,
-            normal_buffer,
-            index_buffer,
-            point_light_buffers: HashMap::new(),
+			geometry: GeometryPool::new(vertex_stride as u32),
+			vertex_scratch: Vec::new(),
+			quantize_positions,
+            light_clusters: HashMap::new(),
             gui_buffers: HashMap::new(),
             camera_buffers: HashMap::new(),
             default_texture,
@@ -153,15 +375,35 @@ where
 			default_point_lights,
 			default_material,
 			textures: HashMap::new(),
-			materials: HashMap::new(),
+			atlas: TextureAtlas::default(),
+			atlas_pages: Vec::new(),
+			texture_rects: HashMap::new(),
+			material_buffer,
+			raw_materials,
+			material_slots: HashMap::new(),
+			free_material_slots: Vec::new(),
+			material_generation: 0,
+			material_bindings: HashMap::new(),
+			texture_bindings: HashMap::new(),
             ui_compositors: HashMap::new(),
             scene_draw_calls: HashMap::new(),
+			camera_draw_calls: HashMap::new(),
+			static_draw_calls: HashMap::new(),
+			static_bundles: HashMap::new(),
+			static_batches: HashMap::new(),
+			occlusion_buffers: HashMap::new(),
+			gpu_culling: gpu_culling(),
+			depth_prepass: depth_prepass(),
+			gpu_culls: HashMap::new(),
+			primitive_bounds: HashMap::new(),
             ui_render_args: HashMap::new(),
 			windows: Vec::new(),
+			capture_targets: Vec::new(),
 			//nodes: HashMap::new(),
 			mesh_nodes: HashMap::new(),
 			fps: 0,
 			topo_sorted_nodes: Vec::new(),
+			label_font: None,
         }
     }
 
@@ -256,14 +498,50 @@ where
 					log::warn!("TextureSource::None encountered - using red texture");
 				}
  			};
+			if data.len() == (width * height * 4) as usize {
+				if let Some(placement) = self.atlas.insert(width, height) {
+					while self.atlas_pages.len() <= placement.page {
+						let name = format!("atlas_page_{}", self.atlas_pages.len());
+						let blank = vec![0; (ATLAS_SIZE * ATLAS_SIZE * 4) as usize];
+						self.atlas_pages.push(self.hardware.create_texture(&name, &blank, ATLAS_SIZE, ATLAS_SIZE));
+					}
+					let (tile, tile_width, tile_height) = pad_tile(&data, width, height);
+					let page = self.atlas_pages[placement.page];
+					self.hardware.write_texture(page, placement.x, placement.y, tile_width, tile_height, &tile);
+					self.textures.insert(texture_id.clone(), page);
+					self.texture_rects.insert(texture_id.clone(), placement.uv_rect);
+					continue;
+				}
+			}
 			let handle = self.hardware.create_texture(&texture.name, &data, width, height);
 			self.textures.insert(texture_id.clone(), handle);
 		}
 	}
 
 	fn process_materials(&mut self) {
+		// Removed and edited materials give their slot and bind group back,
+		// an edited one is set up again below like a new one.
+		let materials = &self.state.materials;
+		let mut freed = Vec::new();
+		self.material_slots.retain(|material_id, (slot, version)| {
+			if materials.version(material_id) == Some(*version) {
+				return true;
+			}
+			freed.push((*material_id, *slot));
+			false
+		});
+		for (material_id, slot) in freed {
+			if let Some(binding) = self.material_bindings.remove(&material_id) {
+				self.release_texture_binding(binding.textures);
+				self.material_generation += 1;
+			}
+			self.free_material_slots.push(slot);
+		}
+
+		let uploaded = self.raw_materials.len();
+		let mut reused = Vec::new();
 		for (material_id, material) in &self.state.materials {
-			if self.materials.contains_key(&material_id) {
+			if self.material_slots.contains_key(&material_id) {
 				continue;
 			}
 
@@ -275,12 +553,102 @@ where
 				occlusion_strength: material.occlusion_strength,
 				emissive_factor: material.emissive_factor,
 				_padding: 0.0,
+				uv_rects: self.material_uv_rects(material),
 			};
 			crate::log4!("new material: {:?}", raw_material);
+			let version = self.state.materials.version(&material_id).unwrap_or(0);
+			let slot = match self.free_material_slots.pop() {
+				Some(slot) => {
+					self.raw_materials[slot as usize] = raw_material;
+					reused.push(slot);
+					slot
+				}
+				None => {
+					self.raw_materials.push(raw_material);
+					self.raw_materials.len() as u32 - 1
+				}
+			};
+			self.material_slots.insert(material_id, (slot, version));
+		}
 
-			let buffer = self.hardware.create_buffer(&format!("material_buffer_{:?}", material_id.index()), 1000);
-			self.hardware.write_buffer(buffer, bytemuck::bytes_of(&raw_material));
-			self.materials.insert(material_id.clone(), buffer);
+		let mut upload_from = uploaded;
+		let size = self.raw_materials.len() as u64 * MATERIAL_STRIDE;
+		if size > self.material_buffer.size {
+			let new_size = (size as f32 * 1.5) as u64;
+			crate::log2!("resizing material buffer from {} to {}", self.material_buffer.size, new_size);
+			self.hardware.destroy_buffer(self.material_buffer);
+			self.material_buffer = self.hardware.create_buffer("materials", new_size);
+			// Every bind group points into the old buffer.
+			upload_from = 0;
+			self.material_generation += 1;
+			self.material_bindings.clear();
+			for (_, binding) in self.texture_bindings.drain() {
+				self.hardware.destroy_material(binding.handle);
+			}
+			self.hardware.destroy_material(self.default_material);
+			self.default_material = self.hardware.create_material([self.default_texture; 5], material_slice(self.material_buffer));
+		}
+		for slot in reused {
+			if (slot as usize) < upload_from {
+				let raw_material = self.raw_materials[slot as usize];
+				self.hardware.write_buffer_at(self.material_buffer, slot as u64 * MATERIAL_STRIDE, bytemuck::bytes_of(&raw_material));
+			}
+		}
+		if upload_from < self.raw_materials.len() {
+			let mut data = vec![0u8; (self.raw_materials.len() - upload_from) * MATERIAL_STRIDE as usize];
+			for (i, raw_material) in self.raw_materials[upload_from..].iter().enumerate() {
+				let start = i * MATERIAL_STRIDE as usize;
+				data[start..start + std::mem::size_of::<RawMaterial>()].copy_from_slice(bytemuck::bytes_of(raw_material));
+			}
+			self.hardware.write_buffer_at(self.material_buffer, upload_from as u64 * MATERIAL_STRIDE, &data);
+		}
+
+		for (material_id, material) in &self.state.materials {
+			let textures = self.material_textures(material);
+			if self.material_bindings.get(&material_id).map_or(false, |b| b.textures == textures) {
+				continue;
+			}
+			let slot = self.material_slots[&material_id].0;
+			// A texture that loaded since may have gone into the atlas.
+			let uv_rects = self.material_uv_rects(material);
+			if self.raw_materials[slot as usize].uv_rects != uv_rects {
+				self.raw_materials[slot as usize].uv_rects = uv_rects;
+				let raw_material = self.raw_materials[slot as usize];
+				self.hardware.write_buffer_at(self.material_buffer, slot as u64 * MATERIAL_STRIDE, bytemuck::bytes_of(&raw_material));
+			}
+			let features = self.material_features(material);
+			let handle = match self.texture_bindings.get_mut(&textures) {
+				Some(binding) => {
+					binding.users += 1;
+					binding.handle
+				}
+				None => {
+					let handle = self.hardware.create_material(textures, material_slice(self.material_buffer));
+					self.texture_bindings.insert(textures, TextureBinding { handle, users: 1 });
+					handle
+				}
+			};
+			let old = self.material_bindings.insert(material_id, MaterialBinding {
+				textures,
+				features,
+				handle,
+			});
+			if let Some(old) = old {
+				self.release_texture_binding(old.textures);
+			}
+			self.material_generation += 1;
+		}
+	}
+
+	fn release_texture_binding(&mut self, textures: [TextureHandle; 5]) {
+		let binding = match self.texture_bindings.get_mut(&textures) {
+			Some(binding) => binding,
+			None => return,
+		};
+		binding.users -= 1;
+		if binding.users == 0 {
+			self.hardware.destroy_material(binding.handle);
+			self.texture_bindings.remove(&textures);
 		}
 	}
 
@@ -289,40 +657,184 @@ where
 		for (_, s) in &mut self.scene_draw_calls {
 			s.clear();
 		}
+		for (_, s) in &mut self.camera_draw_calls {
+			s.clear();
+		}
+		for (_, s) in &mut self.static_draw_calls {
+			s.clear();
+		}
+		for (_, buffer) in &mut self.scene_instance_buffers {
+			buffer.begin_frame();
+		}
+		for (_, cull) in &mut self.gpu_culls {
+			cull.begin_frame();
+		}
+		self.geometry.begin_frame();
+
+		let mut occluders: HashMap<ArenaId<Scene>, Vec<[glam::Vec3; 3]>> = HashMap::new();
+		for (_, node) in &self.state.nodes {
+			let (scene_id, mesh) = match (node.scene_id, node.occluder.and_then(|id| self.state.meshes.get(&id))) {
+				(Some(scene_id), Some(mesh)) => (scene_id, mesh),
+				_ => continue,
+			};
+			let triangles = occluders.entry(scene_id).or_insert(Vec::new());
+			for primitive in &mesh.primitives {
+				if primitive.topology != PrimitiveTopology::TriangleList {
+					continue;
+				}
+				let world = |i: u16| primitive.vertices.get(i as usize)
+					.map(|v| node.global_transform.transform_point3(glam::Vec3::from_array(*v)));
+				for t in primitive.indices.chunks_exact(3) {
+					if let (Some(a), Some(b), Some(c)) = (world(t[0]), world(t[1]), world(t[2])) {
+						triangles.push([a, b, c]);
+					}
+				}
+			}
+		}
+
+		let mut cull_views: HashMap<ArenaId<Scene>, Vec<CullView>> = HashMap::new();
+		for (camera_id, camera) in &self.state.cameras {
+			let node = match camera.node_id.and_then(|id| self.state.nodes.get(&id)) {
+				Some(node) => node,
+				None => continue,
+			};
+			let scene_id = match node.scene_id {
+				Some(id) => id,
+				None => continue,
+			};
+			self.scene_draw_calls.entry(scene_id).or_insert(Vec::new());
+			let view_projection = camera_view_projection(camera, node);
+			match occluders.get(&scene_id) {
+				Some(triangles) if triangles.len() > 0 => {
+					self.occlusion_buffers.entry(camera_id)
+						.or_insert_with(|| OcclusionBuffer::new(OCCLUSION_WIDTH, OCCLUSION_HEIGHT))
+						.render(&view_projection, triangles);
+				}
+				_ => {
+					self.occlusion_buffers.remove(&camera_id);
+				}
+			}
+			cull_views.entry(scene_id).or_insert(Vec::new()).push(CullView {
+				camera_id,
+				position: node.global_transform.w_axis.truncate(),
+				projection: 1.0 / (camera.fovy * 0.5).tan().abs(),
+				frustum: Frustum::from_view_projection(&view_projection),
+				near: camera.znear,
+				far: camera.zfar,
+			});
+		}
+		let cameras = &self.state.cameras;
+		self.occlusion_buffers.retain(|camera_id, _| cameras.contains(camera_id));
+		self.gpu_culls.retain(|camera_id, _| cameras.contains(camera_id));
+		let meshes = &self.state.meshes;
+		self.primitive_bounds.retain(|(mesh_id, _), _| meshes.contains(mesh_id));
         
+		let mut batch_members: HashMap<ArenaId<Scene>, Vec<BatchMember>> = HashMap::new();
+
 		for (mesh_id, mesh) in &self.state.meshes {
-			for primitive in &mesh.primitives {
+			for (primitive_index, primitive) in mesh.primitives.iter().enumerate() {
 				if primitive.topology == PrimitiveTopology::TriangleList {
 					if primitive.vertices.len() == 0 || primitive.indices.len() == 0 {
 						continue;
 					}
 
-					let vertices_start = self.vertices_buffer.len();
-                    self.vertices_buffer.write(bytemuck::cast_slice(&primitive.vertices));
-					let vertices_end = self.vertices_buffer.len();
-
-					let normals_start = self.normal_buffer.len();
-					self.normal_buffer.write(bytemuck::cast_slice(&primitive.normals));
-					let normals_end = self.normal_buffer.len();
-
-					let indices_start = self.index_buffer.len();
-					self.index_buffer.write(bytemuck::cast_slice(&primitive.indices));
-					let indices_end = self.index_buffer.len();
+					// An edited mesh or a new one reusing the id has a different
+					// version, the geometry of the old one is released at the end of
+					// the frame since nothing asks for it anymore.
+					let version = self.state.meshes.version(&mesh_id).unwrap_or(0);
+					let key = GeometryKey::Primitive(mesh_id, primitive_index, version);
+					let geometry = match self.geometry.get(&key) {
+						Some(geometry) => geometry.clone(),
+						None => {
+							self.vertex_scratch.clear();
+							let dequantize = pack_vertices(primitive, self.quantize_positions, &mut self.vertex_scratch);
+							let mut index_lists: Vec<&[u16]> = vec![&primitive.indices];
+							index_lists.extend(primitive.lods.iter().map(|lod| lod.indices.as_slice()));
+							let bounds = primitive.vertices.iter().fold(
+								(glam::Vec3::splat(f32::MAX), glam::Vec3::splat(f32::MIN)),
+								|(min, max), v| (min.min(glam::Vec3::from_array(*v)), max.max(glam::Vec3::from_array(*v))),
+							);
+							self.primitive_bounds.insert((mesh_id, primitive_index), bounds);
+							match self.geometry.insert(&mut self.hardware, key, &self.vertex_scratch, &index_lists, dequantize) {
+								Some(geometry) => geometry.clone(),
+								None => continue,
+							}
+						}
+					};
+					let dequantize = geometry.dequantize;
+					let (local_min, local_max) = match self.primitive_bounds.get(&(mesh_id, primitive_index)) {
+						Some(bounds) => *bounds,
+						None => continue,
+					};
 
-					let tex_coords_start = self.tex_coords_buffer.len();
-					if primitive.tex_coords.len() > 0 {
-                        self.tex_coords_buffer.write(bytemuck::cast_slice(&primitive.tex_coords));
-					} else {
-						let tex_coords = vec![[0.0, 0.0]; primitive.vertices.len()];
-						self.tex_coords_buffer.write(bytemuck::cast_slice(&tex_coords));
-					}
-					let tex_coords_end = self.tex_coords_buffer.len();
 					let node_ids = match self.mesh_nodes.get(&mesh_id) {
 						Some(ids) => ids,
 						None => continue,
 					};
 
-					let mut checkpoints: HashMap<ArenaId<Scene>, Range<u32>> = HashMap::new();
+					// Instances of primitives with LODs keep their stable slots, the
+					// draws of each camera pick the level matching the distance of
+					// the instances from that camera. The GPU culling pass picks
+					// the levels itself.
+					if primitive.lods.len() > 0 && !self.gpu_culling {
+						let mut buckets: HashMap<(ArenaId<Camera>, usize), (Vec<u32>, u16)> = HashMap::new();
+						for node_id in node_ids {
+							let node = match self.state.nodes.get(node_id) {
+								Some(node) => node,
+								None => continue,
+							};
+							let scene_id = match node.scene_id {
+								Some(id) => id,
+								None => continue,
+							};
+							let views = match cull_views.get(&scene_id) {
+								Some(views) => views,
+								None => continue,
+							};
+							let transform = node.global_transform;
+							let position = transform.w_axis.truncate();
+							let scale = transform.x_axis.truncate().length()
+								.max(transform.y_axis.truncate().length())
+								.max(transform.z_axis.truncate().length());
+							let instance = RawInstance::new(&(transform * dequantize));
+							let buffer = self.scene_instance_buffers.entry(scene_id)
+								.or_insert_with(|| InstanceBuffer::new(self.hardware.create_buffer(&format!("instances_{:?}", scene_id.index()), 1000)));
+							let slot = buffer.set((*node_id, primitive_index), instance);
+							let (min, max) = transform_aabb(&transform, local_min, local_max);
+							for view in views {
+								if !is_visible(view, self.occlusion_buffers.get(&view.camera_id), min, max) {
+									continue;
+								}
+								let lod = select_lod(&primitive.lods, position.distance(view.position), scale, view.projection);
+								let (slots, depth) = buckets.entry((view.camera_id, lod)).or_insert((Vec::new(), u16::MAX));
+								slots.push(slot);
+								*depth = (*depth).min(view_depth_bucket(view, min, max));
+							}
+						}
+
+						for ((camera_id, lod), (mut slots, depth)) in buckets {
+							let draw_calls = self.camera_draw_calls.entry(camera_id).or_insert(Vec::new());
+							for instances in slot_runs(&mut slots) {
+								draw_calls.push(DrawCall {
+									material: primitive.material,
+									page: geometry.page,
+									base_vertex: geometry.base_vertex,
+									instances,
+									indices_range: geometry.index_lists[lod].clone(),
+									indirect: None,
+									depth_bucket: depth,
+								});
+							}
+						}
+						continue;
+					}
+
+					let mut camera_slots: HashMap<ArenaId<Camera>, Vec<u32>> = HashMap::new();
+					let mut camera_depths: HashMap<ArenaId<Camera>, u16> = HashMap::new();
+					let mut scene_slots: HashMap<ArenaId<Scene>, Vec<u32>> = HashMap::new();
+					// Static batches merge the full mesh, LODs are picked per
+					// instance.
+					let batchable = primitive.lods.is_empty() && node_ids.len() <= STATIC_BATCH_MAX_INSTANCES;
 
 					for node_id in node_ids {
 						let node = match self.state.nodes.get(node_id) {
@@ -333,42 +845,111 @@ where
 							Some(id) => id,
 							None => continue,
 						};
-						let instance = RawInstance {
-							model: node.global_transform.to_cols_array_2d(),
-						};
+						let instance = RawInstance::new(&(node.global_transform * dequantize));
 						let buffer = self.scene_instance_buffers.entry(scene_id)
-							.or_insert_with(|| Buffer::new(self.hardware.create_buffer(&format!("instances_{:?}", scene_id.index()), 1000)));
-
-						let instance_start = buffer.len() as u32 / std::mem::size_of::<RawInstance>() as u32;
-						buffer.write(bytemuck::bytes_of(&instance));
-						let instance_end = buffer.len() as u32 / std::mem::size_of::<RawInstance>() as u32;
+							.or_insert_with(|| InstanceBuffer::new(self.hardware.create_buffer(&format!("instances_{:?}", scene_id.index()), 1000)));
+						let slot = buffer.set((*node_id, primitive_index), instance);
+						if batchable && buffer.is_static(&(*node_id, primitive_index)) {
+							batch_members.entry(scene_id).or_insert(Vec::new()).push((*node_id, mesh_id, primitive_index, version));
+							continue;
+						}
+						if self.gpu_culling {
+							scene_slots.entry(scene_id).or_insert(Vec::new()).push(slot);
+							continue;
+						}
+						let views = match cull_views.get(&scene_id) {
+							Some(views) => views,
+							None => continue,
+						};
+						let (min, max) = transform_aabb(&node.global_transform, local_min, local_max);
+						for view in views {
+							if !is_visible(view, self.occlusion_buffers.get(&view.camera_id), min, max) {
+								continue;
+							}
+							camera_slots.entry(view.camera_id).or_insert(Vec::new()).push(slot);
+							let depth = camera_depths.entry(view.camera_id).or_insert(u16::MAX);
+							*depth = (*depth).min(view_depth_bucket(view, min, max));
+						}
+					}
 
-						let checkpoint = checkpoints
-							.entry(scene_id)
-							.or_insert(instance_start..instance_end);
-						checkpoint.end = instance_end;
+					// The compute pass tests the runs of slots against the frustum of
+					// every camera of the scene and picks their LODs, nothing is
+					// tested per instance here. Occluders are not tested in this mode.
+					if self.gpu_culling {
+						// Instances carry the dequantize transform so the bounds have to
+						// be in the quantized space of the vertices.
+						let bounds = stored_bounds(&dequantize, local_min, local_max);
+						for (scene_id, mut slots) in scene_slots {
+							let runs = slot_runs(&mut slots);
+							for view in cull_views.get(&scene_id).into_iter().flatten() {
+								let distances = lod_distances(&primitive.lods, view.projection);
+								let mesh = CullMesh {
+									levels: &geometry.index_lists,
+									lod_distances: &distances,
+									base_vertex: geometry.base_vertex,
+									bounds,
+									dequantize,
+								};
+								let cull = self.gpu_culls.entry(view.camera_id).or_insert_with(|| GpuCull::new(&mut self.hardware));
+								let args = cull.push_draw(&mesh, &runs);
+								let draw_calls = self.camera_draw_calls.entry(view.camera_id).or_insert(Vec::new());
+								for (indirect, indices) in args.zip(&geometry.index_lists) {
+									// The depth of the visible instances is only known on the
+									// GPU, these sort as the nearest draws.
+									draw_calls.push(DrawCall {
+										material: primitive.material,
+										page: geometry.page,
+										base_vertex: geometry.base_vertex,
+										instances: 0..0,
+										indices_range: indices.clone(),
+										indirect: Some(indirect),
+										depth_bucket: 0,
+									});
+								}
+							}
+						}
+						continue;
 					}
 
-					for (scene_id, instances) in checkpoints {
-						let draw_calls = self.scene_draw_calls.entry(scene_id).or_insert(Vec::new());
-						draw_calls.push(DrawCall {
-							material: primitive.material,
-							vertices: vertices_start..vertices_end,
-							indices: indices_start..indices_end,
-							normals: normals_start..normals_end,
-							tex_coords: tex_coords_start..tex_coords_end,
-							instances,
-							indices_range: 0..primitive.indices.len() as u32,
-						});
+					// Nodes of a mesh usually sit in neighbouring slots so this is
+					// one draw call per camera unless some of them are moving or
+					// culled.
+					for (camera_id, mut slots) in camera_slots {
+						let depth = camera_depths.get(&camera_id).copied().unwrap_or(0);
+						let draw_calls = self.camera_draw_calls.entry(camera_id).or_insert(Vec::new());
+						for instances in slot_runs(&mut slots) {
+							draw_calls.push(DrawCall {
+								material: primitive.material,
+								page: geometry.page,
+								base_vertex: geometry.base_vertex,
+								instances,
+								indices_range: geometry.index_lists[0].clone(),
+								indirect: None,
+								depth_bucket: depth,
+							});
+						}
 					}
 				}
 			}
 		}
+
+		// Opaque draws front to back so the depth test rejects what is hidden
+		// before it is shaded.
+		for (_, calls) in &mut self.camera_draw_calls {
+			sort_front_to_back(calls, |call| call.depth_bucket);
+		}
+		self.process_static_batches(batch_members);
+		self.process_labels();
+		for (_, views) in &cull_views {
+			for view in views {
+				if let Some(cull) = self.gpu_culls.get_mut(&view.camera_id) {
+					cull.flush(&mut self.hardware, view.frustum.planes(), view.position);
+				}
+			}
+		}
+
 		let flush_timer = Instant::now();
-		self.vertices_buffer.flush(&mut self.hardware);
-		self.tex_coords_buffer.flush(&mut self.hardware);
-		self.normal_buffer.flush(&mut self.hardware);
-		self.index_buffer.flush(&mut self.hardware);
+		self.geometry.end_frame();
 		for (_, buffer) in &mut self.scene_instance_buffers {
 			buffer.flush(&mut self.hardware);
 		}
@@ -381,6 +962,137 @@ where
 		}
     }
 
+	/// Draws primitives of nodes that have not moved as merged per material
+	/// batches. The merged geometry is only rebuilt when a node joins or
+	/// leaves the static set of its scene or the mesh of a member changes.
+	fn process_static_batches(&mut self, members: HashMap<ArenaId<Scene>, Vec<BatchMember>>) {
+		self.static_batches.retain(|scene_id, _| members.contains_key(scene_id));
+		for (scene_id, members) in members {
+			let batches = self.static_batches.entry(scene_id).or_insert_with(StaticBatches::default);
+			let count = members.len();
+			let nodes = &self.state.nodes;
+			let meshes = &self.state.meshes;
+			let rebuilt = batches.update(members, self.quantize_positions, |(node_id, mesh_id, primitive_index, _)| {
+				let node = nodes.get(node_id)?;
+				let primitive = meshes.get(mesh_id)?.primitives.get(*primitive_index)?;
+				Some((node.global_transform, primitive))
+			});
+			if rebuilt {
+				crate::log3!("Rebuilt {} static batches from {} primitives in scene {:?}", batches.batches.len(), count, scene_id.index());
+			}
+
+			let buffer = self.scene_instance_buffers.entry(scene_id)
+				.or_insert_with(|| InstanceBuffer::new(self.hardware.create_buffer(&format!("instances_{:?}", scene_id.index()), 1000)));
+			for (i, batch) in batches.batches.iter().enumerate() {
+				let key = GeometryKey::StaticBatch(scene_id, batches.generation, i);
+				let geometry = match self.geometry.get(&key) {
+					Some(geometry) => geometry.clone(),
+					None => match self.geometry.insert(&mut self.hardware, key, &batch.vertices, &[&batch.indices], batch.dequantize) {
+						Some(geometry) => geometry.clone(),
+						None => continue,
+					},
+				};
+
+				let instances = buffer.push_transient(&[RawInstance::new(&batch.dequantize)]);
+				self.static_draw_calls.entry(scene_id).or_insert(Vec::new()).push(DrawCall {
+					material: batch.material,
+					page: geometry.page,
+					base_vertex: geometry.base_vertex,
+					instances,
+					indices_range: geometry.index_lists[0].clone(),
+					indirect: None,
+					depth_bucket: 0,
+				});
+			}
+		}
+	}
+
+	/// Draws labels as instances of the shared glyph meshes. Every distinct
+	/// glyph and material is uploaded once and gets one draw call per scene
+	/// no matter how many labels use it.
+	fn process_labels(&mut self) {
+		if self.state.labels.len() == 0 {
+			return;
+		}
+		if self.label_font.is_none() {
+			match FontMesh::from_data(LABEL_FONT_DATA) {
+				Ok(font) => self.label_font = Some(font),
+				Err(e) => {
+					log::error!("Failed to load label font: {:?}", e);
+					return;
+				}
+			}
+		}
+		let font = self.label_font.as_ref().unwrap();
+
+		let mut glyph_instances: HashMap<(char, Option<ArenaId<Material>>), HashMap<ArenaId<Scene>, Vec<glam::Mat4>>> = HashMap::new();
+		for (_, label) in &self.state.labels {
+			let node = match label.node_id.and_then(|id| self.state.nodes.get(&id)) {
+				Some(node) => node,
+				None => continue,
+			};
+			let scene_id = match node.scene_id {
+				Some(id) => id,
+				None => continue,
+			};
+			let origin = node.global_transform
+				* glam::Mat4::from_translation(label.offset)
+				* glam::Mat4::from_scale(glam::Vec3::splat(label.size));
+			for (c, pen) in font.layout(&label.text) {
+				let model = origin * glam::Mat4::from_translation(glam::Vec3::new(pen[0], pen[1], 0.0));
+				glyph_instances
+					.entry((c, label.material))
+					.or_insert_with(HashMap::new)
+					.entry(scene_id)
+					.or_insert_with(Vec::new)
+					.push(model);
+			}
+		}
+
+		for ((c, material), scenes) in glyph_instances {
+			let primitive = match font.mesh(c).and_then(|m| m.primitives.first()) {
+				Some(p) => p,
+				None => continue,
+			};
+			if primitive.vertices.len() == 0 || primitive.indices.len() == 0 {
+				continue;
+			}
+
+			let key = GeometryKey::Glyph(c);
+			let geometry = match self.geometry.get(&key) {
+				Some(geometry) => geometry.clone(),
+				None => {
+					self.vertex_scratch.clear();
+					let dequantize = pack_vertices(primitive, self.quantize_positions, &mut self.vertex_scratch);
+					match self.geometry.insert(&mut self.hardware, key, &self.vertex_scratch, &[&primitive.indices], dequantize) {
+						Some(geometry) => geometry.clone(),
+						None => continue,
+					}
+				}
+			};
+			let dequantize = geometry.dequantize;
+
+			for (scene_id, models) in scenes {
+				let instances: Vec<RawInstance> = models.iter()
+					.map(|model| RawInstance::new(&(*model * dequantize)))
+					.collect();
+				let buffer = self.scene_instance_buffers.entry(scene_id)
+					.or_insert_with(|| InstanceBuffer::new(self.hardware.create_buffer(&format!("instances_{:?}", scene_id.index()), 1000)));
+				let instances = buffer.push_transient(&instances);
+
+				self.scene_draw_calls.entry(scene_id).or_insert(Vec::new()).push(DrawCall {
+					material,
+					page: geometry.page,
+					base_vertex: geometry.base_vertex,
+					instances,
+					indices_range: geometry.index_lists[0].clone(),
+					indirect: None,
+					depth_bucket: 0,
+				});
+			}
+		}
+	}
+
     fn process_cameras(&mut self) {
 		for (cam_id, cam) in &self.state.cameras {
 			let node_id = match cam.node_id {
@@ -391,8 +1103,7 @@ where
 				Some(node) => node,
 				None => continue,
 			};
-			let model = glam::Mat4::perspective_lh(cam.fovy, cam.aspect, cam.znear, cam.zfar)
-				* node.global_transform.inverse();
+			let model = camera_view_projection(cam, node);
 
 			let cam = RawCamera {
 				model: model.to_cols_array_2d(),
@@ -408,7 +1119,10 @@ where
 		}
 	}
 
+    /// Sorts the point lights of every camera's scene into the camera's
+	/// froxel clusters so fragments only loop over the lights near them.
     fn process_point_lights(&mut self) {
+		let mut scene_lights: HashMap<ArenaId<Scene>, Vec<ClusterLight>> = HashMap::new();
 		for (_, light) in &self.state.point_lights {
             let node_id = match light.node_id {
                 Some(id) => id,
@@ -422,16 +1136,33 @@ where
 				Some(id) => id,
 				None => continue,
 			};
-			let model = node.global_transform;
-			let pos = model.w_axis.truncate().into();
-			let light = RawPointLight::new(light.color, light.intensity, pos);
+			scene_lights.entry(scene_id).or_insert(Vec::new()).push(ClusterLight {
+				color: light.color,
+				intensity: light.intensity,
+				position: node.global_transform.w_axis.truncate(),
+				range: light.range,
+			});
+		}
 
-			self.point_light_buffers.entry(scene_id).or_insert_with(|| {
-				crate::log2!("Creating new point light buffer for scene ID: {:?}", scene_id);
-				Buffer::new(self.hardware.create_buffer("pointlight", 1000))
-			}).write(bytemuck::bytes_of(&light));
+		for (camera_id, camera) in &self.state.cameras {
+			let node = match camera.node_id.and_then(|id| self.state.nodes.get(&id)) {
+				Some(node) => node,
+				None => continue,
+			};
+			let lights = match node.scene_id.and_then(|id| scene_lights.get(&id)) {
+				Some(lights) => lights.as_slice(),
+				None => &[],
+			};
+			let (clusters, buffer) = self.light_clusters.entry(camera_id).or_insert_with(|| {
+				crate::log2!("Creating light cluster buffer for camera ID: {:?}", camera_id);
+				(LightClusters::default(), Buffer::new(self.hardware.create_buffer("light_clusters", 1000)))
+			});
+			clusters.build(&camera_view_projection(camera, node), camera.znear, camera.zfar, lights);
+			buffer.write(bytemuck::cast_slice(&clusters.words));
 		}
-		for (_, buffer) in &mut self.point_light_buffers {
+		let cameras = &self.state.cameras;
+		self.light_clusters.retain(|camera_id, _| cameras.contains(camera_id));
+		for (_, (_, buffer)) in &mut self.light_clusters {
 			buffer.flush(&mut self.hardware);
 		}
 	}
@@ -526,24 +1257,6 @@ where
 		self.ui_render_args.get(&ui_id)
 	}
 
-	fn get_camera_draw_calls(&self, camera_id: ArenaId<Camera>) -> Option<&Vec<DrawCall>> {
-		let camera = self.state.cameras.get(&camera_id)?;
-		let scene_id = match &camera.node_id {
-			Some(node_id) => {
-				let node = match self.state.nodes.get(node_id) {
-					Some(node) => node,
-					None => return None,
-				};
-				match node.scene_id {
-					Some(id) => id,
-					None => return None,
-				}
-			}
-			None => return None,
-		};
-		self.scene_draw_calls.get(&scene_id)
-	}
-
     fn update_windows(&mut self) {
         for (window_id, window) in self.state.windows.iter_mut() {
 			if self.windows.iter().any(|w| w.window_id == window_id) {
@@ -551,16 +1264,31 @@ where
 			}
 			crate::log1!("Creating window: {:?}", window_id);
             let handle = self.hardware.create_window(&window);
-			let pipeline = self.hardware.create_pipeline("pipeline", handle);
+			let pipelines = self.create_target_pipelines(handle);
 			let gui_pipeline = self.hardware.create_pipeline("gui", handle);
 			self.windows.push(WindowContext {
 				window_id,
 				window: handle,
-				pipeline,
 				gui_pipeline,
+				pipelines,
 			});
         }
 
+		let used_features = self.used_material_features();
+		let pipeline_name = if self.quantize_positions { "pipeline_quantized" } else { "pipeline" };
+		let windows = self.windows.iter_mut().map(|ctx| (ctx.window, &mut ctx.pipelines));
+		let captures = self.capture_targets.iter_mut().map(|target| (target.target, &mut target.pipelines));
+		for (handle, pipelines) in windows.chain(captures) {
+			for features in &used_features {
+				if pipelines.material_pipelines.contains_key(features) {
+					continue;
+				}
+				crate::log2!("Creating material pipeline {:?} for {:?}", features, handle);
+				let pipeline = self.hardware.create_material_pipeline(pipeline_name, handle, *features);
+				pipelines.material_pipelines.insert(*features, pipeline);
+			}
+		}
+
         /*for (window_id, _) in self.prev_state.windows.iter() {
             if !self.state.windows.contains(&window_id) {
                 //self.hardware.destroy_window(window_id);
@@ -569,14 +1297,130 @@ where
     }
 
 
+	fn used_material_features(&self) -> Vec<MaterialFeatures> {
+		let mut used_features = vec![MaterialFeatures::NONE];
+		for binding in self.material_bindings.values() {
+			if !used_features.contains(&binding.features) {
+				used_features.push(binding.features);
+			}
+		}
+		used_features
+	}
+
+	/// The 3D pipelines of a new window or capture target. Material variants
+	/// that are in use already are created with them.
+	fn create_target_pipelines(&mut self, handle: WindowHandle) -> TargetPipelines {
+		let pipeline_name = if self.quantize_positions { "pipeline_quantized" } else { "pipeline" };
+		let pipeline = self.hardware.create_pipeline(pipeline_name, handle);
+		let depth_pipeline = match (self.depth_prepass, self.quantize_positions) {
+			(true, true) => Some(self.hardware.create_pipeline("depth_prepass_quantized", handle)),
+			(true, false) => Some(self.hardware.create_pipeline("depth_prepass", handle)),
+			(false, _) => None,
+		};
+		let mut material_pipelines = HashMap::new();
+		for features in self.used_material_features() {
+			material_pipelines.insert(features, self.hardware.create_material_pipeline(pipeline_name, handle, features));
+		}
+		TargetPipelines {
+			pipeline,
+			material_pipelines,
+			depth_pipeline,
+		}
+	}
+
+	/// Textures bound for a material, the default texture standing in for
+	/// the ones it doesn't have or that aren't loaded.
+	fn material_textures(&self, material: &Material) -> [TextureHandle; 5] {
+		let texture = |id: Option<ArenaId<Texture>>| id.and_then(|id| self.textures.get(&id)).copied().unwrap_or(self.default_texture);
+		[
+			texture(material.base_color_texture),
+			texture(material.metallic_roughness_texture),
+			texture(material.normal_texture),
+			texture(material.occlusion_texture),
+			texture(material.emissive_texture),
+		]
+	}
+
+	fn material_uv_rects(&self, material: &Material) -> [[f32; 4]; 5] {
+		let rect = |id: Option<ArenaId<Texture>>| id.and_then(|id| self.texture_rects.get(&id)).copied().unwrap_or([0.0, 0.0, 1.0, 1.0]);
+		[
+			rect(material.base_color_texture),
+			rect(material.metallic_roughness_texture),
+			rect(material.normal_texture),
+			rect(material.occlusion_texture),
+			rect(material.emissive_texture),
+		]
+	}
+
+	/// Textures of a material that are loaded and get bound, which picks the
+	/// pipeline variant it is drawn with.
+	fn material_features(&self, material: &Material) -> MaterialFeatures {
+		let loaded = |texture: Option<ArenaId<Texture>>| texture.map_or(false, |id| self.textures.contains_key(&id));
+		let mut features = MaterialFeatures::NONE;
+		if loaded(material.base_color_texture) {
+			features.insert(MaterialFeatures::BASE_COLOR_TEXTURE);
+		}
+		if loaded(material.metallic_roughness_texture) {
+			features.insert(MaterialFeatures::METALLIC_ROUGHNESS_TEXTURE);
+		}
+		if loaded(material.normal_texture) {
+			features.insert(MaterialFeatures::NORMAL_TEXTURE);
+		}
+		if loaded(material.occlusion_texture) {
+			features.insert(MaterialFeatures::OCCLUSION_TEXTURE);
+		}
+		if loaded(material.emissive_texture) {
+			features.insert(MaterialFeatures::EMISSIVE_TEXTURE);
+		}
+		features
+	}
+
     pub fn on_mouse_input(&mut self, window: WindowHandle, event: MouseEvent) {
 		let window_ctx = match self.windows.iter().find(|w| w.window == window) {
 			Some(w) => w,
 			None => return,
 		};
-		self.app.on_mouse_input(window_ctx.window_id, event, &mut self.state);
+		let window_id = window_ctx.window_id;
+		// The hovered area is the one the click lands on, the app sees it
+		// flagged from this event until the end of the frame.
+		if matches!(event, MouseEvent::Pressed { button: MouseButton::Left }) {
+			if let Some(area) = self.state.hovered.get_mut(&window_id) {
+				area.clicked = true;
+			}
+		}
+		self.app.on_mouse_input(window_id, event, &mut self.state);
     }
 
+	/// Updates the hovered mouse area of a window. Position is in normalized
+	/// device coordinates.
+	pub fn on_cursor_moved(&mut self, window: WindowHandle, x: f32, y: f32) {
+		let window_ctx = match self.windows.iter().find(|w| w.window == window) {
+			Some(w) => w,
+			None => return,
+		};
+		let window_id = window_ctx.window_id;
+		let hit = self.state.windows.get(&window_id)
+			.and_then(|w| w.ui)
+			.and_then(|ui| self.ui_compositors.get(&ui))
+			.and_then(|c| c.hit_grid.query(x, y));
+		match hit {
+			Some(mut area) => {
+				// A click stays on its area while the pointer moves inside it.
+				area.clicked = self.state.hovered.get(&window_id).map_or(false, |prev| prev.id == area.id && prev.clicked);
+				self.state.hovered.insert(window_id, area);
+			}
+			None => {
+				self.state.hovered.remove(&window_id);
+			}
+		}
+	}
+
+	pub fn on_cursor_left(&mut self, window: WindowHandle) {
+		if let Some(window_ctx) = self.windows.iter().find(|w| w.window == window) {
+			self.state.hovered.remove(&window_ctx.window_id);
+		}
+	}
+
 	pub fn on_keyboard_input(&mut self, window: WindowHandle, key: KeyboardKey, action: KeyAction) {
 		let window_ctx = match self.windows.iter().find(|w| w.window == window) {
 			Some(w) => w,
@@ -590,6 +1434,156 @@ where
 		self.app.on_process(&mut self.state, dt);
 	}
 
+	/// Camera and light buffers a view draws with, None until its camera
+	/// has a buffer. With `viewport` the draws are set to the view's rect,
+	/// bundles leave it to the pass that executes them.
+	fn view_binding(&self, view: &View, viewport: bool) -> Option<ViewBinding> {
+		let camera_buffer = self.camera_buffers.get(&view.camview.camera_id)?;
+		let point_light_buffer = match self.light_clusters.get(&view.camview.camera_id) {
+			Some((_, b)) => b,
+			None => &self.default_point_lights,
+		};
+		let v = &view.camview;
+		Some(ViewBinding {
+			camera_id: v.camera_id,
+			camera: camera_buffer.handle,
+			lights: point_light_buffer.handle,
+			viewport: if viewport { Some([v.x, v.y, v.w, v.h]) } else { None },
+			scissor: if viewport { v.clip } else { None },
+		})
+	}
+
+	/// Adds a draw call to a pass with the pipeline variant and bind group
+	/// of its material, then draws it once per view.
+	fn push_draw(&self, pass: &mut RenderPass, pipelines: &TargetPipelines, views: &[ViewBinding], instance_buffer: &InstanceBuffer<(ArenaId<Node>, usize)>, call: &DrawCall) {
+		let binding = call.material.and_then(|id| Some((self.material_bindings.get(&id)?, self.material_slots.get(&id)?.0)));
+		let (material, features, slot) = match binding {
+			Some((binding, slot)) => (binding.handle, binding.features, slot),
+			None => (self.default_material, MaterialFeatures::NONE, 0),
+		};
+		// Untextured draws get the variant that samples nothing.
+		pass.set_pipeline(pipelines.material_pipelines.get(&features).copied().unwrap_or(pipelines.pipeline));
+		pass.bind_material(2, material, slot * MATERIAL_STRIDE as u32);
+		let (vertices, indices) = match self.geometry.page(call.page) {
+			Some(page) => page,
+			None => return,
+		};
+		pass.set_vertex_buffer(0, vertices);
+		pass.set_index_buffer(indices);
+		for view in views {
+			view.set_viewport(pass);
+			pass.bind_buffer(0, view.camera);
+			pass.bind_buffer(1, view.lights);
+			self.push_instances(pass, view.camera_id, instance_buffer, call);
+		}
+	}
+
+	/// Adds a draw call to a depth pre-pass, which only needs the camera and
+	/// the geometry.
+	fn push_depth_draw(&self, pass: &mut RenderPass, view: &ViewBinding, instance_buffer: &InstanceBuffer<(ArenaId<Node>, usize)>, call: &DrawCall) {
+		let (vertices, indices) = match self.geometry.page(call.page) {
+			Some(page) => page,
+			None => return,
+		};
+		view.set_viewport(pass);
+		pass.bind_buffer(0, view.camera);
+		pass.set_vertex_buffer(0, vertices);
+		pass.set_index_buffer(indices);
+		self.push_instances(pass, view.camera_id, instance_buffer, call);
+	}
+
+	/// Draws the instances of a call, from the camera's cull output when it
+	/// was culled on the GPU.
+	fn push_instances(&self, pass: &mut RenderPass, camera_id: ArenaId<Camera>, instance_buffer: &InstanceBuffer<(ArenaId<Node>, usize)>, call: &DrawCall) {
+		match (call.indirect, self.gpu_culls.get(&camera_id)) {
+			(Some(draw), Some(cull)) => {
+				let output = cull.output_slice(draw);
+				if output.range.start == output.range.end {
+					return;
+				}
+				pass.set_vertex_buffer(1, output);
+				pass.draw_indexed_indirect(cull.args(), GpuCull::args_offset(draw));
+			}
+			(Some(_), None) => {}
+			(None, _) => {
+				pass.set_vertex_buffer(1, instance_buffer.full());
+				pass.draw_indexed_base(call.indices_range.clone(), call.base_vertex, call.instances.clone());
+			}
+		}
+	}
+
+	/// Commands drawing a view's static batches, everything they need bound
+	/// included since bundles don't inherit the pass state. Bundles can't set
+	/// a viewport, the pass sets it before executing them.
+	fn static_commands(&self, ctx: &WindowContext, view: &View) -> Option<RenderPass> {
+		let calls = self.static_draw_calls.get(&view.scene_id).filter(|calls| !calls.is_empty())?;
+		let instance_buffer = self.scene_instance_buffers.get(&view.scene_id)?;
+		let binding = self.view_binding(view, false)?;
+		let mut pass = RenderPass::default();
+		for call in calls {
+			self.push_draw(&mut pass, &ctx.pipelines, &[binding], instance_buffer, call);
+		}
+		Some(pass)
+	}
+
+	/// Stamp of the static bundle of a view, None when it has nothing to
+	/// draw.
+	fn static_bundle_stamp(&self, ctx: &WindowContext, view: &View) -> Option<StaticBundleStamp> {
+		self.static_draw_calls.get(&view.scene_id).filter(|calls| !calls.is_empty())?;
+		let instance_buffer = self.scene_instance_buffers.get(&view.scene_id)?;
+		let binding = self.view_binding(view, false)?;
+		Some(StaticBundleStamp {
+			batches: self.static_batches.get(&view.scene_id).map_or(0, |batches| batches.generation),
+			materials: self.material_generation,
+			geometry: self.geometry.buffer_generation(),
+			instances: (instance_buffer.full().handle, instance_buffer.transient_start()),
+			camera: binding.camera,
+			lights: binding.lights,
+			pipelines: (ctx.pipelines.pipeline, ctx.pipelines.material_pipelines.len()),
+		})
+	}
+
+	/// Re-records the static bundle of every view whose stamp changed since
+	/// it was recorded: rebuilt batches, a new material bind group, moved
+	/// slots or a resized buffer.
+	fn update_static_bundles(&mut self) {
+		let mut live = Vec::new();
+		for ctx_index in 0..self.windows.len() {
+			let window_id = self.windows[ctx_index].window_id;
+			let args = match self.get_window_render_args(window_id) {
+				Some(args) => args.clone(),
+				None => continue,
+			};
+			for v in &args.views {
+				let key = (window_id, v.camview.camera_id);
+				let stamp = match self.static_bundle_stamp(&self.windows[ctx_index], v) {
+					Some(stamp) => stamp,
+					None => continue,
+				};
+				live.push(key);
+				if self.static_bundles.get(&key).map_or(false, |(recorded, _)| *recorded == stamp) {
+					continue;
+				}
+				let commands = match self.static_commands(&self.windows[ctx_index], v) {
+					Some(commands) => commands,
+					None => continue,
+				};
+				if let Some((_, old)) = self.static_bundles.remove(&key) {
+					self.hardware.destroy_render_bundle(old);
+				}
+				crate::log2!("Recording static bundle of {} draws for camera {:?}", commands.subpasses.len(), v.camview.camera_id);
+				let bundle = self.hardware.create_render_bundle(commands);
+				self.static_bundles.insert(key, (stamp, bundle));
+			}
+		}
+		let stale: Vec<_> = self.static_bundles.keys().filter(|key| !live.contains(key)).copied().collect();
+		for key in stale {
+			if let Some((_, bundle)) = self.static_bundles.remove(&key) {
+				self.hardware.destroy_render_bundle(bundle);
+			}
+		}
+	}
+
     pub fn render(&mut self, dt: f32) {
 		let fps = (1.0 / dt) as u32;
 		if (fps as i32 - self.fps as i32).abs() > 10 {
@@ -600,12 +1594,12 @@ where
 		if crate::debug_level() >= 3 {
 			let frame_start = Instant::now();
 			let timer = Instant::now();
-			self.process_materials();
-			let materials_time = timer.elapsed();
-			let timer = Instant::now();
 			self.process_textures();
 			let textures_time = timer.elapsed();
 			let timer = Instant::now();
+			self.process_materials();
+			let materials_time = timer.elapsed();
+			let timer = Instant::now();
 			self.process_nodes();
 			let nodes_time = timer.elapsed();
 			let timer = Instant::now();
@@ -642,8 +1636,8 @@ where
 				total_time
 			);
 		} else {
-			self.process_materials();
 			self.process_textures();
+			self.process_materials();
 			self.process_nodes();
 			self.process_meshes();
 			self.process_cameras();
@@ -652,6 +1646,9 @@ where
 			self.update_windows();
 			self.app.on_process(&mut self.state, dt);
 		}
+		for area in self.state.hovered.values_mut() {
+			area.clicked = false;
+		}
 		if let Some((window_id, path)) = self.state.screenshot_request.take() {
 			let ctx = match self.windows.iter().find(|w| w.window_id == window_id) {
 				Some(ctx) => ctx,
@@ -662,6 +1659,8 @@ where
 			};
 			self.hardware.save_screenshot(ctx.window, &path);
 		}
+		self.update_static_bundles();
+		let mut frames = Vec::new();
         for (window_id, _) in &self.state.windows {
 			let ctx = match self.windows.iter().find(|w| w.window_id == window_id) {
 				Some(ctx) => ctx,
@@ -671,6 +1670,17 @@ where
 				}
 			};
             let mut encoder = RenderEncoder::new();
+			// A camera shown in several views or windows is culled once.
+			let views: Vec<_> = self.get_window_render_args(window_id)
+				.map(|args| args.views.iter().map(|v| (v.camview.camera_id, v.scene_id)).collect())
+				.unwrap_or_default();
+			for (camera_id, scene_id) in views {
+				let cull = self.gpu_culls.get_mut(&camera_id);
+				let instance_buffer = self.scene_instance_buffers.get(&scene_id);
+				if let Some(dispatch) = cull.zip(instance_buffer).and_then(|(cull, buffer)| cull.dispatch(buffer.handle)) {
+					encoder.cull_instances(dispatch);
+				}
+			}
             let args = match self.get_window_render_args(window_id) {
                 Some(a) => a,
                 None => {
@@ -678,99 +1688,26 @@ where
                 }
             };
 
-            let pass = encoder.begin_render_pass();
-			pass.set_pipeline(ctx.pipeline);
-            for v in &args.views {
-                let camera_buffer = match self.camera_buffers.get(&v.camview.camera_id) {
-                    Some(b) => b,
-                    None => {
-                        panic!("Camera buffer not found");
-                    }
-                };
-
-                let calls = match self.get_camera_draw_calls(v.camview.camera_id) {
-                    Some(c) => c,
-                    None => {
-                        //panic!("Draw calls not found");
-						continue;
-                    }
-                };
-
-                let instance_buffer = match self.scene_instance_buffers.get(&v.scene_id) {
-                    Some(b) => b,
-                    None => {
-                        panic!("Instance buffer not found");
-                    }
-                };
-
-                let point_light_buffer = match self.point_light_buffers.get(&v.scene_id) {
-                    Some(b) => b,
-                    None => {
-						&self.default_point_lights
-					}
-                };
-                
-				pass.bind_buffer(0, camera_buffer.handle);
-                pass.bind_buffer(1, point_light_buffer.handle);
-
-                for call in calls {
-					let mut base_color_texture = self.default_texture;
-					let mut metallic_roughness_texture = self.default_texture;
-					let mut normal_texture = self.default_texture;
-					let mut occlusion_texture = self.default_texture;
-					let mut emissive_texture = self.default_texture;
-					let mut material = self.default_material;
-					
-					if let Some(material_id) = call.material {
-						if let Some(material_buffer) = self.state.materials.get(&material_id) {
-							if let Some(base_color_texture_id) = material_buffer.base_color_texture {
-								if let Some(t) = self.textures.get(&base_color_texture_id) {
-									base_color_texture = *t;
-								}
-							}
-							if let Some(metallic_roughness_texture_id) = material_buffer.metallic_roughness_texture {
-								if let Some(t) = self.textures.get(&metallic_roughness_texture_id) {
-									metallic_roughness_texture = *t;
-								}
-							}
-							if let Some(normal_texture_id) = material_buffer.normal_texture {
-								if let Some(t) = self.textures.get(&normal_texture_id) {
-									normal_texture = *t;
-								}
-							}
-							if let Some(occlusion_texture_id) = material_buffer.occlusion_texture {
-								if let Some(t) = self.textures.get(&occlusion_texture_id) {
-									occlusion_texture = *t;
-								}
-							}
-							if let Some(emissive_texture_id) = material_buffer.emissive_texture {
-								if let Some(t) = self.textures.get(&emissive_texture_id) {
-									emissive_texture = *t;
-								}
-							}
-						}
-
-						if let Some(m) = self.materials.get(&material_id) {
-							material = *m;
-						}
-					}
-
-					pass.bind_texture(2, base_color_texture);
-					pass.bind_texture(3, metallic_roughness_texture);
-					pass.bind_texture(4, normal_texture);
-					pass.bind_texture(5, occlusion_texture);
-					pass.bind_texture(6, emissive_texture);
-					pass.bind_buffer(7, material);
-                    pass.set_vertex_buffer(0, self.vertices_buffer.slice(call.vertices.clone()));
-                    pass.set_vertex_buffer(1, instance_buffer.full());
-                    pass.set_vertex_buffer(2, self.normal_buffer.slice(call.normals.clone()));
-                    pass.set_vertex_buffer(3, self.tex_coords_buffer.slice(call.tex_coords.clone()));
-                    pass.set_index_buffer(self.index_buffer.slice(call.indices.clone()));
-                    let indices = call.indices.clone();
-                    let instances = call.instances.clone();
-                    pass.draw_indexed(call.indices_range.clone(), instances.start as u32..instances.end as u32);
-                }
-            }
+			// Views of the same scene share a pass, every draw is set up once
+			// and then issued per view into the view's viewport.
+			let mut groups: Vec<(ArenaId<Scene>, Vec<ViewBinding>)> = Vec::new();
+			for v in &args.views {
+				if v.camview.w <= 0.0 || v.camview.h <= 0.0 {
+					continue;
+				}
+				let binding = match self.view_binding(v, true) {
+					Some(binding) => binding,
+					None => continue,
+				};
+				match groups.iter_mut().find(|(scene_id, _)| *scene_id == v.scene_id) {
+					Some((_, views)) => views.push(binding),
+					None => groups.push((v.scene_id, vec![binding])),
+				}
+			}
+			if groups.is_empty() {
+				encoder.begin_render_pass().set_pipeline(ctx.pipelines.pipeline);
+			}
+			self.push_scene_passes(&mut encoder, &ctx.pipelines, Some(window_id), &groups);
 
 			if let Some(gui_buffers) = self.gui_buffers.get(&args.ui) {
 				if gui_buffers.indices_range.start != gui_buffers.indices_range.end
@@ -793,7 +1730,185 @@ where
 					gui_pass.draw_indexed(gui_buffers.indices_range.clone(), 0..1);
 				}
 			}
-            self.hardware.render(encoder, ctx.window);
+			frames.push((ctx.window, encoder));
+		}
+		self.push_captures(&mut frames);
+		self.hardware.render_frame(frames);
+		self.state.captured_images.extend(self.hardware.take_captures());
+	}
+
+	/// Passes drawing the views of each scene group: a depth pre-pass when
+	/// enabled, then a pass where every draw is set up once and issued per
+	/// view into the view's viewport. Windows replay their static batches
+	/// from bundles, capture targets draw them like the rest.
+	fn push_scene_passes(&self, encoder: &mut RenderEncoder, pipelines: &TargetPipelines, window_id: Option<ArenaId<Window>>, groups: &[(ArenaId<Scene>, Vec<ViewBinding>)]) {
+		for (scene_id, views) in groups {
+			let instance_buffer = match self.scene_instance_buffers.get(scene_id) {
+				Some(b) => b,
+				None => continue,
+			};
+			if let Some(depth_pipeline) = pipelines.depth_pipeline {
+				let pass = encoder.begin_render_pass();
+				pass.set_pipeline(depth_pipeline);
+				for view in views {
+					let static_calls = self.static_draw_calls.get(scene_id).into_iter().flatten();
+					for call in static_calls.chain(self.camera_draw_calls.get(&view.camera_id).into_iter().flatten()) {
+						self.push_depth_draw(pass, view, instance_buffer, call);
+					}
+				}
+			}
+			let pass = encoder.begin_render_pass();
+			pass.set_pipeline(pipelines.pipeline);
+			match window_id {
+				Some(window_id) => {
+					for view in views {
+						if let Some((_, bundle)) = self.static_bundles.get(&(window_id, view.camera_id)) {
+							pass.set_viewport(view.viewport.unwrap_or([0.0, 0.0, 1.0, 1.0]));
+							if let Some(rect) = view.scissor {
+								pass.set_scissor(rect);
+							}
+							pass.execute_bundle(*bundle);
+						}
+					}
+				}
+				None => {
+					for call in self.static_draw_calls.get(scene_id).into_iter().flatten() {
+						self.push_draw(pass, pipelines, views, instance_buffer, call);
+					}
+				}
+			}
+			for call in self.scene_draw_calls.get(scene_id).into_iter().flatten() {
+				self.push_draw(pass, pipelines, views, instance_buffer, call);
+			}
+			for view in views {
+				for call in self.camera_draw_calls.get(&view.camera_id).into_iter().flatten() {
+					self.push_draw(pass, pipelines, std::slice::from_ref(view), instance_buffer, call);
+				}
+			}
+		}
+	}
+
+	/// Renders this frame's capture requests. Requests of the same size are
+	/// tiled into shared targets, so the draw lists of a scene are set up
+	/// once for all of its poses and each target is read back at once.
+	fn push_captures(&mut self, frames: &mut Vec<(WindowHandle, RenderEncoder)>) {
+		let requests = std::mem::take(&mut self.state.capture_requests);
+		let mut by_size: Vec<((u32, u32), Vec<(CaptureRequest, ArenaId<Scene>)>)> = Vec::new();
+		for request in requests {
+			if request.width == 0 || request.height == 0 {
+				log::warn!("Capture {} has no pixels, skipped", request.id);
+				continue;
+			}
+			let scene_id = self.state.cameras.get(&request.camera_id)
+				.and_then(|camera| camera.node_id)
+				.and_then(|node_id| self.state.nodes.get(&node_id))
+				.and_then(|node| node.scene_id);
+			let scene_id = match scene_id {
+				Some(scene_id) => scene_id,
+				None => {
+					log::warn!("Camera {:?} of capture {} is not in a scene, skipped", request.camera_id, request.id);
+					continue;
+				}
+			};
+			let size = (request.width, request.height);
+			match by_size.iter_mut().find(|(s, _)| *s == size) {
+				Some((_, requests)) => requests.push((request, scene_id)),
+				None => by_size.push((size, vec![(request, scene_id)])),
+			}
+		}
+
+		let mut used = Vec::new();
+		'sizes: for ((width, height), requests) in by_size {
+			let mut rest = &requests[..];
+			while !rest.is_empty() {
+				let (cols, rows) = capture_grid(rest.len(), width, height);
+				let (batch, next) = rest.split_at(rest.len().min((cols * rows) as usize));
+				rest = next;
+				let free = self.capture_targets.iter().position(|t| {
+					(t.tile_width, t.tile_height, t.cols, t.rows) == (width, height, cols, rows) && !used.contains(&t.target)
+				});
+				let index = match free {
+					Some(index) => index,
+					None => {
+						let target = match self.hardware.create_render_target(cols * width, rows * height) {
+							Some(target) => target,
+							None => {
+								log::error!("Offscreen captures are not supported by this backend");
+								break 'sizes;
+							}
+						};
+						crate::log2!("Creating {}x{} capture target of {}x{} tiles", cols, rows, width, height);
+						let pipelines = self.create_target_pipelines(target);
+						self.capture_targets.push(CaptureTarget {
+							target,
+							tile_width: width,
+							tile_height: height,
+							cols,
+							rows,
+							pipelines,
+						});
+						self.capture_targets.len() - 1
+					}
+				};
+				let target = &self.capture_targets[index];
+				used.push(target.target);
+
+				let mut encoder = RenderEncoder::new();
+				let mut groups: Vec<(ArenaId<Scene>, Vec<ViewBinding>)> = Vec::new();
+				let mut tiles = Vec::new();
+				for (i, (request, scene_id)) in batch.iter().enumerate() {
+					let (col, row) = (i as u32 % cols, i as u32 / cols);
+					let cull = self.gpu_culls.get_mut(&request.camera_id);
+					let instance_buffer = self.scene_instance_buffers.get(scene_id);
+					if let Some(dispatch) = cull.zip(instance_buffer).and_then(|(cull, buffer)| cull.dispatch(buffer.handle)) {
+						encoder.cull_instances(dispatch);
+					}
+					let rect = tile_viewport(col, row, cols, rows);
+					let view = View {
+						camview: CamView {
+							camera_id: request.camera_id,
+							x: rect[0],
+							y: rect[1],
+							w: rect[2],
+							h: rect[3],
+							clip: None,
+						},
+						scene_id: *scene_id,
+					};
+					let binding = match self.view_binding(&view, true) {
+						Some(binding) => binding,
+						None => continue,
+					};
+					match groups.iter_mut().find(|(id, _)| id == scene_id) {
+						Some((_, views)) => views.push(binding),
+						None => groups.push((*scene_id, vec![binding])),
+					}
+					tiles.push(CaptureTile {
+						id: request.id,
+						x: col * width,
+						y: row * height,
+						width,
+						height,
+					});
+				}
+				if groups.is_empty() {
+					continue;
+				}
+				self.push_scene_passes(&mut encoder, &target.pipelines, None, &groups);
+				self.hardware.capture_tiles(target.target, tiles);
+				frames.push((target.target, encoder));
+			}
+		}
+
+		// Targets are only reused by requests of the same size and count, so
+		// the ones this frame didn't need are freed instead of piling up.
+		let (kept, evicted): (Vec<_>, Vec<_>) = std::mem::take(&mut self.capture_targets)
+			.into_iter()
+			.partition(|target| used.contains(&target.target));
+		self.capture_targets = kept;
+		for target in evicted {
+			crate::log2!("Destroying {}x{} capture target of {}x{} tiles", target.cols, target.rows, target.tile_width, target.tile_height);
+			self.hardware.destroy_window(target.target);
 		}
 	}
 }
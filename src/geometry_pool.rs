@@ -0,0 +1,409 @@
+use std::collections::HashMap;
+use std::hash::Hash;
+use std::ops::Range;
+
+use crate::buffer::BufferSlice;
+use crate::hardware::BufferHandle;
+use crate::hardware::Hardware;
+
+/// Pages start this small and double until they reach the max size.
+const MIN_PAGE_BYTES: u64 = 1 << 20;
+/// Stays below the max_buffer_size requested by the wgpu backends.
+const MAX_PAGE_BYTES: u64 = 64 << 20;
+
+/// First fit allocator over `0..capacity`. Free ranges are kept sorted and
+/// merged with their neighbours when released.
+#[derive(Debug, Clone)]
+pub struct RangeAllocator {
+	capacity: u32,
+	free: Vec<Range<u32>>,
+}
+
+impl RangeAllocator {
+	pub fn new(capacity: u32) -> Self {
+		let mut allocator = Self {
+			capacity: 0,
+			free: Vec::new(),
+		};
+		allocator.grow(capacity);
+		allocator
+	}
+
+	pub fn capacity(&self) -> u32 {
+		self.capacity
+	}
+
+	pub fn alloc(&mut self, size: u32) -> Option<Range<u32>> {
+		if size == 0 {
+			return Some(0..0);
+		}
+		let i = self.free.iter().position(|r| r.end - r.start >= size)?;
+		let start = self.free[i].start;
+		self.free[i].start += size;
+		if self.free[i].start == self.free[i].end {
+			self.free.remove(i);
+		}
+		Some(start..start + size)
+	}
+
+	pub fn release(&mut self, range: Range<u32>) {
+		if range.start == range.end {
+			return;
+		}
+		let i = self.free.partition_point(|r| r.start < range.start);
+		self.free.insert(i, range);
+		if i + 1 < self.free.len() && self.free[i].end == self.free[i + 1].start {
+			self.free[i].end = self.free[i + 1].end;
+			self.free.remove(i + 1);
+		}
+		if i > 0 && self.free[i - 1].end == self.free[i].start {
+			self.free[i - 1].end = self.free[i].end;
+			self.free.remove(i);
+		}
+	}
+
+	pub fn grow(&mut self, capacity: u32) {
+		if capacity <= self.capacity {
+			return;
+		}
+		let old = self.capacity;
+		self.capacity = capacity;
+		self.release(old..capacity);
+	}
+}
+
+/// Geometry of one key inside a page. Index lists share the vertices and
+/// are addressed relative to `base_vertex`.
+#[derive(Debug, Clone)]
+pub struct GeometryAlloc {
+	pub page: usize,
+	pub base_vertex: i32,
+	/// First index and end of every index list in the page's index buffer.
+	pub index_lists: Vec<Range<u32>>,
+	/// Maps the stored positions back to model space.
+	pub dequantize: glam::Mat4,
+	vertices: Range<u32>,
+	indices: Range<u32>,
+	seen: u64,
+}
+
+#[derive(Debug, Clone)]
+struct Page {
+	vertices: BufferHandle,
+	indices: BufferHandle,
+	vertex_alloc: RangeAllocator,
+	index_alloc: RangeAllocator,
+}
+
+impl Page {
+	fn try_alloc(&mut self, vertex_count: u32, index_count: u32) -> Option<(Range<u32>, Range<u32>)> {
+		let vertices = self.vertex_alloc.alloc(vertex_count)?;
+		match self.index_alloc.alloc(index_count) {
+			Some(indices) => Some((vertices, indices)),
+			None => {
+				self.vertex_alloc.release(vertices);
+				None
+			}
+		}
+	}
+}
+
+fn page_capacity(current: u64, needed: u64) -> u64 {
+	let mut capacity = current.max(MIN_PAGE_BYTES);
+	while capacity < needed {
+		capacity *= 2;
+	}
+	capacity.min(MAX_PAGE_BYTES)
+}
+
+/// Mesh geometry suballocated from a few large vertex and index buffers.
+/// Geometry is uploaded once when inserted and drawn with a base vertex and
+/// first index, so draws sharing a page need no buffer rebinds. Geometry
+/// not used during a frame is released at the end of it.
+pub struct GeometryPool<K> {
+	stride: u32,
+	pages: Vec<Page>,
+	allocs: HashMap<K, GeometryAlloc>,
+	frame: u64,
+	buffer_generation: u64,
+}
+
+impl<K: Hash + Eq> GeometryPool<K> {
+	pub fn new(stride: u32) -> Self {
+		Self {
+			stride,
+			pages: Vec::new(),
+			allocs: HashMap::new(),
+			frame: 0,
+			buffer_generation: 0,
+		}
+	}
+
+	pub fn begin_frame(&mut self) {
+		self.frame += 1;
+	}
+
+	/// Returns the geometry of `key` and keeps it alive for this frame.
+	pub fn get(&mut self, key: &K) -> Option<&GeometryAlloc> {
+		let frame = self.frame;
+		let alloc = self.allocs.get_mut(key)?;
+		alloc.seen = frame;
+		Some(alloc)
+	}
+
+	pub fn insert(
+		&mut self,
+		hardware: &mut impl Hardware,
+		key: K,
+		vertices: &[u8],
+		index_lists: &[&[u16]],
+		dequantize: glam::Mat4,
+	) -> Option<&GeometryAlloc> {
+		if let Some(old) = self.allocs.remove(&key) {
+			self.release(&old);
+		}
+		let vertex_count = vertices.len() as u32 / self.stride;
+		let index_total: u32 = index_lists.iter().map(|l| l.len() as u32).sum();
+		// Index ranges stay even so every write is 4 byte aligned.
+		let index_count = (index_total + 1) & !1;
+
+		let (page, vertex_range, index_range) = match self.alloc(hardware, vertex_count, index_count) {
+			Some(a) => a,
+			None => {
+				log::error!("Geometry with {} vertices and {} indices does not fit a page", vertex_count, index_total);
+				return None;
+			}
+		};
+
+		let p = &self.pages[page];
+		let vertex_offset = vertex_range.start as u64 * self.stride as u64;
+		hardware.write_buffer_at(p.vertices, vertex_offset, vertices);
+
+		let mut lists = Vec::with_capacity(index_lists.len());
+		let mut data = Vec::with_capacity(index_count as usize);
+		for list in index_lists {
+			let first = index_range.start + data.len() as u32;
+			lists.push(first..first + list.len() as u32);
+			data.extend_from_slice(list);
+		}
+		if index_count > 0 {
+			data.resize(index_count as usize, 0);
+			hardware.write_buffer_at(p.indices, index_range.start as u64 * 2, bytemuck::cast_slice(&data));
+		}
+
+		let alloc = GeometryAlloc {
+			page,
+			base_vertex: vertex_range.start as i32,
+			index_lists: lists,
+			dequantize,
+			vertices: vertex_range,
+			indices: index_range,
+			seen: self.frame,
+		};
+		Some(self.allocs.entry(key).or_insert(alloc))
+	}
+
+	fn alloc(&mut self, hardware: &mut impl Hardware, vertex_count: u32, index_count: u32) -> Option<(usize, Range<u32>, Range<u32>)> {
+		for (i, page) in self.pages.iter_mut().enumerate() {
+			if let Some((vertices, indices)) = page.try_alloc(vertex_count, index_count) {
+				return Some((i, vertices, indices));
+			}
+		}
+
+		let stride = self.stride as u64;
+		let vertex_bytes = vertex_count as u64 * stride;
+		let index_bytes = index_count as u64 * 2;
+		if vertex_bytes > MAX_PAGE_BYTES || index_bytes > MAX_PAGE_BYTES {
+			return None;
+		}
+
+		// Grow the last page before starting a new one to keep the number of
+		// pages, and with it the rebinds, low.
+		if let Some(page) = self.pages.last_mut() {
+			let vertex_capacity = page.vertex_alloc.capacity() as u64 * stride;
+			let index_capacity = page.index_alloc.capacity() as u64 * 2;
+			let vertex_target = page_capacity(vertex_capacity, vertex_capacity + vertex_bytes);
+			let index_target = page_capacity(index_capacity, index_capacity + index_bytes);
+			if vertex_target > vertex_capacity || index_target > index_capacity {
+				grow_page(hardware, page, (vertex_target / stride) as u32, (index_target / 2) as u32, self.stride);
+				self.buffer_generation += 1;
+				let i = self.pages.len() - 1;
+				if let Some((vertices, indices)) = self.pages[i].try_alloc(vertex_count, index_count) {
+					return Some((i, vertices, indices));
+				}
+			}
+		}
+
+		let vertex_capacity = (page_capacity(0, vertex_bytes) / stride) as u32;
+		let index_capacity = (page_capacity(0, index_bytes) / 2) as u32;
+		let index = self.pages.len();
+		crate::log2!("Creating geometry page {} with {} vertices and {} indices", index, vertex_capacity, index_capacity);
+		let mut page = Page {
+			vertices: hardware.create_buffer(&format!("geometry_vertices_{}", index), vertex_capacity as u64 * stride),
+			indices: hardware.create_buffer(&format!("geometry_indices_{}", index), index_capacity as u64 * 2),
+			vertex_alloc: RangeAllocator::new(vertex_capacity),
+			index_alloc: RangeAllocator::new(index_capacity),
+		};
+		let (vertices, indices) = page.try_alloc(vertex_count, index_count)?;
+		self.pages.push(page);
+		Some((index, vertices, indices))
+	}
+
+	fn release(&mut self, alloc: &GeometryAlloc) {
+		if let Some(page) = self.pages.get_mut(alloc.page) {
+			page.vertex_alloc.release(alloc.vertices.clone());
+			page.index_alloc.release(alloc.indices.clone());
+		}
+	}
+
+	/// Releases geometry that was not used during the frame.
+	pub fn end_frame(&mut self) {
+		let frame = self.frame;
+		let mut released = Vec::new();
+		self.allocs.retain(|_, alloc| {
+			if alloc.seen == frame {
+				return true;
+			}
+			released.push(alloc.clone());
+			false
+		});
+		for alloc in &released {
+			self.release(alloc);
+		}
+	}
+
+	/// Bumped whenever a page moves into new buffers, commands recorded
+	/// with the old ones have to be recorded again.
+	pub fn buffer_generation(&self) -> u64 {
+		self.buffer_generation
+	}
+
+	pub fn page_count(&self) -> usize {
+		self.pages.len()
+	}
+
+	/// Vertex and index buffers of a page.
+	pub fn page(&self, page: usize) -> Option<(BufferSlice, BufferSlice)> {
+		let page = self.pages.get(page)?;
+		Some((
+			BufferSlice {
+				handle: page.vertices,
+				range: 0..page.vertices.size,
+			},
+			BufferSlice {
+				handle: page.indices,
+				range: 0..page.indices.size,
+			},
+		))
+	}
+}
+
+/// Moves a page into bigger buffers. The geometry is copied on the device
+/// so the pool keeps no copy of it in memory.
+fn grow_page(hardware: &mut impl Hardware, page: &mut Page, vertex_capacity: u32, index_capacity: u32, stride: u32) {
+	crate::log2!("Growing geometry page to {} vertices and {} indices", vertex_capacity, index_capacity);
+	if vertex_capacity > page.vertex_alloc.capacity() {
+		let old = page.vertices;
+		page.vertices = hardware.create_buffer("geometry_vertices", vertex_capacity as u64 * stride as u64);
+		hardware.copy_buffer(old, page.vertices, page.vertex_alloc.capacity() as u64 * stride as u64);
+		hardware.destroy_buffer(old);
+		page.vertex_alloc.grow(vertex_capacity);
+	}
+	if index_capacity > page.index_alloc.capacity() {
+		let old = page.indices;
+		page.indices = hardware.create_buffer("geometry_indices", index_capacity as u64 * 2);
+		hardware.copy_buffer(old, page.indices, page.index_alloc.capacity() as u64 * 2);
+		hardware.destroy_buffer(old);
+		page.index_alloc.grow(index_capacity);
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[derive(Default)]
+	struct RecordingHardware {
+		created: Vec<u64>,
+		writes: Vec<(u32, u64, usize)>,
+		copies: Vec<(u32, u32, u64)>,
+	}
+
+	impl Hardware for RecordingHardware {
+		fn create_buffer(&mut self, _name: &str, size: u64) -> BufferHandle {
+			self.created.push(size);
+			BufferHandle { id: self.created.len() as u32, size }
+		}
+
+		fn destroy_buffer(&mut self, _handle: BufferHandle) {}
+
+		fn write_buffer_at(&mut self, buffer: BufferHandle, offset: u64, data: &[u8]) {
+			self.writes.push((buffer.id, offset, data.len()));
+		}
+
+		fn copy_buffer(&mut self, src: BufferHandle, dst: BufferHandle, size: u64) {
+			self.copies.push((src.id, dst.id, size));
+		}
+	}
+
+	#[test]
+	fn test_range_allocator_merges_freed_ranges() {
+		let mut a = RangeAllocator::new(10);
+		let x = a.alloc(4).unwrap();
+		let y = a.alloc(4).unwrap();
+		assert_eq!(y, 4..8);
+		assert_eq!(a.alloc(4), None);
+		a.release(x);
+		a.release(y);
+		assert_eq!(a.alloc(10), Some(0..10));
+		a.grow(12);
+		assert_eq!(a.alloc(2), Some(10..12));
+	}
+
+	#[test]
+	fn test_geometry_is_uploaded_once_and_released_when_unused() {
+		let mut hardware = RecordingHardware::default();
+		let mut pool: GeometryPool<u32> = GeometryPool::new(4);
+		pool.begin_frame();
+		let a = pool.insert(&mut hardware, 1, &[0; 12], &[&[0, 1, 2], &[0, 2, 1]], glam::Mat4::IDENTITY).unwrap().clone();
+		let b = pool.insert(&mut hardware, 2, &[0; 8], &[&[0, 1]], glam::Mat4::IDENTITY).unwrap().clone();
+		assert_eq!(a.base_vertex, 0);
+		assert_eq!(a.index_lists, vec![0..3, 3..6]);
+		assert_eq!(b.base_vertex, 3);
+		assert_eq!(b.index_lists, vec![6..8]);
+		assert_eq!(b.page, a.page);
+		pool.end_frame();
+		let writes = hardware.writes.len();
+
+		pool.begin_frame();
+		assert!(pool.get(&2).is_some());
+		pool.end_frame();
+		assert_eq!(hardware.writes.len(), writes);
+		assert!(pool.get(&1).is_none());
+
+		pool.begin_frame();
+		let c = pool.insert(&mut hardware, 3, &[0; 12], &[&[0, 1, 2]], glam::Mat4::IDENTITY).unwrap();
+		assert_eq!(c.base_vertex, 0);
+		assert_eq!(pool.page_count(), 1);
+	}
+
+	#[test]
+	fn test_pages_grow_then_split() {
+		let mut hardware = RecordingHardware::default();
+		let mut pool: GeometryPool<u32> = GeometryPool::new(4);
+		let big = vec![0u8; (MAX_PAGE_BYTES / 2) as usize];
+		pool.begin_frame();
+		pool.insert(&mut hardware, 1, &big, &[], glam::Mat4::IDENTITY).unwrap();
+		let writes = hardware.writes.len();
+		pool.insert(&mut hardware, 2, &big, &[], glam::Mat4::IDENTITY).unwrap();
+		assert_eq!(pool.page_count(), 1);
+		// The grown page takes the old contents on the device, only the new
+		// geometry is written.
+		assert_eq!(hardware.copies, vec![(1, 3, MAX_PAGE_BYTES / 2)]);
+		assert_eq!(hardware.writes.len(), writes + 1);
+		let c = pool.insert(&mut hardware, 3, &big, &[], glam::Mat4::IDENTITY).unwrap();
+		assert_eq!(c.page, 1);
+		assert_eq!(pool.page_count(), 2);
+		assert!(pool.insert(&mut hardware, 4, &vec![0u8; MAX_PAGE_BYTES as usize + 4], &[], glam::Mat4::IDENTITY).is_none());
+	}
+}
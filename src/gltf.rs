@@ -13,6 +13,8 @@ use crate::AnimationOutput;
 use crate::ArenaId;
 use crate::Material;
 use crate::Mesh;
+use crate::mesh_optimizer::optimize_primitive;
+use crate::lod::generate_lods;
 use crate::Model3D;
 use crate::Node;
 use crate::NodeParent;
@@ -117,6 +119,8 @@ pub fn load_node(n: &gltf::Node, buffers: &[Data], state: &mut State, parser_sta
 					}
 				}
 
+				optimize_primitive(&mut primitive);
+				generate_lods(&mut primitive);
 				mesh.primitives.push(primitive);
 			}
 
@@ -0,0 +1,330 @@
+use std::ops::Range;
+
+use crate::buffer::BufferSlice;
+use crate::hardware::BufferHandle;
+use crate::hardware::CullDispatch;
+use crate::hardware::Hardware;
+use crate::internal_types::RawInstance;
+
+/// LODs the compute pass can pick from, besides the full mesh.
+pub const MAX_CULL_LODS: usize = 4;
+
+/// Run of consecutive instance slots the compute pass has to test and the
+/// draw they belong to. `first_item` is the invocation of the run's first
+/// instance, runs are sorted by it.
+#[repr(C)]
+#[derive(Debug, Copy, Clone, PartialEq, bytemuck::Pod, bytemuck::Zeroable)]
+pub struct RawCullRange {
+	pub first_instance: u32,
+	pub first_item: u32,
+	pub draw: u32,
+}
+
+/// Bounds, origin and axis scales of a draw's mesh in the space its
+/// instance transforms map from, the distances its LODs take over at and
+/// where its visible instances are written to. Each level has its own
+/// indirect arguments from `first_args` on and `instance_count` outputs
+/// from `first_output` on.
+#[repr(C)]
+#[derive(Debug, Copy, Clone, PartialEq, bytemuck::Pod, bytemuck::Zeroable)]
+pub struct RawCullDraw {
+	pub bounds_min: [f32; 3],
+	pub first_output: u32,
+	pub bounds_max: [f32; 3],
+	pub first_args: u32,
+	pub origin: [f32; 3],
+	pub lod_count: u32,
+	pub inv_scale: [f32; 3],
+	pub instance_count: u32,
+	pub lod_distances: [f32; MAX_CULL_LODS],
+}
+
+/// Same layout as the arguments of `draw_indexed_indirect`. The compute
+/// pass counts the visible instances into `instance_count`.
+#[repr(C)]
+#[derive(Debug, Copy, Clone, PartialEq, bytemuck::Pod, bytemuck::Zeroable)]
+pub struct RawDrawIndexedIndirect {
+	pub index_count: u32,
+	pub instance_count: u32,
+	pub first_index: u32,
+	pub base_vertex: i32,
+	pub first_instance: u32,
+}
+
+#[repr(C)]
+#[derive(Debug, Copy, Clone, bytemuck::Pod, bytemuck::Zeroable)]
+pub struct RawCullFrustum {
+	pub planes: [[f32; 4]; 6],
+	pub position: [f32; 3],
+	pub item_count: u32,
+	pub range_count: u32,
+	_padding: [u32; 3],
+}
+
+/// Mesh of a draw as the compute pass sees it. `levels` are the index
+/// ranges of the full mesh and its LODs, `lod_distances` the distances
+/// each LOD takes over at for an instance of scale 1, as given by
+/// `lod::lod_distances`. `bounds` are in the stored space of the vertices
+/// `dequantize` maps to model space.
+pub struct CullMesh<'a> {
+	pub levels: &'a [Range<u32>],
+	pub lod_distances: &'a [f32],
+	pub base_vertex: i32,
+	pub bounds: (glam::Vec3, glam::Vec3),
+	pub dequantize: glam::Mat4,
+}
+
+/// Per camera state of the compute culling pass. Draws are uploaded as the
+/// runs of stable slots their instances occupy, so the upload doesn't grow
+/// with the instance count of a mesh whose nodes sit next to each other.
+/// Every draw reserves room for all of its instances in the output buffer,
+/// the compute pass copies the visible ones to the front of that room and
+/// counts them into the draw's indirect arguments.
+#[derive(Debug)]
+pub struct GpuCull {
+	frustum: BufferHandle,
+	ranges: BufferHandle,
+	draws: BufferHandle,
+	args: BufferHandle,
+	output: BufferHandle,
+	frame_ranges: Vec<RawCullRange>,
+	frame_item_count: u32,
+	frame_output_count: u32,
+	frame_draws: Vec<RawCullDraw>,
+	frame_args: Vec<RawDrawIndexedIndirect>,
+	frame_outputs: Vec<Range<u32>>,
+	/// The compute pass counts into the indirect arguments without
+	/// resetting them, so it runs once per frame however many views or
+	/// windows show the camera.
+	dispatched: bool,
+}
+
+fn ensure_size(hardware: &mut impl Hardware, handle: &mut BufferHandle, name: &str, size: u64) {
+	if size <= handle.size {
+		return;
+	}
+	let new_size = (size as f32 * 1.5) as u64;
+	crate::log2!("resizing {} buffer {:?} from {} to {}", name, handle, handle.size, new_size);
+	hardware.destroy_buffer(*handle);
+	*handle = hardware.create_buffer(name, new_size);
+}
+
+impl GpuCull {
+	pub fn new(hardware: &mut impl Hardware) -> Self {
+		Self {
+			frustum: hardware.create_buffer("cull_frustum", std::mem::size_of::<RawCullFrustum>() as u64),
+			ranges: hardware.create_buffer("cull_ranges", 1024),
+			draws: hardware.create_buffer("cull_draws", 1024),
+			args: hardware.create_buffer("cull_args", 1024),
+			output: hardware.create_buffer("cull_output", 1024),
+			frame_ranges: Vec::new(),
+			frame_item_count: 0,
+			frame_output_count: 0,
+			frame_draws: Vec::new(),
+			frame_args: Vec::new(),
+			frame_outputs: Vec::new(),
+			dispatched: false,
+		}
+	}
+
+	pub fn begin_frame(&mut self) {
+		self.frame_ranges.clear();
+		self.frame_item_count = 0;
+		self.frame_output_count = 0;
+		self.frame_draws.clear();
+		self.frame_args.clear();
+		self.frame_outputs.clear();
+		self.dispatched = false;
+	}
+
+	/// Adds an indexed draw whose instances are the given slot runs of the
+	/// scene instance buffer. Returns the indices of the indirect arguments
+	/// of its levels, the first of `mesh.levels` first. Each instance is
+	/// counted into the level picked by its distance.
+	pub fn push_draw(&mut self, mesh: &CullMesh, runs: &[Range<u32>]) -> Range<u32> {
+		let draw = self.frame_draws.len() as u32;
+		let first_args = self.frame_args.len() as u32;
+		let first_item = self.frame_item_count;
+		for run in runs.iter().filter(|run| run.end > run.start) {
+			self.frame_ranges.push(RawCullRange {
+				first_instance: run.start,
+				first_item: self.frame_item_count,
+				draw,
+			});
+			self.frame_item_count += run.end - run.start;
+		}
+		let instance_count = self.frame_item_count - first_item;
+
+		let levels = &mesh.levels[..mesh.levels.len().min(MAX_CULL_LODS + 1)];
+		let lod_count = (levels.len() - 1).min(mesh.lod_distances.len());
+		let mut lod_distances = [0.0; MAX_CULL_LODS];
+		lod_distances[..lod_count].copy_from_slice(&mesh.lod_distances[..lod_count]);
+		let inv_scale = glam::Vec3::new(
+			mesh.dequantize.x_axis.truncate().length(),
+			mesh.dequantize.y_axis.truncate().length(),
+			mesh.dequantize.z_axis.truncate().length(),
+		).recip();
+		self.frame_draws.push(RawCullDraw {
+			bounds_min: mesh.bounds.0.to_array(),
+			first_output: self.frame_output_count,
+			bounds_max: mesh.bounds.1.to_array(),
+			first_args,
+			origin: mesh.dequantize.inverse().transform_point3(glam::Vec3::ZERO).to_array(),
+			lod_count: lod_count as u32,
+			inv_scale: inv_scale.to_array(),
+			instance_count,
+			lod_distances,
+		});
+		for indices in &levels[..lod_count + 1] {
+			let first_output = self.frame_output_count;
+			self.frame_output_count += instance_count;
+			self.frame_outputs.push(first_output..self.frame_output_count);
+			// The instance offset goes into the vertex buffer binding instead
+			// of `first_instance`, which needs INDIRECT_FIRST_INSTANCE to be
+			// honored.
+			self.frame_args.push(RawDrawIndexedIndirect {
+				index_count: indices.end - indices.start,
+				instance_count: 0,
+				first_index: indices.start,
+				base_vertex: mesh.base_vertex,
+				first_instance: 0,
+			});
+		}
+		first_args..self.frame_args.len() as u32
+	}
+
+	/// Output instances of the indirect arguments `draw`, to be bound as the
+	/// instance vertex buffer.
+	pub fn output_slice(&self, draw: u32) -> BufferSlice {
+		let stride = std::mem::size_of::<RawInstance>() as u64;
+		let range = self.frame_outputs.get(draw as usize).cloned().unwrap_or(0..0);
+		BufferSlice {
+			handle: self.output,
+			range: range.start as u64 * stride..range.end as u64 * stride,
+		}
+	}
+
+	pub fn args(&self) -> BufferHandle {
+		self.args
+	}
+
+	pub fn args_offset(draw: u32) -> u64 {
+		draw as u64 * std::mem::size_of::<RawDrawIndexedIndirect>() as u64
+	}
+
+	/// Uploads the frame's draws, the planes to test them against and the
+	/// camera position to pick their LODs by.
+	pub fn flush(&mut self, hardware: &mut impl Hardware, planes: [[f32; 4]; 6], position: glam::Vec3) {
+		if self.frame_ranges.is_empty() {
+			return;
+		}
+		let stride = std::mem::size_of::<RawInstance>() as u64;
+		ensure_size(hardware, &mut self.ranges, "cull_ranges", std::mem::size_of_val(self.frame_ranges.as_slice()) as u64);
+		ensure_size(hardware, &mut self.draws, "cull_draws", std::mem::size_of_val(self.frame_draws.as_slice()) as u64);
+		ensure_size(hardware, &mut self.args, "cull_args", std::mem::size_of_val(self.frame_args.as_slice()) as u64);
+		ensure_size(hardware, &mut self.output, "cull_output", self.frame_output_count as u64 * stride);
+
+		let frustum = RawCullFrustum {
+			planes,
+			position: position.to_array(),
+			item_count: self.frame_item_count,
+			range_count: self.frame_ranges.len() as u32,
+			_padding: [0; 3],
+		};
+		hardware.write_buffer(self.frustum, bytemuck::bytes_of(&frustum));
+		hardware.write_buffer(self.ranges, bytemuck::cast_slice(&self.frame_ranges));
+		hardware.write_buffer(self.draws, bytemuck::cast_slice(&self.frame_draws));
+		hardware.write_buffer(self.args, bytemuck::cast_slice(&self.frame_args));
+	}
+
+	/// Compute pass of the frame's draws, `None` once it has been taken.
+	pub fn dispatch(&mut self, instances: BufferHandle) -> Option<CullDispatch> {
+		if self.frame_ranges.is_empty() || self.dispatched {
+			return None;
+		}
+		self.dispatched = true;
+		Some(CullDispatch {
+			frustum: self.frustum,
+			instances,
+			ranges: self.ranges,
+			draws: self.draws,
+			args: self.args,
+			output: self.output,
+			item_count: self.frame_item_count,
+		})
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[derive(Default)]
+	struct RecordingHardware {
+		writes: Vec<(BufferHandle, Vec<u8>)>,
+		created: u32,
+	}
+
+	impl Hardware for RecordingHardware {
+		fn create_buffer(&mut self, _name: &str, size: u64) -> BufferHandle {
+			self.created += 1;
+			BufferHandle { id: self.created, size }
+		}
+
+		fn destroy_buffer(&mut self, _handle: BufferHandle) {}
+
+		fn write_buffer(&mut self, buffer: BufferHandle, data: &[u8]) {
+			self.writes.push((buffer, data.to_vec()));
+		}
+	}
+
+	#[test]
+	fn test_draws_get_disjoint_output_ranges() {
+		let mut hardware = RecordingHardware::default();
+		let mut cull = GpuCull::new(&mut hardware);
+		cull.begin_frame();
+		let mesh = |levels| CullMesh {
+			levels,
+			lod_distances: &[10.0, 20.0],
+			base_vertex: 100,
+			bounds: (glam::Vec3::splat(-1.0), glam::Vec3::splat(1.0)),
+			dequantize: glam::Mat4::IDENTITY,
+		};
+		let a = cull.push_draw(&mesh(&[0..36]), &[4..7]).start;
+		let b = cull.push_draw(&mesh(&[36..42, 42..45]), &[2..3, 9..10]).start;
+		assert_eq!((a, b), (0, 1));
+		assert_eq!(GpuCull::args_offset(b), 20);
+
+		let stride = std::mem::size_of::<RawInstance>() as u64;
+		assert_eq!(cull.output_slice(a).range, 0..3 * stride);
+		assert_eq!(cull.output_slice(b).range, 3 * stride..5 * stride);
+		assert_eq!(cull.output_slice(b + 1).range, 5 * stride..7 * stride);
+		assert_eq!(cull.frame_draws[0].lod_count, 0);
+		assert_eq!(cull.frame_draws[1].first_output, 3);
+		assert_eq!(cull.frame_draws[1].first_args, 1);
+		assert_eq!(cull.frame_draws[1].lod_count, 1);
+		assert_eq!(cull.frame_draws[1].lod_distances, [10.0, 0.0, 0.0, 0.0]);
+		assert_eq!(cull.frame_ranges, vec![
+			RawCullRange { first_instance: 4, first_item: 0, draw: 0 },
+			RawCullRange { first_instance: 2, first_item: 3, draw: 1 },
+			RawCullRange { first_instance: 9, first_item: 4, draw: 1 },
+		]);
+		assert_eq!(cull.frame_args[1], RawDrawIndexedIndirect {
+			index_count: 6,
+			instance_count: 0,
+			first_index: 36,
+			base_vertex: 100,
+			first_instance: 0,
+		});
+
+		cull.flush(&mut hardware, [[0.0; 4]; 6], glam::Vec3::ZERO);
+		let dispatch = cull.dispatch(BufferHandle { id: 99, size: 0 }).unwrap();
+		assert_eq!(dispatch.item_count, 5);
+		assert!(cull.dispatch(BufferHandle { id: 99, size: 0 }).is_none());
+		assert!(hardware.writes.iter().any(|(handle, data)| *handle == cull.args && data.len() == 60));
+
+		cull.begin_frame();
+		cull.flush(&mut hardware, [[0.0; 4]; 6], glam::Vec3::ZERO);
+		assert!(cull.dispatch(BufferHandle { id: 99, size: 0 }).is_none());
+	}
+}
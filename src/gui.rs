@@ -18,21 +18,35 @@ impl Color {
 	pub const DARK_GRAY: [f32; 3] = [0.25, 0.25, 0.25];
 }
 
+/// Mouse area under the pointer. Position is in normalized device coordinates.
+#[derive(Debug, Clone, PartialEq)]
 pub struct MouseArea {
-
+	pub id: u32,
+	pub x: f32,
+	pub y: f32,
+	/// Set when the left button was pressed over the area since the last
+	/// frame.
+	pub clicked: bool,
 }
 
 impl MouseArea {
-    pub fn on_clicked<F>(&self, mut f: F)
-    where
-        F: FnMut(),
-    {
-        f();
-    }
+	pub fn on_clicked<F>(&self, mut f: F)
+	where
+		F: FnMut(),
+	{
+		if self.clicked {
+			f();
+		}
+	}
 }
 
-pub fn mouse_area() -> MouseArea {
-	MouseArea {}
+/// Element which reports the pointer with the given id while it is inside
+/// its outline.
+pub fn mouse_area(id: u32) -> GUIElement {
+	GUIElement {
+		mouse_area: Some(id),
+		..Default::default()
+	}
 }
 
 #[derive(Clone, Debug, Default)]
@@ -130,6 +144,11 @@ pub struct GUIElement {
 	pub anchor_right: bool,
 	pub anchor_top: bool,
 	pub anchor_bottom: bool,
+	/// Size of every child along the flex direction. When set only the
+	/// children intersecting the visible region are laid out.
+	pub item_extent: Option<f32>,
+	pub scroll_offset: f32,
+	pub mouse_area: Option<u32>,
 }
 
 impl GUIElement {
@@ -206,6 +225,21 @@ impl GUIElement {
 		self.anchor_bottom = true;
 		self
 	}
+
+	pub fn virtualize(mut self, item_extent: f32) -> Self {
+		self.item_extent = Some(item_extent);
+		self
+	}
+
+	pub fn scroll(mut self, offset: f32) -> Self {
+		self.scroll_offset = offset;
+		self
+	}
+
+	pub fn mouse_area(mut self, id: u32) -> Self {
+		self.mouse_area = Some(id);
+		self
+	}
 }
 
 pub fn column(children: &[GUIElement]) -> GUIElement {
@@ -224,6 +258,26 @@ pub fn row(children: &[GUIElement]) -> GUIElement {
 	}
 }
 
+/// Column which only lays out the rows visible inside its outline.
+pub fn virtual_column(item_extent: f32, children: Vec<GUIElement>) -> GUIElement {
+	GUIElement {
+		flex_dir: Flex::Vertical,
+		children,
+		item_extent: Some(item_extent),
+		..Default::default()
+	}
+}
+
+/// Row which only lays out the columns visible inside its outline.
+pub fn virtual_row(item_extent: f32, children: Vec<GUIElement>) -> GUIElement {
+	GUIElement {
+		flex_dir: Flex::Horizontal,
+		children,
+		item_extent: Some(item_extent),
+		..Default::default()
+	}
+}
+
 pub fn stack(children: &[GUIElement]) -> GUIElement {
 	GUIElement {
 		children: children.to_vec(),
@@ -2,18 +2,54 @@ use std::ops::Range;
 use crate::buffer::Buffer;
 use crate::buffer::BufferSlice;
 use crate::ArenaId;
+use crate::CapturedImage;
 use crate::Window;
 
 pub trait Hardware {
     fn create_buffer(&mut self, name: &str, size: u64) -> BufferHandle { unimplemented!() }
 	fn destroy_buffer(&mut self, handle: BufferHandle) { unimplemented!() }
     fn create_texture(&mut self, name: &str, data: &[u8], width: u32, height: u32) -> TextureHandle { unimplemented!() }
+	/// Writes RGBA8 pixels to a rectangle of a texture.
+	fn write_texture(&mut self, texture: TextureHandle, x: u32, y: u32, width: u32, height: u32, data: &[u8]) { unimplemented!() }
+	/// Prebuilds the bind group of a set of material textures: base colour,
+	/// metallic-roughness, normal, occlusion and emissive. `material` is the
+	/// first `RawMaterial` of the shared material array; draws pick their
+	/// entry with the offset given to `bind_material`, so materials whose
+	/// textures sit in the same atlas pages share one bind group.
+	fn create_material(&mut self, textures: [TextureHandle; 5], material: BufferSlice) -> MaterialHandle { unimplemented!() }
+	fn destroy_material(&mut self, handle: MaterialHandle) { unimplemented!() }
     fn create_pipeline(&mut self, name: &str, window: WindowHandle) -> PipelineHandle { unimplemented!() }
+	/// Variant of a 3D pipeline that only samples the textures in `features`.
+	fn create_material_pipeline(&mut self, name: &str, window: WindowHandle, features: MaterialFeatures) -> PipelineHandle { unimplemented!() }
     fn render(&mut self, encoder: RenderEncoder, window: WindowHandle) { unimplemented!() }
+	/// Renders the encoders of all windows of a frame. Backends that can
+	/// encode them in parallel and submit them at once override this.
+	fn render_frame(&mut self, frames: Vec<(WindowHandle, RenderEncoder)>) {
+		for (window, encoder) in frames {
+			self.render(encoder, window);
+		}
+	}
     fn create_window(&mut self, window: &Window) -> WindowHandle { unimplemented!() }
+	/// Destroys a window or render target and the pipelines created for it.
     fn destroy_window(&mut self, handle: WindowHandle) { unimplemented!() }
 	fn write_buffer(&mut self, buffer: BufferHandle, data: &[u8]) { unimplemented!() }
+	/// Writes `data` at a byte offset leaving the rest of the buffer as is.
+	fn write_buffer_at(&mut self, buffer: BufferHandle, offset: u64, data: &[u8]) { unimplemented!() }
+	/// Copies the first `size` bytes of `src` to the start of `dst` on the
+	/// device, after the writes queued before it.
+	fn copy_buffer(&mut self, src: BufferHandle, dst: BufferHandle, size: u64) { unimplemented!() }
 	fn save_screenshot(&mut self, window: WindowHandle, path: &str) { unimplemented!() }
+	/// Offscreen color and depth target drawn into like a window. None when
+	/// the backend has no offscreen targets.
+	fn create_render_target(&mut self, width: u32, height: u32) -> Option<WindowHandle> { None }
+	/// Reads tiles of a target back into memory after its next render.
+	fn capture_tiles(&mut self, target: WindowHandle, tiles: Vec<CaptureTile>) {}
+	/// Captures that finished since the last call.
+	fn take_captures(&mut self) -> Vec<CapturedImage> { Vec::new() }
+	/// Records the draws of `commands` once so later passes can replay
+	/// them with `RenderPass::execute_bundle`.
+	fn create_render_bundle(&mut self, commands: RenderPass) -> BundleHandle { unimplemented!() }
+	fn destroy_render_bundle(&mut self, handle: BundleHandle) { unimplemented!() }
 }
 
 #[derive(Debug, Clone, Copy, PartialEq, Eq)]
@@ -21,11 +57,57 @@ pub struct WindowHandle {
     pub id: u32,
 }
 
-#[derive(Debug, Clone, Copy)]
+/// Pixel rect of a render target, from its top left corner, returned as
+/// the capture `id`.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct CaptureTile {
+	pub id: u64,
+	pub x: u32,
+	pub y: u32,
+	pub width: u32,
+	pub height: u32,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
 pub struct PipelineHandle {
     pub id: u32,
 }
 
+/// Textures a material samples. 3D pipelines are specialized per set so
+/// draws without a texture skip its fetch entirely.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, Default)]
+pub struct MaterialFeatures(pub u32);
+
+impl MaterialFeatures {
+	pub const NONE: Self = Self(0);
+	pub const BASE_COLOR_TEXTURE: Self = Self(1 << 0);
+	pub const METALLIC_ROUGHNESS_TEXTURE: Self = Self(1 << 1);
+	pub const NORMAL_TEXTURE: Self = Self(1 << 2);
+	pub const OCCLUSION_TEXTURE: Self = Self(1 << 3);
+	pub const EMISSIVE_TEXTURE: Self = Self(1 << 4);
+	pub const ALL: Self = Self(0b11111);
+
+	pub fn contains(self, other: Self) -> bool {
+		self.0 & other.0 == other.0
+	}
+
+	pub fn insert(&mut self, other: Self) {
+		self.0 |= other.0;
+	}
+
+	/// Values of the override constants in 3d_shader.wgsl.
+	pub fn shader_constants(self) -> [(&'static str, f64); 5] {
+		let flag = |feature| if self.contains(feature) { 1.0 } else { 0.0 };
+		[
+			("HAS_BASE_COLOR_TEXTURE", flag(Self::BASE_COLOR_TEXTURE)),
+			("HAS_METALLIC_ROUGHNESS_TEXTURE", flag(Self::METALLIC_ROUGHNESS_TEXTURE)),
+			("HAS_NORMAL_TEXTURE", flag(Self::NORMAL_TEXTURE)),
+			("HAS_OCCLUSION_TEXTURE", flag(Self::OCCLUSION_TEXTURE)),
+			("HAS_EMISSIVE_TEXTURE", flag(Self::EMISSIVE_TEXTURE)),
+		]
+	}
+}
+
 pub struct Surface {
 
 }
@@ -39,17 +121,39 @@ pub struct BufferHandle {
 #[derive(Debug)]
 pub struct Pipeline {}
 
+/// Compute pass that tests the `item_count` instances of the slot runs in
+/// `ranges` against the frustum and compacts the visible ones into
+/// `output`, counting them into the indirect draw arguments in `args`.
+/// Buffer layouts are defined in `gpu_cull`.
+#[derive(Debug, Clone)]
+pub struct CullDispatch {
+    pub frustum: BufferHandle,
+    pub instances: BufferHandle,
+    pub ranges: BufferHandle,
+    pub draws: BufferHandle,
+    pub args: BufferHandle,
+    pub output: BufferHandle,
+    pub item_count: u32,
+}
+
 pub struct RenderEncoder {
-    pub passes: Vec<RenderPass>
+    pub passes: Vec<RenderPass>,
+    /// Run before any of the render passes.
+    pub culls: Vec<CullDispatch>,
 }
 
 impl RenderEncoder {
     pub fn new() -> Self {
         Self {
             passes: Vec::new(),
+            culls: Vec::new(),
         }
     }
 
+    pub fn cull_instances(&mut self, dispatch: CullDispatch) {
+        self.culls.push(dispatch);
+    }
+
     pub fn begin_render_pass(&mut self) -> &mut RenderPass {
         let render_pass = RenderPass::default();
         self.passes.push(render_pass);
@@ -65,20 +169,40 @@ pub struct RenderPass {
     pub pipeline: Option<PipelineHandle>,
     pub buffers: Vec<(u32, BufferHandle)>,
     pub textures: Vec<(u32, TextureHandle)>,
+    pub materials: Vec<(u32, MaterialHandle, u32)>,
     pub indices: Option<Range<u32>>,
     pub instances: Option<Range<u32>>,
+    pub viewport: Option<[f32; 4]>,
+    pub scissor: Option<[f32; 4]>,
 }
 
+// Bindings replace the previous one in the same slot so the state cloned
+// into every subpass stays as small as the number of slots.
 impl RenderPass {
     pub fn bind_buffer(&mut self, slot: u32, handle: BufferHandle) {
+        self.unbind(slot);
         self.buffers.push((slot, handle));
     }
 
     pub fn bind_texture(&mut self, slot: u32, texture: TextureHandle) {
+        self.unbind(slot);
         self.textures.push((slot, texture));
     }
 
+    /// `offset` is the byte offset of the draw's entry in the material array.
+    pub fn bind_material(&mut self, slot: u32, material: MaterialHandle, offset: u32) {
+        self.unbind(slot);
+        self.materials.push((slot, material, offset));
+    }
+
+    fn unbind(&mut self, slot: u32) {
+        self.buffers.retain(|(s, _)| *s != slot);
+        self.textures.retain(|(s, _)| *s != slot);
+        self.materials.retain(|(s, _, _)| *s != slot);
+    }
+
     pub fn set_vertex_buffer(&mut self, slot: u32, buffer: BufferSlice) {
+        self.vertex_buffers.retain(|(s, _)| *s != slot);
         self.vertex_buffers.push((slot, buffer));
     }
 
@@ -86,17 +210,64 @@ impl RenderPass {
         self.index_buffer = Some(buffer);
     }
 
+    /// Limits the following draws, bundles included, to a rect of the
+    /// target given as x, y, width and height in 0..1 with y going up from
+    /// the bottom, like `CamView`. The scissor follows the viewport.
+    pub fn set_viewport(&mut self, rect: [f32; 4]) {
+        self.viewport = Some(rect);
+        self.scissor = None;
+    }
+
+    /// Narrows the scissor of the following draws to a rect given like the
+    /// viewport, for a view partly hidden by the GUI around it.
+    pub fn set_scissor(&mut self, rect: [f32; 4]) {
+        self.scissor = Some(rect);
+    }
+
     pub fn draw_indexed(&mut self, indices: Range<u32>, instances: Range<u32>) {
+        self.draw_indexed_base(indices, 0, instances);
+    }
+
+    /// Draws with `base_vertex` added to every index so meshes sharing one
+    /// vertex buffer can keep their own indices.
+    pub fn draw_indexed_base(&mut self, indices: Range<u32>, base_vertex: i32, instances: Range<u32>) {
         self.indices = Some(indices);
         self.instances = Some(instances);
+        self.push_subpass(base_vertex, None);
+    }
+
+    /// Draws with the arguments stored at `offset` in `args`, written on the
+    /// GPU by a cull dispatch.
+    pub fn draw_indexed_indirect(&mut self, args: BufferHandle, offset: u64) {
+        self.push_subpass(0, Some((args, offset)));
+    }
+
+    /// Replays a recorded bundle. Bindings and the pipeline don't carry over
+    /// into or out of it.
+    pub fn execute_bundle(&mut self, bundle: BundleHandle) {
+        self.subpasses.push(Subpass {
+            bundle: Some(bundle),
+            viewport: self.viewport,
+            scissor: self.scissor,
+            ..Default::default()
+        });
+    }
+
+    fn push_subpass(&mut self, base_vertex: i32, indirect: Option<(BufferHandle, u64)>) {
         let subpass = Subpass {
             vertex_buffers: self.vertex_buffers.clone(),
             index_buffer: self.index_buffer.clone(),
             pipeline: self.pipeline.clone(),
             buffers: self.buffers.clone(),
             indices: self.indices.clone(),
+            base_vertex,
             instances: self.instances.clone(),
 			textures: self.textures.clone(),
+            materials: self.materials.clone(),
+            indirect,
+            bundle: None,
+            viewport: self.viewport,
+            scissor: self.scissor,
         };
         self.subpasses.push(subpass);
     }
@@ -106,18 +277,64 @@ impl RenderPass {
     }
 }
 
-#[derive(Default, Debug)]
+#[derive(Default, Debug, Clone, PartialEq)]
 pub struct Subpass {
     pub vertex_buffers: Vec<(u32, BufferSlice)>,
     pub index_buffer: Option<BufferSlice>,
     pub pipeline: Option<PipelineHandle>,
     pub buffers: Vec<(u32, BufferHandle)>,
     pub indices: Option<Range<u32>>,
+    pub base_vertex: i32,
     pub instances: Option<Range<u32>>,
 	pub textures: Vec<(u32, TextureHandle)>,
+    pub materials: Vec<(u32, MaterialHandle, u32)>,
+    pub indirect: Option<(BufferHandle, u64)>,
+    pub bundle: Option<BundleHandle>,
+    pub viewport: Option<[f32; 4]>,
+    pub scissor: Option<[f32; 4]>,
+}
+
+/// Pixel rect of a viewport given in 0..1 with y going up, clamped to the
+/// target. None when nothing of it is left.
+pub fn viewport_pixels(rect: [f32; 4], width: u32, height: u32) -> Option<[u32; 4]> {
+	let to_pixels = |v: f32, size: u32| (v * size as f32).round().clamp(0.0, size as f32) as u32;
+	let x0 = to_pixels(rect[0], width);
+	let x1 = to_pixels(rect[0] + rect[2], width);
+	let y0 = to_pixels(1.0 - rect[1] - rect[3], height);
+	let y1 = to_pixels(1.0 - rect[1], height);
+	if x1 <= x0 || y1 <= y0 {
+		return None;
+	}
+	Some([x0, y0, x1 - x0, y1 - y0])
 }
 
-#[derive(Debug, Clone, Copy)]
+/// Pixel rect draws are cut to: the viewport, narrowed by the scissor.
+pub fn scissor_pixels(viewport: [u32; 4], scissor: Option<[f32; 4]>, width: u32, height: u32) -> Option<[u32; 4]> {
+	let [x, y, w, h] = match scissor {
+		Some(rect) => viewport_pixels(rect, width, height)?,
+		None => return Some(viewport),
+	};
+	let x0 = x.max(viewport[0]);
+	let y0 = y.max(viewport[1]);
+	let x1 = (x + w).min(viewport[0] + viewport[2]);
+	let y1 = (y + h).min(viewport[1] + viewport[3]);
+	if x1 <= x0 || y1 <= y0 {
+		return None;
+	}
+	Some([x0, y0, x1 - x0, y1 - y0])
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 pub struct TextureHandle {
     pub id: u32,
 }
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct MaterialHandle {
+    pub id: u32,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct BundleHandle {
+    pub id: u32,
+}
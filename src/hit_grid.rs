@@ -0,0 +1,304 @@
+use crate::gui::MouseArea;
+use std::collections::HashMap;
+
+/// Interactive rectangle produced by the lineariser. Later rects are drawn
+/// on top of earlier ones so the index in the list is the z order.
+#[derive(Debug, Clone, PartialEq)]
+pub struct HitRect {
+	pub id: u32,
+	pub min: [f32; 2],
+	pub max: [f32; 2],
+}
+
+impl HitRect {
+	fn contains(&self, x: f32, y: f32) -> bool {
+		x >= self.min[0] && x <= self.max[0] && y >= self.min[1] && y <= self.max[1]
+	}
+}
+
+/// Rects covering more cells than this are kept out of the grid and tested
+/// on every query instead, so a full-screen area costs one entry.
+const MAX_RECT_CELLS: usize = 16;
+
+#[derive(Debug, Clone)]
+struct HitEntry {
+	/// Id and how many rects with the same id came before it, which stays
+	/// the same when unrelated rects are added or removed around it.
+	key: (u32, u32),
+	rect: HitRect,
+	z: u32,
+	cells: Vec<usize>,
+	overflow: bool,
+	frame: u64,
+}
+
+/// Uniform grid over normalized device coordinates used to answer which
+/// mouse area is under the pointer. Cells hold entry indices keyed by a
+/// stable id rather than by z order, so a rect whose z shifts because
+/// something was inserted before it only updates its stored z.
+#[derive(Debug, Clone)]
+pub struct HitGrid {
+	resolution: usize,
+	entries: Vec<Option<HitEntry>>,
+	free: Vec<usize>,
+	index: HashMap<(u32, u32), usize>,
+	cells: Vec<Vec<u32>>,
+	overflow: Vec<u32>,
+	frame: u64,
+	len: usize,
+}
+
+impl HitGrid {
+	pub fn new(resolution: usize) -> Self {
+		let resolution = resolution.max(1);
+		Self {
+			resolution,
+			entries: Vec::new(),
+			free: Vec::new(),
+			index: HashMap::new(),
+			cells: vec![Vec::new(); resolution * resolution],
+			overflow: Vec::new(),
+			frame: 0,
+			len: 0,
+		}
+	}
+
+	pub fn len(&self) -> usize {
+		self.len
+	}
+
+	fn cell_coord(&self, v: f32) -> usize {
+		let c = ((v + 1.0) * 0.5 * self.resolution as f32).floor();
+		(c.max(0.0) as usize).min(self.resolution - 1)
+	}
+
+	fn cells_of(&self, rect: &HitRect) -> Vec<usize> {
+		let mut cells = Vec::new();
+		if rect.min[0] > 1.0 || rect.max[0] < -1.0 || rect.min[1] > 1.0 || rect.max[1] < -1.0 {
+			return cells;
+		}
+		let min_x = self.cell_coord(rect.min[0]);
+		let max_x = self.cell_coord(rect.max[0]);
+		let min_y = self.cell_coord(rect.min[1]);
+		let max_y = self.cell_coord(rect.max[1]);
+		for y in min_y..=max_y {
+			for x in min_x..=max_x {
+				cells.push(y * self.resolution + x);
+			}
+		}
+		cells
+	}
+
+	fn insert(&mut self, slot: usize) {
+		let mut cells = match &self.entries[slot] {
+			Some(entry) => self.cells_of(&entry.rect),
+			None => return,
+		};
+		let overflow = cells.len() > MAX_RECT_CELLS;
+		if overflow {
+			self.overflow.push(slot as u32);
+			cells.clear();
+		}
+		for &cell in &cells {
+			self.cells[cell].push(slot as u32);
+		}
+		if let Some(entry) = &mut self.entries[slot] {
+			entry.cells = cells;
+			entry.overflow = overflow;
+		}
+	}
+
+	fn remove(&mut self, slot: usize) {
+		let entry = match &mut self.entries[slot] {
+			Some(entry) => entry,
+			None => return,
+		};
+		let unlink = |list: &mut Vec<u32>| {
+			if let Some(pos) = list.iter().position(|&s| s == slot as u32) {
+				list.swap_remove(pos);
+			}
+		};
+		for &cell in &entry.cells {
+			unlink(&mut self.cells[cell]);
+		}
+		entry.cells.clear();
+		if entry.overflow {
+			unlink(&mut self.overflow);
+			entry.overflow = false;
+		}
+	}
+
+	/// Brings the grid in line with a new layout. Only rects that moved,
+	/// appeared or disappeared touch the grid; the rest just take their new
+	/// z, so an unchanged GUI costs a single pass over the list.
+	pub fn update(&mut self, rects: &[HitRect]) {
+		self.frame += 1;
+		let mut seen: HashMap<u32, u32> = HashMap::new();
+		for (z, rect) in rects.iter().enumerate() {
+			let count = seen.entry(rect.id).or_insert(0);
+			let key = (rect.id, *count);
+			*count += 1;
+
+			let slot = match self.index.get(&key) {
+				Some(&slot) => slot,
+				None => {
+					let entry = HitEntry {
+						key,
+						rect: rect.clone(),
+						z: z as u32,
+						cells: Vec::new(),
+						overflow: false,
+						frame: self.frame,
+					};
+					let slot = match self.free.pop() {
+						Some(slot) => {
+							self.entries[slot] = Some(entry);
+							slot
+						}
+						None => {
+							self.entries.push(Some(entry));
+							self.entries.len() - 1
+						}
+					};
+					self.index.insert(key, slot);
+					self.insert(slot);
+					continue;
+				}
+			};
+			let moved = match &mut self.entries[slot] {
+				Some(entry) => {
+					entry.z = z as u32;
+					entry.frame = self.frame;
+					entry.rect != *rect
+				}
+				None => continue,
+			};
+			if moved {
+				self.remove(slot);
+				if let Some(entry) = &mut self.entries[slot] {
+					entry.rect = rect.clone();
+				}
+				self.insert(slot);
+			}
+		}
+
+		for slot in 0..self.entries.len() {
+			let key = match &self.entries[slot] {
+				Some(entry) if entry.frame != self.frame => entry.key,
+				_ => continue,
+			};
+			self.remove(slot);
+			self.entries[slot] = None;
+			self.index.remove(&key);
+			self.free.push(slot);
+		}
+		self.len = rects.len();
+	}
+
+	/// Returns the topmost mouse area at the given position.
+	pub fn query(&self, x: f32, y: f32) -> Option<MouseArea> {
+		if x < -1.0 || x > 1.0 || y < -1.0 || y > 1.0 {
+			return None;
+		}
+		let cell = self.cell_coord(y) * self.resolution + self.cell_coord(x);
+		let mut top: Option<&HitEntry> = None;
+		for &slot in self.cells[cell].iter().chain(&self.overflow) {
+			let entry = match &self.entries[slot as usize] {
+				Some(entry) => entry,
+				None => continue,
+			};
+			if top.map_or(true, |top| entry.z > top.z) && entry.rect.contains(x, y) {
+				top = Some(entry);
+			}
+		}
+		top.map(|entry| MouseArea {
+			id: entry.rect.id,
+			x,
+			y,
+			clicked: false,
+		})
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	fn hit(id: u32, min: [f32; 2], max: [f32; 2]) -> HitRect {
+		HitRect { id, min, max }
+	}
+
+	#[test]
+	fn test_query_returns_topmost() {
+		let mut grid = HitGrid::new(8);
+		grid.update(&[
+			hit(1, [-1.0, -1.0], [1.0, 1.0]),
+			hit(2, [0.0, 0.0], [0.5, 0.5]),
+		]);
+		assert_eq!(grid.query(0.25, 0.25).map(|m| m.id), Some(2));
+		assert_eq!(grid.query(-0.5, -0.5).map(|m| m.id), Some(1));
+		assert_eq!(grid.query(2.0, 0.0), None);
+	}
+
+	#[test]
+	fn test_update_moves_changed_rects() {
+		let mut grid = HitGrid::new(8);
+		grid.update(&[
+			hit(1, [-1.0, -1.0], [-0.5, -0.5]),
+			hit(2, [0.5, 0.5], [1.0, 1.0]),
+		]);
+		grid.update(&[
+			hit(1, [-1.0, -1.0], [-0.5, -0.5]),
+			hit(2, [-0.25, -0.25], [0.25, 0.25]),
+		]);
+		assert_eq!(grid.query(0.75, 0.75), None);
+		assert_eq!(grid.query(0.0, 0.0).map(|m| m.id), Some(2));
+		grid.update(&[hit(1, [-1.0, -1.0], [-0.5, -0.5])]);
+		assert_eq!(grid.len(), 1);
+		assert_eq!(grid.query(0.0, 0.0), None);
+		assert_eq!(grid.query(-0.75, -0.75).map(|m| m.id), Some(1));
+	}
+
+	#[test]
+	fn test_insert_before_keeps_entries_binned() {
+		let mut grid = HitGrid::new(8);
+		grid.update(&[
+			hit(1, [-0.5, -0.5], [0.0, 0.0]),
+			hit(2, [-0.25, -0.25], [0.25, 0.25]),
+		]);
+		let binned = |grid: &HitGrid| grid.cells.iter().map(|c| c.len()).sum::<usize>();
+		let before = binned(&grid);
+		grid.update(&[
+			hit(3, [0.5, 0.5], [0.6, 0.6]),
+			hit(1, [-0.5, -0.5], [0.0, 0.0]),
+			hit(2, [-0.25, -0.25], [0.25, 0.25]),
+		]);
+		// Only the new rect was binned, the shifted ones kept their cells.
+		assert_eq!(binned(&grid), before + 1);
+		assert_eq!(grid.query(-0.1, -0.1).map(|m| m.id), Some(2));
+		grid.update(&[
+			hit(2, [-0.25, -0.25], [0.25, 0.25]),
+			hit(1, [-0.5, -0.5], [0.0, 0.0]),
+		]);
+		assert_eq!(grid.len(), 2);
+		assert_eq!(binned(&grid), before);
+		assert_eq!(grid.query(-0.1, -0.1).map(|m| m.id), Some(1));
+		assert_eq!(grid.query(0.55, 0.55), None);
+	}
+
+	#[test]
+	fn test_large_rects_overflow() {
+		let mut grid = HitGrid::new(32);
+		grid.update(&[
+			hit(1, [-1.0, -1.0], [1.0, 1.0]),
+			hit(2, [0.0, 0.0], [0.05, 0.05]),
+		]);
+		assert_eq!(grid.overflow.len(), 1);
+		assert!(grid.cells.iter().map(|c| c.len()).sum::<usize>() <= MAX_RECT_CELLS);
+		assert_eq!(grid.query(0.01, 0.01).map(|m| m.id), Some(2));
+		assert_eq!(grid.query(-0.9, 0.9).map(|m| m.id), Some(1));
+		grid.update(&[hit(2, [0.0, 0.0], [0.05, 0.05])]);
+		assert!(grid.overflow.is_empty());
+		assert_eq!(grid.query(-0.9, 0.9), None);
+	}
+}
@@ -0,0 +1,312 @@
+use std::collections::HashMap;
+use std::hash::Hash;
+use std::ops::Range;
+
+use crate::buffer::BufferSlice;
+use crate::hardware::BufferHandle;
+use crate::hardware::Hardware;
+use crate::internal_types::RawInstance;
+
+/// Slots are handed out in chunks so the buffer only ever grows at the end
+/// and a slot index never changes once assigned.
+const CHUNK_SLOTS: u32 = 256;
+/// Frames a moving instance has to stay still before it is moved back to
+/// the static region.
+const SETTLE_FRAMES: u64 = 120;
+/// Clean slots between two dirty ones that are uploaded anyway instead of
+/// splitting the write.
+const MERGE_GAP: u32 = 8;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum Region {
+	Static,
+	Dynamic,
+}
+
+#[derive(Debug, Clone)]
+struct Slot {
+	region: Region,
+	index: u32,
+	seen: u64,
+	changed: u64,
+}
+
+/// Instance buffer where every key owns a stable slot. Instances that do
+/// not move live in static chunks and moving ones in dynamic chunks so the
+/// slots written each frame end up next to each other. Only changed slots
+/// are uploaded, coalesced into ranges. Instances that are rebuilt every
+/// frame go to the transient region after the slots.
+#[derive(Debug, Clone)]
+pub struct InstanceBuffer<K> {
+	pub handle: BufferHandle,
+	slots: HashMap<K, Slot>,
+	instances: Vec<RawInstance>,
+	free: [Vec<u32>; 2],
+	dirty: Vec<u32>,
+	transient: Vec<RawInstance>,
+	frame: u64,
+	full_upload: bool,
+}
+
+impl<K: Hash + Eq + Copy> InstanceBuffer<K> {
+	pub fn new(handle: BufferHandle) -> Self {
+		Self {
+			handle,
+			slots: HashMap::new(),
+			instances: Vec::new(),
+			free: [Vec::new(), Vec::new()],
+			dirty: Vec::new(),
+			transient: Vec::new(),
+			frame: 0,
+			full_upload: true,
+		}
+	}
+
+	pub fn begin_frame(&mut self) {
+		self.frame += 1;
+		self.transient.clear();
+	}
+
+	fn alloc(&mut self, region: Region) -> u32 {
+		let free = &mut self.free[region as usize];
+		if let Some(index) = free.pop() {
+			return index;
+		}
+		let start = self.instances.len() as u32;
+		self.instances.resize(self.instances.len() + CHUNK_SLOTS as usize, RawInstance { rows: [[0.0; 4]; 3] });
+		free.extend((start + 1..start + CHUNK_SLOTS).rev());
+		start
+	}
+
+	fn release(&mut self, slot: &Slot) {
+		let free = &mut self.free[slot.region as usize];
+		free.push(slot.index);
+	}
+
+	/// Writes the instance of `key` and returns its slot. New keys start in
+	/// the static region, a key moves to the dynamic region the first time
+	/// its instance changes.
+	pub fn set(&mut self, key: K, instance: RawInstance) -> u32 {
+		let frame = self.frame;
+		let mut slot = match self.slots.get(&key) {
+			Some(slot) => slot.clone(),
+			None => {
+				let index = self.alloc(Region::Static);
+				self.instances[index as usize] = instance;
+				self.dirty.push(index);
+				self.slots.insert(key, Slot { region: Region::Static, index, seen: frame, changed: frame });
+				return index;
+			}
+		};
+		slot.seen = frame;
+
+		let unchanged = bytemuck::bytes_of(&self.instances[slot.index as usize]) == bytemuck::bytes_of(&instance);
+		let target = if !unchanged {
+			slot.changed = frame;
+			Region::Dynamic
+		} else if slot.region == Region::Dynamic && frame - slot.changed > SETTLE_FRAMES {
+			Region::Static
+		} else {
+			slot.region
+		};
+
+		if target != slot.region {
+			self.release(&slot);
+			slot.region = target;
+			slot.index = self.alloc(target);
+		} else if unchanged {
+			self.slots.insert(key, slot.clone());
+			return slot.index;
+		}
+		self.instances[slot.index as usize] = instance;
+		self.dirty.push(slot.index);
+		self.slots.insert(key, slot.clone());
+		slot.index
+	}
+
+	/// Whether the instance of `key` sits in the static region.
+	pub fn is_static(&self, key: &K) -> bool {
+		matches!(self.slots.get(key), Some(slot) if slot.region == Region::Static)
+	}
+
+	/// Slot of the first transient instance, it moves when slots are added.
+	pub fn transient_start(&self) -> u32 {
+		self.instances.len() as u32
+	}
+
+	/// Appends instances that only live for the current frame. The range is
+	/// final once all slots of the frame are set.
+	pub fn push_transient(&mut self, instances: &[RawInstance]) -> Range<u32> {
+		let base = self.transient_start();
+		let start = base + self.transient.len() as u32;
+		self.transient.extend_from_slice(instances);
+		start..base + self.transient.len() as u32
+	}
+
+	pub fn full(&self) -> BufferSlice {
+		BufferSlice {
+			handle: self.handle,
+			range: 0..self.handle.size,
+		}
+	}
+
+	/// Frees slots not set this frame and returns the slot ranges that have
+	/// to be uploaded.
+	fn collect_dirty(&mut self) -> Vec<Range<u32>> {
+		let frame = self.frame;
+		let mut released = Vec::new();
+		self.slots.retain(|_, slot| {
+			if slot.seen == frame {
+				return true;
+			}
+			released.push(slot.clone());
+			false
+		});
+		for slot in &released {
+			self.release(slot);
+		}
+
+		let mut dirty = std::mem::take(&mut self.dirty);
+		dirty.sort_unstable();
+		dirty.dedup();
+		let mut ranges: Vec<Range<u32>> = Vec::new();
+		for index in dirty {
+			match ranges.last_mut() {
+				Some(range) if index <= range.end + MERGE_GAP => range.end = index + 1,
+				_ => ranges.push(index..index + 1),
+			}
+		}
+		ranges
+	}
+
+	pub fn flush(&mut self, hardware: &mut impl Hardware) {
+		let stride = std::mem::size_of::<RawInstance>() as u64;
+		let mut ranges = self.collect_dirty();
+		let size = (self.instances.len() + self.transient.len()) as u64 * stride;
+		if size > self.handle.size {
+			let new_size = (size as f32 * 1.5) as u64;
+			crate::log2!("resizing instance buffer {:?} from {} to {}", self.handle, self.handle.size, new_size);
+			hardware.destroy_buffer(self.handle);
+			self.handle = hardware.create_buffer("instances", new_size);
+			self.full_upload = true;
+		}
+		if self.full_upload {
+			ranges = vec![0..self.instances.len() as u32];
+			self.full_upload = false;
+		}
+
+		for range in ranges {
+			if range.start == range.end {
+				continue;
+			}
+			let data = &self.instances[range.start as usize..range.end as usize];
+			hardware.write_buffer_at(self.handle, range.start as u64 * stride, bytemuck::cast_slice(data));
+		}
+		if self.transient.len() > 0 {
+			let offset = self.instances.len() as u64 * stride;
+			hardware.write_buffer_at(self.handle, offset, bytemuck::cast_slice(&self.transient));
+		}
+	}
+}
+
+/// Splits sorted slot indices into contiguous instance ranges.
+pub fn slot_runs(slots: &mut Vec<u32>) -> Vec<Range<u32>> {
+	slots.sort_unstable();
+	let mut runs: Vec<Range<u32>> = Vec::new();
+	for &slot in slots.iter() {
+		match runs.last_mut() {
+			Some(run) if run.end == slot => run.end = slot + 1,
+			_ => runs.push(slot..slot + 1),
+		}
+	}
+	runs
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[derive(Default)]
+	struct RecordingHardware {
+		writes: Vec<(u64, usize)>,
+		created: u32,
+	}
+
+	impl Hardware for RecordingHardware {
+		fn create_buffer(&mut self, _name: &str, size: u64) -> BufferHandle {
+			self.created += 1;
+			BufferHandle { id: self.created, size }
+		}
+
+		fn destroy_buffer(&mut self, _handle: BufferHandle) {}
+
+		fn write_buffer_at(&mut self, _buffer: BufferHandle, offset: u64, data: &[u8]) {
+			self.writes.push((offset, data.len()));
+		}
+	}
+
+	fn instance(x: f32) -> RawInstance {
+		RawInstance::new(&glam::Mat4::from_translation(glam::Vec3::new(x, 0.0, 0.0)))
+	}
+
+	#[test]
+	fn test_only_moved_slots_are_uploaded() {
+		let stride = std::mem::size_of::<RawInstance>() as u64;
+		let mut hardware = RecordingHardware::default();
+		let mut buffer = InstanceBuffer::new(hardware.create_buffer("instances", 1 << 20));
+
+		buffer.begin_frame();
+		let slots: Vec<u32> = (0..100).map(|i| buffer.set(i, instance(i as f32))).collect();
+		buffer.flush(&mut hardware);
+		assert_eq!(hardware.writes, vec![(0, CHUNK_SLOTS as usize * stride as usize)]);
+
+		hardware.writes.clear();
+		buffer.begin_frame();
+		for i in 0..100 {
+			assert_eq!(buffer.set(i, instance(i as f32)), slots[i as usize]);
+		}
+		buffer.flush(&mut hardware);
+		assert!(hardware.writes.is_empty());
+
+		buffer.begin_frame();
+		let mut moved = Vec::new();
+		for i in 0..100 {
+			let x = if i % 10 == 0 { i as f32 + 0.5 } else { i as f32 };
+			let slot = buffer.set(i, instance(x));
+			if i % 10 == 0 {
+				moved.push(slot);
+			} else {
+				assert_eq!(slot, slots[i as usize]);
+			}
+		}
+		buffer.flush(&mut hardware);
+		assert_eq!(slot_runs(&mut moved).len(), 1);
+		assert_eq!(hardware.writes, vec![(moved[0] as u64 * stride, 10 * stride as usize)]);
+	}
+
+	#[test]
+	fn test_removed_slots_are_reused() {
+		let mut hardware = RecordingHardware::default();
+		let mut buffer = InstanceBuffer::new(hardware.create_buffer("instances", 1 << 20));
+		buffer.begin_frame();
+		let a = buffer.set(1, instance(1.0));
+		buffer.set(2, instance(2.0));
+		buffer.flush(&mut hardware);
+
+		buffer.begin_frame();
+		buffer.set(2, instance(2.0));
+		buffer.flush(&mut hardware);
+
+		buffer.begin_frame();
+		buffer.set(2, instance(2.0));
+		assert_eq!(buffer.set(3, instance(3.0)), a);
+		let transient = buffer.push_transient(&[instance(4.0), instance(5.0)]);
+		assert_eq!(transient, CHUNK_SLOTS..CHUNK_SLOTS + 2);
+	}
+
+	#[test]
+	fn test_slot_runs() {
+		assert_eq!(slot_runs(&mut vec![4, 1, 2, 3, 8, 9]), vec![1..5, 8..10]);
+		assert!(slot_runs(&mut vec![]).is_empty());
+	}
+}
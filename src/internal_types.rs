@@ -25,7 +25,10 @@ pub struct CamView {
 	pub x: f32,
 	pub y: f32,
 	pub w: f32,
-	pub h: f32
+	pub h: f32,
+	/// Part of the view left visible by the GUI around it, in the same
+	/// units, None when all of it is.
+	pub clip: Option<[f32; 4]>,
 }
 
 #[repr(C)]
@@ -34,10 +37,21 @@ pub struct RawCamera {
     pub model: [[f32; 4]; 4],
 }
 
+/// Instance transform stored as the top three rows of the affine model
+/// matrix. The last row is always (0, 0, 0, 1) and is not uploaded.
 #[repr(C)]
 #[derive(Copy, Clone, bytemuck::Pod, bytemuck::Zeroable, Debug)]
 pub struct RawInstance {
-    pub model: [[f32; 4]; 4],
+    pub rows: [[f32; 4]; 3],
+}
+
+impl RawInstance {
+	pub fn new(model: &glam::Mat4) -> Self {
+		let t = model.transpose();
+		Self {
+			rows: [t.x_axis.to_array(), t.y_axis.to_array(), t.z_axis.to_array()],
+		}
+	}
 }
 
 #[repr(C)]
@@ -67,6 +81,9 @@ pub struct RawMaterial {
     pub occlusion_strength: f32,      // 4 bytes
     pub emissive_factor: [f32; 3],    // 12 bytes
     pub _padding: f32,                // 4 bytes to align to 16 bytes
+    /// Offset and scale of each texture's uvs inside its atlas page, in
+    /// base colour, metallic-roughness, normal, occlusion, emissive order.
+    pub uv_rects: [[f32; 4]; 5],      // 80 bytes
 }
 
 impl Default for RawMaterial {
@@ -79,6 +96,7 @@ impl Default for RawMaterial {
             occlusion_strength: 1.0,
             emissive_factor: [0.0, 0.0, 0.0],
             _padding: 0.0,
+            uv_rects: [[0.0, 0.0, 1.0, 1.0]; 5],
 		}
 	}
 }
\ No newline at end of file
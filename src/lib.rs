@@ -8,6 +8,19 @@ mod tests;
 mod compositor;
 pub mod physics;
 mod spatial_grid;
+mod hit_grid;
+mod mesh_optimizer;
+mod lod;
+mod light_clusters;
+mod atlas;
+mod draw_order;
+mod capture;
+mod vertex_format;
+mod instance_buffer;
+mod static_batch;
+mod geometry_pool;
+mod gpu_cull;
+mod occlusion;
 //mod engine_state;
 mod debug;
 //mod texture;
@@ -20,6 +33,7 @@ mod state;
 #[cfg(feature = "wgpu_winit")]
 mod wgpu;
 mod mock_hardware;
+mod software;
 mod collision_detection;
 pub mod utility;
 pub mod orbit;
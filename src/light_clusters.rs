@@ -0,0 +1,277 @@
+use glam::Mat4;
+use glam::Vec3;
+use glam::Vec4;
+
+/// Froxel grid of a camera: screen tiles times exponential depth slices.
+pub const CLUSTERS_X: u32 = 16;
+pub const CLUSTERS_Y: u32 = 9;
+pub const CLUSTERS_Z: u32 = 24;
+const CLUSTER_COUNT: usize = (CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z) as usize;
+/// Words of one light in the uploaded buffer.
+const LIGHT_WORDS: usize = 8;
+/// Words before the light data, mirrors `LightClusters` in the 3D shader.
+const HEADER_WORDS: usize = 8;
+
+/// Point light as seen by the clustering. A range of 0 means the light
+/// has no falloff and reaches every cluster, so it goes in the global
+/// list instead of being copied into each of them.
+#[derive(Debug, Clone, Copy)]
+pub struct ClusterLight {
+	pub color: [f32; 3],
+	pub intensity: f32,
+	pub position: Vec3,
+	pub range: f32,
+}
+
+/// Clusters of the lights of one camera, kept as the u32 words the 3D
+/// shader reads: a header with the grid size, depth range and global
+/// light count, the lights, an (offset, count) pair per cluster and the
+/// light indices. The indices start with the global lights every
+/// fragment loops over, the pairs point past them.
+#[derive(Debug, Clone, Default)]
+pub struct LightClusters {
+	pub words: Vec<u32>,
+	counts: Vec<u32>,
+	footprints: Vec<Option<[u32; 6]>>,
+}
+
+/// Depth slice of a view space depth. Slices grow exponentially so near
+/// clusters stay small.
+pub fn depth_slice(depth: f32, near: f32, far: f32) -> u32 {
+	if depth <= near {
+		return 0;
+	}
+	let slice = (depth / near).ln() / (far / near).ln() * CLUSTERS_Z as f32;
+	(slice as u32).min(CLUSTERS_Z - 1)
+}
+
+fn tile(ndc: f32, count: u32) -> u32 {
+	(((ndc * 0.5 + 0.5) * count as f32).max(0.0) as u32).min(count - 1)
+}
+
+/// Cluster bounds as min and max x, y and z, inclusive. None when the
+/// light can't light anything the camera sees. Only for ranged lights.
+fn footprint(view_projection: &Mat4, near: f32, far: f32, light: &ClusterLight) -> Option<[u32; 6]> {
+	let all = [0, CLUSTERS_X - 1, 0, CLUSTERS_Y - 1, 0, CLUSTERS_Z - 1];
+	// perspective_lh puts the view space depth in w.
+	let center = *view_projection * light.position.extend(1.0);
+	let z_min = center.w - light.range;
+	let z_max = center.w + light.range;
+	if z_max < near || z_min > far {
+		return None;
+	}
+	let slices = (depth_slice(z_min, near, far), depth_slice(z_max, near, far));
+
+	let mut ndc_min = glam::Vec2::splat(f32::MAX);
+	let mut ndc_max = glam::Vec2::splat(f32::MIN);
+	for i in 0..8 {
+		let corner = light.position + Vec3::new(
+			if i & 1 == 0 { -light.range } else { light.range },
+			if i & 2 == 0 { -light.range } else { light.range },
+			if i & 4 == 0 { -light.range } else { light.range },
+		);
+		let clip: Vec4 = *view_projection * corner.extend(1.0);
+		// The box reaches behind the camera, its projection is unbounded.
+		if clip.w <= near * 0.5 {
+			return Some([all[0], all[1], all[2], all[3], slices.0, slices.1]);
+		}
+		let ndc = clip.truncate().truncate() / clip.w;
+		ndc_min = ndc_min.min(ndc);
+		ndc_max = ndc_max.max(ndc);
+	}
+	if ndc_max.x < -1.0 || ndc_min.x > 1.0 || ndc_max.y < -1.0 || ndc_min.y > 1.0 {
+		return None;
+	}
+	Some([
+		tile(ndc_min.x, CLUSTERS_X),
+		tile(ndc_max.x, CLUSTERS_X),
+		tile(ndc_min.y, CLUSTERS_Y),
+		tile(ndc_max.y, CLUSTERS_Y),
+		slices.0,
+		slices.1,
+	])
+}
+
+fn cluster_index(x: u32, y: u32, z: u32) -> usize {
+	((z * CLUSTERS_Y + y) * CLUSTERS_X + x) as usize
+}
+
+impl LightClusters {
+	/// Assigns the lights to the clusters of a camera in two passes, counting
+	/// first so the index list is written without reallocating.
+	pub fn build(&mut self, view_projection: &Mat4, near: f32, far: f32, lights: &[ClusterLight]) {
+		let near = near.max(1e-4);
+		let far = far.max(near * 1.01);
+		self.footprints.clear();
+		self.footprints.extend(lights.iter().map(|light| match light.range > 0.0 {
+			true => footprint(view_projection, near, far, light),
+			false => None,
+		}));
+		let global = lights.iter().filter(|light| light.range <= 0.0).count() as u32;
+
+		self.counts.clear();
+		self.counts.resize(CLUSTER_COUNT, 0);
+		for fp in self.footprints.iter().flatten() {
+			for z in fp[4]..=fp[5] {
+				for y in fp[2]..=fp[3] {
+					for x in fp[0]..=fp[1] {
+						self.counts[cluster_index(x, y, z)] += 1;
+					}
+				}
+			}
+		}
+
+		let table_start = HEADER_WORDS + lights.len() * LIGHT_WORDS;
+		let indices_start = table_start + CLUSTER_COUNT * 2;
+		let total: u32 = global + self.counts.iter().sum::<u32>();
+		self.words.clear();
+		self.words.resize(indices_start + total as usize, 0);
+
+		let depth_scale = CLUSTERS_Z as f32 / (far / near).ln();
+		self.words[..HEADER_WORDS].copy_from_slice(&[
+			CLUSTERS_X,
+			CLUSTERS_Y,
+			CLUSTERS_Z,
+			lights.len() as u32,
+			near.to_bits(),
+			far.to_bits(),
+			depth_scale.to_bits(),
+			global,
+		]);
+		for (i, light) in lights.iter().enumerate() {
+			let start = HEADER_WORDS + i * LIGHT_WORDS;
+			self.words[start..start + LIGHT_WORDS].copy_from_slice(&[
+				light.color[0].to_bits(),
+				light.color[1].to_bits(),
+				light.color[2].to_bits(),
+				light.intensity.to_bits(),
+				light.position.x.to_bits(),
+				light.position.y.to_bits(),
+				light.position.z.to_bits(),
+				light.range.to_bits(),
+			]);
+		}
+
+		let mut slot = indices_start;
+		for (i, light) in lights.iter().enumerate() {
+			if light.range <= 0.0 {
+				self.words[slot] = i as u32;
+				slot += 1;
+			}
+		}
+
+		// Offsets are relative to the start of the index list.
+		let mut offset = global;
+		for (i, count) in self.counts.iter_mut().enumerate() {
+			self.words[table_start + i * 2] = offset;
+			self.words[table_start + i * 2 + 1] = 0;
+			offset += *count;
+			*count = 0;
+		}
+		for (light, fp) in self.footprints.iter().enumerate() {
+			let fp = match fp {
+				Some(fp) => fp,
+				None => continue,
+			};
+			for z in fp[4]..=fp[5] {
+				for y in fp[2]..=fp[3] {
+					for x in fp[0]..=fp[1] {
+						let cluster = cluster_index(x, y, z);
+						let entry = table_start + cluster * 2;
+						let slot = self.words[entry] + self.words[entry + 1];
+						self.words[indices_start + slot as usize] = light as u32;
+						self.words[entry + 1] += 1;
+					}
+				}
+			}
+		}
+	}
+
+	/// Indices of the lights that reach every cluster.
+	pub fn global(&self) -> &[u32] {
+		let light_count = self.words[3] as usize;
+		let indices_start = HEADER_WORDS + light_count * LIGHT_WORDS + CLUSTER_COUNT * 2;
+		&self.words[indices_start..indices_start + self.words[7] as usize]
+	}
+
+	/// Light indices of a cluster, without the global ones.
+	pub fn cluster(&self, x: u32, y: u32, z: u32) -> &[u32] {
+		let light_count = self.words[3] as usize;
+		let table_start = HEADER_WORDS + light_count * LIGHT_WORDS;
+		let indices_start = table_start + CLUSTER_COUNT * 2;
+		let entry = table_start + cluster_index(x, y, z) * 2;
+		let offset = indices_start + self.words[entry] as usize;
+		&self.words[offset..offset + self.words[entry + 1] as usize]
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	const NEAR: f32 = 0.1;
+	const FAR: f32 = 100.0;
+
+	fn camera() -> Mat4 {
+		// Camera at the origin looking down +z.
+		Mat4::perspective_lh(std::f32::consts::FRAC_PI_2, 16.0 / 9.0, NEAR, FAR)
+	}
+
+	fn light(position: Vec3, range: f32) -> ClusterLight {
+		ClusterLight {
+			color: [1.0; 3],
+			intensity: 1.0,
+			position,
+			range,
+		}
+	}
+
+	#[test]
+	fn test_depth_slices() {
+		assert_eq!(depth_slice(0.05, NEAR, FAR), 0);
+		assert_eq!(depth_slice(FAR * 2.0, NEAR, FAR), CLUSTERS_Z - 1);
+		let mut last = 0;
+		for i in 1..100 {
+			let slice = depth_slice(i as f32, NEAR, FAR);
+			assert!(slice >= last);
+			last = slice;
+		}
+	}
+
+	#[test]
+	fn test_lights_reach_only_their_clusters() {
+		let mut clusters = LightClusters::default();
+		let lights = [
+			light(Vec3::new(0.0, 0.0, 10.0), 0.5),
+			light(Vec3::new(0.0, 0.0, -10.0), 0.5),
+			light(Vec3::new(0.0, 0.0, 0.0), 0.0),
+		];
+		clusters.build(&camera(), NEAR, FAR, &lights);
+
+		let z = depth_slice(10.0, NEAR, FAR);
+		assert_eq!(clusters.global(), &[2]);
+		assert_eq!(clusters.cluster(CLUSTERS_X / 2, CLUSTERS_Y / 2, z), &[0]);
+		assert!(clusters.cluster(0, 0, z).is_empty());
+		assert!(clusters.cluster(CLUSTERS_X / 2, CLUSTERS_Y / 2, 0).is_empty());
+		assert!(clusters.cluster(CLUSTERS_X - 1, CLUSTERS_Y - 1, CLUSTERS_Z - 1).is_empty());
+	}
+
+	#[test]
+	fn test_unranged_lights_are_stored_once() {
+		let mut clusters = LightClusters::default();
+		let lights = vec![light(Vec3::new(0.0, 0.0, 10.0), 0.0); 1000];
+		clusters.build(&camera(), NEAR, FAR, &lights);
+		assert_eq!(clusters.words.len(), HEADER_WORDS + lights.len() * (LIGHT_WORDS + 1) + CLUSTER_COUNT * 2);
+		assert_eq!(clusters.global().len(), lights.len());
+		assert!(clusters.cluster(CLUSTERS_X / 2, CLUSTERS_Y / 2, depth_slice(10.0, NEAR, FAR)).is_empty());
+	}
+
+	#[test]
+	fn test_light_around_camera_covers_the_screen() {
+		let mut clusters = LightClusters::default();
+		clusters.build(&camera(), NEAR, FAR, &[light(Vec3::new(0.0, 0.0, 0.0), 2.0)]);
+		assert_eq!(clusters.cluster(0, 0, 0), &[0]);
+		assert_eq!(clusters.cluster(CLUSTERS_X - 1, CLUSTERS_Y - 1, depth_slice(1.5, NEAR, FAR)), &[0]);
+		assert!(clusters.cluster(0, 0, depth_slice(3.0, NEAR, FAR)).is_empty());
+	}
+}
@@ -0,0 +1,431 @@
+use std::collections::HashMap;
+
+use crate::Lod;
+use crate::Primitive;
+use crate::PrimitiveTopology;
+
+/// Fractions of the original triangle count generated as LODs.
+const LOD_RATIOS: [f32; 3] = [0.5, 0.25, 0.125];
+/// Primitives smaller than this are not worth simplifying.
+const MIN_LOD_INDICES: usize = 3 * 64;
+/// Screen height in pixels the LOD error threshold is specified against.
+const LOD_REFERENCE_HEIGHT: f32 = 1080.0;
+/// Largest acceptable projected simplification error in pixels.
+const LOD_PIXEL_ERROR: f32 = 1.0;
+
+#[derive(Debug, Clone, Copy, Default)]
+struct Quadric {
+	a: [f64; 10],
+}
+
+impl Quadric {
+	fn from_plane(n: [f64; 3], d: f64) -> Self {
+		let [a, b, c] = n;
+		Self {
+			a: [a * a, a * b, a * c, a * d, b * b, b * c, b * d, c * c, c * d, d * d],
+		}
+	}
+
+	fn add(&mut self, other: &Quadric) {
+		for i in 0..10 {
+			self.a[i] += other.a[i];
+		}
+	}
+
+	fn eval(&self, p: [f32; 3]) -> f64 {
+		let (x, y, z) = (p[0] as f64, p[1] as f64, p[2] as f64);
+		let q = &self.a;
+		q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x
+			+ q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y
+			+ q[7] * z * z + 2.0 * q[8] * z
+			+ q[9]
+	}
+}
+
+fn normal(a: [f32; 3], b: [f32; 3], c: [f32; 3]) -> glam::Vec3 {
+	let a = glam::Vec3::from_array(a);
+	(glam::Vec3::from_array(b) - a).cross(glam::Vec3::from_array(c) - a)
+}
+
+/// Generates simplified index lists for the primitive. All LODs index the
+/// primitive's own vertices, so only the index buffer differs between them.
+pub fn generate_lods(primitive: &mut Primitive) {
+	primitive.lods.clear();
+	if primitive.topology != PrimitiveTopology::TriangleList || primitive.indices.len() < MIN_LOD_INDICES {
+		return;
+	}
+	let mut prev_len = primitive.indices.len();
+	let mut prev_error = 0.0;
+	for ratio in LOD_RATIOS {
+		let target = ((primitive.indices.len() as f32 * ratio) as usize / 3) * 3;
+		let (indices, error) = simplify(primitive, target);
+		if indices.len() as f32 > prev_len as f32 * 0.9 || indices.len() == 0 {
+			break;
+		}
+		prev_len = indices.len();
+		prev_error = error.max(prev_error);
+		primitive.lods.push(Lod {
+			indices,
+			error: prev_error,
+		});
+	}
+	crate::log3!("Generated {} LODs for primitive with {} indices", primitive.lods.len(), primitive.indices.len());
+}
+
+/// Squared difference of the normals and texture coordinates of two
+/// vertices, 0 for attributes the primitive doesn't have.
+fn attribute_distance(primitive: &Primitive, a: u32, b: u32) -> f64 {
+	let (a, b) = (a as usize, b as usize);
+	let mut distance = 0.0;
+	if let (Some(na), Some(nb)) = (primitive.normals.get(a), primitive.normals.get(b)) {
+		distance += (0..3).map(|i| ((na[i] - nb[i]) as f64).powi(2)).sum::<f64>();
+	}
+	if let (Some(ta), Some(tb)) = (primitive.tex_coords.get(a), primitive.tex_coords.get(b)) {
+		distance += (0..2).map(|i| ((ta[i] - tb[i]) as f64).powi(2)).sum::<f64>();
+	}
+	distance
+}
+
+/// Quadric error edge collapse simplification towards `target` indices.
+/// Vertices sharing a position, like the corners of flat shaded faces or
+/// texture seams, are collapsed together, each onto the vertex of the
+/// target position with the closest attributes. Vertices only collapse
+/// onto other existing vertices and vertices on open borders never move,
+/// so the result can reuse the original vertex buffer without cracks.
+/// Returns the indices and the largest collapse error as a distance in
+/// model units.
+pub fn simplify(primitive: &Primitive, target: usize) -> (Vec<u16>, f32) {
+	let vertices = &primitive.vertices;
+	let n = vertices.len();
+	let mut tris: Vec<[u32; 3]> = primitive.indices
+		.chunks_exact(3)
+		.map(|t| [t[0] as u32, t[1] as u32, t[2] as u32])
+		.collect();
+
+	// Topology and quadrics are per position, the vertices at a position
+	// are its wedges.
+	let mut positions: HashMap<[u32; 3], u32> = HashMap::new();
+	let group: Vec<u32> = vertices
+		.iter()
+		.enumerate()
+		.map(|(i, v)| *positions.entry([v[0].to_bits(), v[1].to_bits(), v[2].to_bits()]).or_insert(i as u32))
+		.collect();
+	let mut wedges: Vec<Vec<u32>> = vec![Vec::new(); n];
+	for i in 0..n as u32 {
+		wedges[group[i as usize] as usize].push(i);
+	}
+	let degenerate = |t: &[u32; 3]| {
+		let g = t.map(|i| group[i as usize]);
+		g[0] == g[1] || g[1] == g[2] || g[0] == g[2]
+	};
+	tris.retain(|t| !degenerate(t));
+
+	let mut locked = vec![false; n];
+	let mut edges: HashMap<(u32, u32), u32> = HashMap::new();
+	for t in &tris {
+		for k in 0..3 {
+			let (a, b) = (group[t[k] as usize], group[t[(k + 1) % 3] as usize]);
+			*edges.entry((a.min(b), a.max(b))).or_insert(0) += 1;
+		}
+	}
+	for (&(a, b), &count) in &edges {
+		if count == 1 {
+			locked[a as usize] = true;
+			locked[b as usize] = true;
+		}
+	}
+
+	// Attribute differences are weighed against squared distances on the
+	// scale of the mesh.
+	let (min, max) = vertices.iter().fold(
+		(glam::Vec3::splat(f32::MAX), glam::Vec3::splat(f32::MIN)),
+		|(min, max), v| (min.min(glam::Vec3::from_array(*v)), max.max(glam::Vec3::from_array(*v))),
+	);
+	let attribute_weight = (max - min).length_squared().max(f32::EPSILON) as f64 * 0.01;
+
+	let mut quadrics = vec![Quadric::default(); n];
+	for t in &tris {
+		let nrm = normal(vertices[t[0] as usize], vertices[t[1] as usize], vertices[t[2] as usize]);
+		if nrm.length() == 0.0 {
+			continue;
+		}
+		let nrm = nrm / nrm.length();
+		let p = vertices[t[0] as usize];
+		let d = -(nrm.x as f64 * p[0] as f64 + nrm.y as f64 * p[1] as f64 + nrm.z as f64 * p[2] as f64);
+		let q = Quadric::from_plane([nrm.x as f64, nrm.y as f64, nrm.z as f64], d);
+		for &v in t {
+			quadrics[group[v as usize] as usize].add(&q);
+		}
+	}
+
+	// Wedge of position `v` each wedge of position `u` moves to, and the
+	// attribute error of doing so.
+	let matches = |u: u32, v: u32| -> (Vec<(u32, u32)>, f64) {
+		let mut error = 0.0;
+		let pairs = wedges[u as usize]
+			.iter()
+			.map(|&a| {
+				let (b, distance) = wedges[v as usize]
+					.iter()
+					.map(|&b| (b, attribute_distance(primitive, a, b)))
+					.fold((v, f64::MAX), |best, next| if next.1 < best.1 { next } else { best });
+				error += distance;
+				(a, b)
+			})
+			.collect();
+		(pairs, error)
+	};
+
+	let mut max_error: f64 = 0.0;
+	while tris.len() * 3 > target {
+		let mut offsets = vec![0usize; n + 1];
+		for t in &tris {
+			for &v in t {
+				offsets[group[v as usize] as usize + 1] += 1;
+			}
+		}
+		for i in 0..n {
+			offsets[i + 1] += offsets[i];
+		}
+		let mut fill = offsets.clone();
+		let mut adjacency = vec![0usize; tris.len() * 3];
+		for (ti, t) in tris.iter().enumerate() {
+			for &v in t {
+				let g = group[v as usize] as usize;
+				adjacency[fill[g]] = ti;
+				fill[g] += 1;
+			}
+		}
+
+		let mut candidates: Vec<(f64, f64, u32, u32)> = Vec::with_capacity(tris.len() * 6);
+		for t in &tris {
+			for k in 0..3 {
+				let (a, b) = (group[t[k] as usize], group[t[(k + 1) % 3] as usize]);
+				for (u, v) in [(a, b), (b, a)] {
+					if locked[u as usize] {
+						continue;
+					}
+					let mut q = quadrics[u as usize];
+					q.add(&quadrics[v as usize]);
+					let error = q.eval(vertices[v as usize]).max(0.0);
+					let (_, attributes) = matches(u, v);
+					candidates.push((error + attributes * attribute_weight, error, u, v));
+				}
+			}
+		}
+		candidates.sort_by(|a, b| a.0.partial_cmp(&b.0).unwrap_or(std::cmp::Ordering::Equal));
+
+		let mut remap: Vec<u32> = (0..n as u32).collect();
+		let mut touched = vec![false; n];
+		let mut removed = 0;
+		let needed = tris.len() - target / 3;
+		for (_, error, u, v) in candidates {
+			if removed >= needed {
+				break;
+			}
+			if touched[u as usize] || touched[v as usize] {
+				continue;
+			}
+			let around = &adjacency[offsets[u as usize]..offsets[u as usize + 1]];
+			let mut flips = false;
+			let mut collapsed = 0;
+			for &ti in around {
+				let t = tris[ti];
+				if t.iter().any(|&i| group[i as usize] == v) {
+					collapsed += 1;
+					continue;
+				}
+				let before = normal(vertices[t[0] as usize], vertices[t[1] as usize], vertices[t[2] as usize]);
+				let moved = t.map(|i| if group[i as usize] == u { vertices[v as usize] } else { vertices[i as usize] });
+				let after = normal(moved[0], moved[1], moved[2]);
+				if before.dot(after) <= 0.0 {
+					flips = true;
+					break;
+				}
+			}
+			if flips || collapsed == 0 {
+				continue;
+			}
+			for &ti in around {
+				for &w in &tris[ti] {
+					touched[group[w as usize] as usize] = true;
+				}
+			}
+			let q = quadrics[u as usize];
+			quadrics[v as usize].add(&q);
+			for (a, b) in matches(u, v).0 {
+				remap[a as usize] = b;
+			}
+			removed += collapsed;
+			max_error = max_error.max(error);
+		}
+		if removed == 0 {
+			break;
+		}
+		// Remapped wedges now sit at the position of `v`, their group is
+		// only read through the remapped indices.
+		tris = tris
+			.iter()
+			.map(|t| t.map(|i| remap[i as usize]))
+			.filter(|t| !degenerate(t))
+			.collect();
+	}
+
+	let indices = tris.iter().flat_map(|t| t.iter().map(|&i| i as u16)).collect();
+	(indices, max_error.sqrt() as f32)
+}
+
+/// Picks the coarsest LOD whose error projects to at most a pixel on a
+/// reference height screen. `scale` is the largest axis scale of the
+/// instance and `projection` is `1 / tan(fovy / 2)` of the camera. Returns
+/// 0 for the full resolution primitive and `i + 1` for `lods[i]`.
+pub fn select_lod(lods: &[Lod], distance: f32, scale: f32, projection: f32) -> usize {
+	let pixels_per_unit = projection * LOD_REFERENCE_HEIGHT * 0.5 / distance.max(f32::EPSILON);
+	for (i, lod) in lods.iter().enumerate().rev() {
+		if lod.error * scale * pixels_per_unit <= LOD_PIXEL_ERROR {
+			return i + 1;
+		}
+	}
+	0
+}
+
+/// Distances from which each LOD is picked by `select_lod` for an
+/// instance of scale 1, for the GPU culling pass to pick levels with.
+pub fn lod_distances(lods: &[Lod], projection: f32) -> Vec<f32> {
+	lods.iter()
+		.map(|lod| lod.error * projection * LOD_REFERENCE_HEIGHT * 0.5 / LOD_PIXEL_ERROR)
+		.collect()
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	fn sphere(rings: usize, segments: usize) -> Primitive {
+		let mut p = Primitive::new(PrimitiveTopology::TriangleList);
+		for r in 0..=rings {
+			let theta = std::f32::consts::PI * r as f32 / rings as f32;
+			for s in 0..segments {
+				let phi = 2.0 * std::f32::consts::PI * s as f32 / segments as f32;
+				p.vertices.push([theta.sin() * phi.cos(), theta.cos(), theta.sin() * phi.sin()]);
+			}
+		}
+		for r in 0..rings {
+			for s in 0..segments {
+				let a = (r * segments + s) as u16;
+				let b = (r * segments + (s + 1) % segments) as u16;
+				let c = a + segments as u16;
+				let d = b + segments as u16;
+				p.indices.extend_from_slice(&[a, c, b, b, c, d]);
+			}
+		}
+		p
+	}
+
+	#[test]
+	fn test_generate_lods_reduces_indices() {
+		let mut p = sphere(32, 32);
+		generate_lods(&mut p);
+		assert!(p.lods.len() >= 2);
+		let mut prev_len = p.indices.len();
+		let mut prev_error = 0.0;
+		for lod in &p.lods {
+			assert!(lod.indices.len() < prev_len);
+			assert!(lod.error >= prev_error);
+			assert!(lod.indices.iter().all(|&i| (i as usize) < p.vertices.len()));
+			prev_len = lod.indices.len();
+			prev_error = lod.error;
+		}
+	}
+
+	#[test]
+	fn test_flat_grid_simplifies_without_error() {
+		let n = 16;
+		let mut p = Primitive::new(PrimitiveTopology::TriangleList);
+		for y in 0..=n {
+			for x in 0..=n {
+				p.vertices.push([x as f32, y as f32, 0.0]);
+			}
+		}
+		for y in 0..n {
+			for x in 0..n {
+				let a = (y * (n + 1) + x) as u16;
+				let b = a + 1;
+				let c = a + (n + 1) as u16;
+				let d = c + 1;
+				p.indices.extend_from_slice(&[a, b, d, a, d, c]);
+			}
+		}
+		let (lod, error) = simplify(&p, p.indices.len() / 4);
+		assert!(lod.len() < p.indices.len() / 2);
+		assert_eq!(error, 0.0);
+	}
+
+	#[test]
+	fn test_flat_shaded_mesh_simplifies() {
+		// As loaded from STL, every triangle has its own vertices and normal.
+		let smooth = sphere(16, 16);
+		let mut p = Primitive::new(PrimitiveTopology::TriangleList);
+		for t in smooth.indices.chunks_exact(3) {
+			let corners = [t[0], t[1], t[2]].map(|i| smooth.vertices[i as usize]);
+			let n = normal(corners[0], corners[1], corners[2]).normalize_or_zero().to_array();
+			for corner in corners {
+				p.indices.push(p.vertices.len() as u16);
+				p.vertices.push(corner);
+				p.normals.push(n);
+			}
+		}
+		let (lod, _) = simplify(&p, p.indices.len() / 2);
+		assert!(lod.len() <= p.indices.len() * 3 / 4);
+		// No cracks open up between the faces, the only open edges are the
+		// ones around the tiny hole at the south pole.
+		let open_edges = |indices: &[u16]| {
+			let mut edges: HashMap<([u32; 3], [u32; 3]), u32> = HashMap::new();
+			let key = |i: u16| p.vertices[i as usize].map(f32::to_bits);
+			for t in indices.chunks_exact(3) {
+				if t.iter().map(|&i| key(i)).collect::<std::collections::HashSet<_>>().len() < 3 {
+					continue;
+				}
+				for k in 0..3 {
+					let (a, b) = (key(t[k]), key(t[(k + 1) % 3]));
+					*edges.entry((a.min(b), a.max(b))).or_insert(0) += 1;
+				}
+			}
+			let mut open: Vec<_> = edges.into_iter().filter(|(_, count)| *count != 2).map(|(edge, _)| edge).collect();
+			open.sort();
+			open
+		};
+		assert_eq!(open_edges(&lod), open_edges(&p.indices));
+
+		generate_lods(&mut p);
+		assert!(p.lods.len() >= 2);
+	}
+
+	#[test]
+	fn test_select_lod_by_distance() {
+		let lods = vec![
+			Lod { indices: vec![], error: 0.001 },
+			Lod { indices: vec![], error: 0.01 },
+		];
+		assert_eq!(select_lod(&lods, 0.5, 1.0, 1.0), 0);
+		assert_eq!(select_lod(&lods, 1.0, 1.0, 1.0), 1);
+		assert_eq!(select_lod(&lods, 100.0, 1.0, 1.0), 2);
+		assert_eq!(select_lod(&lods, 100.0, 100.0, 1.0), 1);
+		assert_eq!(select_lod(&[], 100.0, 1.0, 1.0), 0);
+	}
+
+	#[test]
+	fn test_lod_distances_match_select_lod() {
+		let lods = vec![
+			Lod { indices: vec![], error: 0.001 },
+			Lod { indices: vec![], error: 0.01 },
+		];
+		let distances = lod_distances(&lods, 2.0);
+		for distance in [0.1, 1.0, 1.5, 5.0, 20.0, 100.0] {
+			for scale in [0.5, 1.0, 3.0] {
+				let level = distances.iter().filter(|&&d| distance >= d * scale).count();
+				assert_eq!(level, select_lod(&lods, distance, scale, 2.0));
+			}
+		}
+	}
+}
@@ -76,7 +76,8 @@ impl log::Log for SimpleLogger {
                 Level::Trace => "TRACE".magenta(),
             };
             let thread_id = thread::current().id();
-            println!("[{}] [{:?}] - {}", level, thread_id, record.args());
+            // Stderr keeps stdout free for frame streams, see SCREENSHOT_STREAM.
+            eprintln!("[{}] [{:?}] - {}", level, thread_id, record.args());
         }
     }
 
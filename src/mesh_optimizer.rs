@@ -0,0 +1,372 @@
+use std::collections::HashMap;
+
+use crate::Primitive;
+use crate::PrimitiveTopology;
+
+const CACHE_SIZE: usize = 16;
+
+/// Optimizes a triangle list primitive for rendering. Vertices are welded by
+/// position, normal and uv, triangles are ordered for the post transform
+/// cache and then by clusters for overdraw, and finally vertices are
+/// renumbered in the order they are first referenced.
+pub fn optimize_primitive(primitive: &mut Primitive) {
+	if primitive.topology != PrimitiveTopology::TriangleList || primitive.indices.len() < 3 {
+		return;
+	}
+	let before = primitive.vertices.len();
+	weld_vertices(primitive);
+	let mut indices: Vec<u32> = primitive.indices.iter().map(|&i| i as u32).collect();
+	indices.truncate(indices.len() - indices.len() % 3);
+	remove_degenerate(&mut indices);
+	let (order, clusters) = tipsify(&indices, primitive.vertices.len(), CACHE_SIZE);
+	let order = sort_clusters_for_overdraw(&indices, &order, &clusters, &primitive.vertices);
+	let mut reordered = Vec::with_capacity(indices.len());
+	for t in order {
+		reordered.extend_from_slice(&indices[t * 3..t * 3 + 3]);
+	}
+	primitive.indices = reordered.iter().map(|&i| i as u16).collect();
+	reorder_vertices_for_fetch(primitive);
+	crate::log3!("Optimized primitive: {} -> {} vertices", before, primitive.vertices.len());
+}
+
+fn bits2(v: &[f32; 2]) -> [u32; 2] {
+	[(v[0] + 0.0).to_bits(), (v[1] + 0.0).to_bits()]
+}
+
+fn bits3(v: &[f32; 3]) -> [u32; 3] {
+	[(v[0] + 0.0).to_bits(), (v[1] + 0.0).to_bits(), (v[2] + 0.0).to_bits()]
+}
+
+/// Merges vertices whose attributes are bit identical. Attributes that are
+/// missing or do not match the vertex count are ignored.
+pub fn weld_vertices(primitive: &mut Primitive) {
+	let count = primitive.vertices.len();
+	let has_normals = primitive.normals.len() == count;
+	let has_tex_coords = primitive.tex_coords.len() == count;
+	let mut lookup: HashMap<([u32; 3], [u32; 3], [u32; 2]), u16> = HashMap::with_capacity(count);
+	let mut remap = Vec::with_capacity(count);
+	let mut vertices = Vec::new();
+	let mut normals = Vec::new();
+	let mut tex_coords = Vec::new();
+
+	for i in 0..count {
+		let normal = if has_normals { bits3(&primitive.normals[i]) } else { [0; 3] };
+		let tex_coord = if has_tex_coords { bits2(&primitive.tex_coords[i]) } else { [0; 2] };
+		let key = (bits3(&primitive.vertices[i]), normal, tex_coord);
+		let index = *lookup.entry(key).or_insert_with(|| {
+			vertices.push(primitive.vertices[i]);
+			if has_normals {
+				normals.push(primitive.normals[i]);
+			}
+			if has_tex_coords {
+				tex_coords.push(primitive.tex_coords[i]);
+			}
+			(vertices.len() - 1) as u16
+		});
+		remap.push(index);
+	}
+
+	if vertices.len() == count {
+		return;
+	}
+	for index in primitive.indices.iter_mut() {
+		*index = remap[*index as usize];
+	}
+	primitive.vertices = vertices;
+	if has_normals {
+		primitive.normals = normals;
+	}
+	if has_tex_coords {
+		primitive.tex_coords = tex_coords;
+	}
+}
+
+fn remove_degenerate(indices: &mut Vec<u32>) {
+	let mut out = 0;
+	for t in 0..indices.len() / 3 {
+		let (a, b, c) = (indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2]);
+		if a == b || b == c || a == c {
+			continue;
+		}
+		indices[out * 3] = a;
+		indices[out * 3 + 1] = b;
+		indices[out * 3 + 2] = c;
+		out += 1;
+	}
+	indices.truncate(out * 3);
+}
+
+/// Tipsify vertex cache ordering (Sander, Nehab and Barczak 2007). Returns
+/// the new triangle order and the start of each cluster, a cluster being
+/// broken whenever the fanning vertex had to be taken from the dead end
+/// stack or the input order.
+fn tipsify(indices: &[u32], vertex_count: usize, cache_size: usize) -> (Vec<usize>, Vec<usize>) {
+	let triangle_count = indices.len() / 3;
+	let mut live = vec![0u32; vertex_count];
+	for &i in indices {
+		live[i as usize] += 1;
+	}
+	let mut offsets = vec![0usize; vertex_count + 1];
+	for v in 0..vertex_count {
+		offsets[v + 1] = offsets[v] + live[v] as usize;
+	}
+	let mut fill = offsets.clone();
+	let mut adjacency = vec![0usize; indices.len()];
+	for (k, &i) in indices.iter().enumerate() {
+		adjacency[fill[i as usize]] = k / 3;
+		fill[i as usize] += 1;
+	}
+
+	let mut cache_time = vec![0usize; vertex_count];
+	let mut emitted = vec![false; triangle_count];
+	let mut dead_end: Vec<u32> = Vec::new();
+	let mut order = Vec::with_capacity(triangle_count);
+	let mut clusters = vec![0];
+	let mut time = cache_size + 1;
+	let mut cursor = 0;
+	let mut fanning = if vertex_count > 0 { Some(0usize) } else { None };
+
+	while let Some(f) = fanning {
+		let mut candidates: Vec<u32> = Vec::new();
+		for &t in &adjacency[offsets[f]..offsets[f + 1]] {
+			if emitted[t] {
+				continue;
+			}
+			emitted[t] = true;
+			order.push(t);
+			for &v in &indices[t * 3..t * 3 + 3] {
+				dead_end.push(v);
+				candidates.push(v);
+				live[v as usize] -= 1;
+				if time - cache_time[v as usize] > cache_size {
+					cache_time[v as usize] = time;
+					time += 1;
+				}
+			}
+		}
+
+		let mut best = None;
+		let mut best_priority = -1i64;
+		for &v in &candidates {
+			let v = v as usize;
+			if live[v] == 0 {
+				continue;
+			}
+			let age = time - cache_time[v];
+			let priority = if age + 2 * live[v] as usize <= cache_size { age as i64 } else { 0 };
+			if priority > best_priority {
+				best_priority = priority;
+				best = Some(v);
+			}
+		}
+
+		fanning = match best {
+			Some(v) => Some(v),
+			None => {
+				if order.len() > *clusters.last().unwrap() && order.len() < triangle_count {
+					clusters.push(order.len());
+				}
+				skip_dead_end(&mut dead_end, &live, &mut cursor)
+			}
+		};
+	}
+
+	(order, clusters)
+}
+
+fn skip_dead_end(dead_end: &mut Vec<u32>, live: &[u32], cursor: &mut usize) -> Option<usize> {
+	while let Some(v) = dead_end.pop() {
+		if live[v as usize] > 0 {
+			return Some(v as usize);
+		}
+	}
+	while *cursor < live.len() {
+		if live[*cursor] > 0 {
+			return Some(*cursor);
+		}
+		*cursor += 1;
+	}
+	None
+}
+
+/// Orders clusters so that those facing away from the mesh centre come
+/// first, which lets them occlude the inner ones for most view directions.
+fn sort_clusters_for_overdraw(indices: &[u32], order: &[usize], clusters: &[usize], vertices: &[[f32; 3]]) -> Vec<usize> {
+	let mut mesh_centroid = glam::Vec3::ZERO;
+	let mut mesh_area = 0.0;
+	let mut keys = Vec::with_capacity(clusters.len());
+	let mut cluster_data = Vec::with_capacity(clusters.len());
+
+	for (c, &start) in clusters.iter().enumerate() {
+		let end = clusters.get(c + 1).copied().unwrap_or(order.len());
+		let mut centroid = glam::Vec3::ZERO;
+		let mut normal = glam::Vec3::ZERO;
+		let mut area = 0.0;
+		for &t in &order[start..end] {
+			let a = glam::Vec3::from_array(vertices[indices[t * 3] as usize]);
+			let b = glam::Vec3::from_array(vertices[indices[t * 3 + 1] as usize]);
+			let c = glam::Vec3::from_array(vertices[indices[t * 3 + 2] as usize]);
+			let n = (b - a).cross(c - a);
+			let tri_area = n.length() * 0.5;
+			centroid += (a + b + c) / 3.0 * tri_area;
+			normal += n;
+			area += tri_area;
+		}
+		mesh_centroid += centroid;
+		mesh_area += area;
+		if area > 0.0 {
+			centroid /= area;
+		}
+		cluster_data.push((start..end, centroid, normal.normalize_or_zero()));
+	}
+	if mesh_area > 0.0 {
+		mesh_centroid /= mesh_area;
+	}
+
+	for (c, (_, centroid, normal)) in cluster_data.iter().enumerate() {
+		keys.push(((*centroid - mesh_centroid).dot(*normal), c));
+	}
+	keys.sort_by(|a, b| b.0.partial_cmp(&a.0).unwrap_or(std::cmp::Ordering::Equal));
+
+	let mut out = Vec::with_capacity(order.len());
+	for (_, c) in keys {
+		out.extend_from_slice(&order[cluster_data[c].0.clone()]);
+	}
+	out
+}
+
+/// Renumbers vertices in the order the index buffer first uses them and
+/// drops vertices which are not referenced.
+pub fn reorder_vertices_for_fetch(primitive: &mut Primitive) {
+	let count = primitive.vertices.len();
+	let has_normals = primitive.normals.len() == count;
+	let has_tex_coords = primitive.tex_coords.len() == count;
+	let mut remap = vec![u16::MAX; count];
+	let mut vertices = Vec::with_capacity(count);
+	let mut normals = Vec::new();
+	let mut tex_coords = Vec::new();
+
+	for index in primitive.indices.iter_mut() {
+		let old = *index as usize;
+		if remap[old] == u16::MAX {
+			remap[old] = vertices.len() as u16;
+			vertices.push(primitive.vertices[old]);
+			if has_normals {
+				normals.push(primitive.normals[old]);
+			}
+			if has_tex_coords {
+				tex_coords.push(primitive.tex_coords[old]);
+			}
+		}
+		*index = remap[old];
+	}
+
+	primitive.vertices = vertices;
+	if has_normals {
+		primitive.normals = normals;
+	}
+	if has_tex_coords {
+		primitive.tex_coords = tex_coords;
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	/// Average number of vertex shader invocations per triangle with a FIFO
+	/// cache of the given size.
+	fn acmr(indices: &[u16], cache_size: usize) -> f32 {
+		let mut cache: std::collections::VecDeque<u16> = std::collections::VecDeque::new();
+		let mut misses = 0;
+		for &i in indices {
+			if cache.contains(&i) {
+				continue;
+			}
+			misses += 1;
+			cache.push_back(i);
+			if cache.len() > cache_size {
+				cache.pop_front();
+			}
+		}
+		misses as f32 / (indices.len() / 3).max(1) as f32
+	}
+
+	fn grid(n: usize) -> Primitive {
+		let mut p = Primitive::new(PrimitiveTopology::TriangleList);
+		for y in 0..n {
+			for x in 0..n {
+				let quad = [[x, y], [x + 1, y], [x + 1, y + 1], [x, y], [x + 1, y + 1], [x, y + 1]];
+				for [qx, qy] in quad {
+					p.indices.push(p.vertices.len() as u16);
+					p.vertices.push([qx as f32, qy as f32, 0.0]);
+					p.normals.push([0.0, 0.0, 1.0]);
+				}
+			}
+		}
+		p
+	}
+
+	fn triangles(p: &Primitive) -> Vec<[[u32; 3]; 3]> {
+		let mut tris: Vec<[[u32; 3]; 3]> = p.indices.chunks(3).map(|t| {
+			let mut tri = [
+				bits3(&p.vertices[t[0] as usize]),
+				bits3(&p.vertices[t[1] as usize]),
+				bits3(&p.vertices[t[2] as usize]),
+			];
+			let min = (0..3).min_by_key(|&i| tri[i]).unwrap();
+			tri.rotate_left(min);
+			tri
+		}).collect();
+		tris.sort();
+		tris
+	}
+
+	#[test]
+	fn test_weld_merges_duplicates() {
+		let mut p = grid(1);
+		weld_vertices(&mut p);
+		assert_eq!(p.vertices.len(), 4);
+		assert_eq!(p.normals.len(), 4);
+		assert_eq!(p.indices, vec![0, 1, 2, 0, 2, 3]);
+	}
+
+	#[test]
+	fn test_weld_keeps_split_normals() {
+		let mut p = grid(1);
+		p.normals[3] = [0.0, 1.0, 0.0];
+		weld_vertices(&mut p);
+		assert_eq!(p.vertices.len(), 5);
+	}
+
+	#[test]
+	fn test_optimize_preserves_triangles() {
+		let mut p = grid(8);
+		let expected = triangles(&p);
+		optimize_primitive(&mut p);
+		assert_eq!(p.vertices.len(), 81);
+		assert_eq!(triangles(&p), expected);
+	}
+
+	#[test]
+	fn test_optimize_improves_cache_and_fetch_order() {
+		let mut p = grid(32);
+		weld_vertices(&mut p);
+		// Scatter the triangles so the input has poor locality.
+		let tris: Vec<[u16; 3]> = p.indices.chunks(3).map(|t| [t[0], t[1], t[2]]).collect();
+		p.indices = (0..tris.len()).map(|i| tris[(i * 977) % tris.len()]).flatten().collect();
+		let before = acmr(&p.indices, CACHE_SIZE);
+		optimize_primitive(&mut p);
+		let after = acmr(&p.indices, CACHE_SIZE);
+		assert!(after < before, "acmr {} -> {}", before, after);
+		assert!(after < 1.0);
+
+		let mut next = 0;
+		for &i in &p.indices {
+			assert!(i <= next);
+			if i == next {
+				next += 1;
+			}
+		}
+	}
+}
@@ -32,10 +32,26 @@ impl Hardware for MockHardware {
         TextureHandle { id: 0 }
     }
 
+    fn write_texture(&mut self, _texture: TextureHandle, _x: u32, _y: u32, _width: u32, _height: u32, _data: &[u8]) {
+        // No-op for mock
+    }
+
+    fn create_material(&mut self, _textures: [TextureHandle; 5], _material: crate::buffer::BufferSlice) -> MaterialHandle {
+        MaterialHandle { id: 0 }
+    }
+
+    fn destroy_material(&mut self, _handle: MaterialHandle) {
+        // No-op for mock
+    }
+
     fn create_pipeline(&mut self, _name: &str, _window: WindowHandle) -> PipelineHandle {
         PipelineHandle { id: 0 }
     }
 
+    fn create_material_pipeline(&mut self, _name: &str, _window: WindowHandle, _features: MaterialFeatures) -> PipelineHandle {
+        PipelineHandle { id: 0 }
+    }
+
     fn render(&mut self, _encoder: RenderEncoder, _window: WindowHandle) {
         // No-op for mock
     }
@@ -52,7 +68,23 @@ impl Hardware for MockHardware {
         // No-op for mock
     }
 
+    fn write_buffer_at(&mut self, _buffer: BufferHandle, _offset: u64, _data: &[u8]) {
+        // No-op for mock
+    }
+
+    fn copy_buffer(&mut self, _src: BufferHandle, _dst: BufferHandle, _size: u64) {
+        // No-op for mock
+    }
+
 	fn save_screenshot(&mut self, _window: WindowHandle, _path: &str) {
 		// No-op for mock
 	}
+
+	fn create_render_bundle(&mut self, _commands: RenderPass) -> BundleHandle {
+		BundleHandle { id: 0 }
+	}
+
+	fn destroy_render_bundle(&mut self, _handle: BundleHandle) {
+		// No-op for mock
+	}
 }
@@ -0,0 +1,380 @@
+use glam::Mat4;
+use glam::Vec3;
+use glam::Vec4;
+
+/// Resolution of the software depth buffer occluders are drawn into.
+pub const OCCLUSION_WIDTH: usize = 256;
+pub const OCCLUSION_HEIGHT: usize = 128;
+/// Below this many triangles splitting the buffer between threads costs
+/// more than it saves.
+const PARALLEL_TRIANGLES: usize = 512;
+
+/// View frustum planes in world space. Planes point inwards.
+#[derive(Debug, Clone, Copy)]
+pub struct Frustum {
+	planes: [Vec4; 6],
+}
+
+impl Frustum {
+	/// Extracts the planes of a left handed projection with 0..1 depth as
+	/// built by `Mat4::perspective_lh`.
+	pub fn from_view_projection(m: &Mat4) -> Self {
+		let r0 = m.row(0);
+		let r1 = m.row(1);
+		let r2 = m.row(2);
+		let r3 = m.row(3);
+		let mut planes = [r3 + r0, r3 - r0, r3 + r1, r3 - r1, r2, r3 - r2];
+		for p in &mut planes {
+			let len = p.truncate().length();
+			if len > 0.0 {
+				*p = *p / len;
+			}
+		}
+		Self { planes }
+	}
+
+	pub fn planes(&self) -> [[f32; 4]; 6] {
+		self.planes.map(|p| p.to_array())
+	}
+
+	pub fn intersects_aabb(&self, min: Vec3, max: Vec3) -> bool {
+		for p in &self.planes {
+			let corner = Vec3::new(
+				if p.x >= 0.0 { max.x } else { min.x },
+				if p.y >= 0.0 { max.y } else { min.y },
+				if p.z >= 0.0 { max.z } else { min.z },
+			);
+			if p.truncate().dot(corner) + p.w < 0.0 {
+				return false;
+			}
+		}
+		true
+	}
+}
+
+/// Bounds of a local box after transforming it.
+pub fn transform_aabb(m: &Mat4, min: Vec3, max: Vec3) -> (Vec3, Vec3) {
+	let center = m.transform_point3((min + max) * 0.5);
+	let half = (max - min) * 0.5;
+	let extent = Vec3::new(
+		m.x_axis.x.abs() * half.x + m.y_axis.x.abs() * half.y + m.z_axis.x.abs() * half.z,
+		m.x_axis.y.abs() * half.x + m.y_axis.y.abs() * half.y + m.z_axis.y.abs() * half.z,
+		m.x_axis.z.abs() * half.x + m.y_axis.z.abs() * half.y + m.z_axis.z.abs() * half.z,
+	);
+	(center - extent, center + extent)
+}
+
+#[derive(Debug, Clone)]
+struct Level {
+	width: usize,
+	height: usize,
+	depth: Vec<f32>,
+}
+
+/// Occluder triangle in screen space with depth in z.
+type ScreenTriangle = [Vec3; 3];
+
+/// Small software depth buffer with a max depth pyramid on top. Occluders
+/// are rasterized into level 0 and the bounds of instances are tested
+/// against the coarsest level that covers them with a few texels.
+#[derive(Debug, Clone)]
+pub struct OcclusionBuffer {
+	levels: Vec<Level>,
+	view_projection: Mat4,
+}
+
+impl OcclusionBuffer {
+	pub fn new(width: usize, height: usize) -> Self {
+		let width = (width.max(4) + 3) & !3;
+		let height = height.max(1);
+		let mut levels = Vec::new();
+		let (mut w, mut h) = (width, height);
+		loop {
+			levels.push(Level {
+				width: w,
+				height: h,
+				depth: vec![1.0; w * h],
+			});
+			if w == 1 && h == 1 {
+				break;
+			}
+			w = (w + 1) / 2;
+			h = (h + 1) / 2;
+		}
+		Self {
+			levels,
+			view_projection: Mat4::IDENTITY,
+		}
+	}
+
+	pub fn width(&self) -> usize {
+		self.levels[0].width
+	}
+
+	pub fn height(&self) -> usize {
+		self.levels[0].height
+	}
+
+	/// Clears the buffer, rasterizes the world space occluder triangles and
+	/// rebuilds the pyramid.
+	pub fn render(&mut self, view_projection: &Mat4, triangles: &[[Vec3; 3]]) {
+		let threads = if triangles.len() < PARALLEL_TRIANGLES {
+			1
+		} else {
+			std::thread::available_parallelism().map(|n| n.get()).unwrap_or(1).min(8)
+		};
+		self.render_with_threads(view_projection, triangles, threads);
+	}
+
+	fn render_with_threads(&mut self, view_projection: &Mat4, triangles: &[[Vec3; 3]], threads: usize) {
+		self.view_projection = *view_projection;
+		let width = self.width() as f32;
+		let height = self.height() as f32;
+
+		let mut screen: Vec<ScreenTriangle> = Vec::with_capacity(triangles.len());
+		for t in triangles {
+			let mut s = [Vec3::ZERO; 3];
+			let mut behind = false;
+			for (i, p) in t.iter().enumerate() {
+				let c = *view_projection * Vec4::new(p.x, p.y, p.z, 1.0);
+				// Clipping is skipped, triangles crossing the near plane simply
+				// don't occlude anything.
+				if c.w <= 1e-5 {
+					behind = true;
+					break;
+				}
+				let inv_w = 1.0 / c.w;
+				s[i] = Vec3::new(
+					(c.x * inv_w * 0.5 + 0.5) * width,
+					(0.5 - c.y * inv_w * 0.5) * height,
+					c.z * inv_w,
+				);
+			}
+			if !behind {
+				screen.push(s);
+			}
+		}
+
+		let level = &mut self.levels[0];
+		level.depth.fill(1.0);
+		let row_width = level.width;
+		if threads <= 1 {
+			rasterize_rows(&mut level.depth, row_width, 0, &screen);
+		} else {
+			let rows_per_band = (level.height + threads - 1) / threads;
+			let screen = &screen;
+			std::thread::scope(|scope| {
+				for (band, depth) in level.depth.chunks_mut(rows_per_band * row_width).enumerate() {
+					scope.spawn(move || rasterize_rows(depth, row_width, band * rows_per_band, screen));
+				}
+			});
+		}
+		self.build_pyramid();
+	}
+
+	fn build_pyramid(&mut self) {
+		for i in 1..self.levels.len() {
+			let (lower, upper) = self.levels.split_at_mut(i);
+			let src = &lower[i - 1];
+			let dst = &mut upper[0];
+			for y in 0..dst.height {
+				for x in 0..dst.width {
+					let x0 = (x * 2).min(src.width - 1);
+					let x1 = (x * 2 + 1).min(src.width - 1);
+					let y0 = (y * 2).min(src.height - 1);
+					let y1 = (y * 2 + 1).min(src.height - 1);
+					dst.depth[y * dst.width + x] = src.depth[y0 * src.width + x0]
+						.max(src.depth[y0 * src.width + x1])
+						.max(src.depth[y1 * src.width + x0])
+						.max(src.depth[y1 * src.width + x1]);
+				}
+			}
+		}
+	}
+
+	/// Farthest occluder depth stored for a texel of a pyramid level.
+	pub fn max_depth(&self, level: usize, x: usize, y: usize) -> f32 {
+		let level = &self.levels[level];
+		level.depth[y * level.width + x]
+	}
+
+	/// Tests a world space box against the occluders. Boxes reaching behind
+	/// the camera are always visible.
+	pub fn is_visible(&self, min: Vec3, max: Vec3) -> bool {
+		let width = self.width() as f32;
+		let height = self.height() as f32;
+		let mut screen_min = Vec3::splat(f32::MAX);
+		let mut screen_max = Vec3::splat(f32::MIN);
+		for i in 0..8 {
+			let p = Vec3::new(
+				if i & 1 == 0 { min.x } else { max.x },
+				if i & 2 == 0 { min.y } else { max.y },
+				if i & 4 == 0 { min.z } else { max.z },
+			);
+			let c = self.view_projection * Vec4::new(p.x, p.y, p.z, 1.0);
+			if c.w <= 1e-5 {
+				return true;
+			}
+			let inv_w = 1.0 / c.w;
+			let s = Vec3::new(
+				(c.x * inv_w * 0.5 + 0.5) * width,
+				(0.5 - c.y * inv_w * 0.5) * height,
+				c.z * inv_w,
+			);
+			screen_min = screen_min.min(s);
+			screen_max = screen_max.max(s);
+		}
+
+		let x0 = screen_min.x.max(0.0);
+		let y0 = screen_min.y.max(0.0);
+		let x1 = screen_max.x.min(width - 1.0);
+		let y1 = screen_max.y.min(height - 1.0);
+		if x0 > x1 || y0 > y1 {
+			return true;
+		}
+		let (mut x0, mut y0, mut x1, mut y1) = (x0 as usize, y0 as usize, x1 as usize, y1 as usize);
+		let mut level = 0;
+		while level + 1 < self.levels.len() && (x1 - x0 > 1 || y1 - y0 > 1) {
+			level += 1;
+			x0 /= 2;
+			y0 /= 2;
+			x1 /= 2;
+			y1 /= 2;
+		}
+		for y in y0..=y1 {
+			for x in x0..=x1 {
+				if screen_min.z <= self.max_depth(level, x, y) {
+					return true;
+				}
+			}
+		}
+		false
+	}
+}
+
+fn edge(a: Vec3, b: Vec3, x: f32, y: f32) -> f32 {
+	(b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x)
+}
+
+/// Rasterizes the triangles into the rows `first_row..` held by `depth`,
+/// four pixels at a time. Keeps the nearest depth per pixel center.
+fn rasterize_rows(depth: &mut [f32], width: usize, first_row: usize, triangles: &[ScreenTriangle]) {
+	let rows = depth.len() / width;
+	let lanes = Vec4::new(0.0, 1.0, 2.0, 3.0);
+	for t in triangles {
+		let (a, mut b, mut c) = (t[0], t[1], t[2]);
+		let mut area = edge(a, b, c.x, c.y);
+		if area < 0.0 {
+			std::mem::swap(&mut b, &mut c);
+			area = -area;
+		}
+		if area < 1e-8 {
+			continue;
+		}
+		let min_x = a.x.min(b.x).min(c.x).max(0.0) as usize;
+		let max_x = (a.x.max(b.x).max(c.x).ceil().max(0.0) as usize).min(width - 1);
+		let min_y = (a.y.min(b.y).min(c.y).max(0.0) as usize).max(first_row);
+		let max_y = (a.y.max(b.y).max(c.y).ceil().max(0.0) as usize).min(first_row + rows - 1);
+		if min_x > max_x || min_y > max_y {
+			continue;
+		}
+		let start_x = min_x & !3;
+		let inv_area = 1.0 / area;
+
+		// Edge functions weight the vertex opposite to them.
+		let edges = [(b, c, a.z), (c, a, b.z), (a, b, c.z)];
+		for y in min_y..=max_y {
+			let py = y as f32 + 0.5;
+			let row = &mut depth[(y - first_row) * width..(y - first_row + 1) * width];
+			let mut x = start_x;
+			while x <= max_x {
+				let px = lanes + Vec4::splat(x as f32 + 0.5);
+				let mut z = Vec4::ZERO;
+				let mut inside = Vec4::ZERO.cmple(Vec4::ZERO);
+				for (e0, e1, vz) in &edges {
+					let w = Vec4::splat(e1.x - e0.x) * Vec4::splat(py - e0.y) - Vec4::splat(e1.y - e0.y) * (px - Vec4::splat(e0.x));
+					inside = inside & w.cmpge(Vec4::ZERO);
+					z = z + w * Vec4::splat(vz * inv_area);
+				}
+				let old = Vec4::from_slice(&row[x..x + 4]);
+				Vec4::select(inside, z.min(old), old).write_to_slice(&mut row[x..x + 4]);
+				x += 4;
+			}
+		}
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	fn camera() -> Mat4 {
+		// Camera at the origin looking down +z.
+		Mat4::perspective_lh(std::f32::consts::FRAC_PI_2, 2.0, 0.1, 100.0)
+	}
+
+	fn wall(z: f32, half: f32) -> Vec<[Vec3; 3]> {
+		let p = |x: f32, y: f32| Vec3::new(x, y, z);
+		vec![
+			[p(-half, -half), p(half, -half), p(half, half)],
+			[p(-half, -half), p(half, half), p(-half, half)],
+		]
+	}
+
+	#[test]
+	fn test_frustum_culls_boxes_outside() {
+		let frustum = Frustum::from_view_projection(&camera());
+		assert!(frustum.intersects_aabb(Vec3::new(-1.0, -1.0, 5.0), Vec3::new(1.0, 1.0, 6.0)));
+		assert!(!frustum.intersects_aabb(Vec3::new(-1.0, -1.0, -6.0), Vec3::new(1.0, 1.0, -5.0)));
+		assert!(!frustum.intersects_aabb(Vec3::new(-1.0, -1.0, 200.0), Vec3::new(1.0, 1.0, 201.0)));
+		assert!(!frustum.intersects_aabb(Vec3::new(50.0, -1.0, 5.0), Vec3::new(51.0, 1.0, 6.0)));
+	}
+
+	#[test]
+	fn test_wall_hides_boxes_behind_it() {
+		let mut buffer = OcclusionBuffer::new(OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+		buffer.render(&camera(), &wall(5.0, 2.0));
+		assert!(!buffer.is_visible(Vec3::new(-1.0, -1.0, 20.0), Vec3::new(1.0, 1.0, 22.0)));
+		assert!(buffer.is_visible(Vec3::new(-1.0, -1.0, 2.0), Vec3::new(1.0, 1.0, 3.0)));
+		assert!(buffer.is_visible(Vec3::new(-1.0, -1.0, 4.0), Vec3::new(1.0, 1.0, 22.0)));
+		assert!(buffer.is_visible(Vec3::new(10.0, -1.0, 20.0), Vec3::new(12.0, 1.0, 22.0)));
+		assert!(buffer.is_visible(Vec3::new(-1.0, -1.0, -2.0), Vec3::new(1.0, 1.0, 22.0)));
+	}
+
+	#[test]
+	fn test_pyramid_keeps_farthest_depth() {
+		let mut buffer = OcclusionBuffer::new(OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+		// Covers only the left half of the screen.
+		buffer.render(&camera(), &[[Vec3::new(-100.0, -100.0, 5.0), Vec3::new(0.0, -100.0, 5.0), Vec3::new(0.0, 100.0, 5.0)], [Vec3::new(-100.0, -100.0, 5.0), Vec3::new(0.0, 100.0, 5.0), Vec3::new(-100.0, 100.0, 5.0)]]);
+		assert!(buffer.max_depth(0, 0, 0) < 1.0);
+		assert_eq!(buffer.max_depth(0, buffer.width() - 1, 0), 1.0);
+		let top = buffer.levels.len() - 1;
+		assert_eq!(buffer.max_depth(top, 0, 0), 1.0);
+		assert!(buffer.max_depth(1, 0, 0) < 1.0);
+	}
+
+	#[test]
+	fn test_parallel_rasterization_matches_serial() {
+		let mut triangles = Vec::new();
+		for i in 0..PARALLEL_TRIANGLES {
+			let x = (i % 32) as f32 - 16.0;
+			let y = (i / 32) as f32 - 8.0;
+			let z = 5.0 + (i % 7) as f32;
+			triangles.push([Vec3::new(x, y, z), Vec3::new(x + 1.5, y, z), Vec3::new(x, y + 1.5, z + 1.0)]);
+		}
+		let mut serial = OcclusionBuffer::new(OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+		serial.render_with_threads(&camera(), &triangles, 1);
+		let mut parallel = OcclusionBuffer::new(OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+		parallel.render_with_threads(&camera(), &triangles, 5);
+		assert!(serial.levels[0].depth.iter().any(|d| *d < 1.0));
+		assert_eq!(serial.levels[0].depth, parallel.levels[0].depth);
+	}
+
+	#[test]
+	fn test_transform_aabb() {
+		let m = Mat4::from_translation(Vec3::new(1.0, 2.0, 3.0)) * Mat4::from_scale(Vec3::new(2.0, 1.0, 1.0));
+		let (min, max) = transform_aabb(&m, Vec3::splat(-1.0), Vec3::splat(1.0));
+		assert_eq!(min, Vec3::new(-1.0, 1.0, 2.0));
+		assert_eq!(max, Vec3::new(3.0, 3.0, 4.0));
+	}
+}
@@ -1,18 +1,30 @@
+// Top three rows of the affine model matrix.
 struct InstanceInput {
-    @location(5) model_matrix_0: vec4<f32>,
-    @location(6) model_matrix_1: vec4<f32>,
-    @location(7) model_matrix_2: vec4<f32>,
-    @location(8) model_matrix_3: vec4<f32>,
+    @location(5) model_row_0: vec4<f32>,
+    @location(6) model_row_1: vec4<f32>,
+    @location(7) model_row_2: vec4<f32>,
 };
 
+// Interleaved vertex. Positions are either f32 or unorm16 with the
+// dequantization folded into the instance transform, normals are
+// octahedral snorm16 and uvs are f16.
 struct VertexInput {
     @location(0) position: vec3<f32>,
-	@location(1) normal: vec3<f32>,
+	@location(1) normal: vec2<f32>,
 	@location(2) tex_coords: vec2<f32>,
 };
 
+fn oct_decode(e: vec2<f32>) -> vec3<f32> {
+	var n = vec3<f32>(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));
+	let t = max(-n.z, 0.0);
+	n.x += select(t, -t, n.x >= 0.0);
+	n.y += select(t, -t, n.y >= 0.0);
+	return normalize(n);
+}
+
 struct VertexOutput {
-    @builtin(position) clip_position: vec4<f32>,
+    // Invariant to match the depth pre-pass exactly.
+    @invariant @builtin(position) clip_position: vec4<f32>,
     @location(0) color: vec3<f32>,
 	@location(1) world_position: vec3<f32>,
     @location(2) normal: vec3<f32>,
@@ -25,105 +37,211 @@ struct Camera {
 @group(0) @binding(0)
 var<storage, read> camera: Camera;
 
-struct PointLight {
-	color: vec3<f32>,
-	// Padding to align to 16 bytes
-	_padding: f32, 
-	intensity: f32,
-	position: vec3<f32>,
-	// Padding to align to 16 bytes
-	_padding2: f32,
+// Point lights sorted into the camera's froxel clusters. `data` holds the
+// lights (8 words each), an (offset, count) pair per cluster and the light
+// indices, starting with the `global_count` lights without a range that
+// reach every cluster. Built by LightClusters on the CPU.
+struct LightClusters {
+	grid: vec4<u32>,
+	near: f32,
+	far: f32,
+	depth_scale: f32,
+	global_count: u32,
+	data: array<u32>,
 };
 
 struct Material {
 	base_color_factor: vec4<f32>,
 	metallic_factor: f32,
 	roughness_factor: f32,
+	normal_texture_scale: f32,
+	occlusion_strength: f32,
 	emissive_factor: vec3<f32>,
+	// Offset and scale of each texture inside its atlas page.
+	uv_rects: array<vec4<f32>, 5>,
 };
 
+// Textures the material has, set per pipeline variant by the engine so
+// fetches of absent textures are compiled out.
+override HAS_BASE_COLOR_TEXTURE: bool = true;
+override HAS_METALLIC_ROUGHNESS_TEXTURE: bool = true;
+override HAS_NORMAL_TEXTURE: bool = true;
+override HAS_OCCLUSION_TEXTURE: bool = true;
+override HAS_EMISSIVE_TEXTURE: bool = true;
+
 @group(1) @binding(0)
-var<storage, read> point_lights: array<PointLight>;
+var<storage, read> light_clusters: LightClusters;
+
+fn cluster_index(world_position: vec3<f32>) -> u32 {
+	let grid = light_clusters.grid;
+	let clip = camera.model * vec4<f32>(world_position, 1.0);
+	let ndc = clip.xy / clip.w;
+	let x = min(u32(max((ndc.x * 0.5 + 0.5) * f32(grid.x), 0.0)), grid.x - 1u);
+	let y = min(u32(max((ndc.y * 0.5 + 0.5) * f32(grid.y), 0.0)), grid.y - 1u);
+	var z = 0u;
+	if (clip.w > light_clusters.near) {
+		z = min(u32(log(clip.w / light_clusters.near) * light_clusters.depth_scale), grid.z - 1u);
+	}
+	return (z * grid.y + y) * grid.x + x;
+}
+
+fn light_word(index: u32) -> f32 {
+	return bitcast<f32>(light_clusters.data[index]);
+}
 
 @vertex
 fn vs_main(input: VertexInput, instance: InstanceInput) -> VertexOutput {
-	let instance_model = mat4x4<f32>(
-        instance.model_matrix_0,
-        instance.model_matrix_1,
-        instance.model_matrix_2,
-        instance.model_matrix_3,
-    );
+	let position = vec4<f32>(input.position, 1.0);
 
     var out: VertexOutput;
-    let world_position = (instance_model * vec4<f32>(input.position, 1.0)).xyz;
+    let world_position = vec3<f32>(
+        dot(instance.model_row_0, position),
+        dot(instance.model_row_1, position),
+        dot(instance.model_row_2, position),
+    );
     out.clip_position = camera.model * vec4<f32>(world_position, 1.0);
     out.color = vec3(1.0, 0.0, 0.0); // Placeholder for color, to be modified by lighting calculation
     out.world_position = world_position;
-	let normal = input.normal;
-	out.normal = normal;
+	// Normals are stored in the space of the positions. The cofactor matrix
+	// of the instance transform is its inverse transpose up to scale, which
+	// takes them to world space like the pre-transformed static batches.
+	let c0 = vec3<f32>(instance.model_row_0.x, instance.model_row_1.x, instance.model_row_2.x);
+	let c1 = vec3<f32>(instance.model_row_0.y, instance.model_row_1.y, instance.model_row_2.y);
+	let c2 = vec3<f32>(instance.model_row_0.z, instance.model_row_1.z, instance.model_row_2.z);
+	let cofactor = mat3x3<f32>(cross(c1, c2), cross(c2, c0), cross(c0, c1));
+	let handedness = select(1.0, -1.0, dot(c0, cross(c1, c2)) < 0.0);
+	out.normal = normalize(cofactor * oct_decode(input.normal)) * handedness;
 	out.tex_coords = input.tex_coords;
     return out;
 }
 
+// One prebuilt bind group per material: its textures and its entry in the
+// shared material array.
 @group(2) @binding(0)
 var base_color_texture: texture_2d<f32>;
 @group(2) @binding(1)
 var base_color_sampler: sampler;
-
-@group(3) @binding(0)
+@group(2) @binding(2)
 var metallic_roughness_texture: texture_2d<f32>;
-@group(3) @binding(1)
+@group(2) @binding(3)
 var metallic_roughness_sampler: sampler;
-
-@group(4) @binding(0)
+@group(2) @binding(4)
 var normal_texture: texture_2d<f32>;
-@group(4) @binding(1)
+@group(2) @binding(5)
 var normal_sampler: sampler;
-
-@group(5) @binding(0)
+@group(2) @binding(6)
 var occlusion_texture: texture_2d<f32>;
-@group(5) @binding(1)
+@group(2) @binding(7)
 var occlusion_sampler: sampler;
-
-@group(6) @binding(0)
+@group(2) @binding(8)
 var emissive_texture: texture_2d<f32>;
-@group(6) @binding(1)
+@group(2) @binding(9)
 var emissive_sampler: sampler;
-
-@group(7) @binding(0)
+@group(2) @binding(10)
 var<storage, read> material: Material;
 
+// Uvs of a material texture. Atlased textures wrap inside their rect,
+// others keep the sampler's own addressing.
+fn texture_uv(slot: u32, uv: vec2<f32>) -> vec2<f32> {
+	let rect = material.uv_rects[slot];
+	return select(rect.xy + fract(uv) * rect.zw, uv, all(rect == vec4<f32>(0.0, 0.0, 1.0, 1.0)));
+}
+
+// Tangent frame from screen space derivatives, the vertices carry no
+// tangents.
+fn perturb_normal(normal: vec3<f32>, world_position: vec3<f32>, uv: vec2<f32>, sampled: vec3<f32>) -> vec3<f32> {
+	let dp1 = dpdx(world_position);
+	let dp2 = dpdy(world_position);
+	let duv1 = dpdx(uv);
+	let duv2 = dpdy(uv);
+	let dp2perp = cross(dp2, normal);
+	let dp1perp = cross(normal, dp1);
+	let t = dp2perp * duv1.x + dp1perp * duv2.x;
+	let b = dp2perp * duv1.y + dp1perp * duv2.y;
+	let scale = inverseSqrt(max(max(dot(t, t), dot(b, b)), 1e-12));
+	let tangent_normal = vec3<f32>(sampled.xy * material.normal_texture_scale, sampled.z);
+	return normalize(mat3x3<f32>(t * scale, b * scale, normal) * tangent_normal);
+}
+
 @fragment
 fn fs_main(in: VertexOutput) -> @location(0) vec4<f32> {
-    let light_color = vec3<f32>(1.0, 1.0, 1.0);
     let view_dir = normalize(camera.model[3].xyz - in.world_position);
     var diffuse = vec3<f32>(0.0, 0.0, 0.0);
     var specular = vec3<f32>(0.0, 0.0, 0.0);
 
-    let texture_color = textureSample(base_color_texture, base_color_sampler, in.tex_coords);
-    let base_color = texture_color.rgb * material.base_color_factor.rgb;
-    let roughness = material.roughness_factor;
-    let metallic = material.metallic_factor;
+    var base_color = material.base_color_factor.rgb;
+    if (HAS_BASE_COLOR_TEXTURE) {
+        base_color *= textureSample(base_color_texture, base_color_sampler, texture_uv(0u, in.tex_coords)).rgb;
+    }
+    var roughness = material.roughness_factor;
+    var metallic = material.metallic_factor;
+    if (HAS_METALLIC_ROUGHNESS_TEXTURE) {
+        // glTF packs roughness in green and metalness in blue.
+        let metallic_roughness = textureSample(metallic_roughness_texture, metallic_roughness_sampler, texture_uv(1u, in.tex_coords));
+        roughness *= metallic_roughness.g;
+        metallic *= metallic_roughness.b;
+    }
+    // Each map only changes the shading of materials that have it, the
+    // variant without textures shades like the shader before them.
+    var normal = in.normal;
+    if (HAS_NORMAL_TEXTURE) {
+        let sampled = textureSample(normal_texture, normal_sampler, texture_uv(2u, in.tex_coords)).xyz * 2.0 - 1.0;
+        normal = perturb_normal(normalize(in.normal), in.world_position, in.tex_coords, sampled);
+    }
+    var occlusion = 1.0;
+    if (HAS_OCCLUSION_TEXTURE) {
+        let sampled = textureSample(occlusion_texture, occlusion_sampler, texture_uv(3u, in.tex_coords)).r;
+        occlusion = mix(1.0, sampled, material.occlusion_strength);
+    }
+    var emissive = vec3<f32>(0.0);
+    if (HAS_EMISSIVE_TEXTURE) {
+        emissive = material.emissive_factor * textureSample(emissive_texture, emissive_sampler, texture_uv(4u, in.tex_coords)).rgb;
+    }
 
-    for (var i = 0u; i < 2; i = i + 1u) {
-        let point_light = point_lights[i];
-        let light_position = point_light.position;
-        let light_dir = normalize(light_position - in.world_position);
+    let grid = light_clusters.grid;
+    let table = grid.w * 8u;
+    let indices = table + grid.x * grid.y * grid.z * 2u;
+    let entry = table + cluster_index(in.world_position) * 2u;
+    let light_start = indices + light_clusters.data[entry];
+    let count = light_clusters.data[entry + 1u];
+    let global_count = light_clusters.global_count;
+
+    for (var i = 0u; i < global_count + count; i = i + 1u) {
+        var slot = indices + i;
+        if (i >= global_count) {
+            slot = light_start + i - global_count;
+        }
+        let light = light_clusters.data[slot] * 8u;
+        let light_position = vec3<f32>(light_word(light + 4u), light_word(light + 5u), light_word(light + 6u));
+        let light_range = light_word(light + 7u);
+        let to_light = light_position - in.world_position;
+        let dist = length(to_light);
+        let light_dir = to_light / max(dist, 0.0001);
         let halfway_dir = normalize(light_dir + view_dir);
 
+        // Inverse square falloff windowed to reach zero at the range.
+        var attenuation = 1.0;
+        if (light_range > 0.0) {
+            let r = dist / light_range;
+            let fade = clamp(1.0 - r * r * r * r, 0.0, 1.0);
+            attenuation = fade * fade / (1.0 + dist * dist);
+        }
+        let light_color = vec3<f32>(light_word(light), light_word(light + 1u), light_word(light + 2u))
+            * light_word(light + 3u) * attenuation;
+
         // Diffuse
-        let ndotl = max(dot(in.normal, light_dir), 0.0);
+        let ndotl = max(dot(normal, light_dir), 0.0);
         diffuse += ndotl * light_color;
 
         // Blinn-Phong
-        let ndoth = max(dot(in.normal, halfway_dir), 0.0);
+        let ndoth = max(dot(normal, halfway_dir), 0.0);
         let spec = pow(ndoth, (1.0 - roughness) * 128.0); // Higher exponent for smoother surfaces
         specular += spec * light_color;
     }
 
     // **Combine Diffuse and Specular with Material Properties**
     // Adjust specular intensity based on metallic factor
-    let final_color = (diffuse * base_color) + (specular * mix(vec3<f32>(0.04), base_color, metallic));
+    let final_color = (diffuse * base_color * occlusion) + (specular * mix(vec3<f32>(0.04), base_color, metallic)) + emissive;
     // Incorporate the alpha component from base_color_factor
     return vec4<f32>(final_color, material.base_color_factor.a);
 }
\ No newline at end of file
@@ -0,0 +1,106 @@
+struct Frustum {
+	planes: array<vec4<f32>, 6>,
+	position: vec3<f32>,
+	item_count: u32,
+	range_count: u32,
+}
+
+struct Instance {
+	row_0: vec4<f32>,
+	row_1: vec4<f32>,
+	row_2: vec4<f32>,
+}
+
+// Run of instance slots, `first_item` is the invocation of its first
+// instance.
+struct CullRange {
+	first_instance: u32,
+	first_item: u32,
+	draw: u32,
+}
+
+// Each of the `lod_count + 1` levels has its own arguments from
+// `first_args` on and room for `instance_count` outputs.
+struct CullDraw {
+	bounds_min: vec3<f32>,
+	first_output: u32,
+	bounds_max: vec3<f32>,
+	first_args: u32,
+	origin: vec3<f32>,
+	lod_count: u32,
+	inv_scale: vec3<f32>,
+	instance_count: u32,
+	lod_distances: vec4<f32>,
+}
+
+struct DrawArgs {
+	index_count: u32,
+	instance_count: atomic<u32>,
+	first_index: u32,
+	base_vertex: i32,
+	first_instance: u32,
+}
+
+@group(0) @binding(0) var<storage, read> frustum: Frustum;
+@group(0) @binding(1) var<storage, read> instances: array<Instance>;
+@group(0) @binding(2) var<storage, read> ranges: array<CullRange>;
+@group(0) @binding(3) var<storage, read> draws: array<CullDraw>;
+@group(0) @binding(4) var<storage, read_write> args: array<DrawArgs>;
+@group(0) @binding(5) var<storage, read_write> visible: array<Instance>;
+
+@compute @workgroup_size(64)
+fn cs_main(@builtin(global_invocation_id) id: vec3<u32>) {
+	if (id.x >= frustum.item_count) {
+		return;
+	}
+	// Last run starting at or before this invocation.
+	var low = 0u;
+	var high = frustum.range_count;
+	while (high - low > 1u) {
+		let middle = (low + high) / 2u;
+		if (ranges[middle].first_item <= id.x) {
+			low = middle;
+		} else {
+			high = middle;
+		}
+	}
+	let range = ranges[low];
+	let instance = instances[range.first_instance + id.x - range.first_item];
+	let draw = draws[range.draw];
+
+	// World space box around the transformed mesh bounds.
+	let center = vec4<f32>((draw.bounds_min + draw.bounds_max) * 0.5, 1.0);
+	let extent = (draw.bounds_max - draw.bounds_min) * 0.5;
+	let world_center = vec3<f32>(dot(instance.row_0, center), dot(instance.row_1, center), dot(instance.row_2, center));
+	let world_extent = vec3<f32>(
+		dot(abs(instance.row_0.xyz), extent),
+		dot(abs(instance.row_1.xyz), extent),
+		dot(abs(instance.row_2.xyz), extent),
+	);
+
+	for (var i = 0u; i < 6u; i = i + 1u) {
+		let plane = frustum.planes[i];
+		if (dot(plane.xyz, world_center) + plane.w < -dot(abs(plane.xyz), world_extent)) {
+			return;
+		}
+	}
+
+	// Level by the distance of the node origin and its largest axis scale,
+	// as select_lod picks it on the CPU.
+	let origin = vec4<f32>(draw.origin, 1.0);
+	let position = vec3<f32>(dot(instance.row_0, origin), dot(instance.row_1, origin), dot(instance.row_2, origin));
+	let scale = max(max(
+		length(vec3<f32>(instance.row_0.x, instance.row_1.x, instance.row_2.x)) * draw.inv_scale.x,
+		length(vec3<f32>(instance.row_0.y, instance.row_1.y, instance.row_2.y)) * draw.inv_scale.y),
+		length(vec3<f32>(instance.row_0.z, instance.row_1.z, instance.row_2.z)) * draw.inv_scale.z);
+	let distance = length(position - frustum.position);
+	var level = 0u;
+	for (var i = 0u; i < draw.lod_count; i = i + 1u) {
+		if (distance >= draw.lod_distances[i] * scale) {
+			level = i + 1u;
+		}
+	}
+
+	let slot = atomicAdd(&args[draw.first_args + level].instance_count, 1u);
+	visible[draw.first_output + level * draw.instance_count + slot] = instance;
+}
@@ -0,0 +1,30 @@
+// Depth pre-pass: positions only and no fragment stage, so the pass
+// writes depth and nothing else. Bindings and vertex locations match the
+// 3D shader so the same buffers feed both. The position is invariant in
+// both so the colour pass computes bit for bit the depth laid down here.
+struct InstanceInput {
+    @location(5) model_row_0: vec4<f32>,
+    @location(6) model_row_1: vec4<f32>,
+    @location(7) model_row_2: vec4<f32>,
+};
+
+struct VertexInput {
+    @location(0) position: vec3<f32>,
+};
+
+struct Camera {
+    model: mat4x4<f32>,
+}
+@group(0) @binding(0)
+var<storage, read> camera: Camera;
+
+@vertex
+fn vs_main(input: VertexInput, instance: InstanceInput) -> @invariant @builtin(position) vec4<f32> {
+	let position = vec4<f32>(input.position, 1.0);
+	let world_position = vec3<f32>(
+		dot(instance.model_row_0, position),
+		dot(instance.model_row_1, position),
+		dot(instance.model_row_2, position),
+	);
+	return camera.model * vec4<f32>(world_position, 1.0);
+}
@@ -0,0 +1,624 @@
+use std::collections::HashMap;
+use std::path::PathBuf;
+
+use glam::Mat4;
+use glam::Vec3;
+use glam::Vec4;
+
+use crate::buffer::BufferSlice;
+use crate::capture;
+use crate::capture::frame_screenshot_path;
+use crate::capture::Capture;
+use crate::capture::CaptureSettings;
+use crate::capture::FrameStream;
+use crate::gpu_cull::RawCullDraw;
+use crate::gpu_cull::RawCullFrustum;
+use crate::gpu_cull::RawCullRange;
+use crate::gpu_cull::RawDrawIndexedIndirect;
+use crate::hardware::*;
+use crate::internal_types::RawInstance;
+use crate::internal_types::RawMaterial;
+use crate::CapturedImage;
+use crate::Window;
+use super::raster;
+use super::raster::Draw;
+use super::raster::Framebuffer;
+use super::shading::read;
+use super::shading::pack_color;
+use super::shading::Geometry;
+use super::shading::Shader;
+use super::shading::ShaderKind;
+use super::shading::Texture;
+use super::shading::VertexLayout;
+
+/// Clear color of the wgpu backend's passes.
+const CLEAR_COLOR: [f32; 4] = [0.1, 0.2, 0.3, 1.0];
+
+/// Buffer contents kept as words so light clusters are read in place.
+struct SoftBuffer {
+	words: Vec<u32>,
+	size: usize,
+}
+
+impl SoftBuffer {
+	fn new(size: u64) -> Self {
+		Self {
+			words: vec![0; (size as usize + 3) / 4],
+			size: size as usize,
+		}
+	}
+
+	fn bytes(&self) -> &[u8] {
+		&bytemuck::cast_slice(&self.words)[..self.size]
+	}
+
+	fn write(&mut self, offset: usize, data: &[u8]) -> bool {
+		if offset + data.len() > self.size {
+			return false;
+		}
+		bytemuck::cast_slice_mut(&mut self.words)[offset..offset + data.len()].copy_from_slice(data);
+		true
+	}
+}
+
+struct SoftPipeline {
+	window_id: u32,
+	kind: ShaderKind,
+	quantized: bool,
+	features: MaterialFeatures,
+}
+
+struct SoftMaterial {
+	textures: [TextureHandle; 5],
+	material: BufferSlice,
+}
+
+struct SoftTarget {
+	window_id: u32,
+	/// Render target of captures, never saved as a screenshot.
+	offscreen: bool,
+	framebuffer: Framebuffer,
+}
+
+/// Resources a pass reads, borrowed apart from the targets it draws into.
+struct Resources<'a> {
+	buffers: &'a HashMap<u32, SoftBuffer>,
+	textures: &'a HashMap<u32, Texture>,
+	materials: &'a HashMap<u32, SoftMaterial>,
+	pipelines: &'a HashMap<u32, SoftPipeline>,
+}
+
+impl<'a> Resources<'a> {
+	fn slice(&self, slice: &BufferSlice) -> Option<&'a [u8]> {
+		let bytes = self.buffers.get(&slice.handle.id)?.bytes();
+		bytes.get(slice.range.start as usize..slice.range.end as usize)
+	}
+
+	/// The rasterizer's view of a draw, None when it can't be drawn.
+	fn draw(&self, subpass: &Subpass, pipeline: Option<PipelineHandle>, viewport: Option<[f32; 4]>, scissor: Option<[f32; 4]>, width: u32, height: u32) -> Option<Draw<'a>> {
+		let pipeline = subpass.pipeline.or(pipeline)?;
+		let pipeline = match self.pipelines.get(&pipeline.id) {
+			Some(pipeline) => pipeline,
+			None => {
+				log::error!("Pipeline not found: {:?}", pipeline);
+				return None;
+			}
+		};
+		let viewport = viewport_pixels(viewport.unwrap_or([0.0, 0.0, 1.0, 1.0]), width, height)?;
+		let scissor = scissor_pixels(viewport, scissor, width, height)?;
+		let vertex_buffer = |slot: u32| subpass.vertex_buffers.iter().find(|(s, _)| *s == slot).and_then(|(_, slice)| self.slice(slice));
+		let buffer = |slot: u32| subpass.buffers.iter().find(|(s, _)| *s == slot).and_then(|(_, handle)| self.buffers.get(&handle.id));
+		let (vertices, attributes, indices) = match (vertex_buffer(0), vertex_buffer(1), subpass.index_buffer.as_ref().and_then(|slice| self.slice(slice))) {
+			(Some(vertices), Some(attributes), Some(indices)) => (vertices, attributes, indices),
+			_ => {
+				log::error!("Buffers of a draw not found => SKIP");
+				return None;
+			}
+		};
+		let (index_range, base_vertex, instances) = match &subpass.indirect {
+			Some((args, offset)) => {
+				let args: RawDrawIndexedIndirect = self.buffers.get(&args.id).and_then(|b| read(b.bytes(), *offset as usize))?;
+				let first_instance = args.first_instance;
+				(args.first_index..args.first_index + args.index_count, args.base_vertex, first_instance..first_instance + args.instance_count)
+			}
+			None => (subpass.indices.clone()?, subpass.base_vertex, subpass.instances.clone()?),
+		};
+
+		let mut shader = Shader {
+			kind: pipeline.kind,
+			features: pipeline.features,
+			material: RawMaterial::default(),
+			textures: [None; 5],
+			camera: Mat4::IDENTITY,
+			lights: &[],
+		};
+		if pipeline.kind != ShaderKind::Gui {
+			let camera: [[f32; 4]; 4] = buffer(0).and_then(|b| read(b.bytes(), 0))?;
+			shader.camera = Mat4::from_cols_array_2d(&camera);
+		}
+		if pipeline.kind == ShaderKind::Mesh {
+			shader.lights = buffer(1).map(|b| b.words.as_slice()).unwrap_or(&[]);
+			let material = subpass.materials.iter().find(|(s, _, _)| *s == 2).and_then(|(_, handle, offset)| Some((self.materials.get(&handle.id)?, *offset)));
+			if let Some((material, offset)) = material {
+				let raw = self.buffers.get(&material.material.handle.id).and_then(|b| read(b.bytes(), material.material.range.start as usize + offset as usize));
+				match raw {
+					Some(raw) => shader.material = raw,
+					None => log::error!("Material buffer not found: {:?}", material.material.handle),
+				}
+				shader.textures = material.textures.map(|texture| self.textures.get(&texture.id));
+			}
+		}
+		let layout = match (pipeline.kind, pipeline.quantized) {
+			(ShaderKind::Gui, _) => VertexLayout::Gui,
+			(_, true) => VertexLayout::Quantized,
+			(_, false) => VertexLayout::Interleaved,
+		};
+		Some(Draw {
+			shader,
+			geometry: Geometry {
+				layout,
+				vertices,
+				attributes,
+				indices,
+				index_range,
+				base_vertex,
+				instances,
+			},
+			viewport,
+			scissor,
+		})
+	}
+}
+
+/// World space box test of one instance against the frustum, the test of
+/// cull.wgsl.
+fn instance_visible(planes: &[[f32; 4]; 6], draw: &RawCullDraw, instance: &RawInstance) -> bool {
+	let bounds_min = Vec3::from_array(draw.bounds_min);
+	let bounds_max = Vec3::from_array(draw.bounds_max);
+	let center = ((bounds_min + bounds_max) * 0.5).extend(1.0);
+	let extent = (bounds_max - bounds_min) * 0.5;
+	let rows = instance.rows.map(Vec4::from_array);
+	let world_center = Vec3::new(rows[0].dot(center), rows[1].dot(center), rows[2].dot(center));
+	let world_extent = Vec3::new(
+		rows[0].truncate().abs().dot(extent),
+		rows[1].truncate().abs().dot(extent),
+		rows[2].truncate().abs().dot(extent),
+	);
+	planes.iter().all(|plane| {
+		let normal = Vec3::new(plane[0], plane[1], plane[2]);
+		normal.dot(world_center) + plane[3] >= -normal.abs().dot(world_extent)
+	})
+}
+
+/// LOD of an instance by its distance from the camera, the level pick of
+/// cull.wgsl.
+fn instance_level(frustum: &RawCullFrustum, draw: &RawCullDraw, instance: &RawInstance) -> u32 {
+	let rows = instance.rows.map(Vec4::from_array);
+	let origin = Vec3::from_array(draw.origin).extend(1.0);
+	let position = Vec3::new(rows[0].dot(origin), rows[1].dot(origin), rows[2].dot(origin));
+	let scale = (0..3)
+		.map(|axis| Vec3::new(instance.rows[0][axis], instance.rows[1][axis], instance.rows[2][axis]).length() * draw.inv_scale[axis])
+		.fold(0.0, f32::max);
+	let distance = position.distance(Vec3::from_array(frustum.position));
+	let lod_count = (draw.lod_count as usize).min(draw.lod_distances.len());
+	draw.lod_distances[..lod_count].iter().filter(|&&d| distance >= d * scale).count() as u32
+}
+
+/// Runs a cull dispatch on the CPU. Visible instances are appended in
+/// slot run order, where the GPU appends them in any order.
+fn cull_instances(buffers: &mut HashMap<u32, SoftBuffer>, dispatch: &CullDispatch) {
+	let bytes = |handle: &BufferHandle| buffers.get(&handle.id).map(|b| b.bytes());
+	let (frustum, instances, ranges, draws) = match (bytes(&dispatch.frustum).and_then(|b| read::<RawCullFrustum>(b, 0)), bytes(&dispatch.instances), bytes(&dispatch.ranges), bytes(&dispatch.draws)) {
+		(Some(frustum), Some(instances), Some(ranges), Some(draws)) => (frustum, instances, ranges, draws),
+		_ => {
+			log::error!("Cull buffers not found: {:?}", dispatch);
+			return;
+		}
+	};
+	let ranges: Vec<RawCullRange> = (0..frustum.range_count as usize)
+		.map_while(|i| read(ranges, i * std::mem::size_of::<RawCullRange>()))
+		.collect();
+	let mut visible = Vec::new();
+	for (i, range) in ranges.iter().enumerate() {
+		let end = ranges.get(i + 1).map_or(dispatch.item_count, |next| next.first_item);
+		let draw: RawCullDraw = match read(draws, range.draw as usize * std::mem::size_of::<RawCullDraw>()) {
+			Some(draw) => draw,
+			None => continue,
+		};
+		for item in range.first_item..end {
+			let slot = range.first_instance + item - range.first_item;
+			let instance: RawInstance = match read(instances, slot as usize * std::mem::size_of::<RawInstance>()) {
+				Some(instance) => instance,
+				None => break,
+			};
+			if instance_visible(&frustum.planes, &draw, &instance) {
+				let level = instance_level(&frustum, &draw, &instance);
+				visible.push((draw.first_args + level, draw.first_output + level * draw.instance_count, instance));
+			}
+		}
+	}
+	let args_stride = std::mem::size_of::<RawDrawIndexedIndirect>();
+	let count_offset = std::mem::offset_of!(RawDrawIndexedIndirect, instance_count);
+	let mut outputs = Vec::with_capacity(visible.len());
+	if let Some(args) = buffers.get_mut(&dispatch.args.id) {
+		for (draw_args, first_output, instance) in visible {
+			let offset = draw_args as usize * args_stride + count_offset;
+			let slot: u32 = match read(args.bytes(), offset) {
+				Some(slot) => slot,
+				None => continue,
+			};
+			args.write(offset, &(slot + 1).to_ne_bytes());
+			outputs.push(((first_output + slot) as usize * std::mem::size_of::<RawInstance>(), instance));
+		}
+	}
+	if let Some(output) = buffers.get_mut(&dispatch.output.id) {
+		for (offset, instance) in outputs {
+			output.write(offset, bytemuck::bytes_of(&instance));
+		}
+	}
+}
+
+/// Open capture stream and the index of its next frame, None when it
+/// failed to open.
+type StreamState = Option<(FrameStream, u64)>;
+
+/// Renders on the CPU for machines without a GPU adapter. Passes are
+/// rasterized into tiled color and depth targets with the lighting of the
+/// 3D shader, spread over all cores.
+pub struct SoftwareHardware {
+	pipeline_id: u32,
+	buffer_id: u32,
+	texture_id: u32,
+	material_id: u32,
+	bundle_id: u32,
+	window_id: u32,
+	threads: usize,
+	targets: Vec<SoftTarget>,
+	pipelines: HashMap<u32, SoftPipeline>,
+	buffers: HashMap<u32, SoftBuffer>,
+	textures: HashMap<u32, Texture>,
+	materials: HashMap<u32, SoftMaterial>,
+	bundles: HashMap<u32, RenderPass>,
+	pending_captures: HashMap<u32, Vec<CaptureTile>>,
+	captured: Vec<CapturedImage>,
+	pending_screenshots: HashMap<u32, String>,
+	settings: CaptureSettings,
+	streams: HashMap<String, StreamState>,
+	screenshot_dir: Option<PathBuf>,
+	screenshot_counter: u64,
+	screenshot_interval: u64,
+}
+
+impl SoftwareHardware {
+	pub fn new(screenshot_dir: Option<PathBuf>, screenshot_interval: u64, settings: CaptureSettings) -> Self {
+		let threads = std::thread::available_parallelism().map_or(1, |n| n.get());
+		crate::log1!("Rendering in software on {} threads", threads);
+		Self {
+			pipeline_id: 1,
+			buffer_id: 1,
+			texture_id: 1,
+			material_id: 1,
+			bundle_id: 1,
+			window_id: 1,
+			threads,
+			targets: Vec::new(),
+			pipelines: HashMap::new(),
+			buffers: HashMap::new(),
+			textures: HashMap::new(),
+			materials: HashMap::new(),
+			bundles: HashMap::new(),
+			pending_captures: HashMap::new(),
+			captured: Vec::new(),
+			pending_screenshots: HashMap::new(),
+			settings,
+			streams: HashMap::new(),
+			screenshot_dir,
+			screenshot_counter: 0,
+			screenshot_interval,
+		}
+	}
+
+	fn create_target(&mut self, width: u32, height: u32, offscreen: bool) -> WindowHandle {
+		let window_id = self.window_id;
+		self.window_id += 1;
+		self.targets.push(SoftTarget {
+			window_id,
+			offscreen,
+			framebuffer: Framebuffer::new(width, height),
+		});
+		WindowHandle { id: window_id }
+	}
+
+	/// Runs the passes of a target. Color and depth are cleared by the
+	/// first pass that uses them, like the wgpu backend's load ops.
+	fn render_target(&mut self, index: usize, encoder: RenderEncoder) {
+		let resources = Resources {
+			buffers: &self.buffers,
+			textures: &self.textures,
+			materials: &self.materials,
+			pipelines: &self.pipelines,
+		};
+		let framebuffer = &mut self.targets[index].framebuffer;
+		let (width, height) = (framebuffer.width, framebuffer.height);
+		let mut color_cleared = false;
+		let mut depth_cleared = false;
+		for pass in encoder.passes {
+			let kind = pass.pipeline.and_then(|p| resources.pipelines.get(&p.id)).map(|p| p.kind);
+			let (uses_color, uses_depth) = kind.map_or((true, false), |kind| (kind.uses_color(), kind.uses_depth()));
+			let clear_color = (uses_color && !color_cleared).then(|| pack_color(Vec4::from_array(CLEAR_COLOR)));
+			let clear_depth = (uses_depth && !depth_cleared).then_some(1.0);
+			color_cleared |= uses_color;
+			depth_cleared |= uses_depth;
+			framebuffer.clear(clear_color, clear_depth);
+
+			let mut draws = Vec::new();
+			for subpass in &pass.subpasses {
+				let bundle = match subpass.bundle {
+					Some(bundle) => bundle,
+					None => {
+						draws.extend(resources.draw(subpass, pass.pipeline, subpass.viewport, subpass.scissor, width, height));
+						continue;
+					}
+				};
+				// Bundles draw with the viewport and scissor of the pass they
+				// run in.
+				match self.bundles.get(&bundle.id) {
+					Some(commands) => {
+						for inner in &commands.subpasses {
+							draws.extend(resources.draw(inner, commands.pipeline, subpass.viewport, subpass.scissor, width, height));
+						}
+					}
+					None => log::error!("Bundle not found: {:?}", bundle),
+				}
+			}
+			raster::draw(framebuffer, &draws, self.threads);
+		}
+	}
+
+	fn save_capture(&mut self, capture: Capture, pixels: Vec<u8>, width: u32, height: u32) {
+		match capture {
+			Capture::File(path) => capture::save_file(&path, &pixels, width, height),
+			Capture::Stream(path) => {
+				let settings = &self.settings;
+				let state = self.streams.entry(path.clone()).or_insert_with(|| match FrameStream::open(&path, settings.format, settings.fps) {
+					Ok(stream) => Some((stream, 0)),
+					Err(err) => {
+						log::error!("Failed to open capture stream {}: {:?}", path, err);
+						None
+					}
+				});
+				if let Some((stream, next)) = state {
+					let frame = capture::encode_stream_frame(settings.format, pixels);
+					stream.write(*next, Some((width, height, frame)));
+					*next += 1;
+				}
+			}
+			Capture::Tiles(tiles) => {
+				let inside = |tile: &&CaptureTile| tile.x + tile.width <= width && tile.y + tile.height <= height;
+				let images = tiles.iter().filter(inside).map(|tile| CapturedImage {
+					id: tile.id,
+					width: tile.width,
+					height: tile.height,
+					pixels: capture::cut_tile(&pixels, width, tile),
+				});
+				self.captured.extend(images);
+			}
+		}
+	}
+}
+
+impl Hardware for SoftwareHardware {
+	fn create_buffer(&mut self, _name: &str, size: u64) -> BufferHandle {
+		let buffer_id = self.buffer_id;
+		self.buffer_id += 1;
+		self.buffers.insert(buffer_id, SoftBuffer::new(size));
+		BufferHandle { id: buffer_id, size }
+	}
+
+	fn destroy_buffer(&mut self, handle: BufferHandle) {
+		self.buffers.remove(&handle.id);
+	}
+
+	fn create_texture(&mut self, _name: &str, data: &[u8], width: u32, height: u32) -> TextureHandle {
+		let texture_id = self.texture_id;
+		self.texture_id += 1;
+		self.textures.insert(texture_id, Texture::new(data, width, height));
+		TextureHandle { id: texture_id }
+	}
+
+	fn write_texture(&mut self, texture: TextureHandle, x: u32, y: u32, width: u32, height: u32, data: &[u8]) {
+		match self.textures.get_mut(&texture.id) {
+			Some(texture) => texture.write(x, y, width, height, data),
+			None => log::error!("Texture not found: {:?}", texture),
+		}
+	}
+
+	fn create_material(&mut self, textures: [TextureHandle; 5], material: BufferSlice) -> MaterialHandle {
+		let material_id = self.material_id;
+		self.material_id += 1;
+		self.materials.insert(material_id, SoftMaterial { textures, material });
+		MaterialHandle { id: material_id }
+	}
+
+	fn destroy_material(&mut self, handle: MaterialHandle) {
+		self.materials.remove(&handle.id);
+	}
+
+	fn create_pipeline(&mut self, name: &str, window: WindowHandle) -> PipelineHandle {
+		self.create_material_pipeline(name, window, MaterialFeatures::ALL)
+	}
+
+	fn create_material_pipeline(&mut self, name: &str, window: WindowHandle, features: MaterialFeatures) -> PipelineHandle {
+		let pipeline_id = self.pipeline_id;
+		self.pipeline_id += 1;
+		self.pipelines.insert(pipeline_id, SoftPipeline {
+			window_id: window.id,
+			kind: ShaderKind::from_name(name),
+			quantized: name.ends_with("_quantized"),
+			features,
+		});
+		PipelineHandle { id: pipeline_id }
+	}
+
+	fn render(&mut self, encoder: RenderEncoder, window: WindowHandle) {
+		self.render_frame(vec![(window, encoder)]);
+	}
+
+	fn render_frame(&mut self, frames: Vec<(WindowHandle, RenderEncoder)>) {
+		for (_, encoder) in &frames {
+			for dispatch in &encoder.culls {
+				cull_instances(&mut self.buffers, dispatch);
+			}
+		}
+		for (window, encoder) in frames {
+			let index = match self.targets.iter().position(|target| target.window_id == window.id) {
+				Some(index) => index,
+				None => {
+					log::error!("Window not found: {:?}", window);
+					continue;
+				}
+			};
+			let capture = if self.targets[index].offscreen {
+				self.pending_captures.remove(&window.id).map(Capture::Tiles)
+			} else {
+				let frame_index = self.screenshot_counter;
+				self.screenshot_counter += 1;
+				frame_screenshot_path(&mut self.pending_screenshots, &self.screenshot_dir, &self.settings, self.screenshot_interval, frame_index, window.id)
+			};
+			self.render_target(index, encoder);
+			if let Some(capture) = capture {
+				let framebuffer = &self.targets[index].framebuffer;
+				let (pixels, width, height) = (framebuffer.pixels(), framebuffer.width, framebuffer.height);
+				self.save_capture(capture, pixels, width, height);
+			}
+		}
+	}
+
+	fn create_window(&mut self, window: &Window) -> WindowHandle {
+		self.create_target(window.width, window.height, false)
+	}
+
+	fn create_render_target(&mut self, width: u32, height: u32) -> Option<WindowHandle> {
+		Some(self.create_target(width, height, true))
+	}
+
+	fn destroy_window(&mut self, handle: WindowHandle) {
+		self.targets.retain(|target| target.window_id != handle.id);
+		self.pipelines.retain(|_, pipeline| pipeline.window_id != handle.id);
+	}
+
+	fn write_buffer(&mut self, buffer: BufferHandle, data: &[u8]) {
+		self.write_buffer_at(buffer, 0, data);
+	}
+
+	fn write_buffer_at(&mut self, buffer: BufferHandle, offset: u64, data: &[u8]) {
+		let buffer_ctx = match self.buffers.get_mut(&buffer.id) {
+			Some(b) => b,
+			None => {
+				log::error!("Buffer not found: {:?}", buffer);
+				return;
+			}
+		};
+		if !buffer_ctx.write(offset as usize, data) {
+			log::error!("Write of {} bytes at {} past the end of {:?}", data.len(), offset, buffer);
+		}
+	}
+
+	fn copy_buffer(&mut self, src: BufferHandle, dst: BufferHandle, size: u64) {
+		let data = match self.buffers.get(&src.id) {
+			Some(b) if size as usize <= b.size => b.bytes()[..size as usize].to_vec(),
+			_ => {
+				log::error!("Copy of {} bytes from {:?} out of range", size, src);
+				return;
+			}
+		};
+		self.write_buffer_at(dst, 0, &data);
+	}
+
+	fn save_screenshot(&mut self, window: WindowHandle, path: &str) {
+		self.pending_screenshots.insert(window.id, path.to_string());
+	}
+
+	fn capture_tiles(&mut self, target: WindowHandle, tiles: Vec<CaptureTile>) {
+		self.pending_captures.insert(target.id, tiles);
+	}
+
+	fn take_captures(&mut self) -> Vec<CapturedImage> {
+		std::mem::take(&mut self.captured)
+	}
+
+	fn create_render_bundle(&mut self, commands: RenderPass) -> BundleHandle {
+		let bundle_id = self.bundle_id;
+		self.bundle_id += 1;
+		self.bundles.insert(bundle_id, commands);
+		BundleHandle { id: bundle_id }
+	}
+
+	fn destroy_render_bundle(&mut self, handle: BundleHandle) {
+		self.bundles.remove(&handle.id);
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn test_cull_appends_visible_instances() {
+		let mut hardware = SoftwareHardware::new(None, 1, CaptureSettings::default());
+		// Unit box frustum around the origin.
+		let planes: [[f32; 4]; 6] = [
+			[1.0, 0.0, 0.0, 1.0],
+			[-1.0, 0.0, 0.0, 1.0],
+			[0.0, 1.0, 0.0, 1.0],
+			[0.0, -1.0, 0.0, 1.0],
+			[0.0, 0.0, 1.0, 1.0],
+			[0.0, 0.0, -1.0, 1.0],
+		];
+		let at = |x: f32| RawInstance::new(&Mat4::from_translation(Vec3::new(x, 0.0, 0.0)));
+		let instances = [at(9.0), at(0.0), at(5.0), at(1.2)];
+		let ranges = [RawCullRange { first_instance: 1, first_item: 0, draw: 0 }];
+		let mut frustum: RawCullFrustum = bytemuck::Zeroable::zeroed();
+		frustum.planes = planes;
+		frustum.item_count = 3;
+		frustum.range_count = 1;
+		let mut draw: RawCullDraw = bytemuck::Zeroable::zeroed();
+		draw.bounds_min = [-0.5; 3];
+		draw.bounds_max = [0.5; 3];
+		draw.first_output = 1;
+		draw.inv_scale = [1.0; 3];
+		draw.instance_count = 3;
+		// Instances from 1 away from the camera at the origin use the LOD.
+		draw.lod_count = 1;
+		draw.lod_distances[0] = 1.0;
+		let args = [RawDrawIndexedIndirect {
+			index_count: 36,
+			instance_count: 0,
+			first_index: 0,
+			base_vertex: 0,
+			first_instance: 1,
+		}; 2];
+		let mut buffer = |data: &[u8]| {
+			let handle = hardware.create_buffer("test", data.len() as u64);
+			hardware.write_buffer(handle, data);
+			handle
+		};
+		let dispatch = CullDispatch {
+			frustum: buffer(bytemuck::bytes_of(&frustum)),
+			instances: buffer(bytemuck::cast_slice(&instances)),
+			ranges: buffer(bytemuck::cast_slice(&ranges)),
+			draws: buffer(bytemuck::bytes_of(&draw)),
+			args: buffer(bytemuck::cast_slice(&args)),
+			output: buffer(&[0; 7 * 48]),
+			item_count: 3,
+		};
+		cull_instances(&mut hardware.buffers, &dispatch);
+		let args = hardware.buffers[&dispatch.args.id].bytes();
+		let counts = [0, 1].map(|i| read::<RawDrawIndexedIndirect>(args, i * 20).unwrap().instance_count);
+		assert_eq!(counts, [1, 1]);
+		let output = hardware.buffers[&dispatch.output.id].bytes();
+		let visible: Vec<RawInstance> = [1, 4].iter().map(|i| read(output, i * 48).unwrap()).collect();
+		assert_eq!(visible[0].rows, instances[1].rows);
+		assert_eq!(visible[1].rows, instances[3].rows);
+	}
+}
@@ -0,0 +1,4 @@
+mod shading;
+mod raster;
+mod hardware;
+pub use hardware::SoftwareHardware;
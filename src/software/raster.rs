@@ -0,0 +1,627 @@
+use std::sync::Mutex;
+
+use glam::Vec4;
+
+use super::shading::ClipVertex;
+use super::shading::Geometry;
+use super::shading::Shader;
+use super::shading::ShaderKind;
+use super::shading::Varyings;
+use super::shading::pack_color;
+use super::shading::VARYINGS;
+
+/// Side of the square tiles the target is split into. Each tile is
+/// rasterized by one thread, with its own color and depth rows.
+pub const TILE_SIZE: u32 = 64;
+/// Pixels of a row the edge functions are evaluated for at once. The lane
+/// loops are plain arrays so they compile to vector instructions.
+const LANES: usize = 8;
+/// Triangles of a geometry job, so one big draw still spreads over the
+/// threads.
+const JOB_TRIANGLES: u32 = 1024;
+/// Below this many triangles the geometry stage stays on the calling
+/// thread.
+const PARALLEL_TRIANGLES: u32 = 256;
+/// Subpixel precision vertices are snapped to, as on GPUs.
+const SUBPIXELS: f32 = 256.0;
+/// Triangles are clipped to this many times the viewport around its
+/// center, so snapped coordinates stay small enough for exact integer
+/// edge functions.
+const GUARD_BAND: f32 = 4.0;
+
+pub struct Tile {
+	x: u32,
+	y: u32,
+	width: u32,
+	height: u32,
+	color: Vec<u32>,
+	depth: Vec<f32>,
+}
+
+/// Color and depth target stored tile by tile.
+pub struct Framebuffer {
+	pub width: u32,
+	pub height: u32,
+	tiles_x: u32,
+	tiles: Vec<Tile>,
+}
+
+impl Framebuffer {
+	pub fn new(width: u32, height: u32) -> Self {
+		let tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+		let tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+		let mut tiles = Vec::with_capacity((tiles_x * tiles_y) as usize);
+		for ty in 0..tiles_y {
+			for tx in 0..tiles_x {
+				let x = tx * TILE_SIZE;
+				let y = ty * TILE_SIZE;
+				let tile_width = TILE_SIZE.min(width - x);
+				let tile_height = TILE_SIZE.min(height - y);
+				let count = (tile_width * tile_height) as usize;
+				tiles.push(Tile {
+					x,
+					y,
+					width: tile_width,
+					height: tile_height,
+					color: vec![0; count],
+					depth: vec![1.0; count],
+				});
+			}
+		}
+		Self { width, height, tiles_x, tiles }
+	}
+
+	pub fn clear(&mut self, color: Option<u32>, depth: Option<f32>) {
+		for tile in &mut self.tiles {
+			if let Some(color) = color {
+				tile.color.fill(color);
+			}
+			if let Some(depth) = depth {
+				tile.depth.fill(depth);
+			}
+		}
+	}
+
+	/// RGBA8 rows of the whole target.
+	pub fn pixels(&self) -> Vec<u8> {
+		let mut pixels = vec![0; (self.width * self.height * 4) as usize];
+		for tile in &self.tiles {
+			for row in 0..tile.height {
+				let start = (((tile.y + row) * self.width + tile.x) * 4) as usize;
+				let colors = &tile.color[(row * tile.width) as usize..((row + 1) * tile.width) as usize];
+				for (pixel, color) in pixels[start..start + (tile.width * 4) as usize].chunks_exact_mut(4).zip(colors) {
+					pixel.copy_from_slice(&color.to_le_bytes());
+				}
+			}
+		}
+		pixels
+	}
+}
+
+/// A draw ready for the rasterizer.
+pub struct Draw<'a> {
+	pub shader: Shader<'a>,
+	pub geometry: Geometry<'a>,
+	/// Pixel rect clip space maps to, x, y, width and height from the top
+	/// left.
+	pub viewport: [u32; 4],
+	/// Pixel rect the draw is cut to, inside the viewport.
+	pub scissor: [u32; 4],
+}
+
+/// Triangle set up for rasterization in screen space.
+struct Triangle {
+	draw: u32,
+	/// Covered pixels, x0, y0, x1, y1 with the ends exclusive.
+	bounds: [u32; 4],
+	/// Barycentric weight of each vertex as a * x + b * y + c.
+	edges: [[f32; 3]; 3],
+	/// The same edge functions in subpixels, exact for the snapped
+	/// vertices, so both triangles of a shared edge agree on the pixel
+	/// centers on it. Covered where all three are >= 0, edges other than
+	/// top and left ones are biased by -1 so their centers are left out.
+	coverage: [[i64; 3]; 3],
+	z: [f32; 3],
+	inv_w: [f32; 3],
+	/// Varyings divided by w, interpolated linearly in screen space.
+	varyings: [Varyings; 3],
+}
+
+/// Triangles a geometry worker set up and the ones touching each tile, in
+/// submission order.
+struct Bins {
+	triangles: Vec<Triangle>,
+	tiles: Vec<Vec<u32>>,
+}
+
+/// Triangles `triangles` of one instance of a draw.
+#[derive(Clone)]
+struct Job {
+	draw: u32,
+	instance: u32,
+	triangles: std::ops::Range<u32>,
+}
+
+/// Rasterizes draws in order into the target. Triangles are set up and
+/// binned to tiles on up to `threads` threads, then the tiles are shaded
+/// in parallel, each walking the bins in submission order so draws keep
+/// overwriting each other like on the GPU.
+pub fn draw(framebuffer: &mut Framebuffer, draws: &[Draw], threads: usize) {
+	let mut jobs = Vec::new();
+	let mut total = 0;
+	for (i, draw) in draws.iter().enumerate() {
+		let count = draw.geometry.triangle_count();
+		for instance in draw.geometry.instances.clone() {
+			let mut start = 0;
+			while start < count {
+				let end = (start + JOB_TRIANGLES).min(count);
+				jobs.push(Job {
+					draw: i as u32,
+					instance,
+					triangles: start..end,
+				});
+				start = end;
+			}
+			total += count;
+		}
+	}
+	if jobs.is_empty() {
+		return;
+	}
+
+	let threads = threads.max(1);
+	let tiles_x = framebuffer.tiles_x;
+	let tile_count = framebuffer.tiles.len();
+	let workers = if total < PARALLEL_TRIANGLES { 1 } else { threads.min(jobs.len()) };
+	let bins: Vec<Bins> = if workers == 1 {
+		vec![setup(draws, &jobs, tiles_x, tile_count)]
+	} else {
+		// Contiguous runs of jobs of about the same triangle count, so the
+		// bins of worker 0 come before the bins of worker 1.
+		let per_worker = (total as usize + workers - 1) / workers;
+		let mut groups: Vec<&[Job]> = Vec::new();
+		let mut start = 0;
+		let mut count = 0;
+		for (i, job) in jobs.iter().enumerate() {
+			count += job.triangles.len();
+			if count >= per_worker {
+				groups.push(&jobs[start..=i]);
+				start = i + 1;
+				count = 0;
+			}
+		}
+		if start < jobs.len() {
+			groups.push(&jobs[start..]);
+		}
+		std::thread::scope(|scope| {
+			let handles: Vec<_> = groups.iter().map(|group| scope.spawn(move || setup(draws, group, tiles_x, tile_count))).collect();
+			handles.into_iter().map(|handle| handle.join().unwrap()).collect()
+		})
+	};
+
+	let busy: Vec<usize> = (0..tile_count).filter(|&i| bins.iter().any(|b| !b.tiles[i].is_empty())).collect();
+	let mut tiles: Vec<(usize, &mut Tile)> = framebuffer.tiles.iter_mut().enumerate().filter(|(i, _)| busy.binary_search(i).is_ok()).collect();
+	let rasterize = |index: usize, tile: &mut Tile| {
+		for worker in &bins {
+			for &triangle in &worker.tiles[index] {
+				let triangle = &worker.triangles[triangle as usize];
+				raster_triangle(tile, triangle, &draws[triangle.draw as usize].shader);
+			}
+		}
+	};
+	if threads == 1 || tiles.len() == 1 {
+		for (index, tile) in tiles {
+			rasterize(index, tile);
+		}
+		return;
+	}
+	let workers = threads.min(tiles.len());
+	let queue = Mutex::new(tiles.iter_mut());
+	std::thread::scope(|scope| {
+		for _ in 0..workers {
+			scope.spawn(|| loop {
+				let next = queue.lock().unwrap().next();
+				match next {
+					Some((index, tile)) => rasterize(*index, tile),
+					None => break,
+				}
+			});
+		}
+	});
+}
+
+/// Geometry stage of a run of jobs: vertex shading, clipping and binning.
+fn setup(draws: &[Draw], jobs: &[Job], tiles_x: u32, tile_count: usize) -> Bins {
+	let mut bins = Bins {
+		triangles: Vec::new(),
+		tiles: vec![Vec::new(); tile_count],
+	};
+	for job in jobs {
+		let draw = &draws[job.draw as usize];
+		let rows = match draw.geometry.instance(job.instance) {
+			Some(rows) => rows,
+			None => continue,
+		};
+		for triangle in job.triangles.clone() {
+			let vertex = |i: u32| draw.geometry.vertex(&draw.shader.camera, &rows, triangle * 3 + i);
+			let (a, b, c) = match (vertex(0), vertex(1), vertex(2)) {
+				(Some(a), Some(b), Some(c)) => (a, b, c),
+				_ => continue,
+			};
+			let inside = |v: &ClipVertex| CLIP_PLANES.iter().all(|plane| plane(&v.position) >= 0.0);
+			if inside(&a) && inside(&b) && inside(&c) {
+				bins.push(setup_triangle(job.draw, draw.viewport, draw.scissor, [&a, &b, &c]), tiles_x);
+				continue;
+			}
+			let polygon = clip_polygon(&[a, b, c]);
+			for i in 1..polygon.len().saturating_sub(1) {
+				bins.push(setup_triangle(job.draw, draw.viewport, draw.scissor, [&polygon[0], &polygon[i], &polygon[i + 1]]), tiles_x);
+			}
+		}
+	}
+	bins
+}
+
+impl Bins {
+	fn push(&mut self, triangle: Option<Triangle>, tiles_x: u32) {
+		let triangle = match triangle {
+			Some(triangle) => triangle,
+			None => return,
+		};
+		let index = self.triangles.len() as u32;
+		let [x0, y0, x1, y1] = triangle.bounds;
+		for ty in y0 / TILE_SIZE..=(y1 - 1) / TILE_SIZE {
+			for tx in x0 / TILE_SIZE..=(x1 - 1) / TILE_SIZE {
+				self.tiles[(ty * tiles_x + tx) as usize].push(index);
+			}
+		}
+		self.triangles.push(triangle);
+	}
+}
+
+fn lerp_vertex(a: &ClipVertex, b: &ClipVertex, t: f32) -> ClipVertex {
+	let mut varyings = [0.0; VARYINGS];
+	for k in 0..VARYINGS {
+		varyings[k] = a.varyings[k] + (b.varyings[k] - a.varyings[k]) * t;
+	}
+	ClipVertex {
+		position: a.position.lerp(b.position, t),
+		varyings,
+	}
+}
+
+/// Near and far planes, 0 <= z <= w, and the guard band. Inside the band
+/// the sides are left to the scissor.
+const CLIP_PLANES: [fn(&Vec4) -> f32; 6] = [
+	|p| p.z,
+	|p| p.w - p.z,
+	|p| p.w * GUARD_BAND + p.x,
+	|p| p.w * GUARD_BAND - p.x,
+	|p| p.w * GUARD_BAND + p.y,
+	|p| p.w * GUARD_BAND - p.y,
+];
+
+/// Clips a triangle to `CLIP_PLANES`.
+fn clip_polygon(triangle: &[ClipVertex; 3]) -> Vec<ClipVertex> {
+	let mut polygon = triangle.to_vec();
+	for plane in CLIP_PLANES {
+		if polygon.iter().all(|v| plane(&v.position) >= 0.0) {
+			continue;
+		}
+		let mut clipped = Vec::with_capacity(polygon.len() + 1);
+		for i in 0..polygon.len() {
+			let a = &polygon[i];
+			let b = &polygon[(i + 1) % polygon.len()];
+			let (da, db) = (plane(&a.position), plane(&b.position));
+			if da >= 0.0 {
+				clipped.push(*a);
+			}
+			if (da >= 0.0) != (db >= 0.0) {
+				clipped.push(lerp_vertex(a, b, da / (da - db)));
+			}
+		}
+		polygon = clipped;
+	}
+	polygon
+}
+
+fn setup_triangle(draw: u32, viewport: [u32; 4], scissor: [u32; 4], vertices: [&ClipVertex; 3]) -> Option<Triangle> {
+	let [vx, vy, vw, vh] = viewport.map(|v| v as f32);
+	let mut screen = [[0.0f32; 2]; 3];
+	let mut snapped = [[0i64; 2]; 3];
+	let mut z = [0.0; 3];
+	let mut inv_w = [0.0; 3];
+	let mut varyings = [[0.0; VARYINGS]; 3];
+	for (i, vertex) in vertices.iter().enumerate() {
+		let p = vertex.position;
+		if p.w <= 0.0 {
+			return None;
+		}
+		inv_w[i] = 1.0 / p.w;
+		let x = vx + (p.x * inv_w[i] * 0.5 + 0.5) * vw;
+		let y = vy + (0.5 - p.y * inv_w[i] * 0.5) * vh;
+		snapped[i] = [(x * SUBPIXELS).round() as i64, (y * SUBPIXELS).round() as i64];
+		screen[i] = [snapped[i][0] as f32 / SUBPIXELS, snapped[i][1] as f32 / SUBPIXELS];
+		z[i] = p.z * inv_w[i];
+		for k in 0..VARYINGS {
+			varyings[i][k] = vertex.varyings[k] * inv_w[i];
+		}
+	}
+	let [p0, p1, p2] = screen;
+	let area = (p1[0] - p0[0]) * (p2[1] - p0[1]) - (p1[1] - p0[1]) * (p2[0] - p0[0]);
+	if !area.is_finite() || area.abs() < 1e-8 {
+		return None;
+	}
+	// Weight of a vertex from the edge across it, in the same order.
+	let edge = |a: [f32; 2], b: [f32; 2]| {
+		let dx = b[0] - a[0];
+		let dy = b[1] - a[1];
+		[-dy / area, dx / area, (dy * a[0] - dx * a[1]) / area]
+	};
+	let edges = [edge(p1, p2), edge(p2, p0), edge(p0, p1)];
+	// Inside the guard band coordinates are below 2^25 subpixels, so the
+	// products stay far from overflowing.
+	let [s0, s1, s2] = snapped;
+	let sign = if area < 0.0 { -1 } else { 1 };
+	let coverage_edge = |a: [i64; 2], b: [i64; 2]| {
+		let dx = (b[0] - a[0]) * sign;
+		let dy = (b[1] - a[1]) * sign;
+		// Left edges have the inside to their right, top edges are flat
+		// with the inside below, y pointing down.
+		let top_left = -dy > 0 || (dy == 0 && dx > 0);
+		[-dy, dx, dy * a[0] - dx * a[1] - if top_left { 0 } else { 1 }]
+	};
+	let coverage = [coverage_edge(s1, s2), coverage_edge(s2, s0), coverage_edge(s0, s1)];
+
+	let min_x = p0[0].min(p1[0]).min(p2[0]);
+	let max_x = p0[0].max(p1[0]).max(p2[0]);
+	let min_y = p0[1].min(p1[1]).min(p2[1]);
+	let max_y = p0[1].max(p1[1]).max(p2[1]);
+	// Pixels whose centers are inside the bounds, within the scissor.
+	let first = |v: f32, start: u32, end: u32| ((v - 0.5).ceil().max(start as f32) as u32).min(end);
+	let last = |v: f32, start: u32, end: u32| (((v - 0.5).floor() + 1.0).max(start as f32) as u32).min(end);
+	let x0 = first(min_x, scissor[0], scissor[0] + scissor[2]);
+	let x1 = last(max_x, scissor[0], scissor[0] + scissor[2]);
+	let y0 = first(min_y, scissor[1], scissor[1] + scissor[3]);
+	let y1 = last(max_y, scissor[1], scissor[1] + scissor[3]);
+	if x1 <= x0 || y1 <= y0 {
+		return None;
+	}
+	Some(Triangle {
+		draw,
+		bounds: [x0, y0, x1, y1],
+		edges,
+		coverage,
+		z,
+		inv_w,
+		varyings,
+	})
+}
+
+/// Integer edge function `e` at the center of a pixel.
+fn coverage_at(triangle: &Triangle, e: usize, x: u32, y: u32) -> i64 {
+	let subpixels = SUBPIXELS as i64;
+	let [a, b, c] = triangle.coverage[e];
+	a * (x as i64 * subpixels + subpixels / 2) + b * (y as i64 * subpixels + subpixels / 2) + c
+}
+
+/// Perspective correct varyings at barycentric weights.
+fn interpolate(triangle: &Triangle, w: [f32; 3]) -> Varyings {
+	let inv_w = w[0] * triangle.inv_w[0] + w[1] * triangle.inv_w[1] + w[2] * triangle.inv_w[2];
+	let scale = 1.0 / inv_w;
+	let [a, b, c] = &triangle.varyings;
+	let mut out = [0.0; VARYINGS];
+	for k in 0..VARYINGS {
+		out[k] = (w[0] * a[k] + w[1] * b[k] + w[2] * c[k]) * scale;
+	}
+	out
+}
+
+fn weights(triangle: &Triangle, x: f32, y: f32) -> [f32; 3] {
+	triangle.edges.map(|[a, b, c]| a * x + b * y + c)
+}
+
+fn raster_triangle(tile: &mut Tile, triangle: &Triangle, shader: &Shader) {
+	let x0 = triangle.bounds[0].max(tile.x);
+	let x1 = triangle.bounds[2].min(tile.x + tile.width);
+	let y0 = triangle.bounds[1].max(tile.y);
+	let y1 = triangle.bounds[3].min(tile.y + tile.height);
+	if x1 <= x0 || y1 <= y0 {
+		return;
+	}
+	let kind = shader.kind;
+	let derivatives = shader.needs_derivatives();
+	let zero = [0.0; VARYINGS];
+	// Edge functions step by `a` subpixels a pixel, these are the steps
+	// from the first lane to the others.
+	let lane_steps: [[i64; LANES]; 3] = std::array::from_fn(|e| {
+		std::array::from_fn(|lane| triangle.coverage[e][0] * SUBPIXELS as i64 * lane as i64)
+	});
+	for y in y0..y1 {
+		let py = y as f32 + 0.5;
+		let row = ((y - tile.y) * tile.width) as usize;
+		let mut x = x0;
+		while x < x1 {
+			let mut lanes = [[0.0f32; LANES]; 3];
+			let mut depth = [0.0f32; LANES];
+			let mut covered = [false; LANES];
+			let first = [coverage_at(triangle, 0, x, y), coverage_at(triangle, 1, x, y), coverage_at(triangle, 2, x, y)];
+			for lane in 0..LANES {
+				let px = (x + lane as u32) as f32 + 0.5;
+				for e in 0..3 {
+					let [a, b, c] = triangle.edges[e];
+					lanes[e][lane] = a * px + b * py + c;
+				}
+				depth[lane] = lanes[0][lane] * triangle.z[0] + lanes[1][lane] * triangle.z[1] + lanes[2][lane] * triangle.z[2];
+				covered[lane] = x + (lane as u32) < x1
+					&& first[0] + lane_steps[0][lane] >= 0
+					&& first[1] + lane_steps[1][lane] >= 0
+					&& first[2] + lane_steps[2][lane] >= 0;
+			}
+			for lane in 0..LANES {
+				if !covered[lane] {
+					continue;
+				}
+				let i = row + (x + lane as u32 - tile.x) as usize;
+				let z = depth[lane];
+				// LessEqual for the 3D pipelines so draws after a depth
+				// pre-pass pass, Less for the pre-pass, none for the GUI.
+				let passes = match kind {
+					ShaderKind::Mesh => z <= tile.depth[i],
+					ShaderKind::Depth => z < tile.depth[i],
+					ShaderKind::Gui => true,
+				};
+				if !passes || (kind.uses_depth() && !(0.0..=1.0).contains(&z)) {
+					continue;
+				}
+				if kind.uses_depth() {
+					tile.depth[i] = z;
+				}
+				if !kind.uses_color() {
+					continue;
+				}
+				let w = [lanes[0][lane], lanes[1][lane], lanes[2][lane]];
+				let varyings = interpolate(triangle, w);
+				let color = if derivatives {
+					let px = (x + lane as u32) as f32 + 0.5;
+					let right = interpolate(triangle, weights(triangle, px + 1.0, py));
+					let below = interpolate(triangle, weights(triangle, px, py + 1.0));
+					let ddx = std::array::from_fn(|k| right[k] - varyings[k]);
+					let ddy = std::array::from_fn(|k| below[k] - varyings[k]);
+					shader.shade(&varyings, &ddx, &ddy)
+				} else {
+					shader.shade(&varyings, &zero, &zero)
+				};
+				tile.color[i] = pack_color(color);
+			}
+			x += LANES as u32;
+		}
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+	use crate::hardware::MaterialFeatures;
+	use crate::internal_types::RawMaterial;
+	use super::super::shading::Texture;
+	use super::super::shading::VertexLayout;
+	use glam::Mat4;
+
+	fn gui_draw<'a>(positions: &'a [f32], colors: &'a [f32], indices: &'a [u16], viewport: [u32; 4]) -> Draw<'a> {
+		Draw {
+			shader: Shader {
+				kind: ShaderKind::Gui,
+				features: MaterialFeatures::NONE,
+				material: RawMaterial::default(),
+				textures: [None; 5],
+				camera: Mat4::IDENTITY,
+				lights: &[],
+			},
+			geometry: Geometry {
+				layout: VertexLayout::Gui,
+				vertices: bytemuck::cast_slice(positions),
+				attributes: bytemuck::cast_slice(colors),
+				indices: bytemuck::cast_slice(indices),
+				index_range: 0..indices.len() as u32,
+				base_vertex: 0,
+				instances: 0..1,
+			},
+			viewport,
+			scissor: viewport,
+		}
+	}
+
+	#[test]
+	fn test_quads_cover_their_pixels_once() {
+		// Two quads splitting a target spanning tiles. Their shared edge and
+		// diagonals run through pixel centers.
+		let (width, height) = (101, 70);
+		let left = [-1.0, 1.0, 0.0, 0.0, 1.0, 0.0, 0.0, -1.0, 0.0, -1.0, -1.0, 0.0];
+		let right = [0.0, 1.0, 0.0, 1.0, 1.0, 0.0, 1.0, -1.0, 0.0, 0.0, -1.0, 0.0];
+		let (white, grey) = ([1.0; 12], [0.5; 12]);
+		let indices = [0, 1, 2, 0, 2, 3];
+		let viewport = [0, 0, width, height];
+		let draws = [gui_draw(&left, &white, &indices, viewport), gui_draw(&right, &grey, &indices, viewport)];
+
+		let jobs: Vec<_> = (0..2).map(|draw| Job { draw, instance: 0, triangles: 0..2 }).collect();
+		let target = Framebuffer::new(width, height);
+		let bins = setup(&draws, &jobs, target.tiles_x, target.tiles.len());
+		assert_eq!(bins.triangles.len(), 4);
+		for y in 0..height {
+			for x in 0..width {
+				let count = bins.triangles.iter().filter(|triangle| (0..3).all(|e| coverage_at(triangle, e, x, y) >= 0)).count();
+				assert_eq!(count, 1, "pixel {},{}", x, y);
+			}
+		}
+
+		for threads in [1, 4] {
+			let mut framebuffer = Framebuffer::new(width, height);
+			framebuffer.clear(Some(0), None);
+			draw(&mut framebuffer, &draws, threads);
+			let pixels = framebuffer.pixels();
+			for y in 0..height {
+				for x in 0..width {
+					let red = pixels[((y * width + x) * 4) as usize];
+					assert_eq!(red == 255, x < 50, "pixel {},{}", x, y);
+					assert_ne!(red, 0, "pixel {},{}", x, y);
+				}
+			}
+		}
+	}
+
+	#[test]
+	fn test_depth_keeps_the_nearest_triangle() {
+		let (width, height) = (8, 8);
+		let quad = |z: f32| [-1.0, 1.0, z, 1.0, 1.0, z, 1.0, -1.0, z, -1.0, -1.0, z];
+		let (near, far) = (quad(0.2), quad(0.8));
+		let colors = [0.0; 12];
+		let indices = [0, 1, 2, 0, 2, 3];
+		let white = Texture::new(&[255; 4], 1, 1);
+		// Unlit meshes only show their emissive color, which needs an
+		// emissive texture.
+		let mesh = |positions, emissive| {
+			let mut draw = gui_draw(positions, &colors, &indices, [0, 0, width, height]);
+			draw.shader.kind = ShaderKind::Mesh;
+			draw.shader.features = MaterialFeatures::EMISSIVE_TEXTURE;
+			draw.shader.textures[4] = Some(&white);
+			draw.shader.material.emissive_factor = emissive;
+			draw
+		};
+		for (first, second, expected) in [(&near, &far, 255), (&far, &near, 0)] {
+			let draws = [mesh(first, [1.0, 0.0, 0.0]), mesh(second, [0.0, 1.0, 0.0])];
+			let mut framebuffer = Framebuffer::new(width, height);
+			framebuffer.clear(Some(0), Some(1.0));
+			draw(&mut framebuffer, &draws, 2);
+			assert!(framebuffer.tiles[0].depth.iter().all(|&z| (z - 0.2).abs() < 1e-6));
+			assert!(framebuffer.pixels().chunks(4).all(|p| p[0] == expected && p[1] == 255 - expected));
+		}
+
+		let mut untextured = mesh(&near, [1.0, 1.0, 1.0]);
+		untextured.shader.features = MaterialFeatures::NONE;
+		let mut framebuffer = Framebuffer::new(width, height);
+		framebuffer.clear(Some(0), Some(1.0));
+		draw(&mut framebuffer, &[untextured], 1);
+		assert!(framebuffer.pixels().chunks(4).all(|p| p[0] == 0 && p[1] == 0));
+	}
+
+	#[test]
+	fn test_scissor_cuts_the_viewport() {
+		let (width, height) = (16, 8);
+		let quad = [-1.0, 1.0, 0.0, 1.0, 1.0, 0.0, 1.0, -1.0, 0.0, -1.0, -1.0, 0.0];
+		let colors = [1.0; 12];
+		let indices = [0, 1, 2, 0, 2, 3];
+		let mut quad_draw = gui_draw(&quad, &colors, &indices, [0, 0, width, height]);
+		quad_draw.scissor = [4, 2, 8, 4];
+		let mut framebuffer = Framebuffer::new(width, height);
+		framebuffer.clear(Some(0), None);
+		draw(&mut framebuffer, &[quad_draw], 1);
+		let pixels = framebuffer.pixels();
+		for y in 0..height {
+			for x in 0..width {
+				let inside = (4..12).contains(&x) && (2..6).contains(&y);
+				assert_eq!(pixels[((y * width + x) * 4) as usize] == 255, inside, "pixel {},{}", x, y);
+			}
+		}
+	}
+}
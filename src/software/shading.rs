@@ -0,0 +1,375 @@
+use std::ops::Range;
+use std::sync::OnceLock;
+
+use glam::Mat3;
+use glam::Mat4;
+use glam::Vec2;
+use glam::Vec3;
+use glam::Vec4;
+
+use crate::hardware::MaterialFeatures;
+use crate::internal_types::RawMaterial;
+use crate::vertex_format::f16_to_f32;
+use crate::vertex_format::oct_decode;
+use crate::vertex_format::transform_normal;
+
+/// Interpolated vertex outputs: world position, normal and uvs of mesh
+/// draws, the color of GUI draws.
+pub const VARYINGS: usize = 8;
+pub type Varyings = [f32; VARYINGS];
+
+/// Words before the light data in `LightClusters`.
+const LIGHT_HEADER_WORDS: usize = 8;
+const LIGHT_WORDS: usize = 8;
+
+/// Reads a value at a byte offset, None when it runs past the end.
+pub fn read<T: bytemuck::Pod>(bytes: &[u8], offset: usize) -> Option<T> {
+	bytes.get(offset..offset + std::mem::size_of::<T>()).map(bytemuck::pod_read_unaligned)
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum ShaderKind {
+	Gui,
+	Mesh,
+	Depth,
+}
+
+impl ShaderKind {
+	/// Picks the shader by pipeline name like the wgpu pipeline cache.
+	pub fn from_name(name: &str) -> Self {
+		if name == "gui" {
+			Self::Gui
+		} else if name.starts_with("depth_prepass") {
+			Self::Depth
+		} else {
+			Self::Mesh
+		}
+	}
+
+	pub fn uses_color(self) -> bool {
+		self != Self::Depth
+	}
+
+	pub fn uses_depth(self) -> bool {
+		self != Self::Gui
+	}
+}
+
+/// RGBA8 texture sampled like the wgpu backend's samplers: bilinear and
+/// repeating.
+pub struct Texture {
+	pub width: u32,
+	pub height: u32,
+	pub pixels: Vec<u8>,
+}
+
+impl Texture {
+	pub fn new(data: &[u8], width: u32, height: u32) -> Self {
+		let mut pixels = data.to_vec();
+		pixels.resize((width * height * 4) as usize, 255);
+		Self { width, height, pixels }
+	}
+
+	pub fn write(&mut self, x: u32, y: u32, width: u32, height: u32, data: &[u8]) {
+		if x + width > self.width || y + height > self.height || data.len() < (width * height * 4) as usize {
+			log::error!("Texture write of {}x{} at {},{} out of bounds", width, height, x, y);
+			return;
+		}
+		for row in 0..height {
+			let src = (row * width * 4) as usize;
+			let dst = (((y + row) * self.width + x) * 4) as usize;
+			self.pixels[dst..dst + (width * 4) as usize].copy_from_slice(&data[src..src + (width * 4) as usize]);
+		}
+	}
+
+	fn texel(&self, x: i64, y: i64) -> Vec4 {
+		let x = x.rem_euclid(self.width as i64) as usize;
+		let y = y.rem_euclid(self.height as i64) as usize;
+		let i = (y * self.width as usize + x) * 4;
+		let p = &self.pixels[i..i + 4];
+		Vec4::new(p[0] as f32, p[1] as f32, p[2] as f32, p[3] as f32) / 255.0
+	}
+
+	pub fn sample(&self, uv: Vec2) -> Vec4 {
+		if self.width == 0 || self.height == 0 {
+			return Vec4::ONE;
+		}
+		let x = uv.x * self.width as f32 - 0.5;
+		let y = uv.y * self.height as f32 - 0.5;
+		let (x0, y0) = (x.floor(), y.floor());
+		let (fx, fy) = (x - x0, y - y0);
+		let (x0, y0) = (x0 as i64, y0 as i64);
+		let top = self.texel(x0, y0).lerp(self.texel(x0 + 1, y0), fx);
+		let bottom = self.texel(x0, y0 + 1).lerp(self.texel(x0 + 1, y0 + 1), fx);
+		top.lerp(bottom, fy)
+	}
+}
+
+fn linear_to_srgb(v: f32) -> f32 {
+	if v <= 0.0031308 {
+		v * 12.92
+	} else {
+		1.055 * v.powf(1.0 / 2.4) - 0.055
+	}
+}
+
+const SRGB_STEPS: usize = 4096;
+
+/// Packs a linear color as the RGBA8 sRGB bytes the wgpu backend's
+/// Bgra8UnormSrgb targets store, alpha left linear.
+pub fn pack_color(color: Vec4) -> u32 {
+	static SRGB: OnceLock<Vec<u8>> = OnceLock::new();
+	let table = SRGB.get_or_init(|| {
+		(0..SRGB_STEPS).map(|i| (linear_to_srgb(i as f32 / (SRGB_STEPS - 1) as f32) * 255.0).round() as u8).collect()
+	});
+	let encode = |v: f32| table[(v.clamp(0.0, 1.0) * (SRGB_STEPS - 1) as f32).round() as usize] as u32;
+	let alpha = (color.w.clamp(0.0, 1.0) * 255.0).round() as u32;
+	encode(color.x) | encode(color.y) << 8 | encode(color.z) << 16 | alpha << 24
+}
+
+/// Vertex layouts of the pipelines, see `wgpu_types`.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum VertexLayout {
+	/// `RawVertex`.
+	Interleaved,
+	/// `RawQuantizedVertex`.
+	Quantized,
+	/// Clip space positions and colors in two buffers of f32x3.
+	Gui,
+}
+
+/// Vertex after the vertex stage.
+#[derive(Debug, Clone, Copy)]
+pub struct ClipVertex {
+	pub position: Vec4,
+	pub varyings: Varyings,
+}
+
+/// The buffers and arguments of one indexed draw.
+pub struct Geometry<'a> {
+	pub layout: VertexLayout,
+	pub vertices: &'a [u8],
+	/// Second vertex buffer: instances of mesh draws, colors of GUI draws.
+	pub attributes: &'a [u8],
+	/// u16 indices.
+	pub indices: &'a [u8],
+	pub index_range: Range<u32>,
+	pub base_vertex: i32,
+	pub instances: Range<u32>,
+}
+
+impl<'a> Geometry<'a> {
+	pub fn triangle_count(&self) -> u32 {
+		self.index_range.len() as u32 / 3
+	}
+
+	/// Rows of the instance transform. GUI draws have none.
+	pub fn instance(&self, instance: u32) -> Option<[Vec4; 3]> {
+		if self.layout == VertexLayout::Gui {
+			return Some([Vec4::X, Vec4::Y, Vec4::Z]);
+		}
+		let rows: [[f32; 4]; 3] = read(self.attributes, instance as usize * 48)?;
+		Some(rows.map(Vec4::from_array))
+	}
+
+	/// Runs the vertex stage for the `i`th index of the draw.
+	pub fn vertex(&self, camera: &Mat4, rows: &[Vec4; 3], i: u32) -> Option<ClipVertex> {
+		let index: u16 = read(self.indices, (self.index_range.start + i) as usize * 2)?;
+		let vertex = usize::try_from(index as i64 + self.base_vertex as i64).ok()?;
+		let (position, normal, tex_coords) = match self.layout {
+			VertexLayout::Gui => {
+				let position: [f32; 3] = read(self.vertices, vertex * 12)?;
+				let color: [f32; 3] = read(self.attributes, vertex * 12)?;
+				let mut varyings = [0.0; VARYINGS];
+				varyings[..3].copy_from_slice(&color);
+				return Some(ClipVertex {
+					position: Vec3::from_array(position).extend(1.0),
+					varyings,
+				});
+			}
+			VertexLayout::Interleaved => {
+				let position: [f32; 3] = read(self.vertices, vertex * 20)?;
+				let normal: [i16; 2] = read(self.vertices, vertex * 20 + 12)?;
+				let tex_coords: [u16; 2] = read(self.vertices, vertex * 20 + 16)?;
+				(Vec3::from_array(position), normal, tex_coords)
+			}
+			VertexLayout::Quantized => {
+				let position: [u16; 4] = read(self.vertices, vertex * 16)?;
+				let normal: [i16; 2] = read(self.vertices, vertex * 16 + 8)?;
+				let tex_coords: [u16; 2] = read(self.vertices, vertex * 16 + 12)?;
+				let position = Vec3::new(position[0] as f32, position[1] as f32, position[2] as f32) / 65535.0;
+				(position, normal, tex_coords)
+			}
+		};
+		let position = position.extend(1.0);
+		let world = Vec3::new(rows[0].dot(position), rows[1].dot(position), rows[2].dot(position));
+		let linear = Mat3::from_cols(
+			Vec3::new(rows[0].x, rows[1].x, rows[2].x),
+			Vec3::new(rows[0].y, rows[1].y, rows[2].y),
+			Vec3::new(rows[0].z, rows[1].z, rows[2].z),
+		);
+		let normal = transform_normal(&linear, Vec3::from_array(oct_decode(normal)));
+		Some(ClipVertex {
+			position: *camera * world.extend(1.0),
+			varyings: [world.x, world.y, world.z, normal.x, normal.y, normal.z, f16_to_f32(tex_coords[0]), f16_to_f32(tex_coords[1])],
+		})
+	}
+}
+
+/// Fragment state of a draw, the bindings of 3d_shader.wgsl.
+pub struct Shader<'a> {
+	pub kind: ShaderKind,
+	pub features: MaterialFeatures,
+	pub material: RawMaterial,
+	pub textures: [Option<&'a Texture>; 5],
+	/// View-projection of the camera.
+	pub camera: Mat4,
+	/// Words of the camera's `LightClusters`.
+	pub lights: &'a [u32],
+}
+
+impl<'a> Shader<'a> {
+	/// Whether `shade` needs the screen space derivatives of the varyings.
+	pub fn needs_derivatives(&self) -> bool {
+		self.kind == ShaderKind::Mesh && self.texture(2).is_some()
+	}
+
+	fn texture(&self, slot: usize) -> Option<&'a Texture> {
+		if !self.features.contains(MaterialFeatures(1 << slot)) {
+			return None;
+		}
+		self.textures[slot]
+	}
+
+	/// Samples a material texture, atlased ones wrapping inside their rect.
+	fn sample(&self, slot: usize, uv: Vec2) -> Option<Vec4> {
+		let texture = self.texture(slot)?;
+		let rect = self.material.uv_rects[slot];
+		let uv = if rect == [0.0, 0.0, 1.0, 1.0] {
+			uv
+		} else {
+			let fract = uv - uv.floor();
+			Vec2::new(rect[0], rect[1]) + fract * Vec2::new(rect[2], rect[3])
+		};
+		Some(texture.sample(uv))
+	}
+
+	/// Indices of the global lights and of the lights of the cluster a
+	/// world position falls into.
+	fn cluster_lights(&self, world_position: Vec3) -> (&'a [u32], &'a [u32]) {
+		let words = self.lights;
+		if words.len() < LIGHT_HEADER_WORDS || words[0] == 0 || words[1] == 0 || words[2] == 0 || words[3] == 0 {
+			return (&[], &[]);
+		}
+		let (grid_x, grid_y, grid_z, light_count) = (words[0], words[1], words[2], words[3]);
+		let near = f32::from_bits(words[4]);
+		let depth_scale = f32::from_bits(words[6]);
+		let clip = self.camera * world_position.extend(1.0);
+		let ndc = Vec2::new(clip.x, clip.y) / clip.w;
+		let x = (((ndc.x * 0.5 + 0.5) * grid_x as f32).max(0.0) as u32).min(grid_x - 1);
+		let y = (((ndc.y * 0.5 + 0.5) * grid_y as f32).max(0.0) as u32).min(grid_y - 1);
+		let z = if clip.w > near {
+			(((clip.w / near).ln() * depth_scale) as u32).min(grid_z - 1)
+		} else {
+			0
+		};
+		let data = &words[LIGHT_HEADER_WORDS..];
+		let table = light_count as usize * LIGHT_WORDS;
+		let indices = table + (grid_x * grid_y * grid_z) as usize * 2;
+		let entry = table + ((z * grid_y + y) * grid_x + x) as usize * 2;
+		let global = data.get(indices..indices + words[7] as usize).unwrap_or(&[]);
+		let (offset, count) = match (data.get(entry), data.get(entry + 1)) {
+			(Some(offset), Some(count)) => (*offset as usize, *count as usize),
+			_ => return (global, &[]),
+		};
+		(global, data.get(indices + offset..indices + offset + count).unwrap_or(&[]))
+	}
+
+	/// Tangent frame from screen space derivatives, as in the 3D shader.
+	fn perturb_normal(&self, normal: Vec3, ddx: &Varyings, ddy: &Varyings, sampled: Vec3) -> Vec3 {
+		let dp1 = Vec3::new(ddx[0], ddx[1], ddx[2]);
+		let dp2 = Vec3::new(ddy[0], ddy[1], ddy[2]);
+		let duv1 = Vec2::new(ddx[6], ddx[7]);
+		let duv2 = Vec2::new(ddy[6], ddy[7]);
+		let dp2perp = dp2.cross(normal);
+		let dp1perp = normal.cross(dp1);
+		let t = dp2perp * duv1.x + dp1perp * duv2.x;
+		let b = dp2perp * duv1.y + dp1perp * duv2.y;
+		let scale = 1.0 / t.dot(t).max(b.dot(b)).max(1e-12).sqrt();
+		let tangent_normal = Vec3::new(sampled.x * self.material.normal_texture_scale, sampled.y * self.material.normal_texture_scale, sampled.z);
+		(t * scale * tangent_normal.x + b * scale * tangent_normal.y + normal * tangent_normal.z).normalize_or_zero()
+	}
+
+	/// Color of a fragment, `fs_main` of the GUI or the 3D shader.
+	pub fn shade(&self, v: &Varyings, ddx: &Varyings, ddy: &Varyings) -> Vec4 {
+		if self.kind == ShaderKind::Gui {
+			return Vec4::new(v[0], v[1], v[2], 1.0);
+		}
+		let material = &self.material;
+		let world_position = Vec3::new(v[0], v[1], v[2]);
+		let tex_coords = Vec2::new(v[6], v[7]);
+
+		let mut base_color = Vec3::new(material.base_color_factor[0], material.base_color_factor[1], material.base_color_factor[2]);
+		if let Some(sampled) = self.sample(0, tex_coords) {
+			base_color *= sampled.truncate();
+		}
+		let mut roughness = material.roughness_factor;
+		let mut metallic = material.metallic_factor;
+		if let Some(sampled) = self.sample(1, tex_coords) {
+			roughness *= sampled.y;
+			metallic *= sampled.z;
+		}
+		// Maps only change the shading of materials that have them, as in
+		// the 3D shader.
+		let mut normal = Vec3::new(v[3], v[4], v[5]);
+		if let Some(sampled) = self.sample(2, tex_coords) {
+			normal = self.perturb_normal(normal.normalize_or_zero(), ddx, ddy, sampled.truncate() * 2.0 - 1.0);
+		}
+		let mut occlusion = 1.0;
+		if let Some(sampled) = self.sample(3, tex_coords) {
+			occlusion = 1.0 + (sampled.x - 1.0) * material.occlusion_strength;
+		}
+		let mut emissive = Vec3::ZERO;
+		if let Some(sampled) = self.sample(4, tex_coords) {
+			emissive = Vec3::from_array(material.emissive_factor) * sampled.truncate();
+		}
+
+		let data = self.lights.get(LIGHT_HEADER_WORDS..).unwrap_or(&[]);
+		let (global, lights) = self.cluster_lights(world_position);
+		let view_dir = if global.is_empty() && lights.is_empty() {
+			Vec3::ZERO
+		} else {
+			(self.camera.w_axis.truncate() - world_position).normalize_or_zero()
+		};
+		let mut diffuse = Vec3::ZERO;
+		let mut specular = Vec3::ZERO;
+		for &light in global.iter().chain(lights) {
+			let start = light as usize * LIGHT_WORDS;
+			let words = match data.get(start..start + LIGHT_WORDS) {
+				Some(words) => words,
+				None => continue,
+			};
+			let word = |i: usize| f32::from_bits(words[i]);
+			let to_light = Vec3::new(word(4), word(5), word(6)) - world_position;
+			let range = word(7);
+			let dist = to_light.length();
+			let light_dir = to_light / dist.max(0.0001);
+			let halfway_dir = (light_dir + view_dir).normalize_or_zero();
+			// Inverse square falloff windowed to reach zero at the range.
+			let mut attenuation = 1.0;
+			if range > 0.0 {
+				let r = dist / range;
+				let fade = (1.0 - r * r * r * r).clamp(0.0, 1.0);
+				attenuation = fade * fade / (1.0 + dist * dist);
+			}
+			let light_color = Vec3::new(word(0), word(1), word(2)) * word(3) * attenuation;
+			diffuse += normal.dot(light_dir).max(0.0) * light_color;
+			let ndoth = normal.dot(halfway_dir).max(0.0);
+			specular += ndoth.powf((1.0 - roughness) * 128.0) * light_color;
+		}
+
+		let reflectance = Vec3::splat(0.04).lerp(base_color, metallic);
+		let color = diffuse * base_color * occlusion + specular * reflectance + emissive;
+		color.extend(material.base_color_factor[3])
+	}
+}
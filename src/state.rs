@@ -7,6 +7,7 @@ use crate::types::*;
 use crate::utility::get_scene_bounding_box;
 use crate::GUIElement;
 use crate::Window;
+use crate::MouseArea;
 
 #[derive(Debug, Clone, Default)]
 pub struct State {
@@ -17,6 +18,7 @@ pub struct State {
     pub windows: Arena<Window>,
     pub guis: Arena<GUIElement>,
     pub point_lights: Arena<PointLight>,
+    pub labels: Arena<Label>,
     pub textures: Arena<Texture>,
     pub raycasts: Arena<RayCast>,
     pub models: Arena<Model3D>,
@@ -25,6 +27,12 @@ pub struct State {
     pub joints: Arena<Joint>,
     pub keyboard: Option<Keyboard>,
 	pub screenshot_request: Option<(ArenaId<Window>, String)>,
+	/// Taken every frame, see `CaptureRequest`.
+	pub capture_requests: Vec<CaptureRequest>,
+	/// Filled in as captures finish, drained by the app.
+	pub captured_images: Vec<CapturedImage>,
+	/// Mouse area currently under the pointer in each window.
+	pub hovered: HashMap<ArenaId<Window>, MouseArea>,
 }
 
 impl State {
@@ -68,6 +76,7 @@ impl State {
             + self.windows.mem_size()
             + self.guis.mem_size()
             + self.point_lights.mem_size()
+            + self.labels.mem_size()
             + self.textures.mem_size()
             + self.raycasts.mem_size()
             + self.joints.mem_size()
@@ -81,6 +90,7 @@ impl State {
         crate::log2!("window count: {:?}", self.windows.len());
         crate::log2!("gui count: {:?}", self.guis.len());
         crate::log2!("point light count: {:?}", self.point_lights.len());
+        crate::log2!("label count: {:?}", self.labels.len());
         crate::log2!("texture count: {:?}", self.textures.len());
         crate::log2!("raycast count: {:?}", self.raycasts.len());
         crate::log2!("joint count: {:?}", self.joints.len());
@@ -0,0 +1,161 @@
+use crate::vertex_format::pack_vertices;
+use crate::ArenaId;
+use crate::Material;
+use crate::Mesh;
+use crate::Node;
+use crate::Primitive;
+use crate::PrimitiveTopology;
+
+/// Meshes used by more nodes than this are left to instancing.
+pub const STATIC_BATCH_MAX_INSTANCES: usize = 8;
+/// Indices are u16 so a batch can't address more vertices than this.
+const MAX_BATCH_VERTICES: usize = u16::MAX as usize + 1;
+
+/// Primitive of a static node that is merged into a batch, with the
+/// version of its mesh so edits to the geometry or material show up as a
+/// different member.
+pub type BatchMember = (ArenaId<Node>, ArenaId<Mesh>, usize, u64);
+
+/// Merged geometry ready to be written to the vertex and index buffers.
+/// Drawn with a single instance whose transform is `dequantize`.
+#[derive(Debug, Clone)]
+pub struct PackedBatch {
+	pub material: Option<ArenaId<Material>>,
+	pub vertices: Vec<u8>,
+	pub indices: Vec<u16>,
+	pub dequantize: glam::Mat4,
+}
+
+#[derive(Debug, Clone, Default)]
+pub struct StaticBatches {
+	pub members: Vec<BatchMember>,
+	pub batches: Vec<PackedBatch>,
+	/// Bumped on every rebuild so stale uploads of the batches can be told
+	/// apart from the current ones.
+	pub generation: u64,
+}
+
+impl StaticBatches {
+	/// Rebuilds the batches when the set of static primitives or one of
+	/// their meshes changed. Returns whether a rebuild happened.
+	pub fn update<'a, F>(&mut self, members: Vec<BatchMember>, quantize: bool, lookup: F) -> bool
+	where
+		F: Fn(&BatchMember) -> Option<(glam::Mat4, &'a Primitive)>,
+	{
+		if members == self.members {
+			return false;
+		}
+		let sources: Vec<(glam::Mat4, &Primitive)> = members.iter().filter_map(|m| lookup(m)).collect();
+		self.batches = merge_primitives(&sources)
+			.into_iter()
+			.map(|primitive| {
+				let mut vertices = Vec::new();
+				let dequantize = pack_vertices(&primitive, quantize, &mut vertices);
+				PackedBatch {
+					material: primitive.material,
+					vertices,
+					indices: primitive.indices,
+					dequantize,
+				}
+			})
+			.collect();
+		self.members = members;
+		self.generation += 1;
+		true
+	}
+}
+
+/// Pre-transforms the primitives into world space and merges the ones
+/// sharing a material. A material's batch is split when it would no longer
+/// fit u16 indices.
+pub fn merge_primitives(sources: &[(glam::Mat4, &Primitive)]) -> Vec<Primitive> {
+	let mut batches: Vec<Primitive> = Vec::new();
+	let mut open: Vec<(Option<ArenaId<Material>>, usize)> = Vec::new();
+	for (transform, primitive) in sources {
+		if primitive.topology != PrimitiveTopology::TriangleList || primitive.vertices.len() > MAX_BATCH_VERTICES {
+			continue;
+		}
+		let open_batch = open.iter().position(|(m, _)| *m == primitive.material);
+		let index = match open_batch {
+			Some(i) if batches[open[i].1].vertices.len() + primitive.vertices.len() <= MAX_BATCH_VERTICES => open[i].1,
+			_ => {
+				let mut batch = Primitive::new(PrimitiveTopology::TriangleList);
+				batch.material = primitive.material;
+				batches.push(batch);
+				match open_batch {
+					Some(i) => open[i].1 = batches.len() - 1,
+					None => open.push((primitive.material, batches.len() - 1)),
+				}
+				batches.len() - 1
+			}
+		};
+
+		let batch = &mut batches[index];
+		let base = batch.vertices.len() as u16;
+		let normal_matrix = glam::Mat3::from_mat4(*transform).inverse().transpose();
+		for (i, v) in primitive.vertices.iter().enumerate() {
+			batch.vertices.push(transform.transform_point3(glam::Vec3::from_array(*v)).to_array());
+			let n = primitive.normals.get(i).copied().unwrap_or([0.0, 0.0, 1.0]);
+			batch.normals.push((normal_matrix * glam::Vec3::from_array(n)).normalize_or_zero().to_array());
+			batch.tex_coords.push(primitive.tex_coords.get(i).copied().unwrap_or([0.0, 0.0]));
+		}
+		batch.indices.extend(primitive.indices.iter().map(|i| base + i));
+	}
+	batches
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	fn triangle() -> Primitive {
+		let mut p = Primitive::new(PrimitiveTopology::TriangleList);
+		p.vertices = vec![[0.0, 0.0, 0.0], [1.0, 0.0, 0.0], [0.0, 1.0, 0.0]];
+		p.normals = vec![[0.0, 0.0, 1.0]; 3];
+		p.indices = vec![0, 1, 2];
+		p
+	}
+
+	#[test]
+	fn test_merge_pre_transforms_geometry() {
+		let p = triangle();
+		let moved = glam::Mat4::from_translation(glam::Vec3::new(5.0, 0.0, 0.0));
+		let batches = merge_primitives(&[(glam::Mat4::IDENTITY, &p), (moved, &p)]);
+		assert_eq!(batches.len(), 1);
+		let batch = &batches[0];
+		assert_eq!(batch.indices, vec![0, 1, 2, 3, 4, 5]);
+		assert_eq!(batch.vertices[4], [6.0, 0.0, 0.0]);
+		assert_eq!(batch.normals[4], [0.0, 0.0, 1.0]);
+	}
+
+	#[test]
+	fn test_batched_normals_match_instanced_ones() {
+		use crate::vertex_format::oct_decode;
+		use crate::vertex_format::transform_normal;
+		use crate::vertex_format::RawQuantizedVertex;
+
+		let mut p = triangle();
+		p.normals = vec![glam::Vec3::new(0.3, -0.2, 0.9).normalize().to_array(); 3];
+		let model = glam::Mat4::from_rotation_x(1.1) * glam::Mat4::from_scale(glam::Vec3::new(2.0, 0.5, 1.0));
+		let world = |model: glam::Mat4, primitive: &Primitive| {
+			let mut out = Vec::new();
+			let dequantize = pack_vertices(primitive, true, &mut out);
+			let stored = bytemuck::cast_slice::<u8, RawQuantizedVertex>(&out)[0].normal;
+			transform_normal(&glam::Mat3::from_mat4(model * dequantize), glam::Vec3::from_array(oct_decode(stored)))
+		};
+		let instanced = world(model, &p);
+		let batches = merge_primitives(&[(model, &p)]);
+		let batched = world(glam::Mat4::IDENTITY, &batches[0]);
+		assert!(instanced.dot(batched) > 0.999, "{:?} {:?}", instanced, batched);
+	}
+
+	#[test]
+	fn test_merge_splits_when_indices_overflow() {
+		let mut big = Primitive::new(PrimitiveTopology::TriangleList);
+		big.vertices = vec![[0.0; 3]; 40000];
+		big.indices = vec![0, 1, 2];
+		let batches = merge_primitives(&[(glam::Mat4::IDENTITY, &big), (glam::Mat4::IDENTITY, &big)]);
+		assert_eq!(batches.len(), 2);
+		assert!(batches.iter().all(|b| b.indices == vec![0, 1, 2]));
+	}
+}
@@ -13,7 +13,6 @@ use lyon::tessellation::FillVertex;
 use lyon::tessellation::VertexBuffers;
 use ttf_parser::GlyphId;
 use ttf_parser::OutlineBuilder;
-use ttf_parser::Rect;
 
 use crate::Mesh;
 use crate::Primitive;
@@ -57,7 +56,9 @@ impl GlyphMeshBuilder {
     //     (self.mesh.positions.len() - 1) as u16
     // }
 
-    pub fn build_mesh(mut self, rect: Rect) -> Mesh {
+    /// Tessellates the outline into a mesh in em units with the glyph origin
+    /// on the baseline.
+    pub fn build_mesh(self, units_per_em: f32) -> Mesh {
         let path = self.builder.build();
 		// Let's use our own custom vertex type instead of the default one.
 		#[derive(Copy, Clone, Debug)]
@@ -84,34 +85,33 @@ impl GlyphMeshBuilder {
 		p.vertices = geometry.vertices.iter().map(|v| [v.position[0], v.position[1], 0.0]).collect();
 		p.indices = geometry.indices.chunks(3).flat_map(|chunk| chunk.iter().rev()).map(|i| *i as u16).collect();
 		p.normals = vec![[0.0, 0.0, 1.0]; p.vertices.len()];
-		normalize(&mut p.vertices, &rect);
+		for v in p.vertices.iter_mut() {
+			v[0] /= units_per_em;
+			v[1] /= units_per_em;
+		}
+		mesh.primitives.push(p);
 		mesh
     }
 }
 
 impl OutlineBuilder for GlyphMeshBuilder {
     fn move_to(&mut self, x: f32, y: f32) {
-		println!("move_to: {}, {}", x, y);
         self.builder.begin(point(x, y));
     }
 
     fn line_to(&mut self, x: f32, y: f32) {
-		println!("line_to: {}, {}", x, y);
         self.builder.line_to(point(x, y));
     }
 
     fn quad_to(&mut self, x1: f32, y1: f32, x: f32, y: f32) {
-		println!("quad_to: {}, {}, {}, {}", x1, y1, x, y);
         self.builder.quadratic_bezier_to(point(x1, y1), point(x, y));
     }
 
     fn curve_to(&mut self, x1: f32, y1: f32, x2: f32, y2: f32, x: f32, y: f32) {
-		println!("curve_to: {}, {}, {}, {}, {}, {}", x1, y1, x2, y2, x, y);
         self.builder.cubic_bezier_to(point(x1, y1), point(x2, y2), point(x, y));
     }
 
     fn close(&mut self) {
-		println!("close");
         self.builder.end(true);
     }
 }
@@ -156,84 +156,71 @@ const chars : [char; 95] = [
 
 pub struct FontMesh {
     map: HashMap<char, Mesh>,
+    advances: HashMap<char, f32>,
+    line_height: f32,
 }
 
 impl FontMesh {
     pub fn load(path: &str) -> anyhow::Result<Self> {
         let font_data = std::fs::read(path)?;
-        let face = ttf_parser::Face::parse(&font_data, 0)?;
+        Self::from_data(&font_data)
+    }
 
-        let mut map = HashMap::new();
+    pub fn from_data(font_data: &[u8]) -> anyhow::Result<Self> {
+        let face = ttf_parser::Face::parse(font_data, 0)?;
+        let units_per_em = face.units_per_em() as f32;
 
-        let glyphs_count = face.number_of_glyphs();
+        let mut map = HashMap::new();
+        let mut advances = HashMap::new();
 
 		for char in chars.iter() {
 			let gid = match face.glyph_index(*char) {
 				Some(gid) => gid,
 				None => {
-					println!("no glyph for char: {:?}", char);
+					log::warn!("no glyph for char: {:?}", char);
 					continue;
 				}
 			};
-			
+			let advance = face.glyph_hor_advance(gid).unwrap_or(0) as f32 / units_per_em;
+			advances.insert(*char, advance);
+
 			let mut b = GlyphMeshBuilder::new();
-            let outline = match face.outline_glyph(gid, &mut b) {
-                Some(outline) => outline,
-                None => {
-                    println!("no outline for glyph: {:?}", gid);
-                    continue;
-                }
-            };
-			let mesh = b.build_mesh(outline);
-			map.insert(*char, mesh);
+            if face.outline_glyph(gid, &mut b).is_none() {
+                continue;
+            }
+			map.insert(*char, b.build_mesh(units_per_em));
 		}
 
-        // for id in 0..glyphs_count {
-        //     let gid = GlyphId(id);
-		// 	face.
-        //     let mut b = GlyphMeshBuilder::new();
-        //     let outline = match face.outline_glyph(gid, &mut b) {
-        //         Some(outline) => outline,
-        //         None => {
-        //             println!("no outline for glyph: {:?}", gid);
-        //             continue;
-        //         }
-        //     };
-		// 	let mesh = b.build_mesh(outline);
-        //     // let mut builder = Builder {};
-
-        //     // outline.build_outline(&mut builder);
-
-        //     // map.insert(glyph.character(), Mesh {});
-        // }
-
-        Ok(FontMesh { map })
+        let line_height = (face.ascender() as f32 - face.descender() as f32 + face.line_gap() as f32) / units_per_em;
+
+        Ok(FontMesh { map, advances, line_height })
     }
 
     pub fn get_mesh(&self, char: char) -> Option<Mesh> {
 		self.map.get(&char).cloned()
     }
-}
 
-fn normalize(points: &mut Vec<[f32; 3]>, rect: &Rect) {
-	let width = rect.width() as f32;
-	let height = rect.height() as f32;
-	let size = width.max(height);
-	let width_ratio = width / size;
-	let height_ratio = height / size;
-
-    // Compute the center of the rectangle
-    let center_x = (rect.x_min + rect.x_max) as f32 / 2.0;
-    let center_y = (rect.y_min + rect.y_max) as f32 / 2.0;
-
-    // Compute the half width and half height of the rectangle
-    let half_width = (rect.x_max - rect.x_min) as f32 / 2.0;
-    let half_height = (rect.y_max - rect.y_min) as f32 / 2.0;
-
-    // Normalize each point
-    for point in points.iter_mut() {
-        point[0] = (point[0] - center_x) / half_width * width_ratio;
-        point[1] = (point[1] - center_y) / half_height * height_ratio;
+    pub fn mesh(&self, char: char) -> Option<&Mesh> {
+		self.map.get(&char)
+    }
+
+    /// Places the glyphs of the text starting from the origin. Positions are
+    /// in em units and characters without an outline only advance the pen.
+    pub fn layout(&self, text: &str) -> Vec<(char, [f32; 2])> {
+		let mut glyphs = Vec::new();
+		let mut pen = [0.0, 0.0];
+		for c in text.chars() {
+			if c == '\n' {
+				pen[0] = 0.0;
+				pen[1] -= self.line_height;
+				continue;
+			}
+			if self.map.contains_key(&c) {
+				glyphs.push((c, pen));
+			}
+			pen[0] += self.advances.get(&c).copied().unwrap_or(0.0);
+		}
+		glyphs
     }
 }
 
@@ -274,34 +261,22 @@ mod tests {
     #[test]
     fn test_font() {
         let font = FontMesh::load("./fonts/Roboto-Regular.ttf").unwrap();
-        let mesh = font.get_mesh('I');
-		println!("mesh: {:?}", mesh);
+        let mesh = font.get_mesh('I').unwrap();
+		assert_eq!(mesh.primitives.len(), 1);
+		assert!(mesh.primitives[0].indices.len() > 0);
+		assert!(font.get_mesh(' ').is_none());
     }
 
 	#[test]
-	fn test_rect_normalize() {
-		let mut v = vec![[200.0, 200.0, 0.0], [100.0, 200.0, 0.0], [100.0, 100.0, 0.0], [200.0, 100.0, 0.0]];
-		let rect = Rect {
-			x_min: 100,
-			y_min: 100,
-			x_max: 200,
-			y_max: 200,
-		};
-		normalize(&mut v, &rect);
-		assert_eq!(v, vec![[1.0, 1.0, 0.0], [-1.0, 1.0, 0.0], [-1.0, -1.0, 0.0], [1.0, -1.0, 0.0]]);
-	}
-
-	#[test]
-	fn test_rect2_normalize() {
-		let mut v = vec![[400.0, 500.0, 0.0], [200.0, 500.0, 0.0], [200.0, 100.0, 0.0], [400.0, 100.0, 0.0]];
-		let rect = Rect {
-			x_min: 200,
-			y_min: 100,
-			x_max: 400,
-			y_max: 500,
-		};
-		normalize(&mut v, &rect);
-		assert_eq!(v, vec![[0.5, 1.0, 0.0], [-0.5, 1.0, 0.0], [-0.5, -1.0, 0.0], [0.5, -1.0, 0.0]]);
+	fn test_layout_advances_pen() {
+		let font = FontMesh::load("./fonts/Roboto-Regular.ttf").unwrap();
+		let glyphs = font.layout("a b\nc");
+		assert_eq!(glyphs.len(), 3);
+		assert_eq!(glyphs[0].1, [0.0, 0.0]);
+		assert!(glyphs[1].1[0] > glyphs[0].1[0]);
+		assert_eq!(glyphs[1].1[1], 0.0);
+		assert_eq!(glyphs[2].1[0], 0.0);
+		assert!(glyphs[2].1[1] < 0.0);
 	}
 
 	#[test]
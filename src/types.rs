@@ -455,6 +455,9 @@ pub struct Node {
 	pub name: Option<String>,
 	pub parent: NodeParent,
 	pub mesh: Option<ArenaId<Mesh>>,
+	/// Simplified mesh that hides whatever is behind it from the cameras
+	/// of the scene. Only used for culling, never drawn.
+	pub occluder: Option<ArenaId<Mesh>>,
 	pub translation: glam::Vec3,
 	pub rotation: glam::Quat,
 	pub scale: glam::Vec3,
@@ -472,6 +475,7 @@ impl Default for Node {
 			name: None,
 			parent: NodeParent::Orphan,
 			mesh: None,
+			occluder: None,
 			translation: glam::Vec3::ZERO,
 			rotation: glam::Quat::IDENTITY,
 			scale: glam::Vec3::splat(1.0),
@@ -495,6 +499,11 @@ impl Node {
 		self
 	}
 
+	pub fn set_occluder(mut self, mesh_id: ArenaId<Mesh>) -> Node {
+		self.occluder = Some(mesh_id);
+		self
+	}
+
     pub fn set_translation(&mut self, x: f32, y: f32, z: f32) {
         self.translation = glam::Vec3::new(x, y, z);
     }
@@ -594,6 +603,14 @@ impl PrimitiveTopology {
 	}
 }
 
+/// Simplified index list sharing the vertices of its primitive. `error` is
+/// the largest deviation from the original surface in model units.
+#[derive(Debug, Clone, PartialEq)]
+pub struct Lod {
+	pub indices: Vec<u16>,
+	pub error: f32,
+}
+
 #[derive(Debug, Clone, PartialEq)]
 pub struct Primitive {
 	pub topology: PrimitiveTopology,
@@ -602,6 +619,7 @@ pub struct Primitive {
 	pub normals: Vec<[f32; 3]>,
 	pub tex_coords: Vec<[f32; 2]>,
 	pub material: Option<ArenaId<Material>>,
+	pub lods: Vec<Lod>,
 }
 
 impl Primitive {
@@ -613,6 +631,7 @@ impl Primitive {
 			normals: vec![],
 			tex_coords: vec![],
 			material: None,
+			lods: vec![],
 		}
 	}
 }
@@ -695,6 +714,28 @@ impl Camera {
 	}
 }
 
+/// Offscreen render of a camera, queued in `State::capture_requests`.
+/// Requests of the same size are drawn together into one target and read
+/// back at once.
+#[derive(Debug, Clone)]
+pub struct CaptureRequest {
+	/// Chosen by the app to tell the images apart.
+	pub id: u64,
+	pub camera_id: ArenaId<Camera>,
+	pub width: u32,
+	pub height: u32,
+}
+
+/// RGBA8 pixels of a capture request, rows top to bottom. Arrives in
+/// `State::captured_images` a frame or two after the request.
+#[derive(Debug, Clone)]
+pub struct CapturedImage {
+	pub id: u64,
+	pub width: u32,
+	pub height: u32,
+	pub pixels: Vec<u8>,
+}
+
 #[derive(Debug, Clone)]
 pub enum AnimationTargetPath {
 	Translation,
@@ -846,6 +887,10 @@ impl Default for Material {
 pub struct PointLight {
 	pub color: [f32; 3],
 	pub intensity: f32,
+	/// Distance where the light has faded out completely. Lights with a
+	/// range fall off with the square of the distance and only reach the
+	/// clusters they overlap, a range of 0 lights everything evenly.
+	pub range: f32,
 	pub node_id: Option<ArenaId<Node>>
 }
 
@@ -854,6 +899,30 @@ impl PointLight {
 		Self {
 			color: [1.0, 1.0, 1.0],
 			intensity: 1.0,
+			range: 0.0,
+			node_id: None
+		}
+	}
+}
+
+/// Text drawn in world space at a node. Glyphs lie in the node's XY plane
+/// and face +Z, `size` is the height of one em in world units.
+#[derive(Debug, Clone, Default)]
+pub struct Label {
+	pub text: String,
+	pub size: f32,
+	pub offset: glam::Vec3,
+	pub material: Option<ArenaId<Material>>,
+	pub node_id: Option<ArenaId<Node>>
+}
+
+impl Label {
+	pub fn new(text: &str) -> Self {
+		Self {
+			text: text.to_string(),
+			size: 0.1,
+			offset: glam::Vec3::ZERO,
+			material: None,
 			node_id: None
 		}
 	}
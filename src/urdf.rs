@@ -7,6 +7,8 @@ use urdf_rs::{read_file, Geometry, JointType as UrdfJointType, Pose, Vec3};
 use crate::types::*;
 use crate::{ArenaId, State};
 use crate::cube;
+use crate::lod::generate_lods;
+use crate::mesh_optimizer::optimize_primitive;
 
 fn resolve_mesh_path(urdf_path: &Path, mesh_filename: &str) -> Option<PathBuf> {
 	let mesh_path = if let Some(stripped) = mesh_filename.strip_prefix("package://") {
@@ -89,6 +91,8 @@ fn load_stl_mesh(path: &Path) -> Mesh {
 		}
 	}
 	prim.normals = normals;
+	optimize_primitive(&mut prim);
+	generate_lods(&mut prim);
 
 	let mut mesh = Mesh::new();
 	mesh.name = Some(path.file_name().unwrap_or_default().to_string_lossy().to_string());
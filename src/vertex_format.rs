@@ -0,0 +1,254 @@
+use crate::Primitive;
+
+/// Interleaved vertex with a full precision position. Normals are
+/// octahedral encoded as snorm16x2 and uvs are stored as f16x2.
+#[repr(C)]
+#[derive(Copy, Clone, Debug, PartialEq, bytemuck::Pod, bytemuck::Zeroable)]
+pub struct RawVertex {
+	pub position: [f32; 3],
+	pub normal: [i16; 2],
+	pub tex_coords: [u16; 2],
+}
+
+/// Interleaved vertex with the position quantized to unorm16 inside the
+/// bounds of its primitive. The fourth position component is padding.
+/// Normals are stored in the same scaled space as the positions.
+#[repr(C)]
+#[derive(Copy, Clone, Debug, PartialEq, bytemuck::Pod, bytemuck::Zeroable)]
+pub struct RawQuantizedVertex {
+	pub position: [u16; 4],
+	pub normal: [i16; 2],
+	pub tex_coords: [u16; 2],
+}
+
+fn sign_not_zero(v: f32) -> f32 {
+	if v >= 0.0 { 1.0 } else { -1.0 }
+}
+
+fn to_snorm16(v: f32) -> i16 {
+	(v.clamp(-1.0, 1.0) * 32767.0).round() as i16
+}
+
+/// Encodes a unit vector with the octahedral mapping.
+pub fn oct_encode(n: [f32; 3]) -> [i16; 2] {
+	let l1 = n[0].abs() + n[1].abs() + n[2].abs();
+	if l1 == 0.0 {
+		return [0, to_snorm16(1.0)];
+	}
+	let mut x = n[0] / l1;
+	let mut y = n[1] / l1;
+	if n[2] < 0.0 {
+		let ox = x;
+		x = (1.0 - y.abs()) * sign_not_zero(ox);
+		y = (1.0 - ox.abs()) * sign_not_zero(y);
+	}
+	[to_snorm16(x), to_snorm16(y)]
+}
+
+/// Inverse of `oct_encode`, mirrors the decode in the 3D shader.
+pub fn oct_decode(e: [i16; 2]) -> [f32; 3] {
+	let x = (e[0] as f32 / 32767.0).max(-1.0);
+	let y = (e[1] as f32 / 32767.0).max(-1.0);
+	let z = 1.0 - x.abs() - y.abs();
+	let t = (-z).max(0.0);
+	let n = glam::Vec3::new(
+		x + if x >= 0.0 { -t } else { t },
+		y + if y >= 0.0 { -t } else { t },
+		z,
+	).normalize();
+	[n.x, n.y, n.z]
+}
+
+/// Converts to IEEE half precision rounding to nearest.
+pub fn f32_to_f16(v: f32) -> u16 {
+	let bits = v.to_bits();
+	let sign = ((bits >> 16) & 0x8000) as u16;
+	let exp = ((bits >> 23) & 0xff) as i32;
+	let mant = bits & 0x7f_ffff;
+	if exp == 0xff {
+		return sign | 0x7c00 | if mant != 0 { 0x200 } else { 0 };
+	}
+	let e = exp - 127 + 15;
+	if e >= 0x1f {
+		return sign | 0x7c00;
+	}
+	if e <= 0 {
+		if e < -10 {
+			return sign;
+		}
+		let m = mant | 0x80_0000;
+		let shift = (14 - e) as u32;
+		let half = m >> shift;
+		let round = (m >> (shift - 1)) & 1;
+		return sign | (half + round) as u16;
+	}
+	let half = sign | ((e as u16) << 10) | (mant >> 13) as u16;
+	half + ((mant >> 12) & 1) as u16
+}
+
+pub fn f16_to_f32(h: u16) -> f32 {
+	let sign = if h & 0x8000 != 0 { -1.0 } else { 1.0 };
+	let exp = ((h >> 10) & 0x1f) as i32;
+	let mant = (h & 0x3ff) as f32;
+	match exp {
+		0 => sign * mant * 2f32.powi(-24),
+		0x1f => if mant == 0.0 { sign * f32::INFINITY } else { f32::NAN },
+		_ => sign * (1.0 + mant / 1024.0) * 2f32.powi(exp - 15),
+	}
+}
+
+/// World space normal of a stored vertex normal, mirrors the 3D shader.
+/// `model` is the linear part of the instance transform. Its cofactor
+/// matrix is the inverse transpose up to scale, so scaled and dequantizing
+/// instances need no inverse.
+pub fn transform_normal(model: &glam::Mat3, normal: glam::Vec3) -> glam::Vec3 {
+	let (c0, c1, c2) = (model.x_axis, model.y_axis, model.z_axis);
+	let cofactor = glam::Mat3::from_cols(c1.cross(c2), c2.cross(c0), c0.cross(c1));
+	let sign = if c0.dot(c1.cross(c2)) < 0.0 { -1.0 } else { 1.0 };
+	(cofactor * normal * sign).normalize_or_zero()
+}
+
+/// Appends the primitive's vertices to `out` in the interleaved layout.
+/// Returns the transform that maps the stored positions back to model
+/// space, which is identity unless the positions were quantized.
+pub fn pack_vertices(primitive: &Primitive, quantize: bool, out: &mut Vec<u8>) -> glam::Mat4 {
+	let count = primitive.vertices.len();
+	let source_normal = |i: usize| primitive.normals.get(i).copied().unwrap_or([0.0, 0.0, 1.0]);
+	let normal = |i: usize| oct_encode(source_normal(i));
+	let tex_coords = |i: usize| {
+		let uv = primitive.tex_coords.get(i).copied().unwrap_or([0.0, 0.0]);
+		[f32_to_f16(uv[0]), f32_to_f16(uv[1])]
+	};
+
+	if !quantize {
+		out.reserve(count * std::mem::size_of::<RawVertex>());
+		for (i, p) in primitive.vertices.iter().enumerate() {
+			out.extend_from_slice(bytemuck::bytes_of(&RawVertex {
+				position: *p,
+				normal: normal(i),
+				tex_coords: tex_coords(i),
+			}));
+		}
+		return glam::Mat4::IDENTITY;
+	}
+
+	let mut min = glam::Vec3::splat(f32::MAX);
+	let mut max = glam::Vec3::splat(f32::MIN);
+	for p in &primitive.vertices {
+		let p = glam::Vec3::from_array(*p);
+		min = min.min(p);
+		max = max.max(p);
+	}
+	if count == 0 {
+		return glam::Mat4::IDENTITY;
+	}
+	// Flat axes keep a unit scale so the dequantize transform stays
+	// invertible, their positions all quantize to 0.
+	let extent = max - min;
+	let scale = glam::Vec3::new(
+		if extent.x > 0.0 { extent.x } else { 1.0 },
+		if extent.y > 0.0 { extent.y } else { 1.0 },
+		if extent.z > 0.0 { extent.z } else { 1.0 },
+	);
+	let inv = scale.recip();
+	out.reserve(count * std::mem::size_of::<RawQuantizedVertex>());
+	for (i, p) in primitive.vertices.iter().enumerate() {
+		let q = (glam::Vec3::from_array(*p) - min) * inv * 65535.0;
+		// Normals transform by the inverse transpose of the dequantize scale,
+		// which the cofactor matrix of the instance transform undoes.
+		let n = (glam::Vec3::from_array(source_normal(i)) * scale).normalize_or_zero();
+		out.extend_from_slice(bytemuck::bytes_of(&RawQuantizedVertex {
+			position: [q.x.round() as u16, q.y.round() as u16, q.z.round() as u16, 0],
+			normal: oct_encode(n.to_array()),
+			tex_coords: tex_coords(i),
+		}));
+	}
+	glam::Mat4::from_translation(min) * glam::Mat4::from_scale(scale)
+}
+
+/// Model space bounds of a primitive in the space of its stored positions,
+/// the inverse of the translate and scale returned by `pack_vertices`.
+/// Axes without a scale are left where they are instead of dividing by 0.
+pub fn stored_bounds(dequantize: &glam::Mat4, min: glam::Vec3, max: glam::Vec3) -> (glam::Vec3, glam::Vec3) {
+	let offset = dequantize.w_axis.truncate();
+	let axis = |s: f32| if s != 0.0 { s } else { 1.0 };
+	let scale = glam::Vec3::new(axis(dequantize.x_axis.x), axis(dequantize.y_axis.y), axis(dequantize.z_axis.z));
+	((min - offset) / scale, (max - offset) / scale)
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+	use crate::PrimitiveTopology;
+
+	#[test]
+	fn test_oct_roundtrip() {
+		let normals = [
+			[0.0, 0.0, 1.0],
+			[0.0, 0.0, -1.0],
+			[1.0, 0.0, 0.0],
+			[0.0, -1.0, 0.0],
+			[0.577, -0.577, -0.577],
+			[-0.267, 0.534, 0.802],
+		];
+		for n in normals {
+			let n = glam::Vec3::from_array(n).normalize();
+			let d = glam::Vec3::from_array(oct_decode(oct_encode(n.to_array())));
+			assert!(n.dot(d) > 0.9999, "{:?} -> {:?}", n, d);
+		}
+	}
+
+	#[test]
+	fn test_f16_conversion() {
+		for v in [0.0, 1.0, -2.5, 0.333, 1024.0, 65504.0, 0.0001] {
+			let r = f16_to_f32(f32_to_f16(v));
+			assert!((r - v).abs() <= v.abs() * 0.001 + 1e-7, "{} -> {}", v, r);
+		}
+		assert_eq!(f16_to_f32(f32_to_f16(100000.0)), f32::INFINITY);
+	}
+
+	#[test]
+	fn test_quantized_positions_dequantize() {
+		let mut p = Primitive::new(PrimitiveTopology::TriangleList);
+		p.vertices = vec![[-1.0, 2.0, 0.5], [3.0, 4.0, 0.5], [0.25, 3.0, 0.5]];
+		let mut out = Vec::new();
+		let dequantize = pack_vertices(&p, true, &mut out);
+		let vertices: &[RawQuantizedVertex] = bytemuck::cast_slice(&out);
+		assert_eq!(vertices.len(), 3);
+		for (v, expected) in vertices.iter().zip(&p.vertices) {
+			let unorm = glam::Vec3::new(v.position[0] as f32, v.position[1] as f32, v.position[2] as f32) / 65535.0;
+			let restored = dequantize.transform_point3(unorm);
+			assert!((restored - glam::Vec3::from_array(*expected)).length() < 1e-3);
+		}
+		// Flat on z, like a plane.
+		assert!(dequantize.determinant().abs() > 0.0);
+		assert!(dequantize.inverse().is_finite());
+		assert_eq!(vertices[1].position[2], 0);
+		let (min, max) = stored_bounds(&dequantize, glam::Vec3::new(-1.0, 2.0, 0.5), glam::Vec3::new(3.0, 4.0, 0.5));
+		assert!((min - glam::Vec3::ZERO).length() < 1e-6);
+		assert!((max - glam::Vec3::new(1.0, 1.0, 0.0)).length() < 1e-6);
+		assert_eq!(std::mem::size_of::<RawQuantizedVertex>(), 16);
+		assert_eq!(std::mem::size_of::<RawVertex>(), 20);
+	}
+
+	#[test]
+	fn test_normals_follow_the_instance_transform() {
+		let mut p = Primitive::new(PrimitiveTopology::TriangleList);
+		p.vertices = vec![[0.0, 0.0, 0.0], [2.0, 0.0, 1.0], [0.0, 0.5, 1.0]];
+		let n = glam::Vec3::new(1.0, 2.0, -4.0).normalize();
+		p.normals = vec![n.to_array(); 3];
+		let model = glam::Mat4::from_rotation_y(0.7) * glam::Mat4::from_scale(glam::Vec3::new(3.0, 1.0, -0.5));
+		let expected = (glam::Mat3::from_mat4(model).inverse().transpose() * n).normalize();
+		for quantize in [false, true] {
+			let mut out = Vec::new();
+			let dequantize = pack_vertices(&p, quantize, &mut out);
+			let stored = if quantize {
+				bytemuck::cast_slice::<u8, RawQuantizedVertex>(&out)[0].normal
+			} else {
+				bytemuck::cast_slice::<u8, RawVertex>(&out)[0].normal
+			};
+			let world = transform_normal(&glam::Mat3::from_mat4(model * dequantize), glam::Vec3::from_array(oct_decode(stored)));
+			assert!(world.dot(expected) > 0.999, "{} {:?} {:?}", quantize, world, expected);
+		}
+	}
+}
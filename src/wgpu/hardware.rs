@@ -16,18 +16,36 @@ use winit::event_loop::ControlFlow;
 use winit::event_loop::EventLoop;
 use winit::keyboard::KeyCode;
 
+use crate::capture::frame_screenshot_path;
+use crate::capture::Capture;
+use crate::capture::CaptureFormat;
+use crate::capture::CaptureSettings;
 use crate::engine::Engine;
+use crate::buffer::BufferSlice;
 use crate::hardware::BufferHandle;
+use crate::hardware::BundleHandle;
+use crate::hardware::CaptureTile;
+use crate::hardware::CullDispatch;
 use crate::hardware::Hardware;
+use crate::hardware::MaterialHandle;
+use crate::hardware::MaterialFeatures;
 use crate::hardware::PipelineHandle;
+use crate::hardware::RenderPass;
 use crate::hardware::RenderEncoder;
 use crate::hardware::TextureHandle;
+use crate::hardware::scissor_pixels;
+use crate::hardware::viewport_pixels;
 use crate::hardware::WindowHandle;
 use crate::mock_hardware::MockHardware;
+use crate::software::SoftwareHardware;
 use crate::KeyAction;
 use crate::MouseEvent;
 use super::wgpu_types::*;
+use super::pipeline_cache::PipelineCache;
+use super::screenshot::ScreenshotQueue;
+use super::screenshot::ScreenshotReadback;
 use crate::App;
+use crate::CapturedImage;
 use crate::KeyboardKey;
 use crate::MouseButton;
 use crate::Window;
@@ -53,7 +71,8 @@ enum UserEvent{
 	CreatePipeline {
 		window: WindowHandle,
 		name: String,
-		pipeline_id: u32
+		pipeline_id: u32,
+		features: MaterialFeatures,
 	},
 	CreateBuffer {
 		buffer_id: u32,
@@ -63,6 +82,22 @@ enum UserEvent{
 	DestroyBuffer {
 		buffer_id: u32,
 	},
+	WriteTexture {
+		texture: TextureHandle,
+		x: u32,
+		y: u32,
+		width: u32,
+		height: u32,
+		data: Vec<u8>,
+	},
+	CreateMaterial {
+		material_id: u32,
+		textures: [TextureHandle; 5],
+		material: BufferSlice,
+	},
+	DestroyMaterial {
+		material_id: u32,
+	},
 	CreateTexture {
 		texture_id: u32,
 		name: String,
@@ -72,16 +107,29 @@ enum UserEvent{
 	},
 	WriteBuffer {
 		buffer: BufferHandle,
+		offset: u64,
 		data: Vec<u8>,
 	},
-	Render {
-		window: WindowHandle,
-		encoder: RenderEncoder,
+	CopyBuffer {
+		src: BufferHandle,
+		dst: BufferHandle,
+		size: u64,
+	},
+	/// Encoders of every window drawn this frame.
+	RenderFrame {
+		frames: Vec<(WindowHandle, RenderEncoder)>,
 	},
 	SaveScreenshot {
 		window: WindowHandle,
 		path: String,
 	},
+	CreateRenderBundle {
+		bundle_id: u32,
+		commands: RenderPass,
+	},
+	DestroyRenderBundle {
+		bundle_id: u32,
+	},
 }
 
 struct WindowContext<'a> {
@@ -96,8 +144,10 @@ struct WindowContext<'a> {
 
 struct PipelineContext {
 	id: u32,
+	window_id: u32,
 	pipeline: Arc<wgpu::RenderPipeline>,
 	depth_texture_view: Option<Arc<wgpu::TextureView>>,
+	uses_color: bool,
 	uses_depth: bool,
 }
 
@@ -114,9 +164,14 @@ struct PgeWininitHandler<'a, A, H> {
 	queue: Arc<wgpu::Queue>,
 	instance: Arc<wgpu::Instance>,
 	pipelines: Vec<PipelineContext>,
+	pipeline_cache: PipelineCache,
+	cull_pipeline: Option<wgpu::ComputePipeline>,
 	buffers: Vec<BufferContext>,
 	textures: Vec<TextureContext>,
+	materials: Vec<MaterialContext>,
+	bundles: Vec<BundleContext>,
 	pending_screenshots: HashMap<u32, String>,
+	screenshots: ScreenshotQueue,
 	screenshot_dir: Option<PathBuf>,
 	screenshot_counter: u64,
 	screenshot_interval: u64,
@@ -124,6 +179,8 @@ struct PgeWininitHandler<'a, A, H> {
 
 struct HeadlessWindowContext {
 	window_id: u32,
+	/// Render target of captures, never saved as a screenshot.
+	offscreen: bool,
 	size: wgpu::Extent3d,
 	color_texture: wgpu::Texture,
 	color_view: wgpu::TextureView,
@@ -135,12 +192,20 @@ struct HeadlessWgpuHardware {
 	pipeline_id: u32,
 	buffer_id: u32,
 	texture_id: u32,
+	material_id: u32,
+	bundle_id: u32,
 	window_id: u32,
 	windows: Vec<HeadlessWindowContext>,
+	pending_captures: HashMap<u32, Vec<CaptureTile>>,
 	pipelines: Vec<PipelineContext>,
+	pipeline_cache: PipelineCache,
+	cull_pipeline: Option<wgpu::ComputePipeline>,
 	buffers: Vec<BufferContext>,
 	textures: Vec<TextureContext>,
+	materials: Vec<MaterialContext>,
+	bundles: Vec<BundleContext>,
 	pending_screenshots: HashMap<u32, String>,
+	screenshots: ScreenshotQueue,
 	screenshot_dir: Option<PathBuf>,
 	screenshot_counter: u64,
 	screenshot_interval: u64,
@@ -153,6 +218,7 @@ impl<'a, A, H> PgeWininitHandler<'a, A, H> {
 			.unwrap_or(0);
 		let screenshot_dir = screenshot_dir_from_env();
 		let screenshot_interval = screenshot_interval_from_env();
+		let screenshots = ScreenshotQueue::new(device.clone(), capture_settings_from_env());
 		Self {
 			engine,
 			start_time: Instant::now(),
@@ -166,9 +232,14 @@ impl<'a, A, H> PgeWininitHandler<'a, A, H> {
 			queue,
 			instance,
 			pipelines: Vec::new(),
+			pipeline_cache: PipelineCache::default(),
+			cull_pipeline: None,
 			buffers: Vec::new(),
 			textures: Vec::new(),
+			materials: Vec::new(),
+			bundles: Vec::new(),
 			pending_screenshots: HashMap::new(),
+			screenshots,
 			screenshot_dir,
 			screenshot_counter: 0,
 			screenshot_interval,
@@ -238,6 +309,7 @@ where
 				window,
 				name,
 				pipeline_id,
+				features,
 			} => {
 				let window_ctx = match self.windows.iter_mut().find(|w| w.window_id == window.id) {
 					Some(window) => window,
@@ -269,447 +341,102 @@ where
 				};
 		
 				window_ctx.surface.configure(&self.device, &config);
-				let camera_bind_group_layout = RawCamera::create_bind_group_layout(&self.device);
-				let point_light_bind_group_layout = RawPointLight::create_bind_group_layout(&self.device);
-				let base_texture_bind_group_layout = TextureBuffer::create_bind_group_layout(&self.device);
-				let metallic_roughness_texture_bind_group_layout = TextureBuffer::create_bind_group_layout(&self.device);
-				let normal_texture_bind_group_layout = TextureBuffer::create_bind_group_layout(&self.device);
-				let occlusion_texture_bind_group_layout = TextureBuffer::create_bind_group_layout(&self.device);
-				let emissive_texture_bind_group_layout = TextureBuffer::create_bind_group_layout(&self.device);
-				let material_bind_group_layout = self.device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
-					label: Some("Material Bind Group Layout"),
-					entries: &[wgpu::BindGroupLayoutEntry {
-						binding: 0,
-						visibility: wgpu::ShaderStages::FRAGMENT | wgpu::ShaderStages::VERTEX,
-						ty: wgpu::BindingType::Buffer {
-							ty: wgpu::BufferBindingType::Storage { read_only: true },
-							has_dynamic_offset: false,
-							min_binding_size: None,
-						},
-						count: None,
-					}],
-				});
-			
-				let (render_pipeline, depth_texture_view, uses_depth) = if name == "gui" {
-					let shader_source =
-						wgpu::ShaderSource::Wgsl(include_str!("../shaders/gui_shader.wgsl").into());
-					let shader = self.device.create_shader_module(wgpu::ShaderModuleDescriptor {
-						label: Some("Gui Shader"),
-						source: shader_source,
-					});
-
-					let render_pipeline_layout = self.device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
-						label: Some("Gui Pipeline Layout"),
-						bind_group_layouts: &[],
-						push_constant_ranges: &[],
-					});
-
-					let position_layout = wgpu::VertexBufferLayout {
-						array_stride: std::mem::size_of::<[f32; 3]>() as wgpu::BufferAddress,
-						step_mode: wgpu::VertexStepMode::Vertex,
-						attributes: &[wgpu::VertexAttribute {
-							offset: 0,
-							format: wgpu::VertexFormat::Float32x3,
-							shader_location: 0,
-						}],
-					};
-					let color_layout = wgpu::VertexBufferLayout {
-						array_stride: std::mem::size_of::<[f32; 3]>() as wgpu::BufferAddress,
-						step_mode: wgpu::VertexStepMode::Vertex,
-						attributes: &[wgpu::VertexAttribute {
-							offset: 0,
-							format: wgpu::VertexFormat::Float32x3,
-							shader_location: 1,
-						}],
-					};
-
-					let render_pipeline = self.device.create_render_pipeline(&wgpu::RenderPipelineDescriptor {
-						label: Some("Gui Pipeline"),
-						layout: Some(&render_pipeline_layout),
-						vertex: wgpu::VertexState {
-							module: &shader,
-							entry_point: "vs_main",
-							buffers: &[position_layout, color_layout],
-							compilation_options: Default::default(),
-						},
-						fragment: Some(wgpu::FragmentState {
-							module: &shader,
-							entry_point: "fs_main",
-							targets: &[Some(wgpu::ColorTargetState {
-								format: wgpu::TextureFormat::Bgra8UnormSrgb,
-								blend: Some(wgpu::BlendState {
-									color: wgpu::BlendComponent::REPLACE,
-									alpha: wgpu::BlendComponent::REPLACE,
-								}),
-								write_mask: wgpu::ColorWrites::ALL,
-							})],
-							compilation_options: Default::default(),
-						}),
-						primitive: wgpu::PrimitiveState {
-							topology: wgpu::PrimitiveTopology::TriangleList,
-							strip_index_format: None,
-							front_face: wgpu::FrontFace::Ccw,
-							cull_mode: None,
-							polygon_mode: wgpu::PolygonMode::Fill,
-							unclipped_depth: false,
-							conservative: false,
-						},
-						depth_stencil: None,
-						multisample: wgpu::MultisampleState {
-							count: 1,
-							mask: !0,
-							alpha_to_coverage_enabled: false,
-						},
-						multiview: None,
-					});
-
-					(render_pipeline, None, false)
-				} else {
-					let tex_coords_layout = wgpu::VertexBufferLayout {
-						array_stride: std::mem::size_of::<TexCoords>() as wgpu::BufferAddress,
-						step_mode: wgpu::VertexStepMode::Vertex,
-						attributes: &[wgpu::VertexAttribute {
-							offset: 0,
-							format: wgpu::VertexFormat::Float32x2,
-							shader_location: 2,
-						}],
-					};
-				
-					let layouts = &[
-						&camera_bind_group_layout, 
-						&point_light_bind_group_layout, 
-						&base_texture_bind_group_layout,
-						&metallic_roughness_texture_bind_group_layout,
-						&normal_texture_bind_group_layout,
-						&occlusion_texture_bind_group_layout,
-						&emissive_texture_bind_group_layout,
-						&material_bind_group_layout,
-					];
-					let buffers = &[Vertices::desc(), RawInstance::desc(), Normals::desc(), tex_coords_layout];
-					let shader_source = wgpu::ShaderSource::Wgsl(include_str!("../shaders/3d_shader.wgsl").into());
-				
-					let shader = self.device.create_shader_module(wgpu::ShaderModuleDescriptor {
-						label: Some("Shader"),
-						source: shader_source
-					});
-				
-					let render_pipeline_layout = self.device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
-						label: Some("Render Pipeline Layout"),
-						bind_group_layouts: layouts,
-						push_constant_ranges: &[],
-					});
-				
-					let depth_stencil_state = wgpu::DepthStencilState {
-						format: wgpu::TextureFormat::Depth24PlusStencil8,
-						depth_write_enabled: true,
-						depth_compare: wgpu::CompareFunction::Less,
-						stencil: wgpu::StencilState::default(),
-						bias: wgpu::DepthBiasState::default(),
-					};
-				
-					let render_pipeline = self.device.create_render_pipeline(&wgpu::RenderPipelineDescriptor {
-						label: Some("Render Pipeline"),
-						layout: Some(&render_pipeline_layout),
-						vertex: wgpu::VertexState {
-							module: &shader,
-							entry_point: "vs_main",
-							buffers,
-							compilation_options: Default::default(),
-						},
-						fragment: Some(wgpu::FragmentState {
-							module: &shader,
-							entry_point: "fs_main",
-							targets: &[Some(wgpu::ColorTargetState {
-								format: wgpu::TextureFormat::Bgra8UnormSrgb,
-								blend: Some(wgpu::BlendState {
-									color: wgpu::BlendComponent::REPLACE,
-									alpha: wgpu::BlendComponent::REPLACE,
-								}),
-								write_mask: wgpu::ColorWrites::ALL,
-							})],
-							compilation_options: Default::default(),
-						}),
-						primitive: wgpu::PrimitiveState {
-							topology: wgpu::PrimitiveTopology::TriangleList,
-							strip_index_format: None,
-							front_face: wgpu::FrontFace::Ccw,
-							cull_mode: None,
-							polygon_mode: wgpu::PolygonMode::Fill,
-							unclipped_depth: false,
-							conservative: false,
-						},
-						depth_stencil: Some(depth_stencil_state),
-						multisample: wgpu::MultisampleState {
-							count: 1,
-							mask: !0,
-							alpha_to_coverage_enabled: false,
-						},
-						multiview: None,
-					});
-
-					let depth_texture = self.device.create_texture(&wgpu::TextureDescriptor {
-						label: Some("Depth Texture"),
-						size: wgpu::Extent3d {
-							width: size.width,
-							height: size.height,
-							depth_or_array_layers: 1,
-						},
-						mip_level_count: 1,
-						sample_count: 1,
-						dimension: wgpu::TextureDimension::D2,
-						format: wgpu::TextureFormat::Depth24PlusStencil8,
-						usage: wgpu::TextureUsages::RENDER_ATTACHMENT,
-						view_formats: Default::default(),
-					});
-					let depth_texture_view =
-						Arc::new(depth_texture.create_view(&wgpu::TextureViewDescriptor::default()));
-
-					(render_pipeline, Some(depth_texture_view), true)
+				let (render_pipeline, uses_color, uses_depth) = self.pipeline_cache.pipeline(&self.device, &name, features);
+				// Variants of a window's 3D pipeline draw into the same passes, so
+				// they share its depth texture.
+				let shared_depth = self.pipelines.iter()
+					.find(|p| p.window_id == window.id && p.uses_depth)
+					.and_then(|p| p.depth_texture_view.clone());
+				let depth_texture_view = match (uses_depth, shared_depth) {
+					(false, _) => None,
+					(true, Some(view)) => Some(view),
+					(true, None) => {
+						let depth_texture = self.device.create_texture(&wgpu::TextureDescriptor {
+							label: Some("Depth Texture"),
+							size: wgpu::Extent3d {
+								width: size.width,
+								height: size.height,
+								depth_or_array_layers: 1,
+							},
+							mip_level_count: 1,
+							sample_count: 1,
+							dimension: wgpu::TextureDimension::D2,
+							format: wgpu::TextureFormat::Depth24PlusStencil8,
+							usage: wgpu::TextureUsages::RENDER_ATTACHMENT,
+							view_formats: Default::default(),
+						});
+						Some(Arc::new(depth_texture.create_view(&wgpu::TextureViewDescriptor::default())))
+					}
 				};
 
 				let pipeline_ctx = PipelineContext {
 					id: pipeline_id,
-					pipeline: Arc::new(render_pipeline),
+					window_id: window.id,
+					pipeline: render_pipeline,
 					depth_texture_view,
+					uses_color,
 					uses_depth,
 				};
 				self.pipelines.push(pipeline_ctx);
 			}
-			UserEvent::Render {
-				window,
-				encoder,
+			UserEvent::RenderFrame {
+				frames,
 			} => {
-				let mut screenshot_path = self.pending_screenshots.remove(&window.id);
-				let frame_index = self.screenshot_counter;
-				self.screenshot_counter += 1;
-				if screenshot_path.is_none() {
-					if let Some(dir) = &self.screenshot_dir {
-						if self.screenshot_interval > 0 && frame_index % self.screenshot_interval == 0 {
-							let filename = format!("screenshot_{}_{}.png", window.id, frame_index);
-							let path = dir.join(filename);
-							screenshot_path = Some(path.to_string_lossy().to_string());
-						}
-					}
-				}
-				let window_ctx = match self.windows.iter().find(|window_ctx| window_ctx.window_id == window.id) {
-					Some(window) => window,
-					None => {
-						log::error!("Window not found: {:?} => RETURN", window);
-						return;
-					}
-				};
-				let output = window_ctx.surface.get_current_texture().unwrap();
-				let view = output.texture.create_view(&wgpu::TextureViewDescriptor::default());
-				let mut wgpu_encoder = self.device.create_command_encoder(&wgpu::CommandEncoderDescriptor {
-					label: Some("Render Encoder"),
+				self.screenshots.poll();
+				let mut cull_encoder = self.device.create_command_encoder(&wgpu::CommandEncoderDescriptor {
+					label: Some("Cull Encoder"),
 				});
-				let mut screenshot_buffer = None;
-				let mut screenshot_info = None;
-				for (pass_index, pass) in encoder.passes.into_iter().enumerate() {
-					let pipeline = pass.pipeline.unwrap();
-					let pipeline_ctx = match self.pipelines.iter().find(|pipeline_ctx| pipeline_ctx.id == pipeline.id) {
-						Some(pipeline_ctx) => pipeline_ctx,
+				for (_, encoder) in &frames {
+					encode_culls(&self.device, &mut self.cull_pipeline, &mut self.buffers, &mut cull_encoder, &encoder.culls);
+				}
+				let mut outputs = Vec::new();
+				for (window, _) in &frames {
+					let frame_index = self.screenshot_counter;
+					self.screenshot_counter += 1;
+					let screenshot = frame_screenshot_path(&mut self.pending_screenshots, &self.screenshot_dir, self.screenshots.settings(), self.screenshot_interval, frame_index, window.id);
+					let window_ctx = match self.windows.iter().find(|window_ctx| window_ctx.window_id == window.id) {
+						Some(window) => window,
 						None => {
-							log::error!("Pipeline not found: {:?} => RETURN", pipeline);
-							return;
-						}
-					};
-					let load_op = if pass_index == 0 {
-						wgpu::LoadOp::Clear(wgpu::Color {
-							r: 0.1,
-							g: 0.2,
-							b: 0.3,
-							a: 1.0,
-						})
-					} else {
-						wgpu::LoadOp::Load
-					};
-					let depth_stencil_attachment = if pipeline_ctx.uses_depth {
-						Some(wgpu::RenderPassDepthStencilAttachment {
-							view: pipeline_ctx
-								.depth_texture_view
-								.as_ref()
-								.expect("missing depth texture view"),
-							depth_ops: Some(wgpu::Operations {
-								load: if pass_index == 0 {
-									wgpu::LoadOp::Clear(1.0)
-								} else {
-									wgpu::LoadOp::Load
-								},
-								store: wgpu::StoreOp::Store,
-							}),
-							stencil_ops: None,
-						})
-					} else {
-						None
-					};
-					let mut wgpu_pass = wgpu_encoder.begin_render_pass(&wgpu::RenderPassDescriptor {
-						label: Some("Render Pass"),
-						color_attachments: &[Some(wgpu::RenderPassColorAttachment {
-							view: &view,
-							resolve_target: None,
-							ops: wgpu::Operations {
-								load: load_op,
-								store: wgpu::StoreOp::Store,
-							},
-						})],
-						depth_stencil_attachment,
-						..Default::default()
-					});
-		
-					wgpu_pass.set_pipeline(&pipeline_ctx.pipeline);
-					for subpass in &pass.subpasses {
-						for (slot, texture) in &subpass.textures {
-							let texture_ctx = match self.textures.iter().find(|t| t.id == texture.id) {
-								Some(texture) => texture, 
-								None => {
-									log::error!("Texture not found: {:?} => RETURN", texture);
-									return;
-								}
-							};
-							wgpu_pass.set_bind_group(*slot, &texture_ctx.bind_group, &[]);
-						}
-						for (slot, buffer) in &subpass.buffers {
-							let buffer_ctx = match self.buffers.iter().find(|b| b.id == buffer.id) {
-								Some(buffer) => buffer,
-								None => {
-									log::error!("Buffer not found: {:?} => RETURN", buffer);
-									return;
-								}
-							};
-							if !buffer_ctx.written {
-								log::error!("BUFFER NOT WRITTEN: {:?} => RETURN", buffer);
-								return;
-							}
-							wgpu_pass.set_bind_group(*slot, &buffer_ctx.bind_group, &[]);
-						}
-						for (slot, buffer) in &subpass.vertex_buffers {
-							let buffer_ctx = match self.buffers.iter().find(|b| b.id == buffer.handle.id) {
-								Some(buffer) => buffer,
-								None => {
-									log::error!("Buffer not found: {:?} => RETURN", buffer);
-									return;
-								}
-							};
-							if !buffer_ctx.written {
-								log::error!("BUFFER NOT WRITTEN: {:?} => RETURN", buffer);
-								return;
-							}
-							if buffer.range.start == buffer.range.end {
-								log::error!("BUFFER RANGE IS ZERO: {:?} => RETURN", buffer);
-								continue;
-							}
-							wgpu_pass.set_vertex_buffer(*slot, buffer_ctx.buffer.slice(buffer.range.clone()));
+							log::error!("Window not found: {:?}", window);
+							continue;
 						}
-						if let Some(slice) = &subpass.index_buffer {
-							let buffer_ctx = match self.buffers.iter().find(|b| b.id == slice.handle.id) {
-								Some(buffer) => buffer,
-								None => {
-									log::error!("Buffer not found: {:?} => RETURN", slice.handle);
-									return;
-								}
-							};
-							if !buffer_ctx.written {
-								log::error!("BUFFER NOT WRITTEN: {:?} => RETURN", slice.handle);
-								return;
-							}
-							if slice.range.start == slice.range.end {
-								log::error!("BUFFER RANGE IS ZERO: {:?} => RETURN", slice.handle);
-								continue;
-							}
-							wgpu_pass.set_index_buffer(buffer_ctx.buffer.slice(slice.range.clone()), wgpu::IndexFormat::Uint16);
-						}
-						let indices = subpass.indices.clone().unwrap();
-						let instances = subpass.instances.clone().unwrap();
-						wgpu_pass.draw_indexed(indices.clone(), 0, instances.clone());
-					}
-				}
-				if screenshot_path.is_some() {
-					let size = window_ctx.wininit_window.inner_size();
-					let bytes_per_pixel = 4;
-					let unpadded_bytes_per_row = size.width * bytes_per_pixel;
-					let align = wgpu::COPY_BYTES_PER_ROW_ALIGNMENT;
-					let padded_bytes_per_row_padding = (align - unpadded_bytes_per_row % align) % align;
-					let padded_bytes_per_row = unpadded_bytes_per_row + padded_bytes_per_row_padding;
-					let output_buffer = self.device.create_buffer(&wgpu::BufferDescriptor {
-						label: Some("Screenshot Buffer"),
-						size: padded_bytes_per_row as u64 * size.height as u64,
-						usage: wgpu::BufferUsages::MAP_READ | wgpu::BufferUsages::COPY_DST,
-						mapped_at_creation: false,
-					});
-					let texture_size = wgpu::Extent3d {
-						width: size.width,
-						height: size.height,
-						depth_or_array_layers: 1,
 					};
-					wgpu_encoder.copy_texture_to_buffer(
-						wgpu::ImageCopyTexture {
-							texture: &output.texture,
-							mip_level: 0,
-							origin: wgpu::Origin3d::ZERO,
-							aspect: wgpu::TextureAspect::All,
-						},
-						wgpu::ImageCopyBuffer {
-							buffer: &output_buffer,
-							layout: wgpu::ImageDataLayout {
-								offset: 0,
-								bytes_per_row: Some(padded_bytes_per_row),
-								rows_per_image: Some(size.height),
-							},
-						},
-						texture_size,
-					);
-					screenshot_buffer = Some(output_buffer);
-					screenshot_info = Some((size.width, size.height, unpadded_bytes_per_row, padded_bytes_per_row));
-				}
-				self.queue.submit(std::iter::once(wgpu_encoder.finish()));
-				output.present();
-				if let (Some(path), Some(buffer), Some((width, height, unpadded_bytes_per_row, padded_bytes_per_row))) =
-					(screenshot_path, screenshot_buffer, screenshot_info)
-				{
-					let buffer_slice = buffer.slice(..);
-					let (tx, rx) = std::sync::mpsc::channel();
-					buffer_slice.map_async(wgpu::MapMode::Read, move |result| {
-						let _ = tx.send(result);
-					});
-					self.device.poll(wgpu::Maintain::Wait);
-					match rx.recv() {
-						Ok(Ok(())) => {}
-						Ok(Err(err)) => {
-							log::error!("Failed to map screenshot buffer: {:?}", err);
-							buffer.unmap();
-							return;
-						}
+					let output = match window_ctx.surface.get_current_texture() {
+						Ok(output) => output,
 						Err(err) => {
-							log::error!("Failed to receive screenshot buffer map result: {:?}", err);
-							buffer.unmap();
-							return;
+							log::error!("Failed to get surface texture of {:?}: {:?}", window, err);
+							continue;
 						}
-					}
-					let data = buffer_slice.get_mapped_range();
-					let mut pixels: Vec<u8> = Vec::with_capacity((width * height * 4) as usize);
-					for chunk in data.chunks(padded_bytes_per_row as usize) {
-						pixels.extend_from_slice(&chunk[..unpadded_bytes_per_row as usize]);
-					}
-					drop(data);
-					buffer.unmap();
-					if matches!(
+					};
+					let view = output.texture.create_view(&wgpu::TextureViewDescriptor::default());
+					let size = window_ctx.wininit_window.inner_size();
+					let swap_bgra = matches!(
 						window_ctx.surface_format,
 						Some(wgpu::TextureFormat::Bgra8Unorm) | Some(wgpu::TextureFormat::Bgra8UnormSrgb)
-					) {
-						for chunk in pixels.chunks_exact_mut(4) {
-							chunk.swap(0, 2);
-						}
-					}
-					match image::save_buffer(
-						&path,
-						&pixels,
-						width,
-						height,
-						image::ColorType::Rgba8,
-					) {
-						Ok(_) => crate::log1!("Screenshot saved to {}", path),
-						Err(err) => log::error!("Failed to save screenshot: {:?}", err),
+					);
+					outputs.push((window.id, output, view, size, screenshot, swap_bgra));
+				}
+				let targets: Vec<_> = outputs.iter().map(|(window_id, output, view, size, screenshot, swap_bgra)| FrameTarget {
+					window_id: *window_id,
+					texture: &output.texture,
+					view,
+					width: size.width,
+					height: size.height,
+					screenshot: screenshot.clone(),
+					swap_bgra: *swap_bgra,
+				}).collect();
+				let resources = PassResources {
+					pipelines: &self.pipelines,
+					buffers: &self.buffers,
+					textures: &self.textures,
+					materials: &self.materials,
+					bundles: &self.bundles,
+				};
+				let drawn = submit_frame(&self.device, &self.queue, &mut self.screenshots, &resources, cull_encoder.finish(), frames, &targets);
+				drop(targets);
+				for (window_id, output, ..) in outputs {
+					if drawn.contains(&window_id) {
+						output.present();
 					}
 				}
 			},
@@ -722,7 +449,7 @@ where
 				let buffer = self.device.create_buffer(&wgpu::BufferDescriptor {
 					label: Some(&name),
 					size,
-					usage: wgpu::BufferUsages::VERTEX | wgpu::BufferUsages::COPY_DST | wgpu::BufferUsages::COPY_SRC | wgpu::BufferUsages::INDEX | wgpu::BufferUsages::UNIFORM | wgpu::BufferUsages::STORAGE,
+					usage: wgpu::BufferUsages::VERTEX | wgpu::BufferUsages::COPY_DST | wgpu::BufferUsages::COPY_SRC | wgpu::BufferUsages::INDEX | wgpu::BufferUsages::UNIFORM | wgpu::BufferUsages::STORAGE | wgpu::BufferUsages::INDIRECT,
 					mapped_at_creation: false,
 				});
 				let layout = self.device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
@@ -772,6 +499,47 @@ where
 				buffer_ctx.buffer.destroy();
 				self.buffers.retain(|b| b.id != buffer_id);
 			}
+			UserEvent::CreateRenderBundle {
+				bundle_id,
+				commands,
+			} => {
+				match record_bundle(&self.device, &self.pipelines, &self.buffers, &self.textures, &self.materials, &commands) {
+					Some(bundle) => self.bundles.push(BundleContext { id: bundle_id, bundle }),
+					None => log::error!("Failed to record render bundle {}", bundle_id),
+				}
+			}
+			UserEvent::DestroyRenderBundle {
+				bundle_id,
+			} => {
+				self.bundles.retain(|b| b.id != bundle_id);
+			}
+			UserEvent::WriteTexture {
+				texture,
+				x,
+				y,
+				width,
+				height,
+				data,
+			} => {
+				write_texture_rect(&self.queue, &self.textures, texture, x, y, width, height, &data);
+			}
+			UserEvent::CreateMaterial {
+				material_id,
+				textures,
+				material,
+			} => {
+				if let Some(bind_group) = create_material_bind_group(&self.device, &self.pipeline_cache.material_layout(&self.device), &self.textures, &self.buffers, &textures, &material) {
+					self.materials.push(MaterialContext {
+						id: material_id,
+						bind_group,
+					});
+				}
+			}
+			UserEvent::DestroyMaterial {
+				material_id,
+			} => {
+				self.materials.retain(|m| m.id != material_id);
+			}
 			UserEvent::CreateTexture {
 				texture_id,
 				name,
@@ -838,11 +606,14 @@ where
 				self.textures.push(TextureContext {
 					id: texture_id,
 					texture,
+					view: texture_view,
+					sampler,
 					bind_group: texture_bind_group,
 				});
 			}
 			UserEvent::WriteBuffer {
 				buffer,
+				offset,
 				data,
 			} => {
 				let buffer_ctx = match self.buffers.iter_mut().find(|b| b.id == buffer.id) {
@@ -853,11 +624,20 @@ where
 					}
 				};
 				if data.len() == 0 {
-					buffer_ctx.written = false;
+					if offset == 0 {
+						buffer_ctx.written = false;
+					}
 					return;
 				}
 				buffer_ctx.written = true;
-				self.queue.write_buffer(&buffer_ctx.buffer, 0, &data);
+				self.queue.write_buffer(&buffer_ctx.buffer, offset, &data);
+			}
+			UserEvent::CopyBuffer {
+				src,
+				dst,
+				size,
+			} => {
+				copy_buffer(&self.device, &self.queue, &mut self.buffers, src, dst, size);
 			}
 			UserEvent::SaveScreenshot {
 				window,
@@ -928,7 +708,7 @@ where
 				event_loop.exit();
 			}
 			WindowEvent::RedrawRequested => {
-				println!("redraw requested for window {:?}", window_id);
+				eprintln!("redraw requested for window {:?}", window_id);
 			}
 			WindowEvent::CursorMoved {
 				device_id,
@@ -965,6 +745,14 @@ where
 				} else {
 					window_ctx.last_cursor_pos = Some(position);
 				}
+				if !window_ctx.lock_cursor && size.width > 0 && size.height > 0 {
+					let x = (position.x / size.width as f64 * 2.0 - 1.0) as f32;
+					let y = (1.0 - position.y / size.height as f64 * 2.0) as f32;
+					self.engine.on_cursor_moved(WindowHandle { id: window_ctx.window_id }, x, y);
+				}
+			}
+			WindowEvent::CursorLeft { .. } => {
+				self.engine.on_cursor_left(WindowHandle { id: window_ctx.window_id });
 			}
 			WindowEvent::MouseInput {
 				device_id,
@@ -1030,6 +818,7 @@ where
 									KeyCode::Digit5 => KeyboardKey::Digit5,
 									KeyCode::Digit6 => KeyboardKey::Digit6,
 									KeyCode::Escape => {
+										self.screenshots.flush();
 										process::exit(0);
 									}
 									_ => return,
@@ -1076,7 +865,7 @@ fn run_with_winit(app: impl App, max_iterations: Option<u64>) -> anyhow::Result<
 	let instance = wgpu::Instance::new(wgpu::InstanceDescriptor::default());
 	let adapters = instance.enumerate_adapters(wgpu::Backends::all());
 	for adapter in adapters {
-		println!("Adapter: {:?}", adapter.get_info());
+		eprintln!("Adapter: {:?}", adapter.get_info());
 	}
 	let mut adapter = block_on(instance.request_adapter(&wgpu::RequestAdapterOptions::default()));
 	if adapter.is_none() {
@@ -1137,7 +926,7 @@ fn arg_value(name: &str) -> Option<String> {
 }
 
 fn is_headless() -> bool {
-	flag_enabled("HEADLESS") || flag_enabled("SCREENSHOT")
+	flag_enabled("HEADLESS") || flag_enabled("SCREENSHOT") || flag_enabled("OFFSCREEN")
 }
 
 fn screenshot_enabled() -> bool {
@@ -1151,6 +940,22 @@ fn screenshot_interval_from_env() -> u64 {
 	}
 }
 
+fn capture_settings_from_env() -> CaptureSettings {
+	let value = |name: &str| env::var(name).ok().or_else(|| arg_value(name));
+	let mut settings = CaptureSettings::default();
+	if let Some(format) = value("SCREENSHOT_FORMAT") {
+		match CaptureFormat::parse(&format) {
+			Some(format) => settings.format = format,
+			None => log::error!("Unknown SCREENSHOT_FORMAT {:?}, saving PNG", format),
+		}
+	}
+	settings.stream_path = value("SCREENSHOT_STREAM");
+	if let Some(fps) = value("SCREENSHOT_FPS").and_then(|fps| fps.parse::<u32>().ok()) {
+		settings.fps = fps;
+	}
+	settings
+}
+
 fn screenshot_dir_from_env() -> Option<PathBuf> {
 	if !screenshot_enabled() {
 		return None;
@@ -1217,13 +1022,18 @@ where
 }
 
 fn run_headless(app: impl App) -> anyhow::Result<()> {
-	if screenshot_enabled() {
+	// Offscreen renders like screenshots do, for the capture requests, but
+	// saves no frames.
+	if screenshot_enabled() || flag_enabled("OFFSCREEN") {
 		return run_headless_with_wgpu(app);
 	}
 	run_headless_loop(app, MockHardware::new(), |engine, dt| engine.tick_headless(dt))
 }
 
 fn run_headless_with_wgpu(app: impl App) -> anyhow::Result<()> {
+	if flag_enabled("SOFTWARE_RENDER") {
+		return run_headless_with_software(app);
+	}
 	let instance = wgpu::Instance::new(wgpu::InstanceDescriptor::default());
 	let mut adapter = block_on(instance.request_adapter(&wgpu::RequestAdapterOptions::default()));
 	if adapter.is_none() {
@@ -1236,8 +1046,8 @@ fn run_headless_with_wgpu(app: impl App) -> anyhow::Result<()> {
 	let adapter = match adapter {
 		Some(adapter) => adapter,
 		None => {
-			log::error!("Failed to find an adapter for headless screenshots; falling back to windowed screenshots.");
-			return run_with_winit(app, read_iterations());
+			log::warn!("Failed to find an adapter for headless screenshots; rendering in software.");
+			return run_headless_with_software(app);
 		}
 	};
 	let (device, queue) = block_on(adapter
@@ -1262,6 +1072,11 @@ fn run_headless_with_wgpu(app: impl App) -> anyhow::Result<()> {
 	run_headless_loop(app, hardware, |engine, dt| engine.render(dt))
 }
 
+fn run_headless_with_software(app: impl App) -> anyhow::Result<()> {
+	let hardware = SoftwareHardware::new(screenshot_dir_from_env(), screenshot_interval_from_env(), capture_settings_from_env());
+	run_headless_loop(app, hardware, |engine, dt| engine.render(dt))
+}
+
 fn read_iterations() -> Option<u64> {
 	match env::var("ITERATIONS") {
 		Ok(value) => value.parse::<u64>().ok(),
@@ -1299,73 +1114,664 @@ fn log_exit_stats(iterations: u64, start_time: Instant) {
 	);
 }
 
-struct BufferContext {
-	id: u32,
-	name: String,
-	buffer: wgpu::Buffer,
-	bind_group: wgpu::BindGroup,
-	written: bool,
+/// Everything a recorded pass may reference, shared read-only by the
+/// encoding workers.
+struct PassResources<'r> {
+	pipelines: &'r [PipelineContext],
+	buffers: &'r [BufferContext],
+	textures: &'r [TextureContext],
+	materials: &'r [MaterialContext],
+	bundles: &'r [BundleContext],
 }
 
-struct TextureContext {
-	id: u32,
-	texture: wgpu::Texture,
-	bind_group: wgpu::BindGroup,
+/// A render pass of one window, recorded into a command buffer of its own.
+struct PassJob<'v> {
+	window_id: u32,
+	pass: RenderPass,
+	/// The first pass of a window drawing color clears it, the same for
+	/// depth.
+	clear_color: bool,
+	clear_depth: bool,
+	color_view: &'v wgpu::TextureView,
+	width: u32,
+	height: u32,
 }
 
-pub struct WgpuHardware {
-	device: Arc<wgpu::Device>,
-	queue: Arc<wgpu::Queue>,
-	instance: Arc<wgpu::Instance>,
-	adapter: Arc<wgpu::Adapter>,
-	proxy: winit::event_loop::EventLoopProxy<UserEvent>,
-	pipeline_id: u32,
-	buffer_id: u32,
-	texture_id: u32,
+/// Color target of a window for one frame.
+struct FrameTarget<'t> {
 	window_id: u32,
+	texture: &'t wgpu::Texture,
+	view: &'t wgpu::TextureView,
+	width: u32,
+	height: u32,
+	screenshot: Option<Capture>,
+	swap_bgra: bool,
 }
 
-impl WgpuHardware {
-	pub fn new(proxy: winit::event_loop::EventLoopProxy<UserEvent>, instance: Arc<wgpu::Instance>, adapter: Arc<wgpu::Adapter>, device: Arc<wgpu::Device>, queue: Arc<wgpu::Queue>) -> Self {
-		Self {
-			instance,
-			device,
-			queue,
-			adapter,
-			proxy,
-			pipeline_id: 1,
-			buffer_id: 1,
-			texture_id: 1,
-			window_id: 1,
+fn encode_pass(device: &wgpu::Device, resources: &PassResources, job: &PassJob) -> Option<wgpu::CommandBuffer> {
+	let pipeline = job.pass.pipeline?;
+	let pipeline_ctx = match resources.pipelines.iter().find(|pipeline_ctx| pipeline_ctx.id == pipeline.id) {
+		Some(pipeline_ctx) => pipeline_ctx,
+		None => {
+			log::error!("Pipeline not found: {:?} => RETURN", pipeline);
+			return None;
+		}
+	};
+	let mut wgpu_encoder = device.create_command_encoder(&wgpu::CommandEncoderDescriptor {
+		label: Some("Render Encoder"),
+	});
+	let load_op = if job.clear_color {
+		wgpu::LoadOp::Clear(wgpu::Color {
+			r: 0.1,
+			g: 0.2,
+			b: 0.3,
+			a: 1.0,
+		})
+	} else {
+		wgpu::LoadOp::Load
+	};
+	let depth_stencil_attachment = if pipeline_ctx.uses_depth {
+		Some(wgpu::RenderPassDepthStencilAttachment {
+			view: pipeline_ctx
+				.depth_texture_view
+				.as_ref()
+				.expect("missing depth texture view"),
+			depth_ops: Some(wgpu::Operations {
+				load: if job.clear_depth {
+					wgpu::LoadOp::Clear(1.0)
+				} else {
+					wgpu::LoadOp::Load
+				},
+				store: wgpu::StoreOp::Store,
+			}),
+			stencil_ops: None,
+		})
+	} else {
+		None
+	};
+	let color_attachment = Some(wgpu::RenderPassColorAttachment {
+		view: job.color_view,
+		resolve_target: None,
+		ops: wgpu::Operations {
+			load: load_op,
+			store: wgpu::StoreOp::Store,
+		},
+	});
+	// Depth-only passes have no fragment stage to write color with.
+	let color_attachments = if pipeline_ctx.uses_color { std::slice::from_ref(&color_attachment) } else { &[] };
+	let mut wgpu_pass = wgpu_encoder.begin_render_pass(&wgpu::RenderPassDescriptor {
+		label: Some("Render Pass"),
+		color_attachments,
+		depth_stencil_attachment,
+		..Default::default()
+	});
+	wgpu_pass.set_pipeline(&pipeline_ctx.pipeline);
+	// Bindings that did not change since the previous draw are skipped.
+	// Keyed by slot, kind (0 buffer, 1 texture, 2 material) and id.
+	let mut bound_groups: Vec<(u32, u8, u32, u32)> = Vec::new();
+	let mut bound_vertex_buffers: Vec<(u32, u32, std::ops::Range<u64>)> = Vec::new();
+	let mut bound_index_buffer: Option<(u32, std::ops::Range<u64>)> = None;
+	let mut current_pipeline = pipeline.id;
+	let mut current_viewport = (None, None);
+	let mut hidden = false;
+	for subpass in &job.pass.subpasses {
+		// Views sharing the pass draw into their own rect of the target.
+		if (subpass.viewport, subpass.scissor) != current_viewport {
+			current_viewport = (subpass.viewport, subpass.scissor);
+			let viewport = viewport_pixels(subpass.viewport.unwrap_or([0.0, 0.0, 1.0, 1.0]), job.width, job.height);
+			match viewport.and_then(|viewport| Some((viewport, scissor_pixels(viewport, subpass.scissor, job.width, job.height)?))) {
+				Some(([x, y, width, height], [sx, sy, sw, sh])) => {
+					wgpu_pass.set_viewport(x as f32, y as f32, width as f32, height as f32, 0.0, 1.0);
+					wgpu_pass.set_scissor_rect(sx, sy, sw, sh);
+					hidden = false;
+				}
+				None => hidden = true,
+			}
+		}
+		if hidden {
+			continue;
+		}
+		if let Some(bundle) = subpass.bundle {
+			match resources.bundles.iter().find(|b| b.id == bundle.id) {
+				Some(bundle_ctx) => wgpu_pass.execute_bundles(std::iter::once(&bundle_ctx.bundle)),
+				None => log::error!("Bundle not found: {:?}", bundle),
+			}
+			// Executing a bundle resets the pass state.
+			current_pipeline = u32::MAX;
+			bound_groups.clear();
+			bound_vertex_buffers.clear();
+			bound_index_buffer = None;
+			continue;
+		}
+		// Material variants of the pass pipeline switch per draw.
+		if let Some(next) = subpass.pipeline.filter(|p| p.id != current_pipeline) {
+			match resources.pipelines.iter().find(|pipeline_ctx| pipeline_ctx.id == next.id) {
+				Some(pipeline_ctx) => wgpu_pass.set_pipeline(&pipeline_ctx.pipeline),
+				None => {
+					log::error!("Pipeline not found: {:?}", next);
+					continue;
+				}
+			}
+			current_pipeline = next.id;
+			bound_groups.clear();
+		}
+		for (slot, texture) in &subpass.textures {
+			if bound_groups.contains(&(*slot, 1, texture.id, 0)) {
+				continue;
+			}
+			let texture_ctx = match resources.textures.iter().find(|t| t.id == texture.id) {
+				Some(texture) => texture,
+				None => {
+					log::error!("Texture not found: {:?} => RETURN", texture);
+					return None;
+				}
+			};
+			wgpu_pass.set_bind_group(*slot, &texture_ctx.bind_group, &[]);
+			bound_groups.retain(|b| b.0 != *slot);
+			bound_groups.push((*slot, 1, texture.id, 0));
+		}
+		for (slot, material, offset) in &subpass.materials {
+			if bound_groups.contains(&(*slot, 2, material.id, *offset)) {
+				continue;
+			}
+			let material_ctx = match resources.materials.iter().find(|m| m.id == material.id) {
+				Some(material) => material,
+				None => {
+					log::error!("Material not found: {:?} => RETURN", material);
+					return None;
+				}
+			};
+			wgpu_pass.set_bind_group(*slot, &material_ctx.bind_group, &[*offset]);
+			bound_groups.retain(|b| b.0 != *slot);
+			bound_groups.push((*slot, 2, material.id, *offset));
+		}
+		for (slot, buffer) in &subpass.buffers {
+			if bound_groups.contains(&(*slot, 0, buffer.id, 0)) {
+				continue;
+			}
+			let buffer_ctx = match resources.buffers.iter().find(|b| b.id == buffer.id) {
+				Some(buffer) => buffer,
+				None => {
+					log::error!("Buffer not found: {:?} => RETURN", buffer);
+					return None;
+				}
+			};
+			if !buffer_ctx.written {
+				log::error!("BUFFER NOT WRITTEN: {:?} => RETURN", buffer);
+				return None;
+			}
+			wgpu_pass.set_bind_group(*slot, &buffer_ctx.bind_group, &[]);
+			bound_groups.retain(|b| b.0 != *slot);
+			bound_groups.push((*slot, 0, buffer.id, 0));
+		}
+		for (slot, buffer) in &subpass.vertex_buffers {
+			if bound_vertex_buffers.contains(&(*slot, buffer.handle.id, buffer.range.clone())) {
+				continue;
+			}
+			let buffer_ctx = match resources.buffers.iter().find(|b| b.id == buffer.handle.id) {
+				Some(buffer) => buffer,
+				None => {
+					log::error!("Buffer not found: {:?} => RETURN", buffer);
+					return None;
+				}
+			};
+			if !buffer_ctx.written {
+				log::error!("BUFFER NOT WRITTEN: {:?} => RETURN", buffer);
+				return None;
+			}
+			if buffer.range.start == buffer.range.end {
+				log::error!("BUFFER RANGE IS ZERO: {:?} => RETURN", buffer);
+				continue;
+			}
+			wgpu_pass.set_vertex_buffer(*slot, buffer_ctx.buffer.slice(buffer.range.clone()));
+			bound_vertex_buffers.retain(|b| b.0 != *slot);
+			bound_vertex_buffers.push((*slot, buffer.handle.id, buffer.range.clone()));
+		}
+		if let Some(slice) = subpass.index_buffer.as_ref().filter(|s| bound_index_buffer != Some((s.handle.id, s.range.clone()))) {
+			let buffer_ctx = match resources.buffers.iter().find(|b| b.id == slice.handle.id) {
+				Some(buffer) => buffer,
+				None => {
+					log::error!("Buffer not found: {:?} => RETURN", slice.handle);
+					return None;
+				}
+			};
+			if !buffer_ctx.written {
+				log::error!("BUFFER NOT WRITTEN: {:?} => RETURN", slice.handle);
+				return None;
+			}
+			if slice.range.start == slice.range.end {
+				log::error!("BUFFER RANGE IS ZERO: {:?} => RETURN", slice.handle);
+				continue;
+			}
+			wgpu_pass.set_index_buffer(buffer_ctx.buffer.slice(slice.range.clone()), wgpu::IndexFormat::Uint16);
+			bound_index_buffer = Some((slice.handle.id, slice.range.clone()));
 		}
+		if let Some((args, offset)) = &subpass.indirect {
+			match resources.buffers.iter().find(|b| b.id == args.id) {
+				Some(buffer_ctx) => wgpu_pass.draw_indexed_indirect(&buffer_ctx.buffer, *offset),
+				None => log::error!("Buffer not found: {:?}", args),
+			}
+			continue;
+		}
+		let indices = subpass.indices.clone().unwrap();
+		let instances = subpass.instances.clone().unwrap();
+		wgpu_pass.draw_indexed(indices.clone(), subpass.base_vertex, instances.clone());
 	}
+	drop(wgpu_pass);
+	Some(wgpu_encoder.finish())
 }
 
-impl Hardware for WgpuHardware {
-	fn create_buffer(&mut self, name: &str, size: u64) -> BufferHandle {
-		let buffer_id = self.buffer_id;
-		self.proxy.send_event(UserEvent::CreateBuffer {
-			name: name.to_string(),
-			buffer_id,
-			size,
-		});
-		self.buffer_id += 1;
-		BufferHandle {
-			id: buffer_id,
-			size,
-		}
+/// Records the jobs on worker threads, wgpu encoders being independent of
+/// each other. Results are in job order, None for passes that failed.
+fn encode_passes(device: &wgpu::Device, resources: &PassResources, jobs: &[PassJob]) -> Vec<Option<wgpu::CommandBuffer>> {
+	let workers = std::thread::available_parallelism().map_or(1, |n| n.get()).min(jobs.len());
+	if workers <= 1 {
+		return jobs.iter().map(|job| encode_pass(device, resources, job)).collect();
 	}
+	let chunk_size = (jobs.len() + workers - 1) / workers;
+	std::thread::scope(|scope| {
+		let workers: Vec<_> = jobs.chunks(chunk_size)
+			.map(|chunk| scope.spawn(move || chunk.iter().map(|job| encode_pass(device, resources, job)).collect::<Vec<_>>()))
+			.collect();
+		workers.into_iter().flat_map(|worker| worker.join().unwrap()).collect()
+	})
+}
 
-	fn destroy_buffer(&mut self, handle: BufferHandle) {
-		self.proxy.send_event(UserEvent::DestroyBuffer {
-			buffer_id: handle.id,
-		});
+/// Encodes the passes of every window of a frame and submits them, after
+/// the culls, in a single `queue.submit`. A window with a failed pass is
+/// left out entirely. Screenshots of the drawn windows are handed to the
+/// screenshot queue. Returns the windows that were drawn.
+fn submit_frame(device: &wgpu::Device, queue: &wgpu::Queue, screenshots: &mut ScreenshotQueue, resources: &PassResources, culls: wgpu::CommandBuffer, frames: Vec<(WindowHandle, RenderEncoder)>, targets: &[FrameTarget]) -> Vec<u32> {
+	let mut jobs = Vec::new();
+	for (window, encoder) in frames {
+		let target = match targets.iter().find(|t| t.window_id == window.id) {
+			Some(target) => target,
+			None => continue,
+		};
+		let mut color_cleared = false;
+		let mut depth_cleared = false;
+		for pass in encoder.passes {
+			let (uses_color, uses_depth) = pass.pipeline
+				.and_then(|pipeline| resources.pipelines.iter().find(|p| p.id == pipeline.id))
+				.map_or((true, false), |p| (p.uses_color, p.uses_depth));
+			let (clear_color, clear_depth) = (uses_color && !color_cleared, uses_depth && !depth_cleared);
+			color_cleared |= uses_color;
+			depth_cleared |= uses_depth;
+			jobs.push(PassJob {
+				window_id: window.id,
+				pass,
+				clear_color,
+				clear_depth,
+				color_view: target.view,
+				width: target.width,
+				height: target.height,
+			});
+		}
 	}
+	let encoded = encode_passes(device, resources, &jobs);
+	let failed: Vec<u32> = jobs.iter().zip(&encoded).filter(|(_, b)| b.is_none()).map(|(job, _)| job.window_id).collect();
+	let drawn: Vec<u32> = targets.iter().map(|t| t.window_id).filter(|id| !failed.contains(id)).collect();
+
+	let mut copies = device.create_command_encoder(&wgpu::CommandEncoderDescriptor {
+		label: Some("Screenshot Encoder"),
+	});
+	let mut readbacks = Vec::new();
+	for target in targets.iter().filter(|t| drawn.contains(&t.window_id)) {
+		if let Some(capture) = &target.screenshot {
+			readbacks.push(copy_screenshot(screenshots, &mut copies, target, capture.clone()));
+		}
+	}
+	let mut command_buffers = vec![culls];
+	command_buffers.extend(jobs.iter().zip(encoded).filter(|(job, _)| !failed.contains(&job.window_id)).filter_map(|(_, b)| b));
+	command_buffers.push(copies.finish());
+	queue.submit(command_buffers);
+	// Mapping can only start once the copies are submitted.
+	for readback in readbacks {
+		screenshots.push(readback);
+	}
+	drawn
+}
 
-	fn create_texture(&mut self, name: &str, data: &[u8], width: u32, height: u32) -> TextureHandle {
-		let texture_id = self.texture_id;
-		self.proxy.send_event(UserEvent::CreateTexture {
-			texture_id,
+fn copy_screenshot(screenshots: &mut ScreenshotQueue, encoder: &mut wgpu::CommandEncoder, target: &FrameTarget, capture: Capture) -> ScreenshotReadback {
+	let bytes_per_pixel = 4;
+	let unpadded_bytes_per_row = target.width * bytes_per_pixel;
+	let align = wgpu::COPY_BYTES_PER_ROW_ALIGNMENT;
+	let padded_bytes_per_row_padding = (align - unpadded_bytes_per_row % align) % align;
+	let padded_bytes_per_row = unpadded_bytes_per_row + padded_bytes_per_row_padding;
+	let buffer = screenshots.buffer(padded_bytes_per_row as u64 * target.height as u64);
+	encoder.copy_texture_to_buffer(
+		wgpu::ImageCopyTexture {
+			texture: target.texture,
+			mip_level: 0,
+			origin: wgpu::Origin3d::ZERO,
+			aspect: wgpu::TextureAspect::All,
+		},
+		wgpu::ImageCopyBuffer {
+			buffer: &buffer,
+			layout: wgpu::ImageDataLayout {
+				offset: 0,
+				bytes_per_row: Some(padded_bytes_per_row),
+				rows_per_image: Some(target.height),
+			},
+		},
+		wgpu::Extent3d {
+			width: target.width,
+			height: target.height,
+			depth_or_array_layers: 1,
+		},
+	);
+	ScreenshotReadback {
+		capture,
+		buffer,
+		width: target.width,
+		height: target.height,
+		unpadded_bytes_per_row,
+		padded_bytes_per_row,
+		swap_bgra: target.swap_bgra,
+	}
+}
+
+fn create_cull_pipeline(device: &wgpu::Device) -> wgpu::ComputePipeline {
+	let shader = device.create_shader_module(wgpu::ShaderModuleDescriptor {
+		label: Some("Cull Shader"),
+		source: wgpu::ShaderSource::Wgsl(include_str!("../shaders/cull.wgsl").into()),
+	});
+	device.create_compute_pipeline(&wgpu::ComputePipelineDescriptor {
+		label: Some("Cull Pipeline"),
+		layout: None,
+		module: &shader,
+		entry_point: "cs_main",
+		compilation_options: Default::default(),
+	})
+}
+
+/// Records the cull dispatches of a frame ahead of its render passes. The
+/// compacted instances only exist on the GPU so their buffers are marked
+/// written here.
+fn encode_culls(device: &wgpu::Device, pipeline: &mut Option<wgpu::ComputePipeline>, buffers: &mut [BufferContext], encoder: &mut wgpu::CommandEncoder, culls: &[CullDispatch]) {
+	if culls.is_empty() {
+		return;
+	}
+	let pipeline = pipeline.get_or_insert_with(|| create_cull_pipeline(device));
+	let layout = pipeline.get_bind_group_layout(0);
+	for cull in culls {
+		let handles = [cull.frustum, cull.instances, cull.ranges, cull.draws, cull.args, cull.output];
+		let mut entries = Vec::with_capacity(handles.len());
+		for (binding, handle) in handles.iter().enumerate() {
+			let buffer_ctx = match buffers.iter().find(|b| b.id == handle.id) {
+				Some(buffer_ctx) => buffer_ctx,
+				None => {
+					log::error!("Buffer not found: {:?}", handle);
+					break;
+				}
+			};
+			entries.push(wgpu::BindGroupEntry {
+				binding: binding as u32,
+				resource: buffer_ctx.buffer.as_entire_binding(),
+			});
+		}
+		if entries.len() != handles.len() {
+			continue;
+		}
+		let bind_group = device.create_bind_group(&wgpu::BindGroupDescriptor {
+			label: Some("Cull Bind Group"),
+			layout: &layout,
+			entries: &entries,
+		});
+		let mut pass = encoder.begin_compute_pass(&wgpu::ComputePassDescriptor {
+			label: Some("Cull Pass"),
+			timestamp_writes: None,
+		});
+		pass.set_pipeline(pipeline);
+		pass.set_bind_group(0, &bind_group, &[]);
+		pass.dispatch_workgroups((cull.item_count + 63) / 64, 1, 1);
+		drop(pass);
+		if let Some(output) = buffers.iter_mut().find(|b| b.id == cull.output.id) {
+			output.written = true;
+		}
+	}
+}
+
+/// Copies between buffers in a submission of its own, so it lands after
+/// the writes already queued for either of them.
+fn copy_buffer(device: &wgpu::Device, queue: &wgpu::Queue, buffers: &mut [BufferContext], src: BufferHandle, dst: BufferHandle, size: u64) {
+	let (src_index, dst_index) = match (buffers.iter().position(|b| b.id == src.id), buffers.iter().position(|b| b.id == dst.id)) {
+		(Some(s), Some(d)) => (s, d),
+		_ => {
+			log::error!("Buffer not found for copy: {:?} -> {:?}", src, dst);
+			return;
+		}
+	};
+	if size == 0 || !buffers[src_index].written {
+		return;
+	}
+	let mut encoder = device.create_command_encoder(&wgpu::CommandEncoderDescriptor {
+		label: Some("Copy Encoder"),
+	});
+	encoder.copy_buffer_to_buffer(&buffers[src_index].buffer, 0, &buffers[dst_index].buffer, 0, size);
+	queue.submit(Some(encoder.finish()));
+	buffers[dst_index].written = true;
+}
+
+fn write_texture_rect(queue: &wgpu::Queue, textures: &[TextureContext], texture: TextureHandle, x: u32, y: u32, width: u32, height: u32, data: &[u8]) {
+	let texture_ctx = match textures.iter().find(|t| t.id == texture.id) {
+		Some(texture_ctx) => texture_ctx,
+		None => {
+			log::error!("Texture not found: {:?}", texture);
+			return;
+		}
+	};
+	if data.len() != (width * height * 4) as usize {
+		log::error!("Texture data of {} bytes doesn't match {}x{}", data.len(), width, height);
+		return;
+	}
+	queue.write_texture(
+		wgpu::ImageCopyTexture {
+			texture: &texture_ctx.texture,
+			mip_level: 0,
+			origin: wgpu::Origin3d { x, y, z: 0 },
+			aspect: wgpu::TextureAspect::All,
+		},
+		data,
+		wgpu::ImageDataLayout {
+			offset: 0,
+			bytes_per_row: Some(4 * width),
+			rows_per_image: Some(height),
+		},
+		wgpu::Extent3d {
+			width,
+			height,
+			depth_or_array_layers: 1,
+		},
+	);
+}
+
+/// Records the draws of a pass into a bundle for the 3D pipelines' targets.
+/// None when something it binds doesn't exist.
+fn record_bundle(device: &wgpu::Device, pipelines: &[PipelineContext], buffers: &[BufferContext], textures: &[TextureContext], materials: &[MaterialContext], commands: &RenderPass) -> Option<wgpu::RenderBundle> {
+	let mut encoder = device.create_render_bundle_encoder(&wgpu::RenderBundleEncoderDescriptor {
+		label: Some("Render Bundle"),
+		color_formats: &[Some(wgpu::TextureFormat::Bgra8UnormSrgb)],
+		depth_stencil: Some(wgpu::RenderBundleDepthStencil {
+			format: wgpu::TextureFormat::Depth24PlusStencil8,
+			depth_read_only: false,
+			stencil_read_only: true,
+		}),
+		sample_count: 1,
+		multiview: None,
+	});
+	fn find<'a>(buffers: &'a [BufferContext], handle: &BufferHandle) -> Option<&'a BufferContext> {
+		let found = buffers.iter().find(|b| b.id == handle.id);
+		if found.is_none() {
+			log::error!("Buffer not found: {:?}", handle);
+		}
+		found
+	}
+	// Redundant bindings are dropped by the bundle encoder itself.
+	let mut current_pipeline = None;
+	for subpass in &commands.subpasses {
+		let pipeline = subpass.pipeline?;
+		if current_pipeline != Some(pipeline.id) {
+			let pipeline_ctx = pipelines.iter().find(|p| p.id == pipeline.id)?;
+			encoder.set_pipeline(&pipeline_ctx.pipeline);
+			current_pipeline = Some(pipeline.id);
+		}
+		for (slot, handle) in &subpass.buffers {
+			encoder.set_bind_group(*slot, &find(buffers, handle)?.bind_group, &[]);
+		}
+		for (slot, handle) in &subpass.textures {
+			let texture_ctx = textures.iter().find(|t| t.id == handle.id)?;
+			encoder.set_bind_group(*slot, &texture_ctx.bind_group, &[]);
+		}
+		for (slot, handle, offset) in &subpass.materials {
+			let material_ctx = materials.iter().find(|m| m.id == handle.id)?;
+			encoder.set_bind_group(*slot, &material_ctx.bind_group, &[*offset]);
+		}
+		for (slot, slice) in &subpass.vertex_buffers {
+			encoder.set_vertex_buffer(*slot, find(buffers, &slice.handle)?.buffer.slice(slice.range.clone()));
+		}
+		if let Some(slice) = &subpass.index_buffer {
+			encoder.set_index_buffer(find(buffers, &slice.handle)?.buffer.slice(slice.range.clone()), wgpu::IndexFormat::Uint16);
+		}
+		match &subpass.indirect {
+			Some((args, offset)) => encoder.draw_indexed_indirect(&find(buffers, args)?.buffer, *offset),
+			None => encoder.draw_indexed(subpass.indices.clone()?, subpass.base_vertex, subpass.instances.clone()?),
+		}
+	}
+	Some(encoder.finish(&wgpu::RenderBundleDescriptor {
+		label: Some("Render Bundle"),
+	}))
+}
+
+/// Bind group of a material, see `MaterialBindGroup`. None when one of its
+/// textures or its buffer doesn't exist.
+fn create_material_bind_group(device: &wgpu::Device, layout: &wgpu::BindGroupLayout, textures: &[TextureContext], buffers: &[BufferContext], material_textures: &[TextureHandle; 5], material: &BufferSlice) -> Option<wgpu::BindGroup> {
+	let mut texture_ctxs = Vec::with_capacity(material_textures.len());
+	for handle in material_textures {
+		match textures.iter().find(|t| t.id == handle.id) {
+			Some(texture_ctx) => texture_ctxs.push(texture_ctx),
+			None => {
+				log::error!("Texture not found: {:?}", handle);
+				return None;
+			}
+		}
+	}
+	let buffer_ctx = match buffers.iter().find(|b| b.id == material.handle.id) {
+		Some(buffer_ctx) => buffer_ctx,
+		None => {
+			log::error!("Buffer not found: {:?}", material.handle);
+			return None;
+		}
+	};
+	let mut entries = Vec::with_capacity(texture_ctxs.len() * 2 + 1);
+	for (i, texture_ctx) in texture_ctxs.iter().enumerate() {
+		entries.push(wgpu::BindGroupEntry {
+			binding: i as u32 * 2,
+			resource: wgpu::BindingResource::TextureView(&texture_ctx.view),
+		});
+		entries.push(wgpu::BindGroupEntry {
+			binding: i as u32 * 2 + 1,
+			resource: wgpu::BindingResource::Sampler(&texture_ctx.sampler),
+		});
+	}
+	entries.push(wgpu::BindGroupEntry {
+		binding: MaterialBindGroup::MATERIAL_BINDING,
+		resource: wgpu::BindingResource::Buffer(wgpu::BufferBinding {
+			buffer: &buffer_ctx.buffer,
+			offset: material.range.start,
+			size: wgpu::BufferSize::new(material.range.end - material.range.start),
+		}),
+	});
+	Some(device.create_bind_group(&wgpu::BindGroupDescriptor {
+		label: Some("Material Bind Group"),
+		layout,
+		entries: &entries,
+	}))
+}
+
+struct BufferContext {
+	id: u32,
+	name: String,
+	buffer: wgpu::Buffer,
+	bind_group: wgpu::BindGroup,
+	written: bool,
+}
+
+struct TextureContext {
+	id: u32,
+	texture: wgpu::Texture,
+	view: wgpu::TextureView,
+	sampler: wgpu::Sampler,
+	bind_group: wgpu::BindGroup,
+}
+
+struct MaterialContext {
+	id: u32,
+	bind_group: wgpu::BindGroup,
+}
+
+struct BundleContext {
+	id: u32,
+	bundle: wgpu::RenderBundle,
+}
+
+pub struct WgpuHardware {
+	device: Arc<wgpu::Device>,
+	queue: Arc<wgpu::Queue>,
+	instance: Arc<wgpu::Instance>,
+	adapter: Arc<wgpu::Adapter>,
+	proxy: winit::event_loop::EventLoopProxy<UserEvent>,
+	pipeline_id: u32,
+	buffer_id: u32,
+	texture_id: u32,
+	material_id: u32,
+	bundle_id: u32,
+	window_id: u32,
+}
+
+impl WgpuHardware {
+	pub fn new(proxy: winit::event_loop::EventLoopProxy<UserEvent>, instance: Arc<wgpu::Instance>, adapter: Arc<wgpu::Adapter>, device: Arc<wgpu::Device>, queue: Arc<wgpu::Queue>) -> Self {
+		Self {
+			instance,
+			device,
+			queue,
+			adapter,
+			proxy,
+			pipeline_id: 1,
+			buffer_id: 1,
+			texture_id: 1,
+			material_id: 1,
+			bundle_id: 1,
+			window_id: 1,
+		}
+	}
+}
+
+impl Hardware for WgpuHardware {
+	fn create_buffer(&mut self, name: &str, size: u64) -> BufferHandle {
+		let buffer_id = self.buffer_id;
+		self.proxy.send_event(UserEvent::CreateBuffer {
+			name: name.to_string(),
+			buffer_id,
+			size,
+		});
+		self.buffer_id += 1;
+		BufferHandle {
+			id: buffer_id,
+			size,
+		}
+	}
+
+	fn destroy_buffer(&mut self, handle: BufferHandle) {
+		self.proxy.send_event(UserEvent::DestroyBuffer {
+			buffer_id: handle.id,
+		});
+	}
+
+	fn create_texture(&mut self, name: &str, data: &[u8], width: u32, height: u32) -> TextureHandle {
+		let texture_id = self.texture_id;
+		self.proxy.send_event(UserEvent::CreateTexture {
+			texture_id,
 			name: name.to_string(),
 			data: data.to_vec(),
 			width,
@@ -1377,6 +1783,54 @@ impl Hardware for WgpuHardware {
 		}
 	}
 
+	fn create_render_bundle(&mut self, commands: RenderPass) -> BundleHandle {
+		let bundle_id = self.bundle_id;
+		self.proxy.send_event(UserEvent::CreateRenderBundle {
+			bundle_id,
+			commands,
+		});
+		self.bundle_id += 1;
+		BundleHandle {
+			id: bundle_id,
+		}
+	}
+
+	fn destroy_render_bundle(&mut self, handle: BundleHandle) {
+		self.proxy.send_event(UserEvent::DestroyRenderBundle {
+			bundle_id: handle.id,
+		});
+	}
+
+	fn write_texture(&mut self, texture: TextureHandle, x: u32, y: u32, width: u32, height: u32, data: &[u8]) {
+		self.proxy.send_event(UserEvent::WriteTexture {
+			texture,
+			x,
+			y,
+			width,
+			height,
+			data: data.to_vec(),
+		});
+	}
+
+	fn create_material(&mut self, textures: [TextureHandle; 5], material: BufferSlice) -> MaterialHandle {
+		let material_id = self.material_id;
+		self.proxy.send_event(UserEvent::CreateMaterial {
+			material_id,
+			textures,
+			material,
+		});
+		self.material_id += 1;
+		MaterialHandle {
+			id: material_id,
+		}
+	}
+
+	fn destroy_material(&mut self, handle: MaterialHandle) {
+		self.proxy.send_event(UserEvent::DestroyMaterial {
+			material_id: handle.id,
+		});
+	}
+
 	fn create_window(&mut self, window: &Window) -> WindowHandle {
 		let window_id = self.window_id;
 		let args = CreateWindow {
@@ -1403,11 +1857,16 @@ impl Hardware for WgpuHardware {
 	}
 
 	fn create_pipeline(&mut self, name: &str, window: WindowHandle) -> PipelineHandle {
+		self.create_material_pipeline(name, window, MaterialFeatures::ALL)
+	}
+
+	fn create_material_pipeline(&mut self, name: &str, window: WindowHandle, features: MaterialFeatures) -> PipelineHandle {
 		let pipeline_id = self.pipeline_id;
 		self.proxy.send_event(UserEvent::CreatePipeline {
 			window,
 			name: name.to_string(),
 			pipeline_id,
+			features,
 		});
 		self.pipeline_id += 1;
 		PipelineHandle {
@@ -1418,14 +1877,34 @@ impl Hardware for WgpuHardware {
 	fn write_buffer(&mut self, buffer: BufferHandle, data: &[u8]) {
 		self.proxy.send_event(UserEvent::WriteBuffer {
 			buffer,
+			offset: 0,
+			data: data.to_vec(),
+		});
+	}
+
+	fn write_buffer_at(&mut self, buffer: BufferHandle, offset: u64, data: &[u8]) {
+		self.proxy.send_event(UserEvent::WriteBuffer {
+			buffer,
+			offset,
 			data: data.to_vec(),
 		});
 	}
 
+	fn copy_buffer(&mut self, src: BufferHandle, dst: BufferHandle, size: u64) {
+		self.proxy.send_event(UserEvent::CopyBuffer {
+			src,
+			dst,
+			size,
+		});
+	}
+
 	fn render(&mut self, encoder: RenderEncoder, window: WindowHandle) {
-		self.proxy.send_event(UserEvent::Render {
-			window,
-			encoder,
+		self.render_frame(vec![(window, encoder)]);
+	}
+
+	fn render_frame(&mut self, frames: Vec<(WindowHandle, RenderEncoder)>) {
+		self.proxy.send_event(UserEvent::RenderFrame {
+			frames,
 		});
 	}
 
@@ -1441,23 +1920,61 @@ impl HeadlessWgpuHardware {
 	fn new(device: Arc<wgpu::Device>, queue: Arc<wgpu::Queue>) -> Self {
 		let screenshot_dir = screenshot_dir_from_env();
 		let screenshot_interval = screenshot_interval_from_env();
+		let screenshots = ScreenshotQueue::new(device.clone(), capture_settings_from_env());
 		Self {
 			device,
 			queue,
 			pipeline_id: 1,
 			buffer_id: 1,
 			texture_id: 1,
+			material_id: 1,
+			bundle_id: 1,
 			window_id: 1,
 			windows: Vec::new(),
+			pending_captures: HashMap::new(),
 			pipelines: Vec::new(),
+			pipeline_cache: PipelineCache::default(),
+			cull_pipeline: None,
 			buffers: Vec::new(),
 			textures: Vec::new(),
+			materials: Vec::new(),
+			bundles: Vec::new(),
 			pending_screenshots: HashMap::new(),
+			screenshots,
 			screenshot_dir,
 			screenshot_counter: 0,
 			screenshot_interval,
 		}
 	}
+
+	fn create_target(&mut self, width: u32, height: u32, offscreen: bool) -> WindowHandle {
+		let window_id = self.window_id;
+		self.window_id += 1;
+		let size = wgpu::Extent3d {
+			width,
+			height,
+			depth_or_array_layers: 1,
+		};
+		let color_texture = self.device.create_texture(&wgpu::TextureDescriptor {
+			label: Some("Headless Color Texture"),
+			size,
+			mip_level_count: 1,
+			sample_count: 1,
+			dimension: wgpu::TextureDimension::D2,
+			format: wgpu::TextureFormat::Bgra8UnormSrgb,
+			usage: wgpu::TextureUsages::RENDER_ATTACHMENT | wgpu::TextureUsages::COPY_SRC,
+			view_formats: Default::default(),
+		});
+		let color_view = color_texture.create_view(&wgpu::TextureViewDescriptor::default());
+		self.windows.push(HeadlessWindowContext {
+			window_id,
+			offscreen,
+			size,
+			color_texture,
+			color_view,
+		});
+		WindowHandle { id: window_id }
+	}
 }
 
 impl Hardware for HeadlessWgpuHardware {
@@ -1472,7 +1989,8 @@ impl Hardware for HeadlessWgpuHardware {
 				| wgpu::BufferUsages::COPY_SRC
 				| wgpu::BufferUsages::INDEX
 				| wgpu::BufferUsages::UNIFORM
-				| wgpu::BufferUsages::STORAGE,
+				| wgpu::BufferUsages::STORAGE
+				| wgpu::BufferUsages::INDIRECT,
 			mapped_at_creation: false,
 		});
 		let layout = self.device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
@@ -1577,12 +2095,52 @@ impl Hardware for HeadlessWgpuHardware {
 		self.textures.push(TextureContext {
 			id: texture_id,
 			texture,
+			view: texture_view,
+			sampler,
 			bind_group: texture_bind_group,
 		});
 		TextureHandle { id: texture_id }
 	}
 
+	fn create_render_bundle(&mut self, commands: RenderPass) -> BundleHandle {
+		let bundle_id = self.bundle_id;
+		self.bundle_id += 1;
+		match record_bundle(&self.device, &self.pipelines, &self.buffers, &self.textures, &self.materials, &commands) {
+			Some(bundle) => self.bundles.push(BundleContext { id: bundle_id, bundle }),
+			None => log::error!("Failed to record render bundle {}", bundle_id),
+		}
+		BundleHandle { id: bundle_id }
+	}
+
+	fn destroy_render_bundle(&mut self, handle: BundleHandle) {
+		self.bundles.retain(|b| b.id != handle.id);
+	}
+
+	fn write_texture(&mut self, texture: TextureHandle, x: u32, y: u32, width: u32, height: u32, data: &[u8]) {
+		write_texture_rect(&self.queue, &self.textures, texture, x, y, width, height, data);
+	}
+
+	fn create_material(&mut self, textures: [TextureHandle; 5], material: BufferSlice) -> MaterialHandle {
+		let material_id = self.material_id;
+		self.material_id += 1;
+		if let Some(bind_group) = create_material_bind_group(&self.device, &self.pipeline_cache.material_layout(&self.device), &self.textures, &self.buffers, &textures, &material) {
+			self.materials.push(MaterialContext {
+				id: material_id,
+				bind_group,
+			});
+		}
+		MaterialHandle { id: material_id }
+	}
+
+	fn destroy_material(&mut self, handle: MaterialHandle) {
+		self.materials.retain(|m| m.id != handle.id);
+	}
+
 	fn create_pipeline(&mut self, name: &str, window: WindowHandle) -> PipelineHandle {
+		self.create_material_pipeline(name, window, MaterialFeatures::ALL)
+	}
+
+	fn create_material_pipeline(&mut self, name: &str, window: WindowHandle, features: MaterialFeatures) -> PipelineHandle {
 		let pipeline_id = self.pipeline_id;
 		self.pipeline_id += 1;
 		let window_ctx = match self.windows.iter().find(|window_ctx| window_ctx.window_id == window.id) {
@@ -1592,456 +2150,103 @@ impl Hardware for HeadlessWgpuHardware {
 				return PipelineHandle { id: pipeline_id };
 			}
 		};
-		let (render_pipeline, depth_texture_view, uses_depth) = if name == "gui" {
-			let shader_source =
-				wgpu::ShaderSource::Wgsl(include_str!("../shaders/gui_shader.wgsl").into());
-			let shader = self.device.create_shader_module(wgpu::ShaderModuleDescriptor {
-				label: Some("Gui Shader"),
-				source: shader_source,
-			});
-
-			let render_pipeline_layout = self.device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
-				label: Some("Gui Pipeline Layout"),
-				bind_group_layouts: &[],
-				push_constant_ranges: &[],
-			});
-
-			let position_layout = wgpu::VertexBufferLayout {
-				array_stride: std::mem::size_of::<[f32; 3]>() as wgpu::BufferAddress,
-				step_mode: wgpu::VertexStepMode::Vertex,
-				attributes: &[wgpu::VertexAttribute {
-					offset: 0,
-					format: wgpu::VertexFormat::Float32x3,
-					shader_location: 0,
-				}],
-			};
-			let color_layout = wgpu::VertexBufferLayout {
-				array_stride: std::mem::size_of::<[f32; 3]>() as wgpu::BufferAddress,
-				step_mode: wgpu::VertexStepMode::Vertex,
-				attributes: &[wgpu::VertexAttribute {
-					offset: 0,
-					format: wgpu::VertexFormat::Float32x3,
-					shader_location: 1,
-				}],
-			};
-
-			let render_pipeline = self.device.create_render_pipeline(&wgpu::RenderPipelineDescriptor {
-				label: Some("Gui Pipeline"),
-				layout: Some(&render_pipeline_layout),
-				vertex: wgpu::VertexState {
-					module: &shader,
-					entry_point: "vs_main",
-					buffers: &[position_layout, color_layout],
-					compilation_options: Default::default(),
-				},
-				fragment: Some(wgpu::FragmentState {
-					module: &shader,
-					entry_point: "fs_main",
-					targets: &[Some(wgpu::ColorTargetState {
-						format: wgpu::TextureFormat::Bgra8UnormSrgb,
-						blend: Some(wgpu::BlendState {
-							color: wgpu::BlendComponent::REPLACE,
-							alpha: wgpu::BlendComponent::REPLACE,
-						}),
-						write_mask: wgpu::ColorWrites::ALL,
-					})],
-					compilation_options: Default::default(),
-				}),
-				primitive: wgpu::PrimitiveState {
-					topology: wgpu::PrimitiveTopology::TriangleList,
-					strip_index_format: None,
-					front_face: wgpu::FrontFace::Ccw,
-					cull_mode: None,
-					polygon_mode: wgpu::PolygonMode::Fill,
-					unclipped_depth: false,
-					conservative: false,
-				},
-				depth_stencil: None,
-				multisample: wgpu::MultisampleState {
-					count: 1,
-					mask: !0,
-					alpha_to_coverage_enabled: false,
-				},
-				multiview: None,
-			});
-
-			(render_pipeline, None, false)
-		} else {
-			let depth_texture = self.device.create_texture(&wgpu::TextureDescriptor {
-				label: None,
-				size: wgpu::Extent3d {
-					width: window_ctx.size.width,
-					height: window_ctx.size.height,
-					depth_or_array_layers: 1,
-				},
-				mip_level_count: 1,
-				sample_count: 1,
-				dimension: wgpu::TextureDimension::D2,
-				format: wgpu::TextureFormat::Depth24PlusStencil8,
-				usage: wgpu::TextureUsages::RENDER_ATTACHMENT,
-				view_formats: Default::default(),
-			});
-			let depth_texture_view =
-				Arc::new(depth_texture.create_view(&wgpu::TextureViewDescriptor::default()));
-			let camera_bind_group_layout = RawCamera::create_bind_group_layout(&self.device);
-			let point_light_bind_group_layout = RawPointLight::create_bind_group_layout(&self.device);
-			let base_texture_bind_group_layout = TextureBuffer::create_bind_group_layout(&self.device);
-			let metallic_roughness_texture_bind_group_layout = TextureBuffer::create_bind_group_layout(&self.device);
-			let normal_texture_bind_group_layout = TextureBuffer::create_bind_group_layout(&self.device);
-			let occlusion_texture_bind_group_layout = TextureBuffer::create_bind_group_layout(&self.device);
-			let emissive_texture_bind_group_layout = TextureBuffer::create_bind_group_layout(&self.device);
-			let material_bind_group_layout = self.device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
-				label: Some("Material Bind Group Layout"),
-				entries: &[wgpu::BindGroupLayoutEntry {
-					binding: 0,
-					visibility: wgpu::ShaderStages::FRAGMENT | wgpu::ShaderStages::VERTEX,
-					ty: wgpu::BindingType::Buffer {
-						ty: wgpu::BufferBindingType::Storage { read_only: true },
-						has_dynamic_offset: false,
-						min_binding_size: None,
+		let (render_pipeline, uses_color, uses_depth) = self.pipeline_cache.pipeline(&self.device, name, features);
+		// Variants of a window's 3D pipeline draw into the same passes, so
+		// they share its depth texture.
+		let shared_depth = self.pipelines.iter()
+			.find(|p| p.window_id == window.id && p.uses_depth)
+			.and_then(|p| p.depth_texture_view.clone());
+		let depth_texture_view = match (uses_depth, shared_depth) {
+			(false, _) => None,
+			(true, Some(view)) => Some(view),
+			(true, None) => {
+				let depth_texture = self.device.create_texture(&wgpu::TextureDescriptor {
+					label: None,
+					size: wgpu::Extent3d {
+						width: window_ctx.size.width,
+						height: window_ctx.size.height,
+						depth_or_array_layers: 1,
 					},
-					count: None,
-				}],
-			});
-			let tex_coords_layout = wgpu::VertexBufferLayout {
-				array_stride: std::mem::size_of::<TexCoords>() as wgpu::BufferAddress,
-				step_mode: wgpu::VertexStepMode::Vertex,
-				attributes: &[wgpu::VertexAttribute {
-					offset: 0,
-					format: wgpu::VertexFormat::Float32x2,
-					shader_location: 2,
-				}],
-			};
-			let layouts = &[
-				&camera_bind_group_layout, 
-				&point_light_bind_group_layout, 
-				&base_texture_bind_group_layout,
-				&metallic_roughness_texture_bind_group_layout,
-				&normal_texture_bind_group_layout,
-				&occlusion_texture_bind_group_layout,
-				&emissive_texture_bind_group_layout,
-				&material_bind_group_layout,
-			];
-			let buffers = &[Vertices::desc(), RawInstance::desc(), Normals::desc(), tex_coords_layout];
-			let shader_source = wgpu::ShaderSource::Wgsl(include_str!("../shaders/3d_shader.wgsl").into());
-			let shader = self.device.create_shader_module(wgpu::ShaderModuleDescriptor {
-				label: Some("Shader"),
-				source: shader_source
-			});
-			let render_pipeline_layout = self.device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
-				label: Some("Render Pipeline Layout"),
-				bind_group_layouts: layouts,
-				push_constant_ranges: &[],
-			});
-			let depth_stencil_state = wgpu::DepthStencilState {
-				format: wgpu::TextureFormat::Depth24PlusStencil8,
-				depth_write_enabled: true,
-				depth_compare: wgpu::CompareFunction::Less,
-				stencil: wgpu::StencilState::default(),
-				bias: wgpu::DepthBiasState::default(),
-			};
-			let render_pipeline = self.device.create_render_pipeline(&wgpu::RenderPipelineDescriptor {
-				label: Some("Render Pipeline"),
-				layout: Some(&render_pipeline_layout),
-				vertex: wgpu::VertexState {
-					module: &shader,
-					entry_point: "vs_main",
-					buffers,
-					compilation_options: Default::default(),
-				},
-				fragment: Some(wgpu::FragmentState {
-					module: &shader,
-					entry_point: "fs_main",
-					targets: &[Some(wgpu::ColorTargetState {
-						format: wgpu::TextureFormat::Bgra8UnormSrgb,
-						blend: Some(wgpu::BlendState {
-							color: wgpu::BlendComponent::REPLACE,
-							alpha: wgpu::BlendComponent::REPLACE,
-						}),
-						write_mask: wgpu::ColorWrites::ALL,
-					})],
-					compilation_options: Default::default(),
-				}),
-				primitive: wgpu::PrimitiveState {
-					topology: wgpu::PrimitiveTopology::TriangleList,
-					strip_index_format: None,
-					front_face: wgpu::FrontFace::Ccw,
-					cull_mode: None,
-					polygon_mode: wgpu::PolygonMode::Fill,
-					unclipped_depth: false,
-					conservative: false,
-				},
-				depth_stencil: Some(depth_stencil_state),
-				multisample: wgpu::MultisampleState {
-					count: 1,
-					mask: !0,
-					alpha_to_coverage_enabled: false,
-				},
-				multiview: None,
-			});
-
-			(render_pipeline, Some(depth_texture_view), true)
+					mip_level_count: 1,
+					sample_count: 1,
+					dimension: wgpu::TextureDimension::D2,
+					format: wgpu::TextureFormat::Depth24PlusStencil8,
+					usage: wgpu::TextureUsages::RENDER_ATTACHMENT,
+					view_formats: Default::default(),
+				});
+				Some(Arc::new(depth_texture.create_view(&wgpu::TextureViewDescriptor::default())))
+			}
 		};
 		self.pipelines.push(PipelineContext {
 			id: pipeline_id,
-			pipeline: Arc::new(render_pipeline),
+			window_id: window.id,
+			pipeline: render_pipeline,
 			depth_texture_view,
+			uses_color,
 			uses_depth,
 		});
 		PipelineHandle { id: pipeline_id }
 	}
 
 	fn render(&mut self, encoder: RenderEncoder, window: WindowHandle) {
-		let mut screenshot_path = self.pending_screenshots.remove(&window.id);
-		let frame_index = self.screenshot_counter;
-		self.screenshot_counter += 1;
-		if screenshot_path.is_none() {
-			if let Some(dir) = &self.screenshot_dir {
-				if self.screenshot_interval > 0 && frame_index % self.screenshot_interval == 0 {
-					let filename = format!("screenshot_{}_{}.png", window.id, frame_index);
-					let path = dir.join(filename);
-					screenshot_path = Some(path.to_string_lossy().to_string());
-				}
-			}
-		}
-		let window_ctx = match self.windows.iter().find(|window_ctx| window_ctx.window_id == window.id) {
-			Some(window_ctx) => window_ctx,
-			None => {
-				log::error!("Window not found: {:?} => RETURN", window);
-				return;
-			}
-		};
-		let mut wgpu_encoder = self.device.create_command_encoder(&wgpu::CommandEncoderDescriptor {
-			label: Some("Render Encoder"),
+		self.render_frame(vec![(window, encoder)]);
+	}
+
+	fn render_frame(&mut self, frames: Vec<(WindowHandle, RenderEncoder)>) {
+		self.screenshots.poll();
+		let mut cull_encoder = self.device.create_command_encoder(&wgpu::CommandEncoderDescriptor {
+			label: Some("Cull Encoder"),
 		});
-		let mut screenshot_buffer = None;
-		let mut screenshot_info = None;
-		for (pass_index, pass) in encoder.passes.into_iter().enumerate() {
-			let pipeline = pass.pipeline.unwrap();
-			let pipeline_ctx = match self.pipelines.iter().find(|pipeline_ctx| pipeline_ctx.id == pipeline.id) {
-				Some(pipeline_ctx) => pipeline_ctx,
+		for (_, encoder) in &frames {
+			encode_culls(&self.device, &mut self.cull_pipeline, &mut self.buffers, &mut cull_encoder, &encoder.culls);
+		}
+		let mut targets = Vec::new();
+		for (window, _) in &frames {
+			let window_ctx = match self.windows.iter().find(|window_ctx| window_ctx.window_id == window.id) {
+				Some(window_ctx) => window_ctx,
 				None => {
-					log::error!("Pipeline not found: {:?} => RETURN", pipeline);
-					return;
+					log::error!("Window not found: {:?}", window);
+					continue;
 				}
 			};
-			let load_op = if pass_index == 0 {
-				wgpu::LoadOp::Clear(wgpu::Color {
-					r: 0.1,
-					g: 0.2,
-					b: 0.3,
-					a: 1.0,
-				})
-			} else {
-				wgpu::LoadOp::Load
-			};
-			let depth_stencil_attachment = if pipeline_ctx.uses_depth {
-				Some(wgpu::RenderPassDepthStencilAttachment {
-					view: pipeline_ctx
-						.depth_texture_view
-						.as_ref()
-						.expect("missing depth texture view"),
-					depth_ops: Some(wgpu::Operations {
-						load: if pass_index == 0 {
-							wgpu::LoadOp::Clear(1.0)
-						} else {
-							wgpu::LoadOp::Load
-						},
-						store: wgpu::StoreOp::Store,
-					}),
-					stencil_ops: None,
-				})
+			let screenshot = if window_ctx.offscreen {
+				self.pending_captures.remove(&window.id).map(Capture::Tiles)
 			} else {
-				None
+				let frame_index = self.screenshot_counter;
+				self.screenshot_counter += 1;
+				frame_screenshot_path(&mut self.pending_screenshots, &self.screenshot_dir, self.screenshots.settings(), self.screenshot_interval, frame_index, window.id)
 			};
-			let mut wgpu_pass = wgpu_encoder.begin_render_pass(&wgpu::RenderPassDescriptor {
-				label: Some("Render Pass"),
-				color_attachments: &[Some(wgpu::RenderPassColorAttachment {
-					view: &window_ctx.color_view,
-					resolve_target: None,
-					ops: wgpu::Operations {
-						load: load_op,
-						store: wgpu::StoreOp::Store,
-					},
-				})],
-				depth_stencil_attachment,
-				..Default::default()
+			targets.push(FrameTarget {
+				window_id: window.id,
+				texture: &window_ctx.color_texture,
+				view: &window_ctx.color_view,
+				width: window_ctx.size.width,
+				height: window_ctx.size.height,
+				screenshot,
+				swap_bgra: true,
 			});
-			wgpu_pass.set_pipeline(&pipeline_ctx.pipeline);
-			for subpass in &pass.subpasses {
-				for (slot, texture) in &subpass.textures {
-					let texture_ctx = match self.textures.iter().find(|t| t.id == texture.id) {
-						Some(texture) => texture, 
-						None => {
-							log::error!("Texture not found: {:?} => RETURN", texture);
-							return;
-						}
-					};
-					wgpu_pass.set_bind_group(*slot, &texture_ctx.bind_group, &[]);
-				}
-				for (slot, buffer) in &subpass.buffers {
-					let buffer_ctx = match self.buffers.iter().find(|b| b.id == buffer.id) {
-						Some(buffer) => buffer,
-						None => {
-							log::error!("Buffer not found: {:?} => RETURN", buffer);
-							return;
-						}
-					};
-					if !buffer_ctx.written {
-						log::error!("BUFFER NOT WRITTEN: {:?} => RETURN", buffer);
-						return;
-					}
-					wgpu_pass.set_bind_group(*slot, &buffer_ctx.bind_group, &[]);
-				}
-				for (slot, buffer) in &subpass.vertex_buffers {
-					let buffer_ctx = match self.buffers.iter().find(|b| b.id == buffer.handle.id) {
-						Some(buffer) => buffer,
-						None => {
-							log::error!("Buffer not found: {:?} => RETURN", buffer);
-							return;
-						}
-					};
-					if !buffer_ctx.written {
-						log::error!("BUFFER NOT WRITTEN: {:?} => RETURN", buffer);
-						return;
-					}
-					if buffer.range.start == buffer.range.end {
-						log::error!("BUFFER RANGE IS ZERO: {:?} => RETURN", buffer);
-						continue;
-					}
-					wgpu_pass.set_vertex_buffer(*slot, buffer_ctx.buffer.slice(buffer.range.clone()));
-				}
-				if let Some(slice) = &subpass.index_buffer {
-					let buffer_ctx = match self.buffers.iter().find(|b| b.id == slice.handle.id) {
-						Some(buffer) => buffer,
-						None => {
-							log::error!("Buffer not found: {:?} => RETURN", slice.handle);
-							return;
-						}
-					};
-					if !buffer_ctx.written {
-						log::error!("BUFFER NOT WRITTEN: {:?} => RETURN", slice.handle);
-						return;
-					}
-					if slice.range.start == slice.range.end {
-						log::error!("BUFFER RANGE IS ZERO: {:?} => RETURN", slice.handle);
-						continue;
-					}
-					wgpu_pass.set_index_buffer(buffer_ctx.buffer.slice(slice.range.clone()), wgpu::IndexFormat::Uint16);
-				}
-				let indices = subpass.indices.clone().unwrap();
-				let instances = subpass.instances.clone().unwrap();
-				wgpu_pass.draw_indexed(indices.clone(), 0, instances.clone());
-			}
-		}
-		if screenshot_path.is_some() {
-			let bytes_per_pixel = 4;
-			let unpadded_bytes_per_row = window_ctx.size.width * bytes_per_pixel;
-			let align = wgpu::COPY_BYTES_PER_ROW_ALIGNMENT;
-			let padded_bytes_per_row_padding = (align - unpadded_bytes_per_row % align) % align;
-			let padded_bytes_per_row = unpadded_bytes_per_row + padded_bytes_per_row_padding;
-			let output_buffer = self.device.create_buffer(&wgpu::BufferDescriptor {
-				label: Some("Screenshot Buffer"),
-				size: padded_bytes_per_row as u64 * window_ctx.size.height as u64,
-				usage: wgpu::BufferUsages::MAP_READ | wgpu::BufferUsages::COPY_DST,
-				mapped_at_creation: false,
-			});
-			wgpu_encoder.copy_texture_to_buffer(
-				wgpu::ImageCopyTexture {
-					texture: &window_ctx.color_texture,
-					mip_level: 0,
-					origin: wgpu::Origin3d::ZERO,
-					aspect: wgpu::TextureAspect::All,
-				},
-				wgpu::ImageCopyBuffer {
-					buffer: &output_buffer,
-					layout: wgpu::ImageDataLayout {
-						offset: 0,
-						bytes_per_row: Some(padded_bytes_per_row),
-						rows_per_image: Some(window_ctx.size.height),
-					},
-				},
-				window_ctx.size,
-			);
-			screenshot_buffer = Some(output_buffer);
-			screenshot_info = Some((window_ctx.size.width, window_ctx.size.height, unpadded_bytes_per_row, padded_bytes_per_row));
-		}
-		self.queue.submit(std::iter::once(wgpu_encoder.finish()));
-		if let (Some(path), Some(buffer), Some((width, height, unpadded_bytes_per_row, padded_bytes_per_row))) =
-			(screenshot_path, screenshot_buffer, screenshot_info)
-		{
-			let buffer_slice = buffer.slice(..);
-			let (tx, rx) = std::sync::mpsc::channel();
-			buffer_slice.map_async(wgpu::MapMode::Read, move |result| {
-				let _ = tx.send(result);
-			});
-			self.device.poll(wgpu::Maintain::Wait);
-			match rx.recv() {
-				Ok(Ok(())) => {}
-				Ok(Err(err)) => {
-					log::error!("Failed to map screenshot buffer: {:?}", err);
-					buffer.unmap();
-					return;
-				}
-				Err(err) => {
-					log::error!("Failed to receive screenshot buffer map result: {:?}", err);
-					buffer.unmap();
-					return;
-				}
-			}
-			let data = buffer_slice.get_mapped_range();
-			let mut pixels: Vec<u8> = Vec::with_capacity((width * height * 4) as usize);
-			for chunk in data.chunks(padded_bytes_per_row as usize) {
-				pixels.extend_from_slice(&chunk[..unpadded_bytes_per_row as usize]);
-			}
-			drop(data);
-			buffer.unmap();
-			for chunk in pixels.chunks_exact_mut(4) {
-				chunk.swap(0, 2);
-			}
-			match image::save_buffer(
-				&path,
-				&pixels,
-				width,
-				height,
-				image::ColorType::Rgba8,
-			) {
-				Ok(_) => crate::log1!("Screenshot saved to {}", path),
-				Err(err) => log::error!("Failed to save screenshot: {:?}", err),
-			}
 		}
+		let resources = PassResources {
+			pipelines: &self.pipelines,
+			buffers: &self.buffers,
+			textures: &self.textures,
+			materials: &self.materials,
+			bundles: &self.bundles,
+		};
+		submit_frame(&self.device, &self.queue, &mut self.screenshots, &resources, cull_encoder.finish(), frames, &targets);
 	}
 
 	fn create_window(&mut self, window: &Window) -> WindowHandle {
-		let window_id = self.window_id;
-		self.window_id += 1;
-		let size = wgpu::Extent3d {
-			width: window.width,
-			height: window.height,
-			depth_or_array_layers: 1,
-		};
-		let color_texture = self.device.create_texture(&wgpu::TextureDescriptor {
-			label: Some("Headless Color Texture"),
-			size,
-			mip_level_count: 1,
-			sample_count: 1,
-			dimension: wgpu::TextureDimension::D2,
-			format: wgpu::TextureFormat::Bgra8UnormSrgb,
-			usage: wgpu::TextureUsages::RENDER_ATTACHMENT | wgpu::TextureUsages::COPY_SRC,
-			view_formats: Default::default(),
-		});
-		let color_view = color_texture.create_view(&wgpu::TextureViewDescriptor::default());
-		self.windows.push(HeadlessWindowContext {
-			window_id,
-			size,
-			color_texture,
-			color_view,
-		});
-		WindowHandle { id: window_id }
+		self.create_target(window.width, window.height, false)
+	}
+
+	fn create_render_target(&mut self, width: u32, height: u32) -> Option<WindowHandle> {
+		Some(self.create_target(width, height, true))
 	}
 
 	fn destroy_window(&mut self, handle: WindowHandle) {
 		self.windows.retain(|window_ctx| window_ctx.window_id != handle.id);
+		self.pipelines.retain(|pipeline_ctx| pipeline_ctx.window_id != handle.id);
 	}
 
 	fn write_buffer(&mut self, buffer: BufferHandle, data: &[u8]) {
@@ -2060,9 +2265,36 @@ impl Hardware for HeadlessWgpuHardware {
 		self.queue.write_buffer(&buffer_ctx.buffer, 0, data);
 	}
 
+	fn write_buffer_at(&mut self, buffer: BufferHandle, offset: u64, data: &[u8]) {
+		let buffer_ctx = match self.buffers.iter_mut().find(|b| b.id == buffer.id) {
+			Some(b) => b,
+			None => {
+				log::error!("Buffer not found: {:?}", buffer);
+				return;
+			}
+		};
+		if data.is_empty() {
+			return;
+		}
+		buffer_ctx.written = true;
+		self.queue.write_buffer(&buffer_ctx.buffer, offset, data);
+	}
+
+	fn copy_buffer(&mut self, src: BufferHandle, dst: BufferHandle, size: u64) {
+		copy_buffer(&self.device, &self.queue, &mut self.buffers, src, dst, size);
+	}
+
 	fn save_screenshot(&mut self, window: WindowHandle, path: &str) {
 		self.pending_screenshots.insert(window.id, path.to_string());
 	}
+
+	fn capture_tiles(&mut self, target: WindowHandle, tiles: Vec<CaptureTile>) {
+		self.pending_captures.insert(target.id, tiles);
+	}
+
+	fn take_captures(&mut self) -> Vec<CapturedImage> {
+		self.screenshots.take_captures()
+	}
 }
 
 /*#[derive(Debug, Clone)]
@@ -1,3 +1,5 @@
 mod wgpu_types;
+mod pipeline_cache;
+mod screenshot;
 mod hardware;
 pub use hardware::run;
\ No newline at end of file
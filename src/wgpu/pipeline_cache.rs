@@ -0,0 +1,234 @@
+use std::collections::HashMap;
+use std::sync::Arc;
+
+use crate::hardware::MaterialFeatures;
+use super::wgpu_types::*;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+enum ShaderKind {
+	Gui,
+	Mesh,
+	Depth,
+}
+
+/// Everything that varies between the render pipelines the backend
+/// creates. Formats, blending and depth state are the same for all of them.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+struct PipelineKey {
+	shader: ShaderKind,
+	quantized: bool,
+	features: MaterialFeatures,
+}
+
+impl PipelineKey {
+	fn new(name: &str, features: MaterialFeatures) -> Self {
+		let quantized = name.ends_with("_quantized");
+		if name == "gui" {
+			return Self {
+				shader: ShaderKind::Gui,
+				quantized: false,
+				features: MaterialFeatures::NONE,
+			};
+		}
+		if name.starts_with("depth_prepass") {
+			return Self {
+				shader: ShaderKind::Depth,
+				quantized,
+				features: MaterialFeatures::NONE,
+			};
+		}
+		Self {
+			shader: ShaderKind::Mesh,
+			quantized,
+			features,
+		}
+	}
+}
+
+/// Shader modules, layouts and render pipelines shared by every window, so
+/// a window opened after the first one only creates its depth texture.
+#[derive(Default)]
+pub struct PipelineCache {
+	shaders: HashMap<ShaderKind, Arc<wgpu::ShaderModule>>,
+	layouts: HashMap<ShaderKind, Arc<wgpu::PipelineLayout>>,
+	material_layout: Option<Arc<wgpu::BindGroupLayout>>,
+	pipelines: HashMap<PipelineKey, Arc<wgpu::RenderPipeline>>,
+}
+
+impl PipelineCache {
+	/// Returns the pipeline and whether it draws color and depth.
+	pub fn pipeline(&mut self, device: &wgpu::Device, name: &str, features: MaterialFeatures) -> (Arc<wgpu::RenderPipeline>, bool, bool) {
+		let key = PipelineKey::new(name, features);
+		let uses_color = key.shader != ShaderKind::Depth;
+		let uses_depth = key.shader != ShaderKind::Gui;
+		if let Some(pipeline) = self.pipelines.get(&key) {
+			return (pipeline.clone(), uses_color, uses_depth);
+		}
+		crate::log2!("Creating pipeline {:?}", key);
+		let pipeline = Arc::new(self.create_pipeline(device, key));
+		self.pipelines.insert(key, pipeline.clone());
+		(pipeline, uses_color, uses_depth)
+	}
+
+	pub fn material_layout(&mut self, device: &wgpu::Device) -> Arc<wgpu::BindGroupLayout> {
+		self.material_layout
+			.get_or_insert_with(|| Arc::new(MaterialBindGroup::create_bind_group_layout(device)))
+			.clone()
+	}
+
+	fn shader(&mut self, device: &wgpu::Device, kind: ShaderKind) -> Arc<wgpu::ShaderModule> {
+		self.shaders.entry(kind).or_insert_with(|| {
+			let (label, source) = match kind {
+				ShaderKind::Gui => ("Gui Shader", include_str!("../shaders/gui_shader.wgsl")),
+				ShaderKind::Mesh => ("Shader", include_str!("../shaders/3d_shader.wgsl")),
+				ShaderKind::Depth => ("Depth Shader", include_str!("../shaders/depth_shader.wgsl")),
+			};
+			Arc::new(device.create_shader_module(wgpu::ShaderModuleDescriptor {
+				label: Some(label),
+				source: wgpu::ShaderSource::Wgsl(source.into()),
+			}))
+		}).clone()
+	}
+
+	fn layout(&mut self, device: &wgpu::Device, kind: ShaderKind) -> Arc<wgpu::PipelineLayout> {
+		if let Some(layout) = self.layouts.get(&kind) {
+			return layout.clone();
+		}
+		let layout = match kind {
+			ShaderKind::Gui => device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
+				label: Some("Gui Pipeline Layout"),
+				bind_group_layouts: &[],
+				push_constant_ranges: &[],
+			}),
+			ShaderKind::Mesh => {
+				let camera_bind_group_layout = RawCamera::create_bind_group_layout(device);
+				let point_light_bind_group_layout = RawPointLight::create_bind_group_layout(device);
+				let material_bind_group_layout = self.material_layout(device);
+				device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
+					label: Some("Render Pipeline Layout"),
+					bind_group_layouts: &[
+						&camera_bind_group_layout,
+						&point_light_bind_group_layout,
+						&material_bind_group_layout,
+					],
+					push_constant_ranges: &[],
+				})
+			}
+			ShaderKind::Depth => {
+				let camera_bind_group_layout = RawCamera::create_bind_group_layout(device);
+				device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
+					label: Some("Depth Pipeline Layout"),
+					bind_group_layouts: &[&camera_bind_group_layout],
+					push_constant_ranges: &[],
+				})
+			}
+		};
+		let layout = Arc::new(layout);
+		self.layouts.insert(kind, layout.clone());
+		layout
+	}
+
+	fn create_pipeline(&mut self, device: &wgpu::Device, key: PipelineKey) -> wgpu::RenderPipeline {
+		let shader = self.shader(device, key.shader);
+		let layout = self.layout(device, key.shader);
+		let constants = key.features.shader_constants().iter().map(|(k, v)| (k.to_string(), *v)).collect::<HashMap<_, _>>();
+		let gui_buffers = [
+			wgpu::VertexBufferLayout {
+				array_stride: std::mem::size_of::<[f32; 3]>() as wgpu::BufferAddress,
+				step_mode: wgpu::VertexStepMode::Vertex,
+				attributes: &[wgpu::VertexAttribute {
+					offset: 0,
+					format: wgpu::VertexFormat::Float32x3,
+					shader_location: 0,
+				}],
+			},
+			wgpu::VertexBufferLayout {
+				array_stride: std::mem::size_of::<[f32; 3]>() as wgpu::BufferAddress,
+				step_mode: wgpu::VertexStepMode::Vertex,
+				attributes: &[wgpu::VertexAttribute {
+					offset: 0,
+					format: wgpu::VertexFormat::Float32x3,
+					shader_location: 1,
+				}],
+			},
+		];
+		let vertices = if key.quantized { QuantizedVertices::desc() } else { InterleavedVertices::desc() };
+		let mesh_buffers = [vertices, RawInstance::desc()];
+		let depth_stencil = |depth_compare| wgpu::DepthStencilState {
+			format: wgpu::TextureFormat::Depth24PlusStencil8,
+			depth_write_enabled: true,
+			depth_compare,
+			stencil: wgpu::StencilState::default(),
+			bias: wgpu::DepthBiasState::default(),
+		};
+		let mesh_options = wgpu::PipelineCompilationOptions {
+			constants: &constants,
+			..Default::default()
+		};
+		// Equal depth passes so draws after a depth pre-pass aren't rejected
+		// by the depth they wrote there.
+		let (label, buffers, compilation_options, depth_stencil) = match key.shader {
+			ShaderKind::Gui => ("Gui Pipeline", &gui_buffers, wgpu::PipelineCompilationOptions::default(), None),
+			ShaderKind::Mesh => ("Render Pipeline", &mesh_buffers, mesh_options, Some(depth_stencil(wgpu::CompareFunction::LessEqual))),
+			ShaderKind::Depth => ("Depth Pipeline", &mesh_buffers, wgpu::PipelineCompilationOptions::default(), Some(depth_stencil(wgpu::CompareFunction::Less))),
+		};
+		let targets = [Some(wgpu::ColorTargetState {
+			format: wgpu::TextureFormat::Bgra8UnormSrgb,
+			blend: Some(wgpu::BlendState {
+				color: wgpu::BlendComponent::REPLACE,
+				alpha: wgpu::BlendComponent::REPLACE,
+			}),
+			write_mask: wgpu::ColorWrites::ALL,
+		})];
+		let fragment = match key.shader {
+			ShaderKind::Depth => None,
+			_ => Some(wgpu::FragmentState {
+				module: &shader,
+				entry_point: "fs_main",
+				targets: &targets,
+				compilation_options: compilation_options.clone(),
+			}),
+		};
+		device.create_render_pipeline(&wgpu::RenderPipelineDescriptor {
+			label: Some(label),
+			layout: Some(&layout),
+			vertex: wgpu::VertexState {
+				module: &shader,
+				entry_point: "vs_main",
+				buffers,
+				compilation_options,
+			},
+			fragment,
+			primitive: wgpu::PrimitiveState {
+				topology: wgpu::PrimitiveTopology::TriangleList,
+				strip_index_format: None,
+				front_face: wgpu::FrontFace::Ccw,
+				cull_mode: None,
+				polygon_mode: wgpu::PolygonMode::Fill,
+				unclipped_depth: false,
+				conservative: false,
+			},
+			depth_stencil,
+			multisample: wgpu::MultisampleState {
+				count: 1,
+				mask: !0,
+				alpha_to_coverage_enabled: false,
+			},
+			multiview: None,
+		})
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn test_gui_pipelines_ignore_material_features() {
+		assert_eq!(PipelineKey::new("gui", MaterialFeatures::ALL), PipelineKey::new("gui", MaterialFeatures::NONE));
+		assert_ne!(PipelineKey::new("pipeline", MaterialFeatures::ALL), PipelineKey::new("pipeline", MaterialFeatures::NONE));
+		assert_ne!(PipelineKey::new("pipeline", MaterialFeatures::ALL), PipelineKey::new("pipeline_quantized", MaterialFeatures::ALL));
+		assert_eq!(PipelineKey::new("depth_prepass_quantized", MaterialFeatures::ALL).shader, ShaderKind::Depth);
+		assert!(PipelineKey::new("depth_prepass_quantized", MaterialFeatures::ALL).quantized);
+	}
+}
@@ -0,0 +1,336 @@
+use std::collections::HashMap;
+use std::collections::VecDeque;
+use std::sync::mpsc;
+use std::sync::Arc;
+use std::sync::Mutex;
+use std::thread::JoinHandle;
+
+use crate::capture;
+use crate::capture::Capture;
+use crate::capture::CaptureFormat;
+use crate::capture::CaptureSettings;
+use crate::capture::FrameStream;
+use crate::hardware::CaptureTile;
+use crate::CapturedImage;
+
+/// Readbacks mapping at once. With all of them in flight the oldest is
+/// waited for, so captures can't run more than a few frames behind.
+const MAX_IN_FLIGHT: usize = 3;
+/// Captures waiting for an encode worker before the render thread blocks.
+const MAX_QUEUED: usize = 4;
+const MAX_WORKERS: usize = 4;
+
+/// A copy of a window's color target into a mappable buffer, submitted
+/// with the frame.
+pub struct ScreenshotReadback {
+	pub capture: Capture,
+	pub buffer: wgpu::Buffer,
+	pub width: u32,
+	pub height: u32,
+	pub unpadded_bytes_per_row: u32,
+	pub padded_bytes_per_row: u32,
+	pub swap_bgra: bool,
+}
+
+struct PendingReadback {
+	readback: ScreenshotReadback,
+	mapped: mpsc::Receiver<Result<(), wgpu::BufferAsyncError>>,
+}
+
+enum Output {
+	File(String),
+	/// Frame `index` of a stream.
+	Stream(Arc<Mutex<FrameStream>>, CaptureFormat, u64),
+	Tiles(Vec<CaptureTile>, Arc<Mutex<Vec<CapturedImage>>>),
+}
+
+struct EncodeJob {
+	output: Output,
+	pixels: Vec<u8>,
+	width: u32,
+	height: u32,
+	swap_bgra: bool,
+}
+
+impl EncodeJob {
+	fn save(mut self) {
+		if self.swap_bgra {
+			swap_red_blue(&mut self.pixels);
+		}
+		match self.output {
+			Output::File(path) => capture::save_file(&path, &self.pixels, self.width, self.height),
+			Output::Stream(stream, format, index) => {
+				let frame = capture::encode_stream_frame(format, self.pixels);
+				stream.lock().unwrap().write(index, Some((self.width, self.height, frame)));
+			}
+			Output::Tiles(tiles, captured) => {
+				let inside = |tile: &&CaptureTile| tile.x + tile.width <= self.width && tile.y + tile.height <= self.height;
+				let images: Vec<_> = tiles.iter().filter(inside).map(|tile| CapturedImage {
+					id: tile.id,
+					width: tile.width,
+					height: tile.height,
+					pixels: capture::cut_tile(&self.pixels, self.width, tile),
+				}).collect();
+				captured.lock().unwrap().extend(images);
+			}
+		}
+	}
+}
+
+struct StreamState {
+	/// None when the stream failed to open.
+	stream: Option<Arc<Mutex<FrameStream>>>,
+	next: u64,
+}
+
+/// Copies the rows of a readback without the padding wgpu requires at the
+/// end of each.
+fn unpad_rows(data: &[u8], padded_bytes_per_row: u32, unpadded_bytes_per_row: u32, height: u32) -> Vec<u8> {
+	let mut pixels = Vec::with_capacity((unpadded_bytes_per_row * height) as usize);
+	for row in data.chunks(padded_bytes_per_row as usize).take(height as usize) {
+		pixels.extend_from_slice(&row[..unpadded_bytes_per_row as usize]);
+	}
+	pixels
+}
+
+fn swap_red_blue(pixels: &mut [u8]) {
+	for pixel in pixels.chunks_exact_mut(4) {
+		pixel.swap(0, 2);
+	}
+}
+
+/// Screenshots leave the render thread as soon as their copy is queued.
+/// Readback buffers are reused, mapping is polled once per frame instead
+/// of waited on, and the swizzle and encode run on worker threads, so
+/// frame N is saved while frame N + 1 renders.
+pub struct ScreenshotQueue {
+	device: Arc<wgpu::Device>,
+	settings: CaptureSettings,
+	streams: HashMap<String, StreamState>,
+	captured: Arc<Mutex<Vec<CapturedImage>>>,
+	free: Vec<wgpu::Buffer>,
+	in_flight: VecDeque<PendingReadback>,
+	jobs: Option<mpsc::SyncSender<EncodeJob>>,
+	workers: Vec<JoinHandle<()>>,
+}
+
+impl ScreenshotQueue {
+	pub fn new(device: Arc<wgpu::Device>, settings: CaptureSettings) -> Self {
+		Self {
+			device,
+			settings,
+			streams: HashMap::new(),
+			captured: Arc::new(Mutex::new(Vec::new())),
+			free: Vec::new(),
+			in_flight: VecDeque::new(),
+			jobs: None,
+			workers: Vec::new(),
+		}
+	}
+
+	pub fn settings(&self) -> &CaptureSettings {
+		&self.settings
+	}
+
+	/// Tiles the workers finished cutting out.
+	pub fn take_captures(&mut self) -> Vec<CapturedImage> {
+		std::mem::take(&mut *self.captured.lock().unwrap())
+	}
+
+	/// A readback buffer of the given size, a free one when there is one.
+	pub fn buffer(&mut self, size: u64) -> wgpu::Buffer {
+		if let Some(i) = self.free.iter().position(|buffer| buffer.size() == size) {
+			return self.free.swap_remove(i);
+		}
+		self.device.create_buffer(&wgpu::BufferDescriptor {
+			label: Some("Screenshot Buffer"),
+			size,
+			usage: wgpu::BufferUsages::MAP_READ | wgpu::BufferUsages::COPY_DST,
+			mapped_at_creation: false,
+		})
+	}
+
+	/// Starts mapping a readback whose copy was submitted.
+	pub fn push(&mut self, readback: ScreenshotReadback) {
+		if self.in_flight.len() >= MAX_IN_FLIGHT {
+			self.wait_oldest();
+		}
+		let (tx, rx) = mpsc::channel();
+		readback.buffer.slice(..).map_async(wgpu::MapMode::Read, move |result| {
+			let _ = tx.send(result);
+		});
+		self.in_flight.push_back(PendingReadback {
+			readback,
+			mapped: rx,
+		});
+	}
+
+	/// Hands the readbacks that finished mapping to the encode workers,
+	/// in the order they were taken. Doesn't block on the GPU.
+	pub fn poll(&mut self) {
+		if self.in_flight.is_empty() {
+			return;
+		}
+		self.device.poll(wgpu::Maintain::Poll);
+		while let Some(pending) = self.in_flight.front() {
+			let result = match pending.mapped.try_recv() {
+				Ok(result) => result,
+				Err(mpsc::TryRecvError::Empty) => break,
+				Err(mpsc::TryRecvError::Disconnected) => {
+					log::error!("Screenshot buffer map callback dropped");
+					Err(wgpu::BufferAsyncError)
+				}
+			};
+			let pending = self.in_flight.pop_front().unwrap();
+			self.finish(pending.readback, result);
+		}
+	}
+
+	/// Waits for every readback in flight and the workers saving them.
+	pub fn flush(&mut self) {
+		while !self.in_flight.is_empty() {
+			self.wait_oldest();
+		}
+		self.jobs = None;
+		for worker in self.workers.drain(..) {
+			if worker.join().is_err() {
+				log::error!("Screenshot worker panicked");
+			}
+		}
+	}
+
+	fn wait_oldest(&mut self) {
+		let pending = match self.in_flight.pop_front() {
+			Some(pending) => pending,
+			None => return,
+		};
+		let result = match pending.mapped.try_recv() {
+			Ok(result) => result,
+			Err(_) => {
+				self.device.poll(wgpu::Maintain::Wait);
+				pending.mapped.recv().unwrap_or(Err(wgpu::BufferAsyncError))
+			}
+		};
+		self.finish(pending.readback, result);
+	}
+
+	fn finish(&mut self, readback: ScreenshotReadback, result: Result<(), wgpu::BufferAsyncError>) {
+		let output = match readback.capture {
+			Capture::File(path) => Output::File(path),
+			Capture::Stream(path) => match self.stream_frame(&path) {
+				Some(output) => output,
+				None => {
+					readback.buffer.unmap();
+					return;
+				}
+			},
+			Capture::Tiles(tiles) => Output::Tiles(tiles, self.captured.clone()),
+		};
+		if let Err(err) = result {
+			log::error!("Failed to map screenshot buffer: {:?}", err);
+			readback.buffer.unmap();
+			if let Output::Stream(stream, _, index) = output {
+				stream.lock().unwrap().write(index, None);
+			}
+			return;
+		}
+		let data = readback.buffer.slice(..).get_mapped_range();
+		let pixels = unpad_rows(&data, readback.padded_bytes_per_row, readback.unpadded_bytes_per_row, readback.height);
+		drop(data);
+		readback.buffer.unmap();
+		if self.free.len() >= MAX_IN_FLIGHT {
+			self.free.remove(0);
+		}
+		self.free.push(readback.buffer);
+		let job = EncodeJob {
+			output,
+			pixels,
+			width: readback.width,
+			height: readback.height,
+			swap_bgra: readback.swap_bgra,
+		};
+		// Blocks when the workers fall behind. Without workers the render
+		// thread saves it.
+		match self.jobs() {
+			Some(jobs) => {
+				if let Err(err) = jobs.send(job) {
+					err.0.save();
+				}
+			}
+			None => job.save(),
+		}
+	}
+
+	/// The next frame of the stream at `path`, opening it on its first
+	/// frame. None when it can't be opened.
+	fn stream_frame(&mut self, path: &str) -> Option<Output> {
+		let settings = &self.settings;
+		let state = self.streams.entry(path.to_string()).or_insert_with(|| {
+			let stream = match FrameStream::open(path, settings.format, settings.fps) {
+				Ok(stream) => Some(Arc::new(Mutex::new(stream))),
+				Err(err) => {
+					log::error!("Failed to open capture stream {}: {:?}", path, err);
+					None
+				}
+			};
+			StreamState {
+				stream,
+				next: 0,
+			}
+		});
+		let stream = state.stream.clone()?;
+		state.next += 1;
+		Some(Output::Stream(stream, settings.format, state.next - 1))
+	}
+
+	/// The encode queue, starting the workers on the first screenshot.
+	fn jobs(&mut self) -> Option<&mpsc::SyncSender<EncodeJob>> {
+		if self.jobs.is_none() {
+			let (tx, rx) = mpsc::sync_channel::<EncodeJob>(MAX_QUEUED);
+			let rx = Arc::new(Mutex::new(rx));
+			let count = std::thread::available_parallelism().map_or(1, |n| n.get()).min(MAX_WORKERS);
+			for i in 0..count {
+				let rx = rx.clone();
+				let worker = std::thread::Builder::new()
+					.name(format!("screenshot-{}", i))
+					.spawn(move || loop {
+						let job = match rx.lock().unwrap().recv() {
+							Ok(job) => job,
+							Err(_) => break,
+						};
+						job.save();
+					});
+				match worker {
+					Ok(worker) => self.workers.push(worker),
+					Err(err) => log::error!("Failed to start screenshot worker: {:?}", err),
+				}
+			}
+			if self.workers.is_empty() {
+				return None;
+			}
+			self.jobs = Some(tx);
+		}
+		self.jobs.as_ref()
+	}
+}
+
+impl Drop for ScreenshotQueue {
+	fn drop(&mut self) {
+		self.flush();
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn test_unpad_rows_and_swap() {
+		// 1x2 image, rows padded to 8 bytes.
+		let data = [1, 2, 3, 4, 0, 0, 0, 0, 5, 6, 7, 8, 0, 0, 0, 0];
+		let mut pixels = unpad_rows(&data, 8, 4, 2);
+		assert_eq!(pixels, vec![1, 2, 3, 4, 5, 6, 7, 8]);
+		swap_red_blue(&mut pixels);
+		assert_eq!(pixels, vec![3, 2, 1, 4, 7, 6, 5, 8]);
+	}
+}
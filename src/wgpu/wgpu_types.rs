@@ -1,3 +1,6 @@
+use crate::vertex_format::RawQuantizedVertex;
+use crate::vertex_format::RawVertex;
+
 pub trait BindableBufferRecipe {
     fn create_bind_group_layout(device: &wgpu::Device) -> wgpu::BindGroupLayout;
     fn create_bind_group(
@@ -35,6 +38,51 @@ impl TextureBuffer {
     }
 }
 
+/// Bind group of one material: five texture and sampler pairs (base
+/// colour, metallic-roughness, normal, occlusion, emissive) followed by the
+/// material's entry in the shared material array.
+pub struct MaterialBindGroup {}
+
+impl MaterialBindGroup {
+    pub const MATERIAL_BINDING: u32 = 10;
+
+    pub fn create_bind_group_layout(device: &wgpu::Device) -> wgpu::BindGroupLayout {
+        let mut entries = Vec::new();
+        for i in 0..5 {
+            entries.push(wgpu::BindGroupLayoutEntry {
+                binding: i * 2,
+                visibility: wgpu::ShaderStages::FRAGMENT,
+                ty: wgpu::BindingType::Texture {
+                    multisampled: false,
+                    view_dimension: wgpu::TextureViewDimension::D2,
+                    sample_type: wgpu::TextureSampleType::Float { filterable: true },
+                },
+                count: None,
+            });
+            entries.push(wgpu::BindGroupLayoutEntry {
+                binding: i * 2 + 1,
+                visibility: wgpu::ShaderStages::FRAGMENT,
+                ty: wgpu::BindingType::Sampler(wgpu::SamplerBindingType::Filtering),
+                count: None,
+            });
+        }
+        entries.push(wgpu::BindGroupLayoutEntry {
+            binding: Self::MATERIAL_BINDING,
+            visibility: wgpu::ShaderStages::FRAGMENT | wgpu::ShaderStages::VERTEX,
+            ty: wgpu::BindingType::Buffer {
+                ty: wgpu::BufferBindingType::Storage { read_only: true },
+                has_dynamic_offset: true,
+                min_binding_size: None,
+            },
+            count: None,
+        });
+        device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
+            label: Some("Material Bind Group Layout"),
+            entries: &entries,
+        })
+    }
+}
+
 pub trait WgpuBuffer {
     fn create_buffer(device: &wgpu::Device, size: usize) -> wgpu::Buffer;
 }
@@ -69,42 +117,61 @@ impl Vertices {
     }
 }
 
-#[repr(C)]
-#[derive(Copy, Clone, bytemuck::Pod, bytemuck::Zeroable)]
-pub struct Normals {
-    normal: [f32; 3],
-}
+/// Interleaved position, octahedral normal and f16 uv stream.
+pub struct InterleavedVertices {}
 
-impl Normals {
+impl InterleavedVertices {
     pub fn desc() -> wgpu::VertexBufferLayout<'static> {
         wgpu::VertexBufferLayout {
-            array_stride: std::mem::size_of::<Normals>() as wgpu::BufferAddress,
+            array_stride: std::mem::size_of::<RawVertex>() as wgpu::BufferAddress,
             step_mode: wgpu::VertexStepMode::Vertex,
-            attributes: &[wgpu::VertexAttribute {
-                offset: 0,
-                format: wgpu::VertexFormat::Float32x3,
-                shader_location: 1,
-            }],
+            attributes: &[
+                wgpu::VertexAttribute {
+                    offset: 0,
+                    format: wgpu::VertexFormat::Float32x3,
+                    shader_location: 0,
+                },
+                wgpu::VertexAttribute {
+                    offset: 12,
+                    format: wgpu::VertexFormat::Snorm16x2,
+                    shader_location: 1,
+                },
+                wgpu::VertexAttribute {
+                    offset: 16,
+                    format: wgpu::VertexFormat::Float16x2,
+                    shader_location: 2,
+                },
+            ],
         }
     }
 }
 
-#[repr(C)]
-#[derive(Copy, Clone, bytemuck::Pod, bytemuck::Zeroable)]
-pub struct TexCoords {
-    tex_coords: [f32; 2],
-}
+/// Same as `InterleavedVertices` with unorm16 positions. The instance
+/// transform carries the dequantization.
+pub struct QuantizedVertices {}
 
-impl TexCoords {
+impl QuantizedVertices {
     pub fn desc() -> wgpu::VertexBufferLayout<'static> {
         wgpu::VertexBufferLayout {
-            array_stride: std::mem::size_of::<TexCoords>() as wgpu::BufferAddress,
+            array_stride: std::mem::size_of::<RawQuantizedVertex>() as wgpu::BufferAddress,
             step_mode: wgpu::VertexStepMode::Vertex,
-            attributes: &[wgpu::VertexAttribute {
-                offset: 0,
-                format: wgpu::VertexFormat::Float32x2,
-                shader_location: 2,
-            }],
+            attributes: &[
+                wgpu::VertexAttribute {
+                    offset: 0,
+                    format: wgpu::VertexFormat::Unorm16x4,
+                    shader_location: 0,
+                },
+                wgpu::VertexAttribute {
+                    offset: 8,
+                    format: wgpu::VertexFormat::Snorm16x2,
+                    shader_location: 1,
+                },
+                wgpu::VertexAttribute {
+                    offset: 12,
+                    format: wgpu::VertexFormat::Float16x2,
+                    shader_location: 2,
+                },
+            ],
         }
     }
 }
@@ -164,7 +231,7 @@ impl BindableBufferRecipe for RawCamera {
 #[repr(C)]
 #[derive(Copy, Clone, bytemuck::Pod, bytemuck::Zeroable, Debug)]
 pub struct RawInstance {
-    pub model: [[f32; 4]; 4],
+    pub rows: [[f32; 4]; 3],
 }
 
 impl RawInstance {
@@ -174,12 +241,10 @@ impl RawInstance {
             array_stride: mem::size_of::<RawInstance>() as wgpu::BufferAddress,
             step_mode: wgpu::VertexStepMode::Instance,
 			attributes: &[
-                // A mat4 takes up 4 vertex slots as it is technically 4 vec4s. We need to define a slot
-                // for each vec4. We'll have to reassemble the mat4 in the shader.
+                // Rows of a 3x4 affine matrix. The shader appends the implicit
+                // (0, 0, 0, 1) row.
                 wgpu::VertexAttribute {
                     offset: 0,
-                    // While our vertex shader only uses locations 0, and 1 now, in later tutorials, we'll
-                    // be using 2, 3, and 4, for Vertex. We'll start at slot 5, not conflict with them later
                     shader_location: 5,
                     format: wgpu::VertexFormat::Float32x4,
                 },
@@ -193,11 +258,6 @@ impl RawInstance {
                     shader_location: 7,
                     format: wgpu::VertexFormat::Float32x4,
                 },
-                wgpu::VertexAttribute {
-                    offset: mem::size_of::<[f32; 12]>() as wgpu::BufferAddress,
-                    shader_location: 8,
-                    format: wgpu::VertexFormat::Float32x4,
-                },
             ],
         }
     }